@@ -139,17 +139,26 @@ void show_commands(char *app_name)
     fossil_io_printf("{bright_black}    -c, --create        Create new archive\n");
     fossil_io_printf("{bright_black}    -x, --extract       Extract archive\n");
     fossil_io_printf("{bright_black}    -l, --list          List archive contents\n");
-    fossil_io_printf("{bright_black}    -f <format>         Format: zip/tar/gz\n");
+    fossil_io_printf("{bright_black}    -f <format>         Format: zip/tar/gz/zst\n");
     fossil_io_printf("{bright_black}    -p, --password <pw> Encrypt with password\n");
-    fossil_io_printf("{bright_black}    --stdout            Output to stdout\n");
-    fossil_io_printf("{bright_black}    --compress <n>      Compression level (0-9)\n");
+    fossil_io_printf("{bright_black}    --stdout            Stream tar/gz/zst of <path> to stdout; - reads stdin\n");
+    fossil_io_printf("{bright_black}    --compress <n>      Compression level (0-9, zst 0-19)\n");
     fossil_io_printf("{bright_black}    --exclude <pat>     Exclude files\n");
+    fossil_io_printf("{bright_black}    -j, --threads <n>   Compression and indexed extraction threads (default: all CPUs)\n");
+    fossil_io_printf("{bright_black}    --index             Write a seekable <archive>.idx (tar/gz/zst)\n");
+    fossil_io_printf("{bright_black}    --member <path>     Extract or list one entry (and below)\n");
+    fossil_io_printf("{bright_black}    --long              Long-distance matching, 128 MiB window (zst)\n");
+    fossil_io_printf("{bright_black}    --dict <file>       zstd dictionary to write and read with\n");
+    fossil_io_printf("{bright_black}    --train-dict        Train --dict on the files first (zst)\n");
+    fossil_io_printf("{bright_black}    --incremental <f>   Archive changes since manifest f; extract replays the chain\n");
 
     fossil_io_printf("{cyan}  compare          {reset}Compare two files/directories\n");
-    fossil_io_printf("{bright_black}    -t, --text          Line diff\n");
+    fossil_io_printf("{bright_black}    -t, --text          Unified line diff\n");
     fossil_io_printf("{bright_black}    -b, --binary        Binary diff\n");
     fossil_io_printf("{bright_black}    --context <n>       Context lines\n");
     fossil_io_printf("{bright_black}    --ignore-case       Ignore case\n");
+    fossil_io_printf("{bright_black}    --all               List every differing byte range\n");
+    fossil_io_printf("{bright_black}    -r, --recursive     Compare directory trees (jsonl)\n");
 
     fossil_io_printf("{cyan}  help             {reset}Display help for commands\n");
     fossil_io_printf("{bright_black}    --examples          Usage examples\n");
@@ -159,11 +168,26 @@ void show_commands(char *app_name)
     fossil_io_printf("{bright_black}    -r, --recursive     Include subdirs\n");
     fossil_io_printf("{bright_black}    -u, --update        Only newer\n");
     fossil_io_printf("{bright_black}    --delete            Remove extraneous files\n");
+    fossil_io_printf("{bright_black}    --delta             Rewrite only changed blocks\n");
+    fossil_io_printf("{bright_black}    -c, --checksum      Compare content, not size+mtime\n");
+    fossil_io_printf("{bright_black}    --manifest          Keep a state manifest in dest\n");
+    fossil_io_printf("{bright_black}    --changes <file>    Sync only the listed paths\n");
+    fossil_io_printf("{bright_black}    --dry-run           Print the plan, change nothing\n");
+    fossil_io_printf("{bright_black}    --plan-out <file>   Write the plan instead of applying it\n");
+    fossil_io_printf("{bright_black}    --plan-in <file>    Apply a saved plan\n");
+    fossil_io_printf("{bright_black}    --two-way           Propagate changes both ways, report conflicts\n");
+    fossil_io_printf("{bright_black}    --remote-cmd <cmd>  Push to dest via `<cmd> sync --server`\n");
 
     fossil_io_printf("{cyan}  watch            {reset}Monitor files or directories\n");
     fossil_io_printf("{bright_black}    -r, --recursive     Include subdirs\n");
     fossil_io_printf("{bright_black}    -e, --events <list> Event filter\n");
-    fossil_io_printf("{bright_black}    -t, --interval <n>  Poll interval\n");
+    fossil_io_printf("{bright_black}    -t, --interval <n>  Poll interval (when polling)\n");
+    fossil_io_printf("{bright_black}    --poll              Poll snapshots (network filesystems)\n");
+    fossil_io_printf("{bright_black}    --settle <ms>       Merge events until quiet this long (100)\n");
+    fossil_io_printf("{bright_black}    --exec <cmd>        Run per batch, changed paths on stdin\n");
+    fossil_io_printf("{bright_black}    --json              Print events as JSON lines\n");
+    fossil_io_printf("{bright_black}    --roots <file>      Also watch the paths listed in file\n");
+    fossil_io_printf("{bright_black}    --queue <n>         Events held before dropping (65536)\n");
 
     fossil_io_printf("{cyan}  rewrite          {reset}Modify file contents or metadata\n");
     fossil_io_printf("{bright_black}    -a, --append        Append\n");
@@ -221,6 +245,8 @@ void show_commands(char *app_name)
     fossil_io_printf("{bright_black}    -i, --interactive   Confirm deletions\n");
     fossil_io_printf("{bright_black}    -d, --delete        Remove duplicates\n");
     fossil_io_printf("{bright_black}    -l, --link          Replace duplicates with links\n");
+    fossil_io_printf("{bright_black}    --reflink           Share extents with original (btrfs/XFS)\n");
+    fossil_io_printf("{bright_black}    --chunks            Report block-level dedupe ratio\n");
     fossil_io_printf("{bright_black}    --media             Preferd structured media format text/fson/json\n");
 
     fossil_io_printf("{cyan}  link             {reset}Create hard or symbolic links\n");
@@ -269,6 +295,9 @@ void show_commands(char *app_name)
     fossil_io_printf("{bright_black}  --verbose             Enable detailed output\n");
     fossil_io_printf("{bright_black}  --color [enable|disable|auto]  Colorize output\n");
     fossil_io_printf("{bright_black}  --clear               Clear the terminal screen\n");
+    fossil_io_printf("{bright_black}  --bwlimit <rate>      Cap sync/copy/merge/archive disk I/O (e.g. 20M)\n");
+    fossil_io_printf("{bright_black}  --iops-limit <n>      Cap read/write operations per second\n");
+    fossil_io_printf("{bright_black}  --adaptive-io         Back off further while read latency is high\n");
 
     exit(FOSSIL_IO_SUCCESS);
 }
@@ -308,8 +337,11 @@ bool app_entry(int argc, char **argv)
         "split",
 
         // Global flags
-        "--help", "--version", "--name", "--verbose", "--color", "--clear"};
+        "--help", "--version", "--name", "--verbose", "--color", "--clear",
+        "--bwlimit", "--iops-limit", "--adaptive-io"};
     const int num_supported = sizeof(supported_commands) / sizeof(supported_commands[0]);
+    uint64_t throttle_bytes = 0, throttle_ops = 0;
+    bool throttle_adaptive = false;
 
     for (i32 i = 1; i < argc; ++i)
     {
@@ -461,6 +493,28 @@ bool app_entry(int argc, char **argv)
         {
             fossil_io_clear_screen(); // ANSI escape sequence to clear screen
         }
+        else if (fossil_io_cstring_compare(argv[i], "--bwlimit") == 0 ||
+                 fossil_io_cstring_compare(argv[i], "--iops-limit") == 0)
+        {
+            bool bandwidth = fossil_io_cstring_compare(argv[i], "--bwlimit") == 0;
+            uint64_t rate = i + 1 < argc ? fossil_shark_throttle_parse_rate(argv[i + 1]) : 0;
+            if (rate == 0)
+            {
+                fossil_io_printf("{red}Error: %s needs a positive rate{reset}\n", argv[i]);
+                return false;
+            }
+            if (bandwidth)
+                throttle_bytes = rate;
+            else
+                throttle_ops = rate;
+            fossil_shark_throttle_set(throttle_bytes, throttle_ops, throttle_adaptive);
+            ++i; // Skip the rate
+        }
+        else if (fossil_io_cstring_compare(argv[i], "--adaptive-io") == 0)
+        {
+            throttle_adaptive = true;
+            fossil_shark_throttle_set(throttle_bytes, throttle_ops, throttle_adaptive);
+        }
         // File Operations Commands
         else if (fossil_io_cstring_compare(argv[i], "show") == 0)
         {
@@ -959,45 +1013,73 @@ bool app_entry(int argc, char **argv)
         }
         else if (fossil_io_cstring_compare(argv[i], "archive") == 0)
         {
-            ccstring path = cnull, format = "zip", password = cnull, exclude_pattern = cnull;
-            bool create = false, extract = false, list = false;
-            bool stdout_output = false;
-            int compress_level = 6;
+            ccstring path = cnull;
+            fossil_shark_archive_options_t opts = {0};
+            opts.format = "zip";
+            opts.compress_level = 6;
 
             for (int j = i + 1; j < argc; j++)
             {
                 if (fossil_io_cstring_compare(argv[j], "-c") == 0 || fossil_io_cstring_compare(argv[j], "--create") == 0)
                 {
-                    create = true;
+                    opts.create = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-x") == 0 || fossil_io_cstring_compare(argv[j], "--extract") == 0)
                 {
-                    extract = true;
+                    opts.extract = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-l") == 0 || fossil_io_cstring_compare(argv[j], "--list") == 0)
                 {
-                    list = true;
+                    opts.list = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-f") == 0 && j + 1 < argc)
                 {
-                    format = argv[++j];
+                    opts.format = argv[++j];
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-p") == 0 || fossil_io_cstring_compare(argv[j], "--password") == 0)
                 {
                     if (j + 1 < argc)
-                        password = argv[++j];
+                        opts.password = argv[++j];
                 }
                 else if (fossil_io_cstring_compare(argv[j], "--stdout") == 0)
                 {
-                    stdout_output = true;
+                    opts.stdout_output = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "--compress") == 0 && j + 1 < argc)
                 {
-                    compress_level = atoi(argv[++j]);
+                    opts.compress_level = atoi(argv[++j]);
                 }
                 else if (fossil_io_cstring_compare(argv[j], "--exclude") == 0 && j + 1 < argc)
                 {
-                    exclude_pattern = argv[++j];
+                    opts.exclude_pattern = argv[++j];
+                }
+                else if ((fossil_io_cstring_compare(argv[j], "-j") == 0 || fossil_io_cstring_compare(argv[j], "--threads") == 0) && j + 1 < argc)
+                {
+                    opts.threads = atoi(argv[++j]);
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--index") == 0)
+                {
+                    opts.index = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--member") == 0 && j + 1 < argc)
+                {
+                    opts.member = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--long") == 0)
+                {
+                    opts.long_window = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--dict") == 0 && j + 1 < argc)
+                {
+                    opts.dict_path = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--train-dict") == 0)
+                {
+                    opts.train_dict = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--incremental") == 0 && j + 1 < argc)
+                {
+                    opts.incremental = argv[++j];
                 }
                 else if (!cnotnull(path))
                 {
@@ -1006,12 +1088,13 @@ bool app_entry(int argc, char **argv)
                 i = j;
             }
             if (cnotnull(path))
-                fossil_shark_archive(path, create, extract, list, format, password, compress_level, stdout_output, exclude_pattern);
+                fossil_shark_archive(path, &opts);
         }
         else if (fossil_io_cstring_compare(argv[i], "compare") == 0)
         {
             ccstring path1 = cnull, path2 = cnull;
             bool text_diff = false, binary_diff = false, ignore_case = false;
+            bool all_ranges = false, recursive = false;
             int context_lines = 3;
 
             for (int j = i + 1; j < argc; j++)
@@ -1028,6 +1111,14 @@ bool app_entry(int argc, char **argv)
                 {
                     ignore_case = true;
                 }
+                else if (fossil_io_cstring_compare(argv[j], "--all") == 0)
+                {
+                    all_ranges = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "-r") == 0 || fossil_io_cstring_compare(argv[j], "--recursive") == 0)
+                {
+                    recursive = true;
+                }
                 else if (fossil_io_cstring_compare(argv[j], "--context") == 0 && j + 1 < argc)
                 {
                     context_lines = atoi(argv[++j]);
@@ -1043,7 +1134,7 @@ bool app_entry(int argc, char **argv)
                 i = j;
             }
             if (cnotnull(path1) && cnotnull(path2))
-                fossil_shark_compare(path1, path2, text_diff, binary_diff, context_lines, ignore_case);
+                fossil_shark_compare(path1, path2, text_diff, binary_diff, context_lines, ignore_case, all_ranges, recursive);
         }
         else if (fossil_io_cstring_compare(argv[i], "help") == 0)
         {
@@ -1076,20 +1167,61 @@ bool app_entry(int argc, char **argv)
         else if (fossil_io_cstring_compare(argv[i], "sync") == 0)
         {
             ccstring src = cnull, dest = cnull;
-            bool recursive = false, update = false, delete_flag = false;
+            fossil_shark_sync_options_t opts = {0};
+            bool server = false;
             for (int j = i + 1; j < argc; j++)
             {
                 if (fossil_io_cstring_compare(argv[j], "-r") == 0 || fossil_io_cstring_compare(argv[j], "--recursive") == 0)
                 {
-                    recursive = true;
+                    opts.recursive = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-u") == 0 || fossil_io_cstring_compare(argv[j], "--update") == 0)
                 {
-                    update = true;
+                    opts.update = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "--delete") == 0)
                 {
-                    delete_flag = true;
+                    opts.delete_flag = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--delta") == 0)
+                {
+                    opts.delta = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "-c") == 0 || fossil_io_cstring_compare(argv[j], "--checksum") == 0)
+                {
+                    opts.checksum = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--manifest") == 0)
+                {
+                    opts.manifest = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--changes") == 0 && j + 1 < argc)
+                {
+                    opts.changes_file = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--dry-run") == 0)
+                {
+                    opts.dry_run = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--plan-out") == 0 && j + 1 < argc)
+                {
+                    opts.plan_out = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--plan-in") == 0 && j + 1 < argc)
+                {
+                    opts.plan_in = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--two-way") == 0)
+                {
+                    opts.two_way = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--remote-cmd") == 0 && j + 1 < argc)
+                {
+                    opts.remote_cmd = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--server") == 0)
+                {
+                    server = true;
                 }
                 else if (!cnotnull(src))
                 {
@@ -1101,38 +1233,105 @@ bool app_entry(int argc, char **argv)
                 }
                 i = j;
             }
-            if (cnotnull(src) && cnotnull(dest))
-                fossil_shark_sync(src, dest, recursive, update, delete_flag);
+            if (server)
+            {
+                // Spawned by a --remote-cmd client; the only path given is ours
+                if (cnotnull(src))
+                    fossil_shark_sync_server(src);
+            }
+            else if (cnotnull(opts.plan_in) && !cnotnull(dest))
+            {
+                // A saved plan needs only the destination
+                dest = src;
+                src = cnull;
+            }
+            if (!server && cnotnull(dest) && (cnotnull(src) || cnotnull(opts.plan_in)))
+                fossil_shark_sync(src, dest, &opts);
         }
         else if (fossil_io_cstring_compare(argv[i], "watch") == 0)
         {
-            ccstring path = cnull, events = cnull;
-            bool recursive = false;
-            int interval = 1;
+            ccstring *paths = NULL;
+            size_t path_count = 0;
+            fossil_shark_watch_options_t opts = {0};
+            opts.interval = 1;
+            opts.settle_ms = 100;
             for (int j = i + 1; j < argc; j++)
             {
                 if (fossil_io_cstring_compare(argv[j], "-r") == 0 || fossil_io_cstring_compare(argv[j], "--recursive") == 0)
                 {
-                    recursive = true;
+                    opts.recursive = true;
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-e") == 0 || fossil_io_cstring_compare(argv[j], "--events") == 0)
                 {
                     if (j + 1 < argc)
-                        events = argv[++j];
+                        opts.events = argv[++j];
                 }
                 else if (fossil_io_cstring_compare(argv[j], "-t") == 0 || fossil_io_cstring_compare(argv[j], "--interval") == 0)
                 {
                     if (j + 1 < argc)
-                        interval = atoi(argv[++j]);
+                        opts.interval = atoi(argv[++j]);
                 }
-                else if (!cnotnull(path))
+                else if (fossil_io_cstring_compare(argv[j], "--poll") == 0)
                 {
-                    path = argv[j];
+                    opts.poll = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--settle") == 0 && j + 1 < argc)
+                {
+                    opts.settle_ms = atoi(argv[++j]);
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--exec") == 0 && j + 1 < argc)
+                {
+                    opts.exec_cmd = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--json") == 0)
+                {
+                    opts.json = true;
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--roots") == 0 && j + 1 < argc)
+                {
+                    opts.roots_file = argv[++j];
+                }
+                else if (fossil_io_cstring_compare(argv[j], "--queue") == 0 && j + 1 < argc)
+                {
+                    // strtoul would take "-1" as a huge count; only plain digits will do
+                    ccstring text = argv[++j];
+                    char *end = cnull;
+                    errno = 0;
+                    unsigned long queue = text[0] >= '0' && text[0] <= '9' ? strtoul(text, &end, 10) : 0;
+                    if (queue == 0 || *end != '\0' || errno == ERANGE)
+                    {
+                        fossil_io_printf("{red}Error: --queue needs a positive number of events{reset}\n");
+                        free(paths);
+                        return false;
+                    }
+                    opts.queue_max = (size_t)queue;
+                }
+                else if (argv[j][0] == '-' && argv[j][1] != '\0')
+                {
+                    // A mistyped flag or one missing its value is not a path to watch
+                    fossil_io_printf("{red}Error: Unknown or incomplete watch option: %s{reset}\n", argv[j]);
+                    free(paths);
+                    return false;
+                }
+                else
+                {
+                    ccstring *new_paths = (ccstring *)realloc(paths, (path_count + 1) * sizeof(*new_paths));
+                    if (new_paths == NULL)
+                    {
+                        fossil_io_printf("{red}Failed to allocate memory for watch paths.{reset}\n");
+                        free(paths);
+                        paths = NULL;
+                        path_count = 0;
+                        break;
+                    }
+                    paths = new_paths;
+                    paths[path_count++] = argv[j];
                 }
                 i = j;
             }
-            if (cnotnull(path))
-                fossil_shark_watch(path, recursive, events, interval);
+            if (path_count > 0 || cnotnull(opts.roots_file))
+                fossil_shark_watch(paths, path_count, &opts);
+            free(paths);
         }
         else if (fossil_io_cstring_compare(argv[i], "rewrite") == 0)
         {
@@ -1618,7 +1817,8 @@ bool app_entry(int argc, char **argv)
         {
             ccstring dir = cnull;
             cstring media = "text";
-            bool use_hash = false, interactive = false, del = false, link = false;
+            bool use_hash = false, interactive = false, del = false, link = false, reflink = false;
+            bool chunks = false;
 
             for (int j = i + 1; j < argc; j++)
             {
@@ -1630,6 +1830,10 @@ bool app_entry(int argc, char **argv)
                     del = true;
                 else if (fossil_io_cstring_compare(argv[j], "--link") == 0)
                     link = true;
+                else if (fossil_io_cstring_compare(argv[j], "--reflink") == 0)
+                    reflink = true;
+                else if (fossil_io_cstring_compare(argv[j], "--chunks") == 0)
+                    chunks = true;
                 else if (fossil_io_cstring_compare(argv[j], "--media") == 0)
                     media = argv[j];
                 else if (!cnotnull(dir))
@@ -1639,7 +1843,7 @@ bool app_entry(int argc, char **argv)
             }
 
             if (cnotnull(dir))
-                fossil_shark_dedupe(dir, use_hash, interactive, del, link, media);
+                fossil_shark_dedupe(dir, use_hash, interactive, del, link, reflink, chunks, media);
         }
         //
         else
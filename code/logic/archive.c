@@ -22,7 +22,7 @@
  * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
  * -----------------------------------------------------------------------------
  */
-#include "fossil/code/archive.h"
+#include "fossil/code/archive_internal.h"
 
 // Helper function to safely create a path by combining directory and filename
 static int fossil_fpath_create_path_safe(char *dest, size_t dest_size, ccstring base_path, ccstring suffix)
@@ -95,44 +95,93 @@ static fossil_io_archive_type_t get_archive_type_from_format(ccstring format)
     return FOSSIL_IO_ARCHIVE_UNKNOWN;
 }
 
-int fossil_shark_archive(ccstring path, bool create, bool extract,
-                         bool list, ccstring format, ccstring password,
-                         int compress_level, bool stdout_output,
-                         ccstring exclude_pattern)
+// The archive library has no zstd type; shark writes and reads tar.zst itself
+static bool archive_is_zstd_format(ccstring format)
 {
+    return fossil_io_cstring_equals(format, "zst") || fossil_io_cstring_equals(format, "tar.zst") ||
+           fossil_io_cstring_equals(format, "zstd") || fossil_io_cstring_equals(format, "tar.zstd");
+}
+
+int fossil_shark_archive(ccstring path, const fossil_shark_archive_options_t *opts)
+{
+    static const fossil_shark_archive_options_t defaults = {0};
+    if (!cnotnull(opts))
+        opts = &defaults;
+    bool create = opts->create, extract = opts->extract, list = opts->list;
+    bool stdout_output = opts->stdout_output, index = opts->index;
+    bool long_window = opts->long_window, train_dict = opts->train_dict;
+    ccstring format = opts->format, password = opts->password, exclude_pattern = opts->exclude_pattern;
+    ccstring member = opts->member, dict_path = opts->dict_path, incremental = opts->incremental;
+    int compress_level = opts->compress_level, threads = opts->threads;
+
     if (!path)
     {
         fossil_io_printf("{red}Error: Archive path must be specified.{normal}\n");
         return 1;
     }
 
+    // "-" streams: create writes the archive to stdout, extract and list read it from stdin
+    bool to_stdout = create && (stdout_output || fossil_io_cstring_equals(path, "-"));
+    bool from_stdin = (extract || list) && fossil_io_cstring_equals(path, "-");
+    fossil_io_filesys_file_t *con = to_stdout ? FOSSIL_STDERR : FOSSIL_STDOUT;
+    if (to_stdout && index)
+        fossil_io_fprintf(con, "{yellow}Warning: --index needs an archive file; not written when streaming.{normal}\n");
+
     if ((!create && !extract && !list) || (create + extract + list > 1))
     {
-        fossil_io_printf("{red}Error: Specify exactly one operation: create, extract, or list.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Specify exactly one operation: create, extract, or list.{normal}\n");
         return 1;
     }
 
-    // Validate compression level
-    if (compress_level < 0 || compress_level > 9)
+    // Validate compression level; zstd goes further, and 0 is its default level
+    bool zstd_format = archive_is_zstd_format(cunwrap_or(format, "tar"));
+    int max_level = zstd_format ? 19 : 9;
+    if (compress_level < 0 || compress_level > max_level)
     {
-        fossil_io_printf("{red}Error: Compression level must be 0-9.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Compression level must be 0-%d.{normal}\n", max_level);
         return 1;
     }
 
+    if (train_dict && (!create || !cnotnull(dict_path)))
+    {
+        fossil_io_fprintf(con, "{red}Error: --train-dict creates an archive and needs --dict <file> to write to.{normal}\n");
+        return 1;
+    }
+    if (cnotnull(incremental) && (list || to_stdout || from_stdin))
+    {
+        fossil_io_fprintf(con, "{red}Error: --incremental creates or restores archive files, not streams or listings.{normal}\n");
+        return 1;
+    }
+    if (create && !zstd_format && (long_window || cnotnull(dict_path)))
+        fossil_io_fprintf(con, "{yellow}Warning: --long and --dict only apply to zst archives; ignored.{normal}\n");
+
+#if defined(_WIN32) || defined(_WIN64)
+    if (to_stdout || from_stdin)
+    {
+        fossil_io_fprintf(con, "{red}Error: Streaming archives through stdin/stdout is not supported on Windows.{normal}\n");
+        return 1;
+    }
+    if (zstd_format || cnotnull(incremental))
+    {
+        fossil_io_fprintf(con, "{red}Error: zst and incremental archives are not supported on Windows.{normal}\n");
+        return 1;
+    }
+#endif
+
     // Check if file exists for extract and list operations
-    if ((extract || list) && fossil_io_filesys_exists(path) != 1)
+    if ((extract || list) && !from_stdin && fossil_io_filesys_exists(path) != 1)
     {
-        fossil_io_printf("{red}Error: Archive file '%s' does not exist.{normal}\n", path);
+        fossil_io_fprintf(con, "{red}Error: Archive file '%s' does not exist.{normal}\n", path);
         return 1;
     }
 
     // Check permissions
-    if (extract || list)
+    if ((extract || list) && !from_stdin)
     {
         fossil_io_filesys_obj_t obj;
         if (fossil_io_filesys_stat(path, &obj) < 0 || !obj.perms.read)
         {
-            fossil_io_printf("{red}Error: Archive file '%s' is not readable.{normal}\n", path);
+            fossil_io_fprintf(con, "{red}Error: Archive file '%s' is not readable.{normal}\n", path);
             return 1;
         }
     }
@@ -145,7 +194,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
 
     if (cunlikely(!sanitized_path || !sanitized_format || !sanitized_password || !sanitized_exclude))
     {
-        fossil_io_printf("{red}Error: Memory allocation failed.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Memory allocation failed.{normal}\n");
         if (cnotnull(sanitized_path))
             fossil_sys_memory_free(sanitized_path);
         if (cnotnull(sanitized_format))
@@ -165,7 +214,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
     if (fossil_io_validate_sanitize_string(path, sanitized_path, 1024, FOSSIL_CTX_FILENAME) &
         (FOSSIL_SAN_SHELL | FOSSIL_SAN_PATH))
     {
-        fossil_io_printf("{red}Error: Suspicious path detected.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Suspicious path detected.{normal}\n");
         fossil_sys_memory_free(sanitized_path);
         fossil_sys_memory_free(sanitized_format);
         fossil_sys_memory_free(sanitized_password);
@@ -177,7 +226,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
     if (fossil_io_validate_sanitize_string(fmt, sanitized_format, 64, FOSSIL_CTX_GENERIC) &
         FOSSIL_SAN_SHELL)
     {
-        fossil_io_printf("{red}Error: Invalid format specification.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Invalid format specification.{normal}\n");
         fossil_sys_memory_free(sanitized_path);
         fossil_sys_memory_free(sanitized_format);
         fossil_sys_memory_free(sanitized_password);
@@ -187,7 +236,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
 
     if (cnotnull(password) && fossil_io_validate_is_weak_password(password, cnull, cnull))
     {
-        fossil_io_printf("{yellow}Warning: Password appears to be weak.{normal}\n");
+        fossil_io_fprintf(con, "{yellow}Warning: Password appears to be weak.{normal}\n");
     }
 
     if (cnotnull(password))
@@ -195,7 +244,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
         if (fossil_io_validate_sanitize_string(password, sanitized_password, 256, FOSSIL_CTX_GENERIC) &
             FOSSIL_SAN_SHELL)
         {
-            fossil_io_printf("{red}Error: Invalid characters in password.{normal}\n");
+            fossil_io_fprintf(con, "{red}Error: Invalid characters in password.{normal}\n");
             fossil_sys_memory_free(sanitized_path);
             fossil_sys_memory_free(sanitized_format);
             fossil_sys_memory_free(sanitized_password);
@@ -209,7 +258,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
         if (fossil_io_validate_sanitize_string(exclude_pattern, sanitized_exclude, 512, FOSSIL_CTX_GENERIC) &
             FOSSIL_SAN_SHELL)
         {
-            fossil_io_printf("{red}Error: Invalid characters in exclude pattern.{normal}\n");
+            fossil_io_fprintf(con, "{red}Error: Invalid characters in exclude pattern.{normal}\n");
             fossil_sys_memory_free(sanitized_path);
             fossil_sys_memory_free(sanitized_format);
             fossil_sys_memory_free(sanitized_password);
@@ -220,9 +269,35 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
 
     // Determine archive type
     fossil_io_archive_type_t archive_type = get_archive_type_from_format(sanitized_format);
-    if (archive_type == FOSSIL_IO_ARCHIVE_UNKNOWN && !list && !extract)
+    if (to_stdout && archive_type != FOSSIL_IO_ARCHIVE_TAR && archive_type != FOSSIL_IO_ARCHIVE_TARGZ && !zstd_format)
     {
-        fossil_io_printf("{red}Error: Unsupported format: %s{normal}\n", sanitized_format);
+        fossil_io_fprintf(con, "{red}Error: Only tar, tar.gz and tar.zst can be streamed to stdout.{normal}\n");
+        fossil_sys_memory_free(sanitized_path);
+        fossil_sys_memory_free(sanitized_format);
+        fossil_sys_memory_free(sanitized_password);
+        fossil_sys_memory_free(sanitized_exclude);
+        return 1;
+    }
+    if (archive_type == FOSSIL_IO_ARCHIVE_UNKNOWN && !zstd_format && !list && !extract)
+    {
+        fossil_io_fprintf(con, "{red}Error: Unsupported format: %s{normal}\n", sanitized_format);
+        fossil_sys_memory_free(sanitized_path);
+        fossil_sys_memory_free(sanitized_format);
+        fossil_sys_memory_free(sanitized_password);
+        fossil_sys_memory_free(sanitized_exclude);
+        return 1;
+    }
+
+    // Tar, tar.gz and tar.zst are read here; the rest goes to the archive library
+    bool native_read = from_stdin;
+#if !defined(_WIN32) && !defined(_WIN64)
+    native_read = native_read || ((extract || list) && (cnotnull(incremental) || tar_sniff(sanitized_path)));
+    zstd_options_t zo = {long_window, cnull, 0};
+#endif
+    if (cnotnull(incremental) && create && archive_type != FOSSIL_IO_ARCHIVE_TAR &&
+        archive_type != FOSSIL_IO_ARCHIVE_TARGZ && !zstd_format)
+    {
+        fossil_io_fprintf(con, "{red}Error: --incremental needs a tar, tar.gz or tar.zst archive.{normal}\n");
         fossil_sys_memory_free(sanitized_path);
         fossil_sys_memory_free(sanitized_format);
         fossil_sys_memory_free(sanitized_password);
@@ -231,12 +306,12 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
     }
 
     // For extract and list operations, auto-detect archive type if unknown
-    if ((extract || list) && archive_type == FOSSIL_IO_ARCHIVE_UNKNOWN)
+    if ((extract || list) && !native_read && archive_type == FOSSIL_IO_ARCHIVE_UNKNOWN)
     {
         archive_type = fossil_io_archive_get_type(sanitized_path);
         if (archive_type == FOSSIL_IO_ARCHIVE_UNKNOWN)
         {
-            fossil_io_printf("{red}Error: Cannot determine archive type for: %s{normal}\n", sanitized_path);
+            fossil_io_fprintf(con, "{red}Error: Cannot determine archive type for: %s{normal}\n", sanitized_path);
             fossil_sys_memory_free(sanitized_path);
             fossil_sys_memory_free(sanitized_format);
             fossil_sys_memory_free(sanitized_password);
@@ -248,7 +323,7 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
     char *log_filename = (char *)fossil_sys_memory_alloc(1024);
     if (cunlikely(!log_filename))
     {
-        fossil_io_printf("{red}Error: Failed to allocate log filename buffer.{normal}\n");
+        fossil_io_fprintf(con, "{red}Error: Failed to allocate log filename buffer.{normal}\n");
         fossil_sys_memory_free(sanitized_path);
         fossil_sys_memory_free(sanitized_format);
         fossil_sys_memory_free(sanitized_password);
@@ -267,12 +342,13 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
             hash_buf, sizeof(hash_buf),
             sanitized_path, fossil_io_cstring_length(sanitized_path)) == 0)
     {
-        fossil_io_printf("{magenta}Archive path hash: %s{normal}\n", hash_buf);
+        fossil_io_fprintf(con, "{magenta}Archive path hash: %s{normal}\n", hash_buf);
     }
 
     fossil_io_filesys_file_t log_stream;
     COption log_option = cnone();
-    if (!stdout_output && fossil_io_filesys_file_open(&log_stream, log_filename, "w") == 0)
+    if (!stdout_output && !to_stdout && !from_stdin &&
+        fossil_io_filesys_file_open(&log_stream, log_filename, "w") == 0)
     {
         log_option = csome(&log_stream);
         char *log_msg = (char *)fossil_sys_memory_alloc(1000);
@@ -315,35 +391,19 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
 
     if (create)
     {
-        // Interactive confirmation for create operation
-        fossil_io_printf("{cyan}Creating archive: %s (format: %s){normal}\n", sanitized_path, sanitized_format);
-        fossil_io_printf("Are you sure you want to create this archive? (y/N): ");
-        fossil_io_flush();
+        fossil_io_fprintf(con, "{cyan}Creating archive: %s (format: %s){normal}\n",
+                          to_stdout ? "stdout" : sanitized_path, sanitized_format);
 
-        char *confirm = (char *)fossil_sys_memory_alloc(10);
-        if (cunlikely(!confirm))
+        // Interactive confirmation, except when streaming where stdin is not ours to read
+        if (!to_stdout)
         {
-            fossil_io_printf("{red}Error: Failed to allocate confirmation buffer.{normal}\n");
-            fossil_sys_memory_free(log_filename);
-            fossil_sys_memory_free(sanitized_path);
-            fossil_sys_memory_free(sanitized_format);
-            fossil_sys_memory_free(sanitized_password);
-            fossil_sys_memory_free(sanitized_exclude);
-            if (log_option.is_some)
-            {
-                fossil_io_filesys_file_close((fossil_io_filesys_file_t *)log_option.value);
-            }
-            return 1;
-        }
+            fossil_io_fprintf(con, "Are you sure you want to create this archive? (y/N): ");
+            fossil_io_flush();
 
-        fossil_sys_memory_zero(confirm, 10);
-        if (fossil_io_gets(confirm, 10) == 0)
-        {
-            fossil_io_trim(confirm);
-            if (confirm[0] != 'y' && confirm[0] != 'Y')
+            char *confirm = (char *)fossil_sys_memory_alloc(10);
+            if (cunlikely(!confirm))
             {
-                fossil_io_printf("Operation cancelled.\n");
-                fossil_sys_memory_free(confirm);
+                fossil_io_fprintf(con, "{red}Error: Failed to allocate confirmation buffer.{normal}\n");
                 fossil_sys_memory_free(log_filename);
                 fossil_sys_memory_free(sanitized_path);
                 fossil_sys_memory_free(sanitized_format);
@@ -353,89 +413,174 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
                 {
                     fossil_io_filesys_file_close((fossil_io_filesys_file_t *)log_option.value);
                 }
-                return 0;
+                return 1;
+            }
+
+            fossil_sys_memory_zero(confirm, 10);
+            if (fossil_io_gets(confirm, 10) == 0)
+            {
+                fossil_io_trim(confirm);
+                if (confirm[0] != 'y' && confirm[0] != 'Y')
+                {
+                    fossil_io_fprintf(con, "Operation cancelled.\n");
+                    fossil_sys_memory_free(confirm);
+                    fossil_sys_memory_free(log_filename);
+                    fossil_sys_memory_free(sanitized_path);
+                    fossil_sys_memory_free(sanitized_format);
+                    fossil_sys_memory_free(sanitized_password);
+                    fossil_sys_memory_free(sanitized_exclude);
+                    if (log_option.is_some)
+                    {
+                        fossil_io_filesys_file_close((fossil_io_filesys_file_t *)log_option.value);
+                    }
+                    return 0;
+                }
             }
+            fossil_sys_memory_free(confirm);
         }
-        fossil_sys_memory_free(confirm);
 
-        // Create archive using new API
-        archive = fossil_io_archive_create(sanitized_path, archive_type, compress_level > 0 ? compress_level : FOSSIL_IO_COMPRESSION_NORMAL);
-        if (!archive)
+#if !defined(_WIN32) && !defined(_WIN64)
+        if (zstd_format || archive_type == FOSSIL_IO_ARCHIVE_TAR || archive_type == FOSSIL_IO_ARCHIVE_TARGZ)
         {
-            fossil_io_printf("{red}Error: Failed to create archive{normal}\n");
-            ret = 1;
+            // Written here, so the limiter paces every read and write. Streaming
+            // with a path archives that directory instead of the current one.
+            ccstring src = to_stdout && !fossil_io_cstring_equals(sanitized_path, "-") ? sanitized_path : ".";
+            int codec = zstd_format ? PACK_ZSTD : archive_type == FOSSIL_IO_ARCHIVE_TARGZ ? PACK_GZIP : PACK_NONE;
+            if (zstd_format && cnotnull(dict_path) &&
+                ((train_dict && !dict_train(src, sanitized_exclude, dict_path, con)) || !dict_load(dict_path, &zo, con)))
+                ret = 1;
+            else
+                ret = tar_create(to_stdout ? cnull : sanitized_path, src, codec, compress_level, threads,
+                                 sanitized_exclude, index, &zo, incremental);
+            if (ret == 0)
+                fossil_io_fprintf(con, "{blue}Archive created successfully{normal}\n");
         }
         else
+#endif
         {
-            // Add current directory contents (cross-platform)
-            if (!fossil_io_archive_add_directory(archive, ".", sanitized_exclude))
+            // The archive library does its own I/O, so a limit can only lower our priority
+            fossil_shark_throttle_background();
+
+            // Create archive using new API
+            archive = fossil_io_archive_create(sanitized_path, archive_type, compress_level > 0 ? compress_level : FOSSIL_IO_COMPRESSION_NORMAL);
+            if (!archive)
             {
-                fossil_io_printf("{red}Error: Failed to add files to archive{normal}\n");
+                fossil_io_fprintf(con, "{red}Error: Failed to create archive{normal}\n");
                 ret = 1;
             }
             else
             {
-                fossil_io_printf("{blue}Archive created successfully{normal}\n");
+                // Add current directory contents (cross-platform)
+                if (!fossil_io_archive_add_directory(archive, ".", sanitized_exclude))
+                {
+                    fossil_io_fprintf(con, "{red}Error: Failed to add files to archive{normal}\n");
+                    ret = 1;
+                }
+                else
+                {
+                    fossil_io_fprintf(con, "{blue}Archive created successfully{normal}\n");
+                }
             }
         }
     }
     else if (extract)
     {
-        fossil_io_printf("{cyan}Extracting archive: %s{normal}\n", sanitized_path);
-
-        // Show progress during extraction
-        fossil_io_show_progress(0);
+        fossil_io_fprintf(con, "{cyan}Extracting archive: %s{normal}\n", from_stdin ? "stdin" : sanitized_path);
 
-        // Open archive for reading
-        archive = fossil_io_archive_open(sanitized_path, archive_type, FOSSIL_IO_ARCHIVE_READ, FOSSIL_IO_COMPRESSION_NONE);
-        if (!archive)
+#if !defined(_WIN32) && !defined(_WIN64)
+        if (native_read)
+        {
+            // Tar streams are read here, overlapping input, inflate and file writes
+            // An incremental restore replays the chain up to this archive
+            ret = cnotnull(dict_path) && !dict_load(dict_path, &zo, con) ? 1
+                  : cnotnull(incremental) ? tar_replay(incremental, sanitized_path, member, &zo, threads, con)
+                                          : tar_read(from_stdin ? cnull : sanitized_path, false, member, &zo, false,
+                                                     threads, con);
+            if (ret == 0)
+                fossil_io_fprintf(con, "{blue}Archive extracted successfully{normal}\n");
+        }
+        else
+#endif
+        if (cnotnull(member))
         {
-            fossil_io_printf("{red}Error: Failed to open archive for extraction{normal}\n");
+            fossil_io_fprintf(con, "{red}Error: --member needs a tar, tar.gz or tar.zst archive{normal}\n");
             ret = 1;
         }
         else
         {
-            fossil_io_show_progress(50);
+            // Show progress during extraction
+            fossil_io_show_progress(0);
+
+            fossil_shark_throttle_background();
 
-            if (!fossil_io_archive_extract_all(archive, "."))
+            // Open archive for reading
+            archive = fossil_io_archive_open(sanitized_path, archive_type, FOSSIL_IO_ARCHIVE_READ, FOSSIL_IO_COMPRESSION_NONE);
+            if (!archive)
             {
-                fossil_io_printf("{red}Error: Failed to extract archive{normal}\n");
+                fossil_io_fprintf(con, "{red}Error: Failed to open archive for extraction{normal}\n");
                 ret = 1;
             }
             else
             {
-                fossil_io_printf("{blue}Archive extracted successfully{normal}\n");
+                fossil_io_show_progress(50);
+
+                if (!fossil_io_archive_extract_all(archive, "."))
+                {
+                    fossil_io_fprintf(con, "{red}Error: Failed to extract archive{normal}\n");
+                    ret = 1;
+                }
+                else
+                {
+                    fossil_io_fprintf(con, "{blue}Archive extracted successfully{normal}\n");
+                }
             }
-        }
 
-        fossil_io_show_progress(100);
-        fossil_io_printf("\n");
+            fossil_io_show_progress(100);
+            fossil_io_fprintf(con, "\n");
+        }
     }
     else if (list)
     {
-        fossil_io_printf("{cyan}Listing contents of archive: %s{normal}\n", sanitized_path);
+        fossil_io_fprintf(con, "{cyan}Listing contents of archive: %s{normal}\n", from_stdin ? "stdin" : sanitized_path);
 
-        // Open archive for reading
-        archive = fossil_io_archive_open(sanitized_path, archive_type, FOSSIL_IO_ARCHIVE_READ, FOSSIL_IO_COMPRESSION_NONE);
-        if (!archive)
+#if !defined(_WIN32) && !defined(_WIN64)
+        if (native_read)
+        {
+            ret = cnotnull(dict_path) && !dict_load(dict_path, &zo, con)
+                      ? 1
+                      : tar_read(from_stdin ? cnull : sanitized_path, true, member, &zo, false, 1, con);
+        }
+        else
+#endif
+        if (cnotnull(member))
         {
-            fossil_io_printf("{red}Error: Failed to open archive for listing{normal}\n");
+            fossil_io_fprintf(con, "{red}Error: --member needs a tar, tar.gz or tar.zst archive{normal}\n");
             ret = 1;
         }
         else
         {
-            // Print archive contents
-            fossil_io_archive_print(archive);
-
-            // Get and display archive statistics
-            fossil_io_archive_stats_t stats;
-            if (fossil_io_archive_get_stats(archive, &stats))
+            // Open archive for reading
+            archive = fossil_io_archive_open(sanitized_path, archive_type, FOSSIL_IO_ARCHIVE_READ, FOSSIL_IO_COMPRESSION_NONE);
+            if (!archive)
+            {
+                fossil_io_fprintf(con, "{red}Error: Failed to open archive for listing{normal}\n");
+                ret = 1;
+            }
+            else
             {
-                fossil_io_printf("\n{blue}Archive Statistics:{normal}\n");
-                fossil_io_printf("Total entries: %zu\n", stats.total_entries);
-                fossil_io_printf("Total size: %zu bytes\n", stats.total_size);
-                fossil_io_printf("Compressed size: %zu bytes\n", stats.compressed_size);
-                fossil_io_printf("Compression ratio: %.2f%%\n", stats.compression_ratio * 100);
+                // Print archive contents
+                fossil_io_archive_print(archive);
+
+                // Get and display archive statistics
+                fossil_io_archive_stats_t stats;
+                if (fossil_io_archive_get_stats(archive, &stats))
+                {
+                    fossil_io_fprintf(con, "\n{blue}Archive Statistics:{normal}\n");
+                    fossil_io_fprintf(con, "Total entries: %zu\n", stats.total_entries);
+                    fossil_io_fprintf(con, "Total size: %zu bytes\n", stats.total_size);
+                    fossil_io_fprintf(con, "Compressed size: %zu bytes\n", stats.compressed_size);
+                    fossil_io_fprintf(con, "Compression ratio: %.2f%%\n", stats.compression_ratio * 100);
+                }
             }
         }
     }
@@ -475,6 +620,10 @@ int fossil_shark_archive(ccstring path, bool create, bool extract,
     }
 
     // Clean up allocated memory
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (cnotnull(zo.dict))
+        fossil_sys_memory_free(zo.dict);
+#endif
     fossil_sys_memory_free(log_filename);
     fossil_sys_memory_free(sanitized_path);
     fossil_sys_memory_free(sanitized_format);
@@ -0,0 +1,420 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/archive_internal.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <errno.h>
+
+static uint64_t inc_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Fold one read of a file into its 128-bit digest; files are always read in
+// the same PACK_READ_BLOCK pieces. It only guards against accidental matches.
+void inc_digest(uint64_t d[2], const uint8_t *data, size_t len)
+{
+    uint64_t h1 = d[0] ^ 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t h2 = d[1] + 0xc2b2ae3d27d4eb4fULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h1 = (h1 ^ w) * 0x87c37b91114253d5ULL;
+        h1 = (h1 << 31) | (h1 >> 33);
+        h2 = (h2 + w) * 0x4cf5ad432745937fULL;
+        h2 = (h2 << 27) | (h2 >> 37);
+        h2 += h1;
+    }
+    for (; i < len; i++)
+    {
+        h1 = (h1 ^ data[i]) * 0x87c37b91114253d5ULL;
+        h2 = (h2 + data[i]) * 0x4cf5ad432745937fULL;
+    }
+    d[0] = inc_mix(h1 + h2);
+    d[1] = inc_mix(h2 ^ (h1 >> 1));
+}
+
+void inc_free(inc_state_t *inc)
+{
+    if (cnotnull(inc->data))
+        fossil_sys_memory_free(inc->data);
+    if (cnotnull(inc->seen))
+        fossil_sys_memory_free(inc->seen);
+    for (size_t i = 0; i < inc->entry_count; i++)
+        fossil_io_cstring_free(inc->entries[i].path);
+    if (cnotnull(inc->entries))
+        fossil_sys_memory_free(inc->entries);
+    memset(inc, 0, sizeof(*inc));
+}
+
+// Load the manifest at path; a missing one is an empty first run
+bool inc_load(ccstring path, inc_state_t *inc, fossil_io_filesys_file_t *con)
+{
+    memset(inc, 0, sizeof(*inc));
+    inc->slot = SIZE_MAX;
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return errno == ENOENT;
+    inc->dev = st.st_dev;
+    inc->ino = st.st_ino;
+    if ((uint64_t)st.st_size < sizeof(inc_header_t))
+        goto damaged;
+    inc->data = fossil_sys_memory_alloc((size_t)st.st_size);
+    fossil_io_filesys_file_t file;
+    if (!cnotnull(inc->data) || fossil_io_filesys_file_open(&file, path, "rb") != 0)
+        goto damaged;
+    size_t got = fossil_io_filesys_file_read(&file, inc->data, 1, (size_t)st.st_size);
+    fossil_io_filesys_file_close(&file);
+
+    // Validate everything up front so lookups can trust the offsets
+    const inc_header_t *hdr = (const inc_header_t *)inc->data;
+    uint64_t recs = (uint64_t)st.st_size / sizeof(inc_rec_t);
+    if (got != (size_t)st.st_size || memcmp(hdr->magic, INC_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != INC_VERSION || hdr->count > recs ||
+        sizeof(*hdr) + hdr->count * sizeof(inc_rec_t) + hdr->chain + hdr->strings != (uint64_t)st.st_size)
+        goto damaged;
+    inc->hdr = hdr;
+    inc->count = hdr->count;
+    inc->recs = (const inc_rec_t *)(inc->data + sizeof(*hdr));
+    inc->chain = (const char *)(inc->recs + hdr->count);
+    inc->strings = inc->chain + hdr->chain;
+    uint64_t ends = 0;
+    for (uint64_t i = 0; i < hdr->chain; i++)
+        ends += inc->chain[i] == '\0';
+    if (ends != hdr->archives || (hdr->chain > 0 && inc->chain[hdr->chain - 1] != '\0'))
+        goto damaged;
+    for (uint64_t i = 0; i < hdr->count; i++)
+    {
+        if (inc->recs[i].path_off + inc->recs[i].path_len > hdr->strings ||
+            inc->recs[i].path_len >= FOSSIL_FILESYS_MAX_PATH)
+            goto damaged;
+    }
+    inc->seen = fossil_sys_memory_calloc(hdr->count ? (size_t)hdr->count : 1, 1);
+    if (!cnotnull(inc->seen))
+        goto damaged;
+    return true;
+
+damaged:
+    fossil_io_fprintf(con, "{red}Error: Manifest %s is damaged or not a manifest{normal}\n", path);
+    inc_free(inc);
+    return false;
+}
+
+// Position of archive in the chain, matched by name or as the same file; -1 if absent
+int64_t inc_chain_find(const inc_state_t *inc, ccstring archive)
+{
+    struct stat want, st;
+    bool exists = stat(archive, &want) == 0;
+    const char *at = inc->chain;
+    for (uint32_t i = 0; cnotnull(inc->hdr) && i < inc->hdr->archives; i++, at += strlen(at) + 1)
+    {
+        if (strcmp(at, archive) == 0 ||
+            (exists && stat(at, &st) == 0 && st.st_dev == want.st_dev && st.st_ino == want.st_ino))
+            return i;
+    }
+    return -1;
+}
+
+// Byte order of the stored name against key, the same order strcmp gives
+static int inc_cmp(const inc_state_t *inc, uint64_t i, ccstring key, size_t len)
+{
+    const inc_rec_t *rec = &inc->recs[i];
+    size_t n = rec->path_len < len ? rec->path_len : len;
+    int c = memcmp(inc->strings + rec->path_off, key, n);
+    if (c != 0)
+        return c;
+    return rec->path_len < len ? -1 : (rec->path_len > len ? 1 : 0);
+}
+
+// First record not ordered before key
+static uint64_t inc_lower(const inc_state_t *inc, ccstring key, size_t len)
+{
+    uint64_t lo = 0, hi = inc->count;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (inc_cmp(inc, mid, key, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static size_t inc_push(inc_state_t *inc, ccstring name, uint64_t size, int64_t mtime_ns,
+                       const uint64_t digest[2], uint32_t mode, char type)
+{
+    if (inc->entry_count == inc->entry_cap)
+    {
+        size_t cap = inc->entry_cap ? inc->entry_cap * 2 : 256;
+        inc_entry_t *grown = fossil_sys_memory_realloc(inc->entries, cap * sizeof(inc_entry_t));
+        if (!cnotnull(grown))
+            return SIZE_MAX;
+        inc->entries = grown;
+        inc->entry_cap = cap;
+    }
+    inc_entry_t *e = &inc->entries[inc->entry_count];
+    e->path = fossil_io_cstring_dup(name);
+    if (!cnotnull(e->path))
+        return SIZE_MAX;
+    e->size = size;
+    e->mtime_ns = mtime_ns;
+    e->digest[0] = digest[0];
+    e->digest[1] = digest[1];
+    e->mode = mode;
+    e->type = type;
+    return inc->entry_count++;
+}
+
+// One tombstone member holding len bytes of NUL-terminated names
+static bool inc_tombstone(tar_writer_t *t, const char *names, size_t len)
+{
+    char name[FOSSIL_FILESYS_MAX_PATH];
+    snprintf(name, sizeof(name), "%s" INC_TOMBSTONES, t->top);
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    st.st_mtime = time(cnull);
+    uint8_t zero[TAR_RECORD] = {0};
+    return tar_entry(t, name, INC_TOMBSTONE_TYPE, &st, len, cnull) && pack_write(&t->pack, names, len) &&
+           pack_write(&t->pack, zero, (TAR_RECORD - len % TAR_RECORD) % TAR_RECORD);
+}
+
+// Tombstones for the records in [lo, hi) this walk has not found, then for
+// self unless it is UINT64_MAX. Names go deepest first, the order they can
+// be removed in; all of them count as found from here on.
+bool inc_bury(tar_writer_t *t, uint64_t lo, uint64_t hi, uint64_t self)
+{
+    inc_state_t *inc = t->inc;
+    size_t total = self != UINT64_MAX ? inc->recs[self].path_len + 1 : 0;
+    for (uint64_t i = lo; i < hi; i++)
+        total += inc->seen[i] ? 0 : inc->recs[i].path_len + 1;
+    if (total == 0)
+        return true;
+    size_t cap = total < INC_TOMBSTONES_MAX ? total : INC_TOMBSTONES_MAX;
+    char *names = fossil_sys_memory_alloc(cap);
+    if (!cnotnull(names))
+        return false;
+    size_t len = 0;
+    bool ok = true;
+    for (uint64_t i = hi; ok && i-- > lo;)
+    {
+        const inc_rec_t *rec = &inc->recs[i];
+        if (inc->seen[i])
+            continue;
+        inc->seen[i] = 1;
+        inc->deleted++;
+        if (len + rec->path_len + 1 > cap)
+        {
+            ok = inc_tombstone(t, names, len); // too many for one member
+            len = 0;
+        }
+        memcpy(names + len, inc->strings + rec->path_off, rec->path_len);
+        len += rec->path_len;
+        names[len++] = '\0';
+    }
+    if (ok && self != UINT64_MAX)
+    {
+        const inc_rec_t *rec = &inc->recs[self];
+        if (len + rec->path_len + 1 > cap)
+        {
+            ok = inc_tombstone(t, names, len);
+            len = 0;
+        }
+        memcpy(names + len, inc->strings + rec->path_off, rec->path_len);
+        len += rec->path_len;
+        names[len++] = '\0';
+    }
+    ok = ok && inc_tombstone(t, names, len);
+    fossil_sys_memory_free(names);
+    return ok;
+}
+
+// Digest of the file at path as tar_contents would take it; false if it cannot be read whole
+static bool inc_hash(tar_writer_t *t, ccstring path, uint64_t size, uint64_t d[2])
+{
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, path, "rb") != 0)
+        return false;
+    d[0] = d[1] = 0;
+    uint64_t left = size;
+    while (left > 0)
+    {
+        size_t want = left < PACK_READ_BLOCK ? (size_t)left : PACK_READ_BLOCK;
+        size_t n = fossil_shark_throttle_read(&file, t->buf, want);
+        if (n == 0)
+            break;
+        inc_digest(d, t->buf, n);
+        left -= n;
+    }
+    fossil_io_filesys_file_close(&file);
+    return left == 0;
+}
+
+// 1 when name is as the manifest last saw it and can be left out, 0 when it
+// has to be archived, -1 on failure. Either way it goes into the next
+// manifest. A directory that became something else is buried first.
+int inc_check(tar_writer_t *t, ccstring path, ccstring name, char type, const struct stat *st)
+{
+    inc_state_t *inc = t->inc;
+    uint64_t size = type == '5' ? 0 : (uint64_t)st->st_size;
+    int64_t mtime = ARCHIVE_MTIME_NS(*st);
+    uint32_t mode = (uint32_t)(st->st_mode & 07777);
+    uint64_t digest[2] = {0, 0};
+    size_t len = strlen(name);
+    uint64_t at = inc_lower(inc, name, len);
+    bool same = false;
+    if (at < inc->count && inc_cmp(inc, at, name, len) == 0)
+    {
+        const inc_rec_t *rec = &inc->recs[at];
+        inc->seen[at] = 1;
+        if (rec->type == '5' && type != '5')
+        {
+            char key[FOSSIL_FILESYS_MAX_PATH];
+            if (len + 2 > sizeof(key))
+                return -1;
+            memcpy(key, name, len);
+            key[len] = '/';
+            uint64_t lo = inc_lower(inc, key, len + 1);
+            key[len] = '/' + 1; // just past every name under it
+            if (!inc_bury(t, lo, inc_lower(inc, key, len + 1), at))
+                return -1;
+        }
+        if (rec->type == (uint32_t)(uint8_t)type && rec->mode == mode && rec->size == size)
+        {
+            // Touched files whose contents did not change are left out too
+            same = rec->mtime_ns == mtime ||
+                   (type == '0' && inc_hash(t, path, size, digest) && digest[0] == rec->digest[0] &&
+                    digest[1] == rec->digest[1]);
+            memcpy(digest, same ? rec->digest : (const uint64_t[2]){0, 0}, sizeof(digest));
+        }
+    }
+    size_t slot = inc_push(inc, name, size, mtime, digest, mode, type);
+    if (slot == SIZE_MAX)
+        return -1;
+    inc->slot = same ? SIZE_MAX : slot;
+    if (same)
+        inc->unchanged++;
+    else
+        inc->changed++;
+    return same ? 1 : 0;
+}
+
+static int inc_entry_cmp(const void *lhs, const void *rhs)
+{
+    return strcmp(((const inc_entry_t *)lhs)->path, ((const inc_entry_t *)rhs)->path);
+}
+
+// Write the next manifest to path, with archive added to the chain
+bool inc_save(inc_state_t *inc, ccstring path, ccstring archive)
+{
+    char temp[FOSSIL_FILESYS_MAX_PATH];
+    int n = snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if (n < 0 || (size_t)n >= sizeof(temp))
+        return false;
+    if (inc->entry_count > 1)
+        qsort(inc->entries, inc->entry_count, sizeof(inc_entry_t), inc_entry_cmp);
+
+    uint64_t old_chain = cnotnull(inc->hdr) ? inc->hdr->chain : 0;
+    inc_header_t hdr = {0};
+    memcpy(hdr.magic, INC_MAGIC, sizeof(hdr.magic));
+    hdr.version = INC_VERSION;
+    hdr.archives = (cnotnull(inc->hdr) ? inc->hdr->archives : 0) + 1;
+    hdr.count = inc->entry_count;
+    hdr.chain = old_chain + strlen(archive) + 1;
+    for (size_t i = 0; i < inc->entry_count; i++)
+        hdr.strings += strlen(inc->entries[i].path);
+
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, temp, "wb") != 0)
+        return false;
+    bool ok = fossil_io_filesys_file_write(&file, &hdr, sizeof(hdr), 1) == 1;
+    uint64_t off = 0;
+    for (size_t i = 0; ok && i < inc->entry_count; i++)
+    {
+        const inc_entry_t *e = &inc->entries[i];
+        inc_rec_t rec = {0};
+        rec.size = e->size;
+        rec.mtime_ns = e->mtime_ns;
+        rec.digest[0] = e->digest[0];
+        rec.digest[1] = e->digest[1];
+        rec.path_off = off;
+        rec.path_len = (uint32_t)strlen(e->path);
+        rec.mode = e->mode;
+        rec.type = (uint32_t)(uint8_t)e->type;
+        off += rec.path_len;
+        ok = fossil_io_filesys_file_write(&file, &rec, sizeof(rec), 1) == 1;
+    }
+    size_t archive_len = strlen(archive) + 1;
+    ok = ok && (old_chain == 0 || fossil_io_filesys_file_write(&file, inc->chain, 1, old_chain) == old_chain) &&
+         fossil_io_filesys_file_write(&file, archive, 1, archive_len) == archive_len;
+    for (size_t i = 0; ok && i < inc->entry_count; i++)
+    {
+        size_t len = strlen(inc->entries[i].path);
+        ok = fossil_io_filesys_file_write(&file, inc->entries[i].path, 1, len) == len;
+    }
+    fossil_io_filesys_file_close(&file);
+
+    if (!ok || fossil_io_filesys_move(temp, path, true) != 0)
+    {
+        fossil_io_filesys_remove(temp, false);
+        return false;
+    }
+    return true;
+}
+
+// Restore path by extracting the chain of manifest up to and including it, base first
+int tar_replay(ccstring manifest, ccstring path, ccstring member, const zstd_options_t *zo, int threads,
+               fossil_io_filesys_file_t *con)
+{
+    inc_state_t inc;
+    if (!inc_load(manifest, &inc, con))
+        return 1;
+    int64_t last = inc_chain_find(&inc, path);
+    if (last < 0)
+    {
+        fossil_io_fprintf(con, "{red}Error: %s is not in the chain of %s{normal}\n", path, manifest);
+        inc_free(&inc);
+        return 1;
+    }
+    int ret = 0;
+    const char *at = inc.chain;
+    for (int64_t i = 0; ret == 0 && i <= last; i++, at += strlen(at) + 1)
+    {
+        fossil_io_fprintf(con, "{cyan}Replaying %s (%lld of %lld){normal}\n", at, (long long)i + 1,
+                          (long long)last + 1);
+        ret = tar_read(at, false, member, zo, true, threads, con);
+    }
+    inc_free(&inc);
+    return ret;
+}
+#endif
@@ -0,0 +1,427 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/archive_internal.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+// Modification time in nanoseconds; a rewrite within the same second still shows
+static int64_t index_mtime_ns(const struct stat *st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+// Write <path>.idx for the archive just written to path
+bool tar_index_save(const tar_writer_t *t, ccstring path)
+{
+    char index_path[FOSSIL_FILESYS_MAX_PATH], temp[FOSSIL_FILESYS_MAX_PATH];
+    int n = snprintf(index_path, sizeof(index_path), "%s" INDEX_SUFFIX, path);
+    if (n < 0 || (size_t)n + 4 >= sizeof(index_path))
+        return false;
+    snprintf(temp, sizeof(temp), "%s.tmp", index_path);
+    struct stat archive;
+    if (stat(path, &archive) != 0)
+        return false;
+
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, temp, "wb") != 0)
+        return false;
+    index_header_t hdr = {0};
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = INDEX_VERSION;
+    hdr.codec = (uint32_t)t->pack.codec;
+    hdr.count = t->index_count;
+    hdr.points = t->pack.point_count;
+    hdr.archive_size = t->pack.out_total;
+    hdr.archive_ino = (uint64_t)archive.st_ino;
+    hdr.archive_mtime_ns = index_mtime_ns(&archive);
+    hdr.stream_size = t->pack.in_total;
+    hdr.create_ns = t->create_ns;
+    for (size_t i = 0; i < t->index_count; i++)
+        hdr.strings += strlen(t->index[i].path) + strlen(t->index[i].link);
+    bool ok = fossil_io_filesys_file_write(&file, &hdr, sizeof(hdr), 1) == 1;
+
+    uint64_t off = 0;
+    for (size_t i = 0; ok && i < t->index_count; i++)
+    {
+        const tar_index_entry_t *e = &t->index[i];
+        index_rec_t rec = {0};
+        rec.header = e->header;
+        rec.size = e->size;
+        rec.mtime = e->mtime;
+        rec.path_off = off;
+        rec.path_len = (uint32_t)strlen(e->path);
+        rec.link_len = (uint32_t)strlen(e->link);
+        rec.mode = e->mode;
+        rec.type = (uint32_t)(uint8_t)e->type;
+        off += rec.path_len + rec.link_len;
+        ok = fossil_io_filesys_file_write(&file, &rec, sizeof(rec), 1) == 1;
+    }
+    if (ok && t->pack.point_count > 0)
+        ok = fossil_io_filesys_file_write(&file, t->pack.points, sizeof(pack_point_t), t->pack.point_count) ==
+             t->pack.point_count;
+    for (size_t i = 0; ok && i < t->index_count; i++)
+    {
+        size_t path_len = strlen(t->index[i].path), link_len = strlen(t->index[i].link);
+        ok = fossil_io_filesys_file_write(&file, t->index[i].path, 1, path_len) == path_len &&
+             fossil_io_filesys_file_write(&file, t->index[i].link, 1, link_len) == link_len;
+    }
+    fossil_io_filesys_file_close(&file);
+
+    if (!ok || fossil_io_filesys_move(temp, index_path, true) != 0)
+    {
+        fossil_io_filesys_remove(temp, false);
+        return false;
+    }
+    return true;
+}
+
+void tar_index_free(tar_index_t *ix)
+{
+    if (cnotnull(ix->data))
+        fossil_sys_memory_free(ix->data);
+    memset(ix, 0, sizeof(*ix));
+}
+
+// Load <path>.idx if there is one and it still describes the archive at path
+bool tar_index_load(ccstring path, tar_index_t *ix)
+{
+    memset(ix, 0, sizeof(*ix));
+    char index_path[FOSSIL_FILESYS_MAX_PATH];
+    int n = snprintf(index_path, sizeof(index_path), "%s" INDEX_SUFFIX, path);
+    struct stat archive, st;
+    if (n < 0 || (size_t)n >= sizeof(index_path) || stat(index_path, &st) != 0 || stat(path, &archive) != 0)
+        return false;
+    if ((uint64_t)st.st_size < sizeof(index_header_t))
+        goto stale;
+    ix->data = fossil_sys_memory_alloc((size_t)st.st_size);
+    fossil_io_filesys_file_t file;
+    if (!cnotnull(ix->data) || fossil_io_filesys_file_open(&file, index_path, "rb") != 0)
+        goto stale;
+    size_t got = fossil_io_filesys_file_read(&file, ix->data, 1, (size_t)st.st_size);
+    fossil_io_filesys_file_close(&file);
+
+    // Validate everything up front so lookups can trust the offsets
+    const index_header_t *hdr = (const index_header_t *)ix->data;
+    uint64_t recs = (uint64_t)st.st_size / sizeof(index_rec_t);
+    uint64_t points = (uint64_t)st.st_size / sizeof(pack_point_t);
+    if (got != (size_t)st.st_size || memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != INDEX_VERSION || hdr->count > recs || hdr->points > points ||
+        sizeof(*hdr) + hdr->count * sizeof(index_rec_t) + hdr->points * sizeof(pack_point_t) + hdr->strings !=
+            (uint64_t)st.st_size ||
+        hdr->archive_size != (uint64_t)archive.st_size || hdr->archive_ino != (uint64_t)archive.st_ino ||
+        hdr->archive_mtime_ns != index_mtime_ns(&archive) || (hdr->codec != PACK_NONE && hdr->points == 0))
+        goto stale;
+    ix->hdr = hdr;
+    ix->recs = (const index_rec_t *)(ix->data + sizeof(*hdr));
+    ix->points = (const pack_point_t *)(ix->recs + hdr->count);
+    ix->strings = (const char *)(ix->points + hdr->points);
+    for (uint64_t i = 0; i < hdr->count; i++)
+    {
+        const index_rec_t *rec = &ix->recs[i];
+        if (rec->path_off + rec->path_len + rec->link_len > hdr->strings ||
+            rec->path_len >= FOSSIL_FILESYS_MAX_PATH || rec->link_len >= FOSSIL_FILESYS_MAX_PATH ||
+            rec->header >= hdr->stream_size)
+            goto stale;
+    }
+    return true;
+
+stale:
+    fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Ignoring stale or damaged index %s{normal}\n", index_path);
+    tar_index_free(ix);
+    return false;
+}
+
+// Copy an indexed entry's path and link out of the string table
+static void tar_index_names(const tar_index_t *ix, const index_rec_t *rec, char *name, char *target)
+{
+    memcpy(name, ix->strings + rec->path_off, rec->path_len);
+    name[rec->path_len] = '\0';
+    memcpy(target, ix->strings + rec->path_off + rec->path_len, rec->link_len);
+    target[rec->link_len] = '\0';
+}
+
+// List from the index alone, without reading the archive
+void tar_index_list(tar_reader_t *r, const tar_index_t *ix)
+{
+    char name[FOSSIL_FILESYS_MAX_PATH], target[FOSSIL_FILESYS_MAX_PATH];
+    for (uint64_t i = 0; i < ix->hdr->count; i++)
+    {
+        const index_rec_t *rec = &ix->recs[i];
+        tar_index_names(ix, rec, name, target);
+        if (!tar_member_match(r, name))
+            continue;
+        tar_list_entry(r, (char)rec->type, name, target, rec->size, (mode_t)rec->mode, (time_t)rec->mtime);
+        if (rec->type == '0' || rec->type == '7')
+            r->total += rec->size;
+        r->entries++;
+    }
+    r->src.in_total = ix->hdr->archive_size;
+    r->src.out_total = ix->hdr->stream_size;
+}
+
+// The checkpoint at or before header in the tar stream
+static size_t tar_index_point(const tar_index_t *ix, uint64_t header)
+{
+    size_t lo = 0, hi = (size_t)ix->hdr->points;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ix->points[mid].in <= header)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Position r at the first header of rec, reading on when it lies close
+// behind the current position and reopening at a checkpoint otherwise
+static bool tar_index_seek(tar_reader_t *r, const tar_index_t *ix, const index_rec_t *rec,
+                           fossil_io_filesys_file_t *file, bool *open)
+{
+    // Plain tar seeks straight to the entry; tar.gz and tar.zst to the last checkpoint at or before it
+    uint64_t in = rec->header, out = rec->header;
+    if (ix->hdr->codec != PACK_NONE)
+    {
+        size_t at = tar_index_point(ix, rec->header);
+        in = ix->points[at].in;
+        out = ix->points[at].out;
+    }
+    if (!*open || rec->header < r->src.out_total || in > r->src.out_total)
+    {
+        if (*open)
+            unpack_close(&r->src);
+        *open = true;
+        if (!unpack_open_at(&r->src, file, out, in, (int)ix->hdr->codec, r->zo))
+            return false;
+    }
+    return tar_skip(r, rec->header - r->src.out_total);
+}
+
+// Extract the matching entries, each read from the nearest checkpoint before it
+bool tar_index_extract(tar_reader_t *r, const tar_index_t *ix, fossil_io_filesys_file_t *file)
+{
+    char name[FOSSIL_FILESYS_MAX_PATH], target[FOSSIL_FILESYS_MAX_PATH];
+    bool open = false, ok = true;
+    for (uint64_t i = 0; ok && i < ix->hdr->count; i++)
+    {
+        const index_rec_t *rec = &ix->recs[i];
+        tar_index_names(ix, rec, name, target);
+        if (tar_member_match(r, name) || rec->type == INC_TOMBSTONE_TYPE)
+            ok = tar_index_seek(r, ix, rec, file, &open) && tar_read_entry(r) > 0;
+    }
+    if (open)
+        unpack_close(&r->src);
+    return ok;
+}
+
+/*
+ * Parallel extraction from an index. The stream is cut into spans at
+ * checkpoints (or anywhere, for plain tar), and each worker inflates its
+ * own spans through its own handle on the archive. Everything that is not
+ * file data is done by the calling thread around them: directories and
+ * tombstones first, in archive order, so workers never create or remove
+ * directories; links last, once their targets exist.
+ */
+#define TAR_SPAN_MAX (64 * 1024 * 1024)
+
+typedef struct
+{
+    uint64_t lo; // index records [lo, hi)
+    uint64_t hi;
+} tar_span_t;
+
+typedef struct
+{
+    tar_reader_t *r; // settings to copy, and where the totals go
+    const tar_index_t *ix;
+    ccstring path;
+    tar_span_t *spans;
+    size_t span_count;
+    size_t next; // next span to hand out
+    bool failed;
+    pthread_mutex_t lock;
+} tar_fanout_t;
+
+// Whether rec is a member whose data a worker writes out
+static bool tar_index_is_data(const index_rec_t *rec)
+{
+    return rec->type == '0' || rec->type == '7';
+}
+
+static void *tar_fanout_worker(void *arg)
+{
+    tar_fanout_t *f = arg;
+    tar_reader_t r;
+    memset(&r, 0, sizeof(r));
+    r.con = f->r->con;
+    r.member = f->r->member;
+    r.member_len = f->r->member_len;
+    r.umask = f->r->umask;
+    r.zo = f->r->zo;
+    r.buf = fossil_sys_memory_alloc(PACK_READ_BLOCK);
+    fossil_io_filesys_file_t file;
+    bool opened = cnotnull(r.buf) && fossil_io_filesys_file_open(&file, f->path, "rb") == 0;
+    bool ok = opened, wrong_dict = false;
+    char name[FOSSIL_FILESYS_MAX_PATH], target[FOSSIL_FILESYS_MAX_PATH];
+    for (;;)
+    {
+        pthread_mutex_lock(&f->lock);
+        size_t at = ok && !f->failed ? f->next++ : f->span_count;
+        pthread_mutex_unlock(&f->lock);
+        if (at >= f->span_count)
+            break;
+        bool open = false;
+        for (uint64_t i = f->spans[at].lo; ok && i < f->spans[at].hi; i++)
+        {
+            const index_rec_t *rec = &f->ix->recs[i];
+            tar_index_names(f->ix, rec, name, target);
+            if (tar_index_is_data(rec) && tar_member_match(&r, name))
+                ok = tar_index_seek(&r, f->ix, rec, &file, &open) && tar_read_entry(&r) > 0;
+        }
+        if (open)
+        {
+            wrong_dict = wrong_dict || r.src.wrong_dict;
+            unpack_close(&r.src);
+        }
+    }
+    if (opened)
+        fossil_io_filesys_file_close(&file);
+    if (cnotnull(r.buf))
+        fossil_sys_memory_free(r.buf);
+
+    pthread_mutex_lock(&f->lock);
+    f->r->entries += r.entries;
+    f->r->errors += r.errors;
+    f->r->total += r.total;
+    f->r->src.wrong_dict = f->r->src.wrong_dict || wrong_dict;
+    f->failed = f->failed || !ok;
+    pthread_mutex_unlock(&f->lock);
+    return cnull;
+}
+
+// Cut the records into spans of about span bytes of the stream, each
+// starting at a checkpoint; false when memory ran out
+static bool tar_fanout_spans(tar_fanout_t *f, size_t workers)
+{
+    const index_header_t *hdr = f->ix->hdr;
+    uint64_t span = hdr->stream_size / (workers * 8);
+    span = span < PACK_CHECKPOINT ? PACK_CHECKPOINT : span > TAR_SPAN_MAX ? TAR_SPAN_MAX : span;
+    f->spans = fossil_sys_memory_alloc((size_t)(hdr->count > 0 ? hdr->count : 1) * sizeof(tar_span_t));
+    if (!cnotnull(f->spans))
+        return false;
+    uint64_t last = 0;
+    for (uint64_t i = 0; i < hdr->count; i++)
+    {
+        uint64_t header = f->ix->recs[i].header;
+        uint64_t key = hdr->codec == PACK_NONE ? header / PACK_CHECKPOINT : tar_index_point(f->ix, header);
+        if (f->span_count == 0 ||
+            (key != last && header - f->ix->recs[f->spans[f->span_count - 1].lo].header >= span))
+            f->spans[f->span_count++].lo = i;
+        f->spans[f->span_count - 1].hi = i + 1;
+        last = key;
+    }
+    return true;
+}
+
+// Extract the matching entries of path with up to workers threads writing files
+bool tar_index_fanout(tar_reader_t *r, const tar_index_t *ix, ccstring path,
+                      fossil_io_filesys_file_t *file, size_t workers)
+{
+    char name[FOSSIL_FILESYS_MAX_PATH], target[FOSSIL_FILESYS_MAX_PATH];
+    bool open = false, ok = true;
+
+    // Directories, the parents of files and tombstones, all in one pass
+    for (uint64_t i = 0; ok && i < ix->hdr->count; i++)
+    {
+        const index_rec_t *rec = &ix->recs[i];
+        tar_index_names(ix, rec, name, target);
+        if (rec->type == INC_TOMBSTONE_TYPE)
+        {
+            ok = tar_index_seek(r, ix, rec, file, &open) && tar_read_entry(r) > 0;
+        }
+        else if (!tar_member_match(r, name))
+        {
+            continue;
+        }
+        else if (rec->type == '5')
+        {
+            ok = tar_extract_entry(r, '5', name, target, 0, (mode_t)rec->mode, (time_t)rec->mtime);
+            r->entries++;
+        }
+        else if (tar_index_is_data(rec) && tar_safe_name(name))
+        {
+            tar_parents(r, name, true); // a failure is reported by the worker
+        }
+    }
+    if (open)
+        unpack_close(&r->src);
+
+    tar_fanout_t f;
+    memset(&f, 0, sizeof(f));
+    f.r = r;
+    f.ix = ix;
+    f.path = path;
+    if (ok && !tar_fanout_spans(&f, workers))
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{red}Error: Memory allocation failed.{normal}\n");
+        r->errors++;
+        ok = false;
+    }
+    if (ok)
+    {
+        pthread_t threads[PACK_MAX_WORKERS];
+        size_t started = 0;
+        pthread_mutex_init(&f.lock, cnull);
+        while (started < workers && started < f.span_count &&
+               pthread_create(&threads[started], cnull, tar_fanout_worker, &f) == 0)
+            started++;
+        if (started == 0)
+            tar_fanout_worker(&f);
+        for (size_t i = 0; i < started; i++)
+            pthread_join(threads[i], cnull);
+        pthread_mutex_destroy(&f.lock);
+        ok = !f.failed;
+    }
+    if (cnotnull(f.spans))
+        fossil_sys_memory_free(f.spans);
+
+    // Links, now that whatever they point at is in place
+    for (uint64_t i = 0; ok && i < ix->hdr->count; i++)
+    {
+        const index_rec_t *rec = &ix->recs[i];
+        tar_index_names(ix, rec, name, target);
+        if (rec->type == '5' || tar_index_is_data(rec) || rec->type == INC_TOMBSTONE_TYPE ||
+            !tar_member_match(r, name))
+            continue;
+        ok = tar_extract_entry(r, (char)rec->type, name, target, 0, (mode_t)rec->mode, (time_t)rec->mtime);
+        r->entries++;
+    }
+    return ok;
+}
+#endif
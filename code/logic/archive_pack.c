@@ -0,0 +1,1090 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/archive_internal.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include <zdict.h>
+
+// A stream at the archive's level and one at level 0 for stored blocks
+static bool pack_deflate_init(z_stream zs[2], int level)
+{
+    memset(zs, 0, 2 * sizeof(z_stream));
+    if (deflateInit2(&zs[0], level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    if (deflateInit2(&zs[1], 0, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        deflateEnd(&zs[0]);
+        return false;
+    }
+    return true;
+}
+
+static bool pack_grow(pack_block_t *b)
+{
+    if (b->out_cap - b->out_len >= 1024)
+        return true;
+    size_t cap = b->out_cap * 2;
+    uint8_t *grown = fossil_sys_memory_realloc(b->out, cap);
+    if (!cnotnull(grown))
+        return false;
+    b->out = grown;
+    b->out_cap = cap;
+    return true;
+}
+
+// Compress one block as a piece of a raw deflate stream
+static bool pack_deflate(pack_t *p, pack_block_t *b, z_stream *zs)
+{
+    b->out_len = 0;
+    if (p->codec == PACK_NONE)
+        return true;
+    b->crc = (uint32_t)crc32(0, b->in + b->dict_len, (uInt)b->len);
+    if (deflateReset(zs) != Z_OK ||
+        (b->dict_len > 0 && deflateSetDictionary(zs, b->in, (uInt)b->dict_len) != Z_OK))
+        return false;
+    zs->next_in = b->in + b->dict_len;
+    zs->avail_in = (uInt)b->len;
+    int flush = b->last ? Z_FINISH : Z_SYNC_FLUSH;
+    for (;;)
+    {
+        if (!pack_grow(b))
+            return false;
+        zs->next_out = b->out + b->out_len;
+        zs->avail_out = (uInt)(b->out_cap - b->out_len);
+        int rc = deflate(zs, flush);
+        b->out_len = b->out_cap - zs->avail_out;
+        if (rc == Z_STREAM_ERROR)
+            return false;
+        if (b->last ? rc == Z_STREAM_END : zs->avail_out > 0)
+            return true;
+    }
+}
+
+// Compress in with mode, appending to the block's output
+static bool pack_zstd_feed(pack_t *p, pack_block_t *b, ZSTD_inBuffer *in, ZSTD_EndDirective mode)
+{
+    for (;;)
+    {
+        if (!pack_grow(b))
+            return false;
+        ZSTD_outBuffer out = {b->out, b->out_cap, b->out_len};
+        size_t rc = ZSTD_compressStream2(p->zc, &out, in, mode);
+        b->out_len = out.pos;
+        if (ZSTD_isError(rc))
+            return false;
+        if (mode == ZSTD_e_end ? rc == 0 : in->pos == in->size)
+            return true;
+    }
+}
+
+// Feed one block to the zstd context; the frame ends with the last block
+// and, when checkpoints are kept, before every checkpoint. A frame also
+// ends where stored blocks start or stop, as the level only changes between frames.
+static bool pack_zstd(pack_t *p, pack_block_t *b)
+{
+    b->out_len = 0;
+    int level = b->stored ? ZSTD_minCLevel() : p->level;
+    if (level != p->zstd_level)
+    {
+        ZSTD_inBuffer none = {cnull, 0, 0};
+        if ((p->zstd_open && !pack_zstd_feed(p, b, &none, ZSTD_e_end)) ||
+            ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_compressionLevel, level)))
+            return false;
+        p->zstd_level = level;
+    }
+    bool end = b->last || (p->checkpoints && (b->at + b->len) % PACK_CHECKPOINT == 0);
+    ZSTD_inBuffer in = {b->in + b->dict_len, b->len, 0};
+    p->zstd_open = !end;
+    return pack_zstd_feed(p, b, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+}
+
+static void *pack_worker(void *arg)
+{
+    pack_t *p = arg;
+    z_stream zs[2];
+    bool ok = p->codec == PACK_NONE || pack_deflate_init(zs, p->level);
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        while (!p->closing && p->taken == p->filled)
+            pthread_cond_wait(&p->wake, &p->lock);
+        if (p->taken == p->filled)
+            break;
+        pack_block_t *b = &p->ring[p->taken++ % p->ring_len];
+        b->state = PACK_BUSY;
+        pthread_mutex_unlock(&p->lock);
+        bool done = ok && pack_deflate(p, b, &zs[b->stored]);
+        pthread_mutex_lock(&p->lock);
+        if (!done)
+            p->failed = true;
+        b->state = PACK_DONE;
+        pthread_cond_broadcast(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (p->codec != PACK_NONE && ok)
+    {
+        deflateEnd(&zs[0]);
+        deflateEnd(&zs[1]);
+    }
+    return cnull;
+}
+
+static bool pack_put(pack_t *p, const void *data, size_t len)
+{
+    if (fossil_shark_throttle_write(p->out, data, len) != len)
+        return false;
+    p->out_total += len;
+    return true;
+}
+
+// Write one finished block; false if the output failed
+static bool pack_emit(pack_t *p, pack_block_t *b)
+{
+    if (p->checkpoints && p->codec != PACK_NONE && b->at % PACK_CHECKPOINT == 0 && b->len > 0)
+    {
+        if (p->point_count == p->point_cap)
+        {
+            size_t cap = p->point_cap ? p->point_cap * 2 : 64;
+            pack_point_t *grown = fossil_sys_memory_realloc(p->points, cap * sizeof(pack_point_t));
+            if (!cnotnull(grown))
+                return false;
+            p->points = grown;
+            p->point_cap = cap;
+        }
+        p->points[p->point_count].in = b->at;
+        p->points[p->point_count].out = p->out_total;
+        p->point_count++;
+    }
+    bool stored = p->codec == PACK_NONE;
+    p->crc = (uint32_t)crc32_combine(p->crc, b->crc, (z_off_t)b->len);
+    return pack_put(p, stored ? b->in + b->dict_len : b->out, stored ? b->len : b->out_len);
+}
+
+// Write out the oldest block in flight once its worker is done with it (no writer thread)
+static void pack_write_next(pack_t *p)
+{
+    pack_block_t *b = &p->ring[p->written % p->ring_len];
+    pthread_mutex_lock(&p->lock);
+    while (b->state != PACK_DONE)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    if (!p->failed && !pack_emit(p, b))
+        p->failed = true;
+    b->state = PACK_FREE;
+    p->written++;
+}
+
+static void *pack_writer(void *arg)
+{
+    pack_t *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        pack_block_t *b = &p->ring[p->written % p->ring_len];
+        while (b->state != PACK_DONE && !(p->closing && p->written == p->filled))
+            pthread_cond_wait(&p->done, &p->lock);
+        if (b->state != PACK_DONE)
+            break;
+        bool failed = p->failed;
+        pthread_mutex_unlock(&p->lock);
+        bool ok = failed || pack_emit(p, b);
+        pthread_mutex_lock(&p->lock);
+        if (!ok)
+            p->failed = true;
+        b->state = PACK_FREE;
+        p->written++;
+        pthread_cond_signal(&p->freed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return cnull;
+}
+
+// Hand the block being filled to the workers
+static void pack_submit(pack_t *p, bool last)
+{
+    pack_block_t *b = p->cur;
+    b->last = last;
+    b->stored = p->codec != PACK_NONE && b->len > 0 && b->dense >= b->len - b->len / 8;
+    if (b->stored)
+        p->stored_total += b->len;
+    p->in_total += b->len;
+
+    // The next block's dictionary is the tail of everything so far
+    size_t total = b->dict_len + b->len;
+    if (p->codec == PACK_GZIP)
+    {
+        p->window_len = total < PACK_WINDOW ? total : PACK_WINDOW;
+        memcpy(p->window, b->in + total - p->window_len, p->window_len);
+    }
+
+    p->cur = cnull;
+    if (p->started == 0)
+    {
+        bool ok = p->codec == PACK_ZSTD ? pack_zstd(p, b) : pack_deflate(p, b, &p->inline_zs[b->stored]);
+        pthread_mutex_lock(&p->lock);
+        if (!ok)
+            p->failed = true;
+        b->state = PACK_DONE;
+        p->filled++;
+        p->taken++;
+        pthread_cond_signal(&p->done);
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    b->state = PACK_FILLED;
+    p->filled++;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static pack_block_t *pack_block(pack_t *p)
+{
+    if (cnotnull(p->cur))
+        return p->cur;
+    pack_block_t *b = &p->ring[p->filled % p->ring_len];
+    if (p->writing)
+    {
+        pthread_mutex_lock(&p->lock);
+        while (b->state != PACK_FREE)
+            pthread_cond_wait(&p->freed, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+    }
+    while (b->state != PACK_FREE)
+        pack_write_next(p);
+    b->at = p->in_total;
+    b->dict_len = p->checkpoints && b->at % PACK_CHECKPOINT == 0 ? 0 : p->window_len;
+    memcpy(b->in, p->window, b->dict_len);
+    b->len = 0;
+    b->dense = 0;
+    p->cur = b;
+    return b;
+}
+
+// Append to the uncompressed stream
+bool pack_write(pack_t *p, const void *data, size_t len)
+{
+    const uint8_t *at = data;
+    while (len > 0 && !p->failed)
+    {
+        pack_block_t *b = pack_block(p);
+        size_t room = PACK_BLOCK - b->len;
+        size_t n = len < room ? len : room;
+        memcpy(b->in + b->dict_len + b->len, at, n);
+        b->len += n;
+        if (p->dense)
+            b->dense += n;
+        at += n;
+        len -= n;
+        if (b->len == PACK_BLOCK)
+            pack_submit(p, false);
+    }
+    return !p->failed;
+}
+
+// Whether data is not worth compressing: slices of it, at most 1/16 of it,
+// deflated at the fastest level save less than 1/64 of their size
+static bool pack_probe(pack_t *p, const uint8_t *data, size_t len)
+{
+    size_t slices = len / (16 * PACK_PROBE_SLICE);
+    if (!p->probe_ready || slices == 0 || deflateReset(&p->probe) != Z_OK)
+        return false;
+    slices = slices < PACK_PROBE_SLICES ? slices : PACK_PROBE_SLICES;
+    size_t step = len / slices, cap = PACK_PROBE_SLICE * PACK_PROBE_SLICES + 1024;
+    p->probe.next_out = p->probe_out;
+    p->probe.avail_out = (uInt)cap;
+    int rc = Z_OK;
+    for (size_t i = 0; i < slices && rc == Z_OK; i++)
+    {
+        p->probe.next_in = (Bytef *)(data + i * step);
+        p->probe.avail_in = PACK_PROBE_SLICE;
+        rc = deflate(&p->probe, i + 1 == slices ? Z_FINISH : Z_NO_FLUSH);
+    }
+    size_t in = slices * PACK_PROBE_SLICE, out = cap - p->probe.avail_out;
+    return rc != Z_STREAM_END || out + in / 64 >= in;
+}
+
+// Append file contents, which the probe may find not worth compressing
+static bool pack_write_data(pack_t *p, const uint8_t *data, size_t len)
+{
+    p->dense = pack_probe(p, data, len);
+    bool ok = pack_write(p, data, len);
+    p->dense = false;
+    return ok;
+}
+
+size_t pack_workers(int threads)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = threads > 0 ? (size_t)threads : cpus > 0 ? (size_t)cpus : 1;
+    return workers > PACK_MAX_WORKERS ? PACK_MAX_WORKERS : workers;
+}
+
+// False when memory ran out; p must be released with pack_free either way
+static bool pack_open(pack_t *p, fossil_io_filesys_file_t *out, int codec, int level, int threads,
+                      bool checkpoints)
+{
+    memset(p, 0, sizeof(*p));
+    p->out = out;
+    p->codec = codec;
+    p->level = level;
+    p->checkpoints = checkpoints;
+    pthread_mutex_init(&p->lock, cnull);
+    pthread_cond_init(&p->wake, cnull);
+    pthread_cond_init(&p->done, cnull);
+    pthread_cond_init(&p->freed, cnull);
+    size_t workers = codec == PACK_NONE ? 0 : pack_workers(threads);
+    if (workers == 1)
+        workers = 0; // one worker would only hand blocks back and forth
+    if (codec == PACK_ZSTD)
+    {
+        p->zc = ZSTD_createCCtx();
+        if (!cnotnull(p->zc) ||
+            ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_compressionLevel, level)) ||
+            ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_checksumFlag, 1)))
+            return false;
+        // A library built without threads refuses this and compresses serially
+        if (workers > 0 && !ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_nbWorkers, (int)workers)))
+            p->zstd_workers = workers;
+        workers = 0;
+    }
+    p->ring_len = workers > 0 ? workers * 2 : 2;
+    p->ring = fossil_sys_memory_calloc(p->ring_len, sizeof(pack_block_t));
+    if (!cnotnull(p->ring))
+        return false;
+    for (size_t i = 0; i < p->ring_len; i++)
+    {
+        pack_block_t *b = &p->ring[i];
+        b->in = fossil_sys_memory_alloc(PACK_WINDOW + PACK_BLOCK);
+        b->out_cap = PACK_BLOCK + PACK_BLOCK / 8 + 1024;
+        b->out = fossil_sys_memory_alloc(b->out_cap);
+        if (!cnotnull(b->in) || !cnotnull(b->out))
+            return false;
+    }
+    if (codec == PACK_GZIP && !pack_deflate_init(p->inline_zs, level))
+        return false;
+    p->inline_ready = codec == PACK_GZIP;
+    p->zstd_level = level;
+
+    // Storing only pays when the archive is compressed in the first place
+    if (codec == PACK_ZSTD || (codec == PACK_GZIP && level != 0))
+    {
+        p->probe_out = fossil_sys_memory_alloc(PACK_PROBE_SLICE * PACK_PROBE_SLICES + 1024);
+        if (!cnotnull(p->probe_out) ||
+            deflateInit2(&p->probe, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        p->probe_ready = true;
+    }
+
+    for (; p->started < workers; p->started++)
+    {
+        if (pthread_create(&p->threads[p->started], cnull, pack_worker, p) != 0)
+            break;
+    }
+
+    if (codec == PACK_GZIP)
+    {
+        // No name, no mtime: the same tree gives the same bytes
+        static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        if (!pack_put(p, header, sizeof(header)))
+            p->failed = true;
+    }
+    p->writing = pthread_create(&p->writer, cnull, pack_writer, p) == 0;
+    return true;
+}
+
+// Flush everything and write the trailer; false if anything failed
+static bool pack_close(pack_t *p)
+{
+    pack_block(p);
+    pack_submit(p, true);
+    while (!p->writing && p->written < p->filled)
+        pack_write_next(p);
+
+    pthread_mutex_lock(&p->lock);
+    p->closing = true;
+    pthread_cond_broadcast(&p->wake);
+    pthread_cond_broadcast(&p->done);
+    pthread_mutex_unlock(&p->lock);
+    for (size_t t = 0; t < p->started; t++)
+        pthread_join(p->threads[t], cnull);
+    if (p->writing)
+        pthread_join(p->writer, cnull);
+    p->writing = false;
+
+    if (p->codec == PACK_GZIP && !p->failed)
+    {
+        uint8_t trailer[8];
+        for (int i = 0; i < 4; i++)
+        {
+            trailer[i] = (uint8_t)(p->crc >> (8 * i));
+            trailer[4 + i] = (uint8_t)(p->in_total >> (8 * i));
+        }
+        if (!pack_put(p, trailer, sizeof(trailer)))
+            p->failed = true;
+    }
+    return !p->failed;
+}
+
+// Long-distance matching and a dictionary for zstd; call before writing anything
+static bool pack_zstd_tune(pack_t *p, const zstd_options_t *zo)
+{
+    if (p->codec != PACK_ZSTD)
+        return true;
+    if (zo->long_window &&
+        (ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_enableLongDistanceMatching, 1)) ||
+         ZSTD_isError(ZSTD_CCtx_setParameter(p->zc, ZSTD_c_windowLog, PACK_LONG_WINDOW_LOG))))
+        return false;
+    return zo->dict_len == 0 || !ZSTD_isError(ZSTD_CCtx_loadDictionary(p->zc, zo->dict, zo->dict_len));
+}
+
+// Threads that compressed, for the summary line
+static size_t pack_threads(const pack_t *p)
+{
+    size_t threads = p->codec == PACK_ZSTD ? p->zstd_workers : p->started;
+    return threads > 0 ? threads : 1;
+}
+
+static void pack_free(pack_t *p)
+{
+    if (p->inline_ready)
+    {
+        deflateEnd(&p->inline_zs[0]);
+        deflateEnd(&p->inline_zs[1]);
+    }
+    if (p->probe_ready)
+        deflateEnd(&p->probe);
+    if (cnotnull(p->probe_out))
+        fossil_sys_memory_free(p->probe_out);
+    ZSTD_freeCCtx(p->zc);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->freed);
+    for (size_t i = 0; cnotnull(p->ring) && i < p->ring_len; i++)
+    {
+        if (cnotnull(p->ring[i].in))
+            fossil_sys_memory_free(p->ring[i].in);
+        if (cnotnull(p->ring[i].out))
+            fossil_sys_memory_free(p->ring[i].out);
+    }
+    if (cnotnull(p->ring))
+        fossil_sys_memory_free(p->ring);
+    if (cnotnull(p->points))
+        fossil_sys_memory_free(p->points);
+}
+
+// Where the next byte written lands in the uncompressed stream
+static uint64_t pack_offset(const pack_t *p)
+{
+    return p->in_total + (cnotnull(p->cur) ? p->cur->len : 0);
+}
+
+uint64_t archive_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// MB/s for bytes handled in ns
+double archive_rate(uint64_t bytes, uint64_t ns)
+{
+    return ns > 0 ? (double)bytes / 1e6 / ((double)ns / 1e9) : 0.0;
+}
+
+static void tar_octal(char *field, size_t width, uint64_t value)
+{
+    snprintf(field, width, "%0*llo", (int)(width - 1), (unsigned long long)value);
+}
+
+// Append one "len key=value\n" record; len counts its own digits
+static void tar_pax_record(char *out, size_t *at, size_t cap, ccstring key, ccstring value)
+{
+    size_t body = strlen(key) + strlen(value) + 3; // space, '=', newline
+    size_t len = body + 1;
+    while ((size_t)snprintf(cnull, 0, "%zu", len) + body > len)
+        len++;
+    if (*at + len < cap)
+        *at += (size_t)snprintf(out + *at, cap - *at, "%zu %s=%s\n", len, key, value);
+}
+
+static bool tar_header(tar_writer_t *t, ccstring name, char type, const struct stat *st,
+                       uint64_t size, ccstring link)
+{
+    uint8_t h[TAR_RECORD];
+    memset(h, 0, sizeof(h));
+    size_t name_len = strlen(name);
+    size_t link_len = cnotnull(link) ? strlen(link) : 0;
+    const uint64_t octal_max = 077777777777ULL; // 11 digits
+
+    // Long paths split at a slash into prefix (155) and name (100)
+    size_t split = 0;
+    if (name_len > 100)
+    {
+        for (size_t i = name_len - 1; i > 0; i--)
+        {
+            if (name[i] == '/' && i <= 155 && name_len - i - 1 <= 100 && name_len - i - 1 > 0)
+            {
+                split = i;
+                break;
+            }
+        }
+    }
+
+    char pax[3 * FOSSIL_FILESYS_MAX_PATH];
+    size_t pax_len = 0;
+    char num[32];
+    if (name_len > 100 && split == 0)
+        tar_pax_record(pax, &pax_len, sizeof(pax), "path", name);
+    if (link_len > 100)
+        tar_pax_record(pax, &pax_len, sizeof(pax), "linkpath", link);
+    if (size > octal_max)
+    {
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)size);
+        tar_pax_record(pax, &pax_len, sizeof(pax), "size", num);
+    }
+    if ((uint64_t)st->st_uid > 07777777)
+    {
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)st->st_uid);
+        tar_pax_record(pax, &pax_len, sizeof(pax), "uid", num);
+    }
+    if ((uint64_t)st->st_gid > 07777777)
+    {
+        snprintf(num, sizeof(num), "%llu", (unsigned long long)st->st_gid);
+        tar_pax_record(pax, &pax_len, sizeof(pax), "gid", num);
+    }
+    if (pax_len > 0)
+    {
+        struct stat pst = *st;
+        pst.st_uid = 0;
+        pst.st_gid = 0;
+        if (!tar_header(t, "././@PaxHeader", 'x', &pst, pax_len, cnull) ||
+            !pack_write(&t->pack, pax, pax_len))
+            return false;
+        size_t pad = (TAR_RECORD - pax_len % TAR_RECORD) % TAR_RECORD;
+        uint8_t zero[TAR_RECORD] = {0};
+        if (!pack_write(&t->pack, zero, pad))
+            return false;
+    }
+
+    if (split > 0)
+    {
+        memcpy(h + 345, name, split);
+        memcpy(h, name + split + 1, name_len - split - 1);
+    }
+    else
+    {
+        memcpy(h, name, name_len < 100 ? name_len : 100);
+    }
+    tar_octal((char *)h + 100, 8, st->st_mode & 07777);
+    tar_octal((char *)h + 108, 8, (uint64_t)st->st_uid > 07777777 ? 0 : (uint64_t)st->st_uid);
+    tar_octal((char *)h + 116, 8, (uint64_t)st->st_gid > 07777777 ? 0 : (uint64_t)st->st_gid);
+    tar_octal((char *)h + 124, 12, size > octal_max ? 0 : size);
+    tar_octal((char *)h + 136, 12, st->st_mtime > 0 ? (uint64_t)st->st_mtime : 0);
+    h[156] = (uint8_t)type;
+    if (link_len > 0)
+        memcpy(h + 157, link, link_len < 100 ? link_len : 100);
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_RECORD; i++)
+        sum += h[i];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    return pack_write(&t->pack, h, sizeof(h));
+}
+
+// One entry's headers, noted in the index when one is kept
+bool tar_entry(tar_writer_t *t, ccstring name, char type, const struct stat *st,
+               uint64_t size, ccstring link)
+{
+    if (t->indexed)
+    {
+        if (t->index_count == t->index_cap)
+        {
+            size_t cap = t->index_cap ? t->index_cap * 2 : 256;
+            tar_index_entry_t *grown = fossil_sys_memory_realloc(t->index, cap * sizeof(tar_index_entry_t));
+            if (!cnotnull(grown))
+                return false;
+            t->index = grown;
+            t->index_cap = cap;
+        }
+        tar_index_entry_t *e = &t->index[t->index_count++];
+        e->path = fossil_io_cstring_dup(name);
+        e->link = fossil_io_cstring_dup(cunwrap_or(link, ""));
+        e->header = pack_offset(&t->pack);
+        e->size = size;
+        e->mtime = (int64_t)st->st_mtime;
+        e->mode = (uint32_t)(st->st_mode & 07777);
+        e->type = type;
+        if (!cnotnull(e->path) || !cnotnull(e->link))
+            return false;
+    }
+    return tar_header(t, name, type, st, size, link);
+}
+
+// File contents, padded to the size in the header even if the file shrank meanwhile
+bool tar_contents(tar_writer_t *t, ccstring path, uint64_t size)
+{
+    t->digest[0] = t->digest[1] = 0;
+    fossil_io_filesys_file_t file;
+    bool opened = fossil_io_filesys_file_open(&file, path, "rb") == 0;
+    uint64_t left = size;
+    while (opened && left > 0)
+    {
+        size_t want = left < PACK_READ_BLOCK ? (size_t)left : PACK_READ_BLOCK;
+        size_t n = fossil_shark_throttle_read(&file, t->buf, want);
+        if (n == 0)
+            break;
+        if (cnotnull(t->inc))
+            inc_digest(t->digest, t->buf, n);
+        if (!pack_write_data(&t->pack, t->buf, n))
+        {
+            fossil_io_filesys_file_close(&file);
+            return false;
+        }
+        left -= n;
+    }
+    if (opened)
+        fossil_io_filesys_file_close(&file);
+    if (cnotnull(t->inc) && t->inc->slot != SIZE_MAX && left == 0)
+        memcpy(t->inc->entries[t->inc->slot].digest, t->digest, sizeof(t->digest));
+    if (left > 0)
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: %s changed while being archived; padded.{normal}\n", path);
+        t->errors++;
+        memset(t->buf, 0, PACK_READ_BLOCK);
+        while (left > 0)
+        {
+            size_t n = left < PACK_READ_BLOCK ? (size_t)left : PACK_READ_BLOCK;
+            if (!pack_write(&t->pack, t->buf, n))
+                return false;
+            left -= n;
+        }
+    }
+    uint8_t zero[TAR_RECORD] = {0};
+    return pack_write(&t->pack, zero, (TAR_RECORD - size % TAR_RECORD) % TAR_RECORD);
+}
+
+static int tar_name_cmp(const void *lhs, const void *rhs)
+{
+    return strcmp(*(const char *const *)lhs, *(const char *const *)rhs);
+}
+
+static bool tar_excluded(ccstring exclude, ccstring name, ccstring rel)
+{
+    return cnotnull(exclude) && (fnmatch(exclude, name, 0) == 0 || fnmatch(exclude, rel, FNM_PATHNAME) == 0);
+}
+
+// Archive the entries of dir (rel is its path inside the archive, "" at the top), in name order
+static bool tar_walk(tar_writer_t *t, ccstring dir, ccstring rel)
+{
+    DIR *d = opendir(dir);
+    if (!cnotnull(d))
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot read directory %s{normal}\n", dir);
+        t->errors++;
+        return true;
+    }
+    char **names = cnull;
+    size_t count = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != cnull)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (count == cap)
+        {
+            size_t grown_cap = cap ? cap * 2 : 64;
+            char **grown = fossil_sys_memory_realloc(names, grown_cap * sizeof(char *));
+            if (!cnotnull(grown))
+                break;
+            names = grown;
+            cap = grown_cap;
+        }
+        names[count++] = fossil_io_cstring_dup(ent->d_name);
+    }
+    closedir(d);
+    if (count > 1)
+        qsort(names, count, sizeof(char *), tar_name_cmp);
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        char path[FOSSIL_FILESYS_MAX_PATH], name[FOSSIL_FILESYS_MAX_PATH];
+        int n1 = snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        int n2 = rel[0] ? snprintf(name, sizeof(name), "%s/%s", rel, names[i])
+                        : snprintf(name, sizeof(name), "%s", names[i]);
+        struct stat st;
+        bool fits = n1 > 0 && (size_t)n1 < sizeof(path) && n2 > 0 && (size_t)n2 + 1 < sizeof(name);
+        if (ok && !fits)
+        {
+            fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Path too long, skipped: %s/%s{normal}\n", dir, names[i]);
+            t->errors++;
+        }
+        if (!ok || !fits || tar_excluded(t->exclude, names[i], name) || lstat(path, &st) != 0 ||
+            (st.st_dev == t->skip_dev && st.st_ino == t->skip_ino) ||
+            (cnotnull(t->inc) && st.st_dev == t->inc->dev && st.st_ino == t->inc->ino))
+        {
+            fossil_io_cstring_free(names[i]);
+            continue;
+        }
+        char type = S_ISDIR(st.st_mode) ? '5' : S_ISLNK(st.st_mode) ? '2' : S_ISREG(st.st_mode) ? '0' : '\0';
+        if (type == '\0')
+        {
+            fossil_io_cstring_free(names[i]);
+            continue; // devices, fifos and sockets are left out
+        }
+
+        // Unchanged since the manifest: left out, though directories are still walked
+        int same = cnotnull(t->inc) ? inc_check(t, path, name, type, &st) : 0;
+        ok = same >= 0;
+        if (ok && type == '5')
+        {
+            size_t len = strlen(name);
+            name[len] = '/';
+            name[len + 1] = '\0';
+            ok = same == 1 || tar_entry(t, name, '5', &st, 0, cnull);
+            name[len] = '\0';
+            ok = ok && tar_walk(t, path, name);
+        }
+        else if (ok && same == 0 && type == '2')
+        {
+            char target[FOSSIL_FILESYS_MAX_PATH];
+            ssize_t len = readlink(path, target, sizeof(target) - 1);
+            if (len >= 0)
+            {
+                target[len] = '\0';
+                ok = tar_entry(t, name, '2', &st, 0, target);
+            }
+        }
+        else if (ok && same == 0)
+        {
+            ok = tar_entry(t, name, '0', &st, (uint64_t)st.st_size, cnull) &&
+                 tar_contents(t, path, (uint64_t)st.st_size);
+        }
+        if (same == 0)
+            t->entries++;
+        fossil_io_cstring_free(names[i]);
+    }
+    if (cnotnull(names))
+        fossil_sys_memory_free(names);
+    return ok;
+}
+
+// Archive src into path as tar (PACK_NONE), tar.gz or tar.zst; a null path streams to stdout.
+// Entries are named relative to src, under src's own name unless src is ".".
+// With indexed set, <path>.idx is written alongside; otherwise an old one is removed.
+// With a manifest, only what changed since it is archived and the manifest moves on.
+int tar_create(ccstring path, ccstring src, int codec, int level, int threads, ccstring exclude,
+               bool indexed, const zstd_options_t *zo, ccstring manifest)
+{
+    uint64_t started = archive_clock_ns();
+    fossil_io_filesys_file_t *con = cnotnull(path) ? FOSSIL_STDOUT : FOSSIL_STDERR;
+    struct stat top;
+    if (stat(src, &top) != 0 || !S_ISDIR(top.st_mode))
+    {
+        fossil_io_fprintf(con, "{red}Error: %s is not a directory{normal}\n", src);
+        return 1;
+    }
+    inc_state_t inc;
+    memset(&inc, 0, sizeof(inc));
+    if (cnotnull(manifest) && !inc_load(manifest, &inc, con))
+        return 1;
+    if (cnotnull(manifest) && inc_chain_find(&inc, path) >= 0)
+    {
+        // Overwriting an archive of the chain would break every restore after it
+        fossil_io_fprintf(con, "{red}Error: %s is already in the chain of %s{normal}\n", path, manifest);
+        inc_free(&inc);
+        return 1;
+    }
+    fossil_io_filesys_file_t file;
+    fossil_io_filesys_file_t *out = FOSSIL_STDOUT;
+    if (cnotnull(path))
+    {
+        if (fossil_io_filesys_file_open(&file, path, "wb") != 0)
+        {
+            fossil_io_fprintf(con, "{red}Error: Cannot create archive %s{normal}\n", path);
+            inc_free(&inc);
+            return 1;
+        }
+        out = &file;
+    }
+    tar_writer_t t;
+    memset(&t, 0, sizeof(t));
+    t.inc = cnotnull(manifest) ? &inc : cnull;
+    t.exclude = cnotnull(exclude) && exclude[0] != '\0' ? exclude : cnull;
+    t.indexed = indexed && cnotnull(path);
+    struct stat self;
+    if (cnotnull(path) ? stat(path, &self) == 0 : fstat(STDOUT_FILENO, &self) == 0 && S_ISREG(self.st_mode))
+    {
+        t.skip_dev = self.st_dev;
+        t.skip_ino = self.st_ino;
+    }
+    t.buf = fossil_sys_memory_alloc(PACK_READ_BLOCK);
+
+    // Leading slashes, "./", "../" and trailing slashes do not belong in entry names
+    char prefix[FOSSIL_FILESYS_MAX_PATH];
+    ccstring name = src;
+    while (name[0] == '/' || (name[0] == '.' && name[1] == '/') || strncmp(name, "../", 3) == 0)
+        name += name[0] == '/' ? 1 : name[1] == '/' ? 2 : 3;
+    size_t prefix_len = strlen(name);
+    while (prefix_len > 0 && name[prefix_len - 1] == '/')
+        prefix_len--;
+    if ((prefix_len == 1 && name[0] == '.') || (prefix_len == 2 && name[0] == '.' && name[1] == '.'))
+        prefix_len = 0;
+    if (prefix_len + 2 > sizeof(prefix))
+        prefix_len = 0;
+    memcpy(prefix, name, prefix_len);
+    prefix[prefix_len] = '\0';
+    char top_name[FOSSIL_FILESYS_MAX_PATH];
+    snprintf(top_name, sizeof(top_name), "%s%s", prefix, prefix_len > 0 ? "/" : "");
+    t.top = top_name;
+
+    bool ok = cnotnull(t.buf) && pack_open(&t.pack, out, codec, level, threads, t.indexed) &&
+              pack_zstd_tune(&t.pack, zo);
+    if (ok)
+    {
+        uint8_t end[2 * TAR_RECORD] = {0};
+        int same = prefix_len > 0 && cnotnull(t.inc) ? inc_check(&t, src, prefix, '5', &top) : 0;
+        ok = same >= 0;
+        if (ok && prefix_len > 0 && same == 0)
+        {
+            ok = tar_entry(&t, top_name, '5', &top, 0, cnull);
+            t.entries++;
+        }
+        ok = ok && tar_walk(&t, src, prefix);
+        // Whatever the manifest had that the walk did not find again was deleted
+        if (cnotnull(t.inc))
+            ok = ok && inc_bury(&t, 0, inc.count, UINT64_MAX);
+        ok = ok && pack_write(&t.pack, end, sizeof(end));
+        ok = pack_close(&t.pack) && ok;
+    }
+    if (cnotnull(path))
+        fossil_io_filesys_file_close(&file);
+    else
+        ok = fossil_io_filesys_file_flush(out) == 0 && ok;
+    t.create_ns = archive_clock_ns() - started;
+
+    if (cnotnull(path))
+    {
+        char index_path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(index_path, sizeof(index_path), "%s" INDEX_SUFFIX, path);
+        if (ok && t.indexed && !tar_index_save(&t, path))
+        {
+            fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot write index %s{normal}\n", index_path);
+            t.errors++;
+        }
+        else if (!t.indexed && fossil_io_filesys_exists(index_path) == 1)
+        {
+            fossil_io_filesys_remove(index_path, false); // it describes the archive that was replaced
+        }
+    }
+    if (ok && cnotnull(t.inc) && !inc_save(&inc, manifest, path))
+    {
+        fossil_io_fprintf(con, "{red}Error: Cannot write manifest %s{normal}\n", manifest);
+        t.errors++;
+        ok = false;
+    }
+
+    if (ok && codec != PACK_NONE)
+        fossil_io_fprintf(con, "{cyan}Archived %zu entries: %llu bytes -> %llu bytes (%zu thread%s, %.1f MB/s, %.0f%% stored){normal}\n",
+                          t.entries, (unsigned long long)t.pack.in_total,
+                          (unsigned long long)t.pack.out_total, pack_threads(&t.pack),
+                          pack_threads(&t.pack) > 1 ? "s" : "", archive_rate(t.pack.in_total, t.create_ns),
+                          t.pack.in_total > 0 ? 100.0 * (double)t.pack.stored_total / (double)t.pack.in_total : 0.0);
+    else if (ok)
+        fossil_io_fprintf(con, "{cyan}Archived %zu entries: %llu bytes{normal}\n",
+                          t.entries, (unsigned long long)t.pack.out_total);
+    else
+        fossil_io_fprintf(con, "{red}Error: Failed writing archive %s{normal}\n", cunwrap_or(path, "to stdout"));
+    if (ok && cnotnull(inc.hdr))
+        fossil_io_fprintf(con, "{cyan}Incremental #%u of %s: %zu changed, %zu unchanged, %zu deleted{normal}\n",
+                          inc.hdr->archives, manifest, inc.changed, inc.unchanged, inc.deleted);
+    else if (ok && cnotnull(t.inc))
+        fossil_io_fprintf(con, "{cyan}Started the chain of %s with a full archive{normal}\n", manifest);
+    inc_free(&inc);
+    pack_free(&t.pack);
+    if (cnotnull(t.buf))
+        fossil_sys_memory_free(t.buf);
+    for (size_t i = 0; i < t.index_count; i++)
+    {
+        if (cnotnull(t.index[i].path))
+            fossil_io_cstring_free(t.index[i].path);
+        if (cnotnull(t.index[i].link))
+            fossil_io_cstring_free(t.index[i].link);
+    }
+    if (cnotnull(t.index))
+        fossil_sys_memory_free(t.index);
+    return ok ? 0 : 1;
+}
+
+/*
+ * Dictionary training for trees of many small, similar files (JSON, logs),
+ * where one file alone is too short for zstd to learn from. Samples are
+ * the heads of regular files, DICT_SAMPLE at most each and DICT_SAMPLES in
+ * all. The dictionary is written to its own file, which readers need too.
+ */
+#define DICT_CAPACITY (112 * 1024) // zstd's default dictionary size
+#define DICT_SAMPLE (128 * 1024)
+#define DICT_SAMPLES (16 * 1024 * 1024)
+#define DICT_MAX (16 * 1024 * 1024)
+
+typedef struct
+{
+    ccstring exclude;
+    uint8_t *data;
+    size_t len;
+    size_t *sizes;
+    size_t count;
+    size_t cap;
+} dict_samples_t;
+
+static void dict_collect(dict_samples_t *s, ccstring dir, ccstring rel)
+{
+    DIR *d = opendir(dir);
+    if (!cnotnull(d))
+        return;
+    struct dirent *ent;
+    while (s->len < DICT_SAMPLES && (ent = readdir(d)) != cnull)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char path[FOSSIL_FILESYS_MAX_PATH], name[FOSSIL_FILESYS_MAX_PATH];
+        int n1 = snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        int n2 = rel[0] ? snprintf(name, sizeof(name), "%s/%s", rel, ent->d_name)
+                        : snprintf(name, sizeof(name), "%s", ent->d_name);
+        struct stat st;
+        if (n1 < 0 || (size_t)n1 >= sizeof(path) || n2 < 0 || (size_t)n2 >= sizeof(name) ||
+            tar_excluded(s->exclude, ent->d_name, name) || lstat(path, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            dict_collect(s, path, name);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || st.st_size == 0)
+            continue;
+        if (s->count == s->cap)
+        {
+            size_t cap = s->cap ? s->cap * 2 : 256;
+            size_t *grown = fossil_sys_memory_realloc(s->sizes, cap * sizeof(size_t));
+            if (!cnotnull(grown))
+                break;
+            s->sizes = grown;
+            s->cap = cap;
+        }
+        size_t want = (uint64_t)st.st_size < DICT_SAMPLE ? (size_t)st.st_size : DICT_SAMPLE;
+        if (want > DICT_SAMPLES - s->len)
+            want = DICT_SAMPLES - s->len;
+        fossil_io_filesys_file_t file;
+        if (fossil_io_filesys_file_open(&file, path, "rb") != 0)
+            continue;
+        size_t n = fossil_shark_throttle_read(&file, s->data + s->len, want);
+        fossil_io_filesys_file_close(&file);
+        if (n > 0)
+        {
+            s->sizes[s->count++] = n;
+            s->len += n;
+        }
+    }
+    closedir(d);
+}
+
+// Train a dictionary on the files under src and write it to dict_path
+bool dict_train(ccstring src, ccstring exclude, ccstring dict_path, fossil_io_filesys_file_t *con)
+{
+    dict_samples_t s;
+    memset(&s, 0, sizeof(s));
+    s.exclude = cnotnull(exclude) && exclude[0] != '\0' ? exclude : cnull;
+    s.data = fossil_sys_memory_alloc(DICT_SAMPLES);
+    uint8_t *dict = fossil_sys_memory_alloc(DICT_CAPACITY);
+    bool ok = false;
+    if (cnotnull(s.data) && cnotnull(dict))
+    {
+        dict_collect(&s, src, "");
+        size_t len = ZDICT_trainFromBuffer(dict, DICT_CAPACITY, s.data, s.sizes, (unsigned)s.count);
+        if (ZDICT_isError(len))
+        {
+            fossil_io_fprintf(con, "{red}Error: Cannot train a dictionary on %zu files: %s{normal}\n", s.count,
+                              ZDICT_getErrorName(len));
+        }
+        else
+        {
+            fossil_io_filesys_file_t file;
+            ok = fossil_io_filesys_file_open(&file, dict_path, "wb") == 0;
+            if (ok)
+            {
+                ok = fossil_io_filesys_file_write(&file, dict, 1, len) == len;
+                fossil_io_filesys_file_close(&file);
+            }
+            if (ok)
+                fossil_io_fprintf(con, "{cyan}Trained dictionary %s: %zu bytes from %zu files{normal}\n", dict_path,
+                                  len, s.count);
+            else
+                fossil_io_fprintf(con, "{red}Error: Cannot write dictionary %s{normal}\n", dict_path);
+        }
+    }
+    else
+    {
+        fossil_io_fprintf(con, "{red}Error: Memory allocation failed.{normal}\n");
+    }
+    if (cnotnull(s.data))
+        fossil_sys_memory_free(s.data);
+    if (cnotnull(s.sizes))
+        fossil_sys_memory_free(s.sizes);
+    if (cnotnull(dict))
+        fossil_sys_memory_free(dict);
+    return ok;
+}
+
+// Read the dictionary file into zo; release it with fossil_sys_memory_free
+bool dict_load(ccstring dict_path, zstd_options_t *zo, fossil_io_filesys_file_t *con)
+{
+    struct stat st;
+    fossil_io_filesys_file_t file;
+    if (stat(dict_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > DICT_MAX ||
+        fossil_io_filesys_file_open(&file, dict_path, "rb") != 0)
+    {
+        fossil_io_fprintf(con, "{red}Error: Cannot read dictionary %s{normal}\n", dict_path);
+        return false;
+    }
+    zo->dict = fossil_sys_memory_alloc((size_t)st.st_size);
+    zo->dict_len = cnotnull(zo->dict) ? fossil_io_filesys_file_read(&file, zo->dict, 1, (size_t)st.st_size) : 0;
+    fossil_io_filesys_file_close(&file);
+    if (zo->dict_len != (size_t)st.st_size)
+    {
+        fossil_io_fprintf(con, "{red}Error: Cannot read dictionary %s{normal}\n", dict_path);
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,950 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/archive_internal.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <zstd_errors.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+static size_t unpack_raw(unpack_t *u, uint8_t *buf)
+{
+    if (cnotnull(u->file))
+        return fossil_shark_throttle_read(u->file, buf, UNPACK_CHUNK);
+    for (;;)
+    {
+        // Only the read may be cancelled, when the archive ends early on a pipe
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+        ssize_t n = read(STDIN_FILENO, buf, UNPACK_CHUNK);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        if (n >= 0)
+            return (size_t)n;
+        if (errno != EINTR)
+            return 0;
+    }
+}
+
+static void *unpack_feeder(void *arg)
+{
+    unpack_t *u = arg;
+    int state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    for (int i = 0;; i ^= 1)
+    {
+        pthread_mutex_lock(&u->lock);
+        while (u->full[i] && !u->stop)
+            pthread_cond_wait(&u->changed, &u->lock);
+        bool stop = u->stop;
+        pthread_mutex_unlock(&u->lock);
+        if (stop)
+            break;
+        size_t n = unpack_raw(u, u->buf[i]);
+        pthread_mutex_lock(&u->lock);
+        u->len[i] = n;
+        u->full[i] = true;
+        pthread_cond_broadcast(&u->changed);
+        pthread_mutex_unlock(&u->lock);
+        if (n == 0)
+            break;
+    }
+    return cnull;
+}
+
+// Next chunk of raw input; an empty chunk is the end of it
+static void unpack_next(unpack_t *u)
+{
+    if (!u->started)
+    {
+        u->in_len = unpack_raw(u, u->buf[0]);
+        u->in = u->buf[0];
+    }
+    else
+    {
+        pthread_mutex_lock(&u->lock);
+        if (u->held)
+        {
+            u->full[u->take] = false;
+            u->take ^= 1;
+            pthread_cond_broadcast(&u->changed);
+        }
+        while (!u->full[u->take])
+            pthread_cond_wait(&u->changed, &u->lock);
+        u->in = u->buf[u->take];
+        u->in_len = u->len[u->take];
+        u->held = true;
+        pthread_mutex_unlock(&u->lock);
+    }
+    u->in_total += u->in_len;
+    u->eof = u->in_len == 0;
+}
+
+static bool unpack_start(unpack_t *u, fossil_io_filesys_file_t *file)
+{
+    memset(u, 0, sizeof(*u));
+    u->file = file;
+    pthread_mutex_init(&u->lock, cnull);
+    pthread_cond_init(&u->changed, cnull);
+    u->buf[0] = fossil_sys_memory_alloc(UNPACK_CHUNK);
+    u->buf[1] = fossil_sys_memory_alloc(UNPACK_CHUNK);
+    if (!cnotnull(u->buf[0]) || !cnotnull(u->buf[1]))
+        return false;
+    u->started = pthread_create(&u->thread, cnull, unpack_feeder, u) == 0;
+    unpack_next(u);
+    return true;
+}
+
+static bool unpack_is_zstd(const uint8_t *h, size_t len)
+{
+    return len >= 4 && h[0] == 0x28 && h[1] == 0xb5 && h[2] == 0x2f && h[3] == 0xfd;
+}
+
+static bool unpack_zstd(unpack_t *u, const zstd_options_t *zo)
+{
+    u->zd = ZSTD_createDCtx();
+    return cnotnull(u->zd) &&
+           (zo->dict_len == 0 || !ZSTD_isError(ZSTD_DCtx_loadDictionary(u->zd, zo->dict, zo->dict_len)));
+}
+
+// file is null for stdin; false when memory ran out. Release with unpack_close either way.
+static bool unpack_open(unpack_t *u, fossil_io_filesys_file_t *file, const zstd_options_t *zo)
+{
+    if (!unpack_start(u, file))
+        return false;
+    if (unpack_is_zstd(u->in, u->in_len))
+        return unpack_zstd(u, zo);
+    u->gzip = u->in_len >= 2 && u->in[0] == 0x1f && u->in[1] == 0x8b;
+    if (u->gzip)
+    {
+        u->zs_ready = inflateInit2(&u->zs, 15 + 16) == Z_OK;
+        if (!u->zs_ready)
+            return false;
+    }
+    return true;
+}
+
+// Start reading file at offset, which is stream_at in the tar stream: a
+// checkpoint of a tar.gz or tar.zst, or a plain tar offset
+bool unpack_open_at(unpack_t *u, fossil_io_filesys_file_t *file, uint64_t offset,
+                    uint64_t stream_at, int codec, const zstd_options_t *zo)
+{
+    bool seeked = fossil_shark_file_seek(file, offset) == 0;
+    if (!unpack_start(u, file) || !seeked)
+        return false;
+    u->in_total += offset;
+    u->out_total = stream_at;
+    if (codec == PACK_ZSTD)
+        return unpack_zstd(u, zo); // checkpoints start frames of their own
+    u->gzip = codec == PACK_GZIP;
+    u->raw = u->gzip;
+    if (u->gzip)
+    {
+        u->zs_ready = inflateInit2(&u->zs, -15) == Z_OK;
+        if (!u->zs_ready)
+            return false;
+    }
+    return true;
+}
+
+// One step of zstd decoding; false when it made no progress
+static bool unpack_zstd_step(unpack_t *u, uint8_t *dst, size_t n, size_t *got)
+{
+    if (u->trailing || (u->member_end && u->in_len > 0 && !unpack_is_zstd(u->in, u->in_len) &&
+                        (u->in[0] & 0xf0) != 0x50)) // not a skippable frame either
+    {
+        u->trailing = true; // zero padding after the data, as some tools write
+        u->in_len = 0;
+        return false;
+    }
+    ZSTD_inBuffer in = {u->in, u->in_len, 0};
+    ZSTD_outBuffer out = {dst, n, *got};
+    size_t rc = ZSTD_decompressStream(u->zd, &out, &in);
+    bool progress = in.pos > 0 || out.pos > *got;
+    u->in += in.pos;
+    u->in_len -= in.pos;
+    *got = out.pos;
+    if (ZSTD_isError(rc))
+    {
+        u->failed = true;
+        u->wrong_dict = ZSTD_getErrorCode(rc) == ZSTD_error_dictionary_wrong;
+    }
+    else if (progress)
+        u->member_end = rc == 0; // otherwise rc only hints at the next frame's header
+    return progress;
+}
+
+// Up to n bytes of the tar stream; fewer only at its end or on a failure
+static size_t unpack_read(unpack_t *u, void *dst, size_t n)
+{
+    uint8_t *at = dst;
+    size_t got = 0;
+    while (got < n && !u->failed)
+    {
+        if (cnotnull(u->zd))
+        {
+            // Decoded data may still be buffered when the input is used up
+            if (!unpack_zstd_step(u, at, n, &got) && !u->failed)
+            {
+                if (u->eof)
+                    break;
+                unpack_next(u);
+            }
+            continue;
+        }
+        if (u->in_len == 0)
+        {
+            if (u->eof)
+                break;
+            unpack_next(u);
+            continue;
+        }
+        if (!u->gzip)
+        {
+            size_t take = u->in_len < n - got ? u->in_len : n - got;
+            memcpy(at + got, u->in, take);
+            u->in += take;
+            u->in_len -= take;
+            got += take;
+            continue;
+        }
+        if (u->trailing || (u->member_end && u->in[0] != 0x1f))
+        {
+            u->trailing = true; // zero padding after the data, as some tools write
+            u->in_len = 0;
+            continue;
+        }
+        if (u->member_end)
+        {
+            inflateReset(&u->zs); // concatenated members form one stream
+            u->member_end = false;
+        }
+        u->zs.next_in = (Bytef *)u->in;
+        u->zs.avail_in = (uInt)u->in_len;
+        u->zs.next_out = at + got;
+        u->zs.avail_out = (uInt)(n - got);
+        int rc = inflate(&u->zs, Z_NO_FLUSH);
+        u->in += u->in_len - u->zs.avail_in;
+        u->in_len = u->zs.avail_in;
+        got = n - u->zs.avail_out;
+        if (rc == Z_STREAM_END)
+        {
+            u->member_end = true;
+            u->trailing = u->raw; // the gzip trailer follows, not another member
+        }
+        else if (rc != Z_OK && rc != Z_BUF_ERROR)
+            u->failed = true;
+    }
+    if (u->eof && (u->gzip || cnotnull(u->zd)) && !u->member_end && !u->trailing)
+        u->failed = true; // cut off inside a member or frame
+    u->out_total += got;
+    return got;
+}
+
+// True when the input ended cleanly: consumes what follows the tar end marker
+static bool unpack_finish(unpack_t *u)
+{
+    uint8_t scratch[4096];
+    while (!u->failed && unpack_read(u, scratch, sizeof(scratch)) > 0)
+        ;
+    return !u->failed;
+}
+
+void unpack_close(unpack_t *u)
+{
+    if (u->started)
+    {
+        pthread_mutex_lock(&u->lock);
+        u->stop = true;
+        pthread_cond_broadcast(&u->changed);
+        pthread_mutex_unlock(&u->lock);
+        if (!u->eof && !cnotnull(u->file))
+            pthread_cancel(u->thread); // may be blocked on a pipe that never ends
+        pthread_join(u->thread, cnull);
+    }
+    if (u->zs_ready)
+        inflateEnd(&u->zs);
+    ZSTD_freeDCtx(u->zd);
+    pthread_mutex_destroy(&u->lock);
+    pthread_cond_destroy(&u->changed);
+    for (int i = 0; i < 2; i++)
+    {
+        if (cnotnull(u->buf[i]))
+            fossil_sys_memory_free(u->buf[i]);
+    }
+}
+
+// Octal, or base-256 when the top bit is set (GNU, for sizes over 8 GiB)
+static uint64_t tar_number(const uint8_t *field, size_t width)
+{
+    uint64_t value = 0;
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x3f;
+        for (size_t i = 1; i < width; i++)
+            value = (value << 8) | field[i];
+        return value;
+    }
+    size_t i = 0;
+    while (i < width && (field[i] == ' ' || field[i] == '\0'))
+        i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++)
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    return value;
+}
+
+static bool tar_checksum_ok(const uint8_t *h)
+{
+    uint64_t stored = tar_number(h + 148, 8);
+    uint64_t sum = 0;
+    int64_t signed_sum = 0;
+    for (size_t i = 0; i < TAR_RECORD; i++)
+    {
+        uint8_t c = i >= 148 && i < 156 ? ' ' : h[i];
+        sum += c;
+        signed_sum += (int8_t)c;
+    }
+    return stored == sum || (int64_t)stored == signed_sum;
+}
+
+// Copy a field that is NUL-terminated only when shorter than its width
+static size_t tar_field(char *out, const uint8_t *field, size_t width)
+{
+    size_t len = 0;
+    while (len < width && field[len] != '\0')
+        len++;
+    memcpy(out, field, len);
+    out[len] = '\0';
+    return len;
+}
+
+bool tar_skip(tar_reader_t *r, uint64_t size)
+{
+    while (size > 0)
+    {
+        size_t n = size < PACK_READ_BLOCK ? (size_t)size : PACK_READ_BLOCK;
+        if (unpack_read(&r->src, r->buf, n) != n)
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+static uint64_t tar_padding(uint64_t size)
+{
+    return (TAR_RECORD - size % TAR_RECORD) % TAR_RECORD;
+}
+
+// Make an entry name safe to create under the current directory: drop "./"
+// and trailing slashes, refuse absolute names and ".." components
+bool tar_safe_name(char *name)
+{
+    char *from = name;
+    while (from[0] == '.' && from[1] == '/')
+        from += 2;
+    memmove(name, from, strlen(from) + 1);
+    size_t len = strlen(name);
+    while (len > 0 && name[len - 1] == '/')
+        name[--len] = '\0';
+    if (len == 0 || name[0] == '/' || strcmp(name, ".") == 0)
+        return false;
+    for (const char *part = name; *part;)
+    {
+        size_t n = strcspn(part, "/");
+        if (n == 2 && part[0] == '.' && part[1] == '.')
+            return false;
+        part += n;
+        while (*part == '/')
+            part++;
+    }
+    return true;
+}
+
+// Check that no directory leading to name is a symlink, creating missing ones
+// when create is set, so a crafted archive cannot write outside the tree
+bool tar_parents(tar_reader_t *r, ccstring name, bool create)
+{
+    const char *slash = strrchr(name, '/');
+    if (!cnotnull(slash))
+        return true;
+    size_t len = (size_t)(slash - name);
+    if (strncmp(r->parent, name, len) == 0 && r->parent[len] == '\0')
+        return true;
+    char path[FOSSIL_FILESYS_MAX_PATH];
+    memcpy(path, name, len);
+    path[len] = '\0';
+    for (char *at = path;;)
+    {
+        char *next = strchr(at, '/');
+        if (cnotnull(next))
+            *next = '\0';
+        struct stat st;
+        if (lstat(path, &st) != 0)
+        {
+            if (!create || errno != ENOENT || mkdir(path, 0777) != 0)
+                return false;
+        }
+        else if (!S_ISDIR(st.st_mode))
+        {
+            return false;
+        }
+        if (!cnotnull(next))
+            break;
+        *next = '/';
+        at = next + 1;
+    }
+    memcpy(r->parent, path, len + 1);
+    return true;
+}
+
+static void tar_set_mtime(ccstring path, time_t mtime)
+{
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static bool tar_remember_dir(tar_reader_t *r, ccstring path, mode_t mode, time_t mtime)
+{
+    if (r->dir_count == r->dir_cap)
+    {
+        size_t cap = r->dir_cap ? r->dir_cap * 2 : 64;
+        struct tar_dir *grown = fossil_sys_memory_realloc(r->dirs, cap * sizeof(*grown));
+        if (!cnotnull(grown))
+            return false;
+        r->dirs = grown;
+        r->dir_cap = cap;
+    }
+    r->dirs[r->dir_count].path = fossil_io_cstring_dup(path);
+    r->dirs[r->dir_count].mode = mode;
+    r->dirs[r->dir_count].mtime = mtime;
+    r->dir_count++;
+    return true;
+}
+
+// Member data into a fresh file; false only when the archive itself could not be read
+static bool tar_write_file(tar_reader_t *r, ccstring name, uint64_t size, mode_t mode, time_t mtime)
+{
+    // Reserving the blocks up front keeps a large member in few extents and
+    // lets parallel writers fill files without growing them piece by piece
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0666);
+    bool written = fd >= 0;
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    if (written && size > 0 && fallocate(fd, 0, 0, (off_t)size) != 0 && errno == ENOSPC)
+        written = false;
+#endif
+    uint64_t left = size;
+    while (left > 0)
+    {
+        size_t n = left < PACK_READ_BLOCK ? (size_t)left : PACK_READ_BLOCK;
+        if (unpack_read(&r->src, r->buf, n) != n)
+            break;
+        if (written && fossil_shark_throttle_write_fd(fd, r->buf, n) != n)
+            written = false;
+        left -= n;
+    }
+    if (written && left == 0)
+    {
+        struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+        fchmod(fd, mode & 0777 & ~r->umask);
+        futimens(fd, times);
+    }
+    if (fd >= 0 && close(fd) != 0)
+        written = false;
+    if (left > 0)
+        return false;
+    if (!written)
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot write %s{normal}\n", name);
+        r->errors++;
+    }
+    return true;
+}
+
+// Create one member under the current directory. Problems with a single
+// member are warnings; false means the archive cannot be read any further.
+bool tar_extract_entry(tar_reader_t *r, char type, char *name, char *target,
+                       uint64_t size, mode_t mode, time_t mtime)
+{
+    ccstring problem = cnull;
+    struct stat st;
+    if (!tar_safe_name(name) || (type == '1' && !tar_safe_name(target)))
+        problem = "Unsafe path";
+    else if (!tar_parents(r, name, true) || (type == '1' && !tar_parents(r, target, false)))
+        problem = "Path leads through a symlink or non-directory";
+    else if (type != '5' && lstat(name, &st) == 0 && S_ISDIR(st.st_mode))
+        problem = "A directory is in the way of";
+    else if (type != '0' && type != '7' && type != '5' && type != '2' && type != '1')
+        problem = "Unsupported entry type for";
+
+    if (cnotnull(problem))
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: %s, skipped: %s{normal}\n", problem, name);
+        r->errors++;
+        return tar_skip(r, size + tar_padding(size));
+    }
+
+    bool ok = true;
+    if (type == '5')
+    {
+        bool exists = lstat(name, &st) == 0;
+        if (exists && !S_ISDIR(st.st_mode))
+            exists = unlink(name) != 0;
+        // Owner access until the end, when the archived mode is applied
+        if ((!exists && mkdir(name, 0700) != 0) || !tar_remember_dir(r, name, mode, mtime))
+            ok = false;
+    }
+    else
+    {
+        unlink(name); // never write through a symlink that is already there
+        if (type == '2')
+        {
+            r->parent[0] = '\0'; // the new link may shadow a checked directory
+            ok = symlink(target, name) == 0;
+            if (ok)
+                tar_set_mtime(name, mtime);
+        }
+        else if (type == '1')
+        {
+            ok = link(target, name) == 0;
+        }
+        else
+        {
+            return tar_write_file(r, name, size, mode, mtime) && tar_skip(r, tar_padding(size));
+        }
+    }
+    if (!ok)
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot create %s{normal}\n", name);
+        r->errors++;
+    }
+    return tar_skip(r, size + tar_padding(size));
+}
+
+void tar_list_entry(tar_reader_t *r, char type, ccstring name, ccstring target,
+                    uint64_t size, mode_t mode, time_t mtime)
+{
+    static const char rwx[] = "rwxrwxrwx";
+    char perms[11];
+    perms[0] = type == '5' ? 'd' : type == '2' ? 'l' : type == '1' ? 'h' : '-';
+    for (int i = 0; i < 9; i++)
+        perms[1 + i] = (mode & (0400u >> i)) ? rwx[i] : '-';
+    perms[10] = '\0';
+    char when[32];
+    struct tm tm;
+    if (localtime_r(&mtime, &tm) == cnull || strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm) == 0)
+        snprintf(when, sizeof(when), "%lld", (long long)mtime);
+    fossil_io_fprintf(r->con, "%s %12llu %s %s%s%s\n", perms, (unsigned long long)size, when, name,
+                      type == '2' ? " -> " : type == '1' ? " link to " : "",
+                      type == '2' || type == '1' ? target : "");
+}
+
+// Whether an entry name is the member asked for or lies under it
+bool tar_member_match(const tar_reader_t *r, ccstring name)
+{
+    if (!cnotnull(r->member))
+        return true;
+    while (name[0] == '.' && name[1] == '/')
+        name += 2;
+    return strncmp(name, r->member, r->member_len) == 0 &&
+           (name[r->member_len] == '\0' || name[r->member_len] == '/');
+}
+
+// A tombstone member of an incremental archive: the names in it, deepest
+// first, are removed (or listed as deleted)
+static bool tar_tombstones(tar_reader_t *r, uint64_t size)
+{
+    char *names = size < INC_TOMBSTONES_MAX ? fossil_sys_memory_alloc((size_t)size + 1) : cnull;
+    if (!cnotnull(names))
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Tombstones too large, skipped{normal}\n");
+        r->errors++;
+        return tar_skip(r, size + tar_padding(size));
+    }
+    bool ok = unpack_read(&r->src, names, (size_t)size) == size && tar_skip(r, tar_padding(size));
+    names[ok ? size : 0] = '\0';
+    for (size_t at = 0; ok && at < size; at += strlen(names + at) + 1)
+    {
+        char name[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(name, sizeof(name), "%s", names + at);
+        if (!tar_safe_name(name) || !tar_member_match(r, name))
+            continue;
+        struct stat st;
+        if (r->list)
+        {
+            fossil_io_fprintf(r->con, "%-10s %12s %16s %s\n", "deleted", "", "", name);
+            r->deleted++;
+        }
+        else if (tar_parents(r, name, false) && lstat(name, &st) == 0)
+        {
+            // Never through a symlink; what is already gone needs nothing
+            if ((S_ISDIR(st.st_mode) ? rmdir(name) : unlink(name)) == 0)
+            {
+                r->deleted++;
+            }
+            else
+            {
+                fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot delete %s{normal}\n", name);
+                r->errors++;
+            }
+        }
+    }
+    r->parent[0] = '\0'; // a checked directory may be gone
+    fossil_sys_memory_free(names);
+    return ok;
+}
+
+// Overrides carried by pax 'x' and GNU 'L'/'K' headers for the next entry
+typedef struct
+{
+    char path[FOSSIL_FILESYS_MAX_PATH];
+    char link[FOSSIL_FILESYS_MAX_PATH];
+    uint64_t size;
+    int64_t mtime;
+    bool has_size;
+    bool has_mtime;
+    bool too_long;
+} tar_meta_t;
+
+static void tar_meta_value(tar_meta_t *m, char *out, ccstring value, size_t len)
+{
+    if (len >= FOSSIL_FILESYS_MAX_PATH)
+    {
+        m->too_long = true;
+        return;
+    }
+    memcpy(out, value, len);
+    out[len] = '\0';
+}
+
+// Parse "len key=value\n" records
+static void tar_pax_parse(tar_meta_t *m, const char *data, size_t len)
+{
+    size_t at = 0;
+    while (at < len)
+    {
+        size_t rec = 0, i = at;
+        while (i < len && data[i] >= '0' && data[i] <= '9')
+            rec = rec * 10 + (size_t)(data[i++] - '0');
+        if (rec == 0 || at + rec > len || i >= len || data[i] != ' ' || data[at + rec - 1] != '\n')
+            return;
+        const char *key = data + i + 1;
+        const char *end = data + at + rec - 1;
+        const char *eq = memchr(key, '=', (size_t)(end - key));
+        if (cnotnull(eq))
+        {
+            size_t key_len = (size_t)(eq - key);
+            const char *value = eq + 1;
+            size_t value_len = (size_t)(end - value);
+            char num[32];
+            size_t num_len = value_len < sizeof(num) - 1 ? value_len : sizeof(num) - 1;
+            memcpy(num, value, num_len);
+            num[num_len] = '\0';
+            if (key_len == 4 && memcmp(key, "path", 4) == 0)
+                tar_meta_value(m, m->path, value, value_len);
+            else if (key_len == 8 && memcmp(key, "linkpath", 8) == 0)
+                tar_meta_value(m, m->link, value, value_len);
+            else if (key_len == 4 && memcmp(key, "size", 4) == 0)
+            {
+                m->size = strtoull(num, cnull, 10);
+                m->has_size = true;
+            }
+            else if (key_len == 5 && memcmp(key, "mtime", 5) == 0)
+            {
+                m->mtime = strtoll(num, cnull, 10);
+                m->has_mtime = true;
+            }
+        }
+        at += rec;
+    }
+}
+
+// List or extract the entry at the current position, with any headers in
+// front of it. Returns 1 for an entry, 0 at the end of the archive and -1
+// when it is corrupt or cut short.
+int tar_read_entry(tar_reader_t *r)
+{
+    tar_meta_t meta;
+    memset(&meta, 0, sizeof(meta));
+    uint8_t h[TAR_RECORD];
+    for (;;)
+    {
+        size_t n = unpack_read(&r->src, h, TAR_RECORD);
+        if (n == 0 && !r->src.failed)
+            return 0; // no end marker, but nothing is missing either
+        if (n != TAR_RECORD)
+            return -1;
+        bool zero = true;
+        for (size_t i = 0; i < TAR_RECORD && zero; i++)
+            zero = h[i] == 0;
+        if (zero)
+            return 0; // end of archive; what follows is drained by unpack_finish
+        if (!tar_checksum_ok(h))
+        {
+            fossil_io_fprintf(FOSSIL_STDERR, "{red}Error: Not a tar archive, or corrupt after %zu entries{normal}\n",
+                              r->entries);
+            return -1;
+        }
+
+        char type = h[156] ? (char)h[156] : '0';
+        uint64_t size = tar_number(h + 124, 12);
+        if (type == 'x' || type == 'L' || type == 'K')
+        {
+            if (size >= PACK_READ_BLOCK)
+            {
+                meta.too_long = true;
+                if (!tar_skip(r, size + tar_padding(size)))
+                    return -1;
+                continue;
+            }
+            if (unpack_read(&r->src, r->buf, (size_t)size) != size)
+                return -1;
+            char *data = (char *)r->buf;
+            size_t len = (size_t)size;
+            if (type == 'x')
+                tar_pax_parse(&meta, data, len);
+            else
+                tar_meta_value(&meta, type == 'L' ? meta.path : meta.link, data, strnlen(data, len));
+            if (!tar_skip(r, tar_padding(size)))
+                return -1;
+            continue;
+        }
+        if (type == 'g')
+        {
+            if (!tar_skip(r, size + tar_padding(size)))
+                return -1;
+            continue;
+        }
+
+        char name[FOSSIL_FILESYS_MAX_PATH], target[FOSSIL_FILESYS_MAX_PATH];
+        if (meta.path[0] != '\0')
+        {
+            snprintf(name, sizeof(name), "%s", meta.path);
+        }
+        else
+        {
+            char prefix[156], base[101];
+            bool ustar = memcmp(h + 257, "ustar", 6) == 0; // POSIX; old GNU has no prefix
+            tar_field(base, h, 100);
+            if (ustar && tar_field(prefix, h + 345, 155) > 0)
+                snprintf(name, sizeof(name), "%s/%s", prefix, base);
+            else
+                snprintf(name, sizeof(name), "%s", base);
+        }
+        if (meta.link[0] != '\0')
+            snprintf(target, sizeof(target), "%s", meta.link);
+        else
+            tar_field(target, h + 157, 100);
+        if (meta.has_size)
+            size = meta.size;
+        time_t mtime = meta.has_mtime ? (time_t)meta.mtime : (time_t)tar_number(h + 136, 12);
+        mode_t mode = (mode_t)tar_number(h + 100, 8);
+        if (type == INC_TOMBSTONE_TYPE)
+            return tar_tombstones(r, size) ? 1 : -1;
+        if (!tar_member_match(r, name))
+            return tar_skip(r, size + tar_padding(size)) ? 1 : -1;
+        if (type == '0' || type == '7')
+            r->total += size;
+
+        bool ok;
+        if (r->list)
+        {
+            tar_list_entry(r, type, name, target, size, mode, mtime);
+            ok = tar_skip(r, size + tar_padding(size));
+        }
+        else if (meta.too_long)
+        {
+            fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Name too long, skipped: %s{normal}\n", name);
+            r->errors++;
+            ok = tar_skip(r, size + tar_padding(size));
+        }
+        else
+        {
+            ok = tar_extract_entry(r, type, name, target, size, mode, mtime);
+        }
+        if (!ok)
+            return -1;
+        r->entries++;
+        return 1;
+    }
+}
+
+// Every entry from the current position on; false when the archive is corrupt or cut short
+static bool tar_read_all(tar_reader_t *r)
+{
+    int rc;
+    while ((rc = tar_read_entry(r)) > 0)
+        ;
+    return rc == 0;
+}
+
+// True when path starts like a tar, tar.gz or tar.zst stream this reader handles
+bool tar_sniff(ccstring path)
+{
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, path, "rb") != 0)
+        return false;
+    uint8_t h[TAR_RECORD];
+    size_t n = fossil_io_filesys_file_read(&file, h, 1, sizeof(h));
+    fossil_io_filesys_file_close(&file);
+    return (n >= 2 && h[0] == 0x1f && h[1] == 0x8b) || unpack_is_zstd(h, n) ||
+           (n == TAR_RECORD && tar_checksum_ok(h));
+}
+
+// One flush of everything written, at the end instead of per file
+static void tar_sync(void)
+{
+#if defined(__linux__) && defined(SYS_syncfs)
+    int fd = open(".", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        syscall(SYS_syncfs, fd);
+        close(fd);
+        return;
+    }
+#endif
+    sync();
+}
+
+// List or extract (into ".") a tar, tar.gz or tar.zst archive; a null path reads stdin.
+// member limits it to that entry and what lies under it; in a chained
+// archive it may be missing. Listings and single members of a file come
+// from its index when it has a current one, and so does extraction on
+// more than one thread (threads 0 for one per CPU).
+int tar_read(ccstring path, bool list, ccstring member, const zstd_options_t *zo, bool chained,
+             int threads, fossil_io_filesys_file_t *con)
+{
+    fossil_io_filesys_file_t file;
+    if (cnotnull(path) && fossil_io_filesys_file_open(&file, path, "rb") != 0)
+    {
+        fossil_io_fprintf(con, "{red}Error: Cannot open archive %s{normal}\n", path);
+        return 1;
+    }
+    tar_reader_t r;
+    memset(&r, 0, sizeof(r));
+    r.con = con;
+    r.zo = zo;
+    r.list = list;
+    r.umask = umask(0);
+    umask(r.umask);
+    r.buf = fossil_sys_memory_alloc(PACK_READ_BLOCK);
+
+    char wanted[FOSSIL_FILESYS_MAX_PATH];
+    if (cnotnull(member))
+    {
+        while (member[0] == '.' && member[1] == '/')
+            member += 2;
+        snprintf(wanted, sizeof(wanted), "%s", member);
+        r.member_len = strlen(wanted);
+        while (r.member_len > 0 && wanted[r.member_len - 1] == '/')
+            wanted[--r.member_len] = '\0';
+        r.member = wanted;
+    }
+
+    tar_index_t ix;
+    size_t workers = list ? 1 : pack_workers(threads);
+    bool indexed = cnotnull(path) && (list || cnotnull(member) || workers > 1) && tar_index_load(path, &ix);
+    bool opened = cnotnull(r.buf), ok = false;
+    uint64_t create_ns = indexed ? ix.hdr->create_ns : 0, started = archive_clock_ns();
+    if (opened && indexed && list)
+    {
+        tar_index_list(&r, &ix);
+        ok = true;
+    }
+    else if (opened && indexed && workers > 1)
+    {
+        ok = tar_index_fanout(&r, &ix, path, &file, workers);
+    }
+    else if (opened && indexed)
+    {
+        ok = tar_index_extract(&r, &ix, &file);
+    }
+    else if (opened)
+    {
+        opened = unpack_open(&r.src, cnotnull(path) ? &file : cnull, zo);
+        ok = opened && tar_read_all(&r) && unpack_finish(&r.src);
+        unpack_close(&r.src);
+    }
+    uint64_t elapsed = archive_clock_ns() - started;
+    if (indexed)
+        tar_index_free(&ix);
+    if (!opened)
+        fossil_io_fprintf(con, "{red}Error: Memory allocation failed.{normal}\n");
+    else if (!ok && r.src.wrong_dict)
+        fossil_io_fprintf(con, "{red}Error: Archive %s needs the zstd dictionary it was written with (--dict){normal}\n",
+                          cunwrap_or(path, "on stdin"));
+    else if (!ok)
+        fossil_io_fprintf(con, "{red}Error: Archive %s is corrupt or truncated{normal}\n", cunwrap_or(path, "on stdin"));
+    else if (cnotnull(member) && r.entries == 0 && r.deleted == 0 && !chained)
+    {
+        fossil_io_fprintf(con, "{red}Error: No entry %s in the archive{normal}\n", wanted);
+        ok = false;
+    }
+
+    // Deepest first, so setting a parent's mtime is not undone by its children
+    for (size_t i = r.dir_count; i-- > 0;)
+    {
+        chmod(r.dirs[i].path, r.dirs[i].mode & 0777 & ~r.umask);
+        tar_set_mtime(r.dirs[i].path, r.dirs[i].mtime);
+        fossil_io_cstring_free(r.dirs[i].path);
+    }
+    if (cnotnull(r.dirs))
+        fossil_sys_memory_free(r.dirs);
+    if (!list && r.entries > 0)
+        tar_sync();
+
+    if (ok && list)
+    {
+        fossil_io_fprintf(con, "\n{blue}Archive Statistics%s:{normal}\n", indexed ? " (from index)" : "");
+        fossil_io_fprintf(con, "Total entries: %zu\n", r.entries);
+        if (r.deleted > 0)
+            fossil_io_fprintf(con, "Deleted entries: %zu\n", r.deleted);
+        fossil_io_fprintf(con, "Total size: %llu bytes\n", (unsigned long long)r.total);
+        fossil_io_fprintf(con, "Compressed size: %llu bytes\n", (unsigned long long)r.src.in_total);
+        fossil_io_fprintf(con, "Compression ratio: %.2f%%\n",
+                          r.src.out_total > 0 ? 100.0 * (double)r.src.in_total / (double)r.src.out_total : 0.0);
+        if (create_ns > 0)
+            fossil_io_fprintf(con, "Compression throughput: %.1f MB/s\n", archive_rate(r.src.out_total, create_ns));
+        if (!indexed)
+            fossil_io_fprintf(con, "Decompression throughput: %.1f MB/s\n", archive_rate(r.src.out_total, elapsed));
+    }
+    else if (ok)
+    {
+        char deleted[48] = "";
+        if (r.deleted > 0)
+            snprintf(deleted, sizeof(deleted), ", %zu deleted", r.deleted);
+        fossil_io_fprintf(con, "{cyan}Extracted %zu entries: %llu bytes%s%s{normal}\n", r.entries,
+                          (unsigned long long)r.total, deleted, r.errors > 0 ? " (some skipped, see warnings)" : "");
+    }
+    if (cnotnull(path))
+        fossil_io_filesys_file_close(&file);
+    if (cnotnull(r.buf))
+        fossil_sys_memory_free(r.buf);
+    return ok && r.errors == 0 ? 0 : 1;
+}
+#endif
@@ -23,269 +23,1356 @@
  * -----------------------------------------------------------------------------
  */
 #include "fossil/code/compare.h"
+#include <ctype.h>
 
-// Helper: read line from file, return dynamically allocated string
-static cstring read_line(fossil_io_filesys_file_t *stream)
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define DIFF_READ_BLOCK (64 * 1024)
+
+/*
+ * One input file for the text diff. The whole file lives in `data` (the
+ * arena); lines are spans into it and carry an interned id so the diff
+ * core only ever compares integers.
+ */
+typedef struct
+{
+    cstring data;
+    size_t size;
+    ccstring *text;  // start of each line
+    uint32_t *len;   // length without the line terminator
+    uint32_t *id;    // interned line id
+    size_t count;
+} diff_file_t;
+
+typedef struct
+{
+    uint64_t hash;
+    uint32_t id;     // id + 1, 0 marks an empty slot
+    uint32_t len;
+} diff_slot_t;
+
+typedef struct
 {
-    size_t size = 128;
-    size_t len = 0;
-    cstring line = (cstring)fossil_sys_memory_alloc(size);
+    diff_slot_t *slots;
+    ccstring *first; // trimmed text of the first line seen with each id
+    size_t mask;
+    uint32_t next_id;
+    bool ignore_case;
+} diff_intern_t;
+
+// Read a whole file with block reads and split it into lines
+static int diff_load(ccstring path, diff_file_t *file)
+{
+    fossil_io_filesys_obj_t obj;
+    if (fossil_io_filesys_stat(path, &obj) != 0)
+        return 1;
+
+    fossil_io_filesys_file_t stream;
+    if (fossil_io_filesys_file_open(&stream, path, "rb") != 0)
+        return 1;
 
-    if (cunlikely(!cnotnull(line)))
+    size_t capacity = obj.size + 1;
+    file->data = (cstring)fossil_sys_memory_alloc(capacity);
+    if (!cnotnull(file->data))
     {
-        return cnull;
+        fossil_io_filesys_file_close(&stream);
+        return 1;
     }
 
-    int c;
-    while (1)
+    size_t n;
+    file->size = 0;
+    for (;;)
     {
-        unsigned char ch;
-        size_t n = fossil_io_filesys_file_read(stream, &ch, 1, 1);
-        if (n != 1)
-            break;
-        c = ch;
-        if (len + 1 >= size)
+        if (capacity - file->size <= 1)
         {
-            size *= 2;
-            cstring new_line = (cstring)fossil_sys_memory_realloc(line, size);
-            if (cunlikely(!cnotnull(new_line)))
+            // File grew after stat; keep reading
+            cstring grown = (cstring)fossil_sys_memory_realloc(file->data, capacity * 2);
+            if (!cnotnull(grown))
             {
-                fossil_sys_memory_free(line);
-                return cnull;
+                fossil_io_filesys_file_close(&stream);
+                return 1;
             }
-            line = new_line;
+            file->data = grown;
+            capacity *= 2;
         }
-        line[len++] = (char)c;
-        if (c == '\n')
+        size_t want = capacity - file->size - 1;
+        if (want > DIFF_READ_BLOCK)
+            want = DIFF_READ_BLOCK;
+        n = fossil_io_filesys_file_read(&stream, file->data + file->size, 1, want);
+        if (n == 0)
             break;
+        file->size += n;
     }
+    fossil_io_filesys_file_close(&stream);
+    file->data[file->size] = cterm;
+
+    size_t lines = 0;
+    for (ccstring p = file->data, end = file->data + file->size;
+         p < end && (p = memchr(p, '\n', (size_t)(end - p))) != cnull; p++)
+        lines++;
+    if (file->size > 0 && file->data[file->size - 1] != '\n')
+        lines++;
+
+    file->text = (ccstring *)fossil_sys_memory_alloc((lines + 1) * sizeof(ccstring));
+    file->len = (uint32_t *)fossil_sys_memory_alloc((lines + 1) * sizeof(uint32_t));
+    file->id = (uint32_t *)fossil_sys_memory_alloc((lines + 1) * sizeof(uint32_t));
+    if (!cnotnull(file->text) || !cnotnull(file->len) || !cnotnull(file->id))
+        return 1;
 
-    if (len == 0)
+    file->count = 0;
+    ccstring p = file->data, end = file->data + file->size;
+    while (p < end)
     {
-        fossil_sys_memory_free(line);
-        return cnull;
+        ccstring nl = memchr(p, '\n', (size_t)(end - p));
+        ccstring stop = cnotnull(nl) ? nl : end;
+        ccstring eol = stop;
+        if (eol > p && eol[-1] == '\r')
+            eol--;
+        file->text[file->count] = p;
+        file->len[file->count] = (uint32_t)(eol - p);
+        file->count++;
+        p = stop + 1;
     }
-    line[len] = cterm;
+    return 0;
+}
 
-    // Trim whitespace from the line
-    fossil_io_trim(line);
+static void diff_free(diff_file_t *file)
+{
+    if (cnotnull(file->data))
+        fossil_sys_memory_free(file->data);
+    if (cnotnull(file->text))
+        fossil_sys_memory_free((void *)file->text);
+    if (cnotnull(file->len))
+        fossil_sys_memory_free(file->len);
+    if (cnotnull(file->id))
+        fossil_sys_memory_free(file->id);
+}
 
-    return line;
+// Lines compare with surrounding whitespace trimmed, as the old reader did
+static void diff_trim(ccstring *text, uint32_t *len)
+{
+    ccstring t = *text;
+    uint32_t n = *len;
+    while (n > 0 && isspace((unsigned char)t[0]))
+    {
+        t++;
+        n--;
+    }
+    while (n > 0 && isspace((unsigned char)t[n - 1]))
+        n--;
+    *text = t;
+    *len = n;
 }
 
-// Helper: compare lines with optional case-insensitivity
-static bool line_equal(ccstring a, ccstring b, bool ignore_case)
+static uint64_t diff_hash(ccstring text, uint32_t len, bool ignore_case)
 {
-    if (!cnotnull(a) || !cnotnull(b))
-        return false;
+    const uint64_t k = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * k;
+    uint32_t i = 0;
 
     if (!ignore_case)
-        return fossil_io_cstring_compare(a, b) == 0;
-    return fossil_io_cstring_case_compare(a, b) == 0;
+    {
+        // Eight bytes per step; lines are hashed once so this dominates
+        for (; i + 8 <= len; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, text + i, sizeof(w));
+            h = (h ^ w) * k;
+            h ^= h >> 29;
+        }
+    }
+    for (; i < len; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (ignore_case)
+            c = (unsigned char)tolower(c);
+        h = (h ^ c) * k;
+        h ^= h >> 29;
+    }
+
+    // Final avalanche so the low bits can index the table directly
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
 }
 
-// Helper: check if file is regular file (cross-platform)
-static bool is_regular_file(ccstring path)
+static bool diff_span_equal(ccstring a, ccstring b, uint32_t len, bool ignore_case)
 {
-    fossil_io_filesys_obj_t obj;
-    if (fossil_io_filesys_stat(path, &obj) != 0)
+    if (!ignore_case)
+        return memcmp(a, b, len) == 0;
+    for (uint32_t i = 0; i < len; i++)
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return false;
+    return true;
+}
+
+// Assign every line an id; equal lines (after trimming/case folding) share one
+static void diff_intern(diff_intern_t *table, diff_file_t *file)
+{
+    for (size_t i = 0; i < file->count; i++)
+    {
+        ccstring text = file->text[i];
+        uint32_t len = file->len[i];
+        diff_trim(&text, &len);
+
+        uint64_t h = diff_hash(text, len, table->ignore_case);
+        size_t slot = (size_t)h & table->mask;
+        for (;;)
+        {
+            diff_slot_t *s = &table->slots[slot];
+            if (s->id == 0)
+            {
+                s->hash = h;
+                s->id = ++table->next_id;
+                s->len = len;
+                table->first[s->id - 1] = text;
+                file->id[i] = s->id - 1;
+                break;
+            }
+            if (s->hash == h && s->len == len &&
+                diff_span_equal(table->first[s->id - 1], text, len, table->ignore_case))
+            {
+                file->id[i] = s->id - 1;
+                break;
+            }
+            slot = (slot + 1) & table->mask;
+        }
+    }
+}
+
+/*
+ * Myers' O(ND) difference algorithm, linear-space variant: find the middle
+ * snake of the shortest edit script from both ends and recurse on the two
+ * halves. When the search gets too expensive, split at the furthest
+ * reaching diagonal instead (the heuristic GNU diff uses), so pathological
+ * inputs stay near-linear at the price of a slightly larger diff.
+ */
+typedef struct
+{
+    const uint32_t *xv, *yv;
+    bool *xchg, *ychg;
+    ptrdiff_t *fd, *bd;
+    ptrdiff_t too_expensive;
+} diff_ctx_t;
+
+typedef struct
+{
+    ptrdiff_t xmid, ymid;
+    bool lo_minimal, hi_minimal;
+} diff_partition_t;
+
+static void diff_middle_snake(diff_ctx_t *ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+                              ptrdiff_t yoff, ptrdiff_t ylim, bool find_minimal,
+                              diff_partition_t *part)
+{
+    ptrdiff_t *const fd = ctx->fd;
+    ptrdiff_t *const bd = ctx->bd;
+    const uint32_t *xv = ctx->xv, *yv = ctx->yv;
+    const ptrdiff_t dmin = xoff - ylim, dmax = xlim - yoff;
+    const ptrdiff_t fmid = xoff - yoff, bmid = xlim - ylim;
+    ptrdiff_t fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    const bool odd = (fmid - bmid) & 1;
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+
+    for (ptrdiff_t c = 1;; ++c)
+    {
+        ptrdiff_t d;
+
+        // Extend the forward search by one edit
+        if (fmin > dmin)
+            fd[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < dmax)
+            fd[++fmax + 1] = -1;
+        else
+            --fmax;
+        for (d = fmax; d >= fmin; d -= 2)
+        {
+            ptrdiff_t tlo = fd[d - 1], thi = fd[d + 1];
+            ptrdiff_t x = tlo >= thi ? tlo + 1 : thi;
+            ptrdiff_t y = x - d;
+            while (x < xlim && y < ylim && xv[x] == yv[y])
+            {
+                x++;
+                y++;
+            }
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x)
+            {
+                part->xmid = x;
+                part->ymid = y;
+                part->lo_minimal = part->hi_minimal = true;
+                return;
+            }
+        }
+
+        // Extend the backward search by one edit
+        if (bmin > dmin)
+            bd[--bmin - 1] = PTRDIFF_MAX;
+        else
+            ++bmin;
+        if (bmax < dmax)
+            bd[++bmax + 1] = PTRDIFF_MAX;
+        else
+            --bmax;
+        for (d = bmax; d >= bmin; d -= 2)
+        {
+            ptrdiff_t tlo = bd[d - 1], thi = bd[d + 1];
+            ptrdiff_t x = tlo < thi ? tlo : thi - 1;
+            ptrdiff_t y = x - d;
+            while (xoff < x && yoff < y && xv[x - 1] == yv[y - 1])
+            {
+                x--;
+                y--;
+            }
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d])
+            {
+                part->xmid = x;
+                part->ymid = y;
+                part->lo_minimal = part->hi_minimal = true;
+                return;
+            }
+        }
+
+        if (find_minimal || c < ctx->too_expensive)
+            continue;
+
+        // Too expensive: take whichever end got furthest
+        ptrdiff_t fxybest = -1, fxbest = 0;
+        for (d = fmax; d >= fmin; d -= 2)
+        {
+            ptrdiff_t x = fd[d] < xlim ? fd[d] : xlim;
+            ptrdiff_t y = x - d;
+            if (ylim < y)
+            {
+                x = ylim + d;
+                y = ylim;
+            }
+            if (fxybest < x + y)
+            {
+                fxybest = x + y;
+                fxbest = x;
+            }
+        }
+
+        ptrdiff_t bxybest = PTRDIFF_MAX, bxbest = 0;
+        for (d = bmax; d >= bmin; d -= 2)
+        {
+            ptrdiff_t x = bd[d] > xoff ? bd[d] : xoff;
+            ptrdiff_t y = x - d;
+            if (y < yoff)
+            {
+                x = yoff + d;
+                y = yoff;
+            }
+            if (x + y < bxybest)
+            {
+                bxybest = x + y;
+                bxbest = x;
+            }
+        }
+
+        if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff))
+        {
+            part->xmid = fxbest;
+            part->ymid = fxybest - fxbest;
+            part->lo_minimal = true;
+            part->hi_minimal = false;
+        }
+        else
+        {
+            part->xmid = bxbest;
+            part->ymid = bxybest - bxbest;
+            part->lo_minimal = false;
+            part->hi_minimal = true;
+        }
+        return;
+    }
+}
+
+static void diff_compareseq(diff_ctx_t *ctx, ptrdiff_t xoff, ptrdiff_t xlim,
+                            ptrdiff_t yoff, ptrdiff_t ylim, bool find_minimal)
+{
+    for (;;)
+    {
+        const uint32_t *xv = ctx->xv, *yv = ctx->yv;
+
+        // Snakes at either end need no search
+        while (xoff < xlim && yoff < ylim && xv[xoff] == yv[yoff])
+        {
+            xoff++;
+            yoff++;
+        }
+        while (xoff < xlim && yoff < ylim && xv[xlim - 1] == yv[ylim - 1])
+        {
+            xlim--;
+            ylim--;
+        }
+
+        if (xoff == xlim)
+        {
+            while (yoff < ylim)
+                ctx->ychg[yoff++] = true;
+            return;
+        }
+        if (yoff == ylim)
+        {
+            while (xoff < xlim)
+                ctx->xchg[xoff++] = true;
+            return;
+        }
+
+        diff_partition_t part;
+        diff_middle_snake(ctx, xoff, xlim, yoff, ylim, find_minimal, &part);
+
+        // Recurse on the lower half, loop on the upper half
+        diff_compareseq(ctx, xoff, part.xmid, yoff, part.ymid, part.lo_minimal);
+        xoff = part.xmid;
+        yoff = part.ymid;
+        find_minimal = part.hi_minimal;
+    }
+}
+
+/*
+ * Mark changed lines in both files. Lines whose id never occurs in the
+ * other file are changed by definition and are discarded before the
+ * search, which keeps D small for logs with many unique lines.
+ */
+static int diff_mark_changes(const diff_file_t *a, const diff_file_t *b,
+                             uint32_t id_count, bool *achg, bool *bchg)
+{
+    int rc = 1;
+    uint8_t *in_a = (uint8_t *)fossil_sys_memory_calloc(id_count ? id_count : 1, 1);
+    uint8_t *in_b = (uint8_t *)fossil_sys_memory_calloc(id_count ? id_count : 1, 1);
+    uint32_t *xv = (uint32_t *)fossil_sys_memory_alloc((a->count + 1) * sizeof(uint32_t));
+    uint32_t *yv = (uint32_t *)fossil_sys_memory_alloc((b->count + 1) * sizeof(uint32_t));
+    size_t *xmap = (size_t *)fossil_sys_memory_alloc((a->count + 1) * sizeof(size_t));
+    size_t *ymap = (size_t *)fossil_sys_memory_alloc((b->count + 1) * sizeof(size_t));
+    bool *xchg = (bool *)fossil_sys_memory_calloc(a->count + 1, sizeof(bool));
+    bool *ychg = (bool *)fossil_sys_memory_calloc(b->count + 1, sizeof(bool));
+    size_t diags = a->count + b->count + 3;
+    ptrdiff_t *fd = (ptrdiff_t *)fossil_sys_memory_alloc(2 * diags * sizeof(ptrdiff_t));
+
+    if (!cnotnull(in_a) || !cnotnull(in_b) || !cnotnull(xv) || !cnotnull(yv) ||
+        !cnotnull(xmap) || !cnotnull(ymap) || !cnotnull(xchg) || !cnotnull(ychg) || !cnotnull(fd))
+        goto cleanup;
+
+    for (size_t i = 0; i < a->count; i++)
+        in_a[a->id[i]] = 1;
+    for (size_t i = 0; i < b->count; i++)
+        in_b[b->id[i]] = 1;
+
+    size_t nx = 0, ny = 0;
+    for (size_t i = 0; i < a->count; i++)
+    {
+        if (in_b[a->id[i]])
+        {
+            xv[nx] = a->id[i];
+            xmap[nx++] = i;
+        }
+        else
+            achg[i] = true;
+    }
+    for (size_t i = 0; i < b->count; i++)
+    {
+        if (in_a[b->id[i]])
+        {
+            yv[ny] = b->id[i];
+            ymap[ny++] = i;
+        }
+        else
+            bchg[i] = true;
+    }
+
+    diff_ctx_t ctx;
+    ctx.xv = xv;
+    ctx.yv = yv;
+    ctx.xchg = xchg;
+    ctx.ychg = ychg;
+    ctx.fd = fd + ny + 1;
+    ctx.bd = fd + diags + ny + 1;
+    ctx.too_expensive = 1;
+    for (size_t d = nx + ny + 3; d != 0; d >>= 2)
+        ctx.too_expensive <<= 1;
+    if (ctx.too_expensive < 4096)
+        ctx.too_expensive = 4096;
+
+    diff_compareseq(&ctx, 0, (ptrdiff_t)nx, 0, (ptrdiff_t)ny, false);
+
+    for (size_t i = 0; i < nx; i++)
+        if (xchg[i])
+            achg[xmap[i]] = true;
+    for (size_t i = 0; i < ny; i++)
+        if (ychg[i])
+            bchg[ymap[i]] = true;
+    rc = 0;
+
+cleanup:
+    if (cnotnull(in_a)) fossil_sys_memory_free(in_a);
+    if (cnotnull(in_b)) fossil_sys_memory_free(in_b);
+    if (cnotnull(xv)) fossil_sys_memory_free(xv);
+    if (cnotnull(yv)) fossil_sys_memory_free(yv);
+    if (cnotnull(xmap)) fossil_sys_memory_free(xmap);
+    if (cnotnull(ymap)) fossil_sys_memory_free(ymap);
+    if (cnotnull(xchg)) fossil_sys_memory_free(xchg);
+    if (cnotnull(ychg)) fossil_sys_memory_free(ychg);
+    if (cnotnull(fd)) fossil_sys_memory_free(fd);
+    return rc;
+}
+
+// Only the prefix and colours go through markup; file text is written as-is
+static void diff_print_range(ccstring prefix, const diff_file_t *file, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++)
+    {
+        fossil_io_printf("%s", prefix);
+        fwrite(file->text[i], 1, file->len[i], stdout);
+        fossil_io_printf("{normal}\n");
+    }
+}
+
+// Emit unified diff hunks; returns the number of hunks
+static int diff_print_hunks(ccstring path1, ccstring path2,
+                            const diff_file_t *a, const diff_file_t *b,
+                            const bool *achg, const bool *bchg, size_t context)
+{
+    int hunks = 0;
+    size_t i = 0, j = 0;
+
+    while (i < a->count || j < b->count)
+    {
+        if ((i >= a->count || !achg[i]) && (j >= b->count || !bchg[j]))
+        {
+            i++;
+            j++;
+            continue;
+        }
+
+        // Found a change; extend the hunk while the next change is near
+        size_t hi_a = i, hi_b = j;
+        for (;;)
+        {
+            while (hi_a < a->count && achg[hi_a])
+                hi_a++;
+            while (hi_b < b->count && bchg[hi_b])
+                hi_b++;
+
+            size_t na = hi_a, nb = hi_b, gap = 0;
+            while (na < a->count && nb < b->count && !achg[na] && !bchg[nb] && gap <= 2 * context)
+            {
+                na++;
+                nb++;
+                gap++;
+            }
+            bool more = (na < a->count && achg[na]) || (nb < b->count && bchg[nb]);
+            if (!more || gap > 2 * context)
+                break;
+            hi_a = na;
+            hi_b = nb;
+        }
+
+        size_t lo_a = i > context ? i - context : 0;
+        size_t lo_b = j - (i - lo_a);
+        size_t end_a = hi_a + context < a->count ? hi_a + context : a->count;
+        size_t end_b = hi_b + (end_a - hi_a);
+        if (end_b > b->count)
+            end_b = b->count;
+
+        if (hunks == 0)
+        {
+            fossil_io_printf("{bold}--- %s{normal}\n", path1);
+            fossil_io_printf("{bold}+++ %s{normal}\n", path2);
+        }
+
+        size_t len_a = end_a - lo_a, len_b = end_b - lo_b;
+        fossil_io_printf("{blue}@@ -%zu,%zu +%zu,%zu @@{normal}\n",
+                         len_a ? lo_a + 1 : lo_a, len_a,
+                         len_b ? lo_b + 1 : lo_b, len_b);
+
+        // Walk the hunk, printing each run of changes as -/+ blocks
+        size_t x = lo_a, y = lo_b;
+        while (x < end_a || y < end_b)
+        {
+            if ((x < end_a && achg[x]) || (y < end_b && bchg[y]))
+            {
+                size_t x0 = x, y0 = y;
+                while (x < end_a && achg[x])
+                    x++;
+                while (y < end_b && bchg[y])
+                    y++;
+                diff_print_range("{red}-", a, x0, x);
+                diff_print_range("{green}+", b, y0, y);
+            }
+            else
+            {
+                diff_print_range(" ", a, x, x + 1);
+                x++;
+                y++;
+            }
+        }
+
+        hunks++;
+        i = end_a;
+        j = end_b;
+    }
+    return hunks;
+}
+
+#define BIN_BLOCK_SIZE (1024 * 1024)
+
+// Tracks differing byte ranges; a range may span block boundaries
+typedef struct
+{
+    bool all;
+    bool open;
+    uint64_t start;
+    uint64_t count;
+} bin_ranges_t;
+
+static void bin_close_range(bin_ranges_t *r, uint64_t end)
+{
+    if (!r->open)
+        return;
+    fossil_io_printf("{cyan}Differs at bytes %llu-%llu (%llu bytes){normal}\n",
+                     (unsigned long long)r->start, (unsigned long long)(end - 1),
+                     (unsigned long long)(end - r->start));
+    r->open = false;
+    r->count++;
+}
+
+// Offset of the first position in [from, len) where the blocks (dis)agree
+static size_t bin_find(const uint8_t *a, const uint8_t *b, size_t from, size_t len, bool want_diff)
+{
+    size_t i = from;
+    while (i < len && i % sizeof(uint64_t) != 0 && ((a[i] != b[i]) != want_diff))
+        i++;
+    if (i < len && ((a[i] != b[i]) == want_diff))
+        return i;
+
+    // Word at a time until the word contains a position of interest
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        if (want_diff ? wa != wb : wa == wb)
+            break;
+        if (!want_diff)
+        {
+            // Need at least one equal byte, not a fully equal word
+            uint64_t x = wa ^ wb;
+            bool any_equal = false;
+            for (size_t k = 0; k < sizeof(uint64_t); k++)
+                if (((x >> (k * 8)) & 0xFF) == 0)
+                    any_equal = true;
+            if (any_equal)
+                break;
+        }
+    }
+    while (i < len && ((a[i] != b[i]) != want_diff))
+        i++;
+    return i;
+}
+
+/*
+ * Compare one block. memcmp decides whether the block differs at all;
+ * only a differing block is narrowed to exact offsets. Returns true when
+ * the caller should stop (first difference reported, --all not set).
+ */
+static bool bin_compare_block(const uint8_t *a, const uint8_t *b, size_t len,
+                              uint64_t base, bin_ranges_t *r)
+{
+    if (!r->open && memcmp(a, b, len) == 0)
         return false;
-    return obj.type == FOSSIL_FILESYS_TYPE_FILE;
+
+    size_t i = 0;
+    while (i < len)
+    {
+        if (!r->open)
+        {
+            i = bin_find(a, b, i, len, true);
+            if (i == len)
+                break;
+            if (!r->all)
+            {
+                fossil_io_printf("{cyan}Binary difference at byte %llu: %02x != %02x{normal}\n",
+                                 (unsigned long long)(base + i), a[i], b[i]);
+                r->count++;
+                return true;
+            }
+            r->open = true;
+            r->start = base + i;
+        }
+        i = bin_find(a, b, i, len, false);
+        if (i < len)
+            bin_close_range(r, base + i);
+    }
+    return false;
 }
 
-int fossil_shark_compare(ccstring path1, ccstring path2,
-                         bool text_diff, bool binary_diff,
-                         int context_lines, bool ignore_case)
+#ifndef _WIN32
+// Map a whole file read-only; returns NULL when mapping is not possible
+static const uint8_t *bin_map(ccstring path, size_t size)
 {
-    if (!cnotnull(path1) || !cnotnull(path2))
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return cnull;
+    void *map = mmap(cnull, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return cnull;
+#ifdef MADV_SEQUENTIAL
+    madvise(map, size, MADV_SEQUENTIAL);
+#endif
+    return (const uint8_t *)map;
+}
+#endif
+
+// Read until size bytes arrive or the file ends or fails; returns the count
+static size_t bin_read_full(fossil_io_filesys_file_t *file, uint8_t *buffer, size_t size)
+{
+    size_t got = 0;
+    while (got < size)
     {
-        fossil_io_printf("{red}Error: Two paths must be specified.{normal}\n");
+        size_t n = fossil_io_filesys_file_read(file, buffer + got, 1, size - got);
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+static int bin_compare(ccstring path1, ccstring path2, bool all_ranges)
+{
+    fossil_io_filesys_obj_t o1, o2;
+    if (fossil_io_filesys_stat(path1, &o1) != 0 || fossil_io_filesys_stat(path2, &o2) != 0)
+    {
+        fossil_io_printf("{red}Error: Failed to open files for binary comparison.{normal}\n");
         return 1;
     }
 
-    if (cunlikely(!is_regular_file(path1) || !is_regular_file(path2)))
+    // Different sizes already answer the question unless ranges were asked for
+    if (o1.size != o2.size && !all_ranges)
     {
-        fossil_io_printf("{red}Error: Failed to access files or not regular files.{normal}\n");
+        fossil_io_printf("{cyan}Binary files differ in size: %zu != %zu{normal}\n",
+                         (size_t)o1.size, (size_t)o2.size);
         return 1;
     }
 
-    if (binary_diff)
+    uint64_t common = o1.size < o2.size ? o1.size : o2.size;
+    bin_ranges_t ranges = {0};
+    ranges.all = all_ranges;
+    bool done = false;
+
+#ifndef _WIN32
+    const uint8_t *m1 = common ? bin_map(path1, o1.size) : cnull;
+    const uint8_t *m2 = common ? bin_map(path2, o2.size) : cnull;
+    if (cnotnull(m1) && cnotnull(m2))
     {
+        for (uint64_t off = 0; off < common && !done; off += BIN_BLOCK_SIZE)
+        {
+            size_t len = (size_t)(common - off < BIN_BLOCK_SIZE ? common - off : BIN_BLOCK_SIZE);
+            done = bin_compare_block(m1 + off, m2 + off, len, off, &ranges);
+        }
+        munmap((void *)m1, o1.size);
+        munmap((void *)m2, o2.size);
+        common = 0; // already compared
+    }
+    else
+    {
+        if (cnotnull(m1))
+            munmap((void *)m1, o1.size);
+        if (cnotnull(m2))
+            munmap((void *)m2, o2.size);
+    }
+#endif
+
+    if (common > 0)
+    {
+        // Fallback: block reads through the filesystem layer
         fossil_io_filesys_file_t f1, f2;
-        if (cunlikely(fossil_io_filesys_file_open(&f1, path1, "rb") != 0 ||
-                      fossil_io_filesys_file_open(&f2, path2, "rb") != 0))
+        if (cunlikely(fossil_io_filesys_file_open(&f1, path1, "rb") != 0))
+        {
+            fossil_io_printf("{red}Error: Failed to open files for binary comparison.{normal}\n");
+            return 1;
+        }
+        if (cunlikely(fossil_io_filesys_file_open(&f2, path2, "rb") != 0))
         {
+            fossil_io_filesys_file_close(&f1);
             fossil_io_printf("{red}Error: Failed to open files for binary comparison.{normal}\n");
             return 1;
         }
 
-        int diff_found = 0;
-        int c1, c2;
-        size_t pos = 0;
-        unsigned char b1, b2;
-        while (fossil_io_filesys_file_read(&f1, &b1, 1, 1) == 1 &&
-               fossil_io_filesys_file_read(&f2, &b2, 1, 1) == 1)
+        uint8_t *b1 = (uint8_t *)fossil_sys_memory_alloc(BIN_BLOCK_SIZE);
+        uint8_t *b2 = (uint8_t *)fossil_sys_memory_alloc(BIN_BLOCK_SIZE);
+        int rc = 0;
+        if (!cnotnull(b1) || !cnotnull(b2))
+            rc = 1;
+
+        for (uint64_t off = 0; rc == 0 && off < common && !done;)
         {
-            c1 = b1;
-            c2 = b2;
-            if (c1 != c2)
+            // Both sides must hold the same span before it is compared
+            size_t want = (size_t)(common - off < BIN_BLOCK_SIZE ? common - off : BIN_BLOCK_SIZE);
+            if (bin_read_full(&f1, b1, want) != want || bin_read_full(&f2, b2, want) != want)
             {
-                fossil_io_printf("{cyan}Binary difference at byte %zu: %02x != %02x{normal}\n", pos, c1 & 0xFF, c2 & 0xFF);
-                diff_found = 1;
+                fossil_io_printf("{red}Error: Read failed during binary comparison at offset %llu.{normal}\n",
+                                 (unsigned long long)off);
+                rc = 1;
                 break;
             }
-            pos++;
+            done = bin_compare_block(b1, b2, want, off, &ranges);
+            off += want;
         }
-        // Check for length difference
-        if (!diff_found &&
-            (fossil_io_filesys_file_read(&f1, &b1, 1, 1) == 1 ||
-             fossil_io_filesys_file_read(&f2, &b2, 1, 1) == 1))
-            diff_found = 1;
+
+        if (cnotnull(b1))
+            fossil_sys_memory_free(b1);
+        if (cnotnull(b2))
+            fossil_sys_memory_free(b2);
         fossil_io_filesys_file_close(&f1);
         fossil_io_filesys_file_close(&f2);
-        return diff_found;
+        if (rc != 0)
+            return rc;
     }
 
-    if (text_diff)
+    bin_close_range(&ranges, o1.size < o2.size ? o1.size : o2.size);
+
+    if (o1.size != o2.size)
     {
-        fossil_io_filesys_file_t f1, f2;
-        if (cunlikely(fossil_io_filesys_file_open(&f1, path1, "r") != 0 ||
-                      fossil_io_filesys_file_open(&f2, path2, "r") != 0))
+        fossil_io_printf("{cyan}Binary files differ in size: %zu != %zu{normal}\n",
+                         (size_t)o1.size, (size_t)o2.size);
+    }
+
+    if (all_ranges)
+        fossil_io_printf("{blue}%llu differing range(s){normal}\n", (unsigned long long)ranges.count);
+
+    return (ranges.count > 0 || o1.size != o2.size) ? 1 : 0;
+}
+
+// Helper: check if file is regular file (cross-platform)
+static bool is_regular_file(ccstring path)
+{
+    fossil_io_filesys_obj_t obj;
+    if (fossil_io_filesys_stat(path, &obj) != 0)
+        return false;
+    return obj.type == FOSSIL_FILESYS_TYPE_FILE;
+}
+
+#define TREE_LIST_INITIAL 256
+#define TREE_MAX_WORKERS 8
+
+/*
+ * Recursive compare. Both listings are sorted by name and merge-joined,
+ * so each side is walked exactly once. Same-size file pairs are queued
+ * to a small worker pool that verifies them while the walk goes on; every
+ * classification, including each verified pair, is streamed as soon as it
+ * is known.
+ */
+typedef struct
+{
+    cstring rel;
+    cstring a;
+    cstring b;
+    bool meta_changed;
+} tree_job_t;
+
+typedef struct
+{
+    tree_job_t *jobs;
+    size_t count;
+    size_t cap;
+    size_t next;
+    bool walking;
+    uint64_t added;
+    uint64_t removed;
+    uint64_t type_changed;
+    uint64_t meta_changed;
+    uint64_t content_changed;
+    uint64_t errors;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+#endif
+} tree_ctx_t;
+
+static void tree_lock(tree_ctx_t *ctx)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&ctx->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+static void tree_unlock(tree_ctx_t *ctx)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&ctx->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+// Called with the lock held; blocks until a job is queued or the walk ends
+static void tree_wait(tree_ctx_t *ctx)
+{
+#ifndef _WIN32
+    while (ctx->next == ctx->count && ctx->walking)
+        pthread_cond_wait(&ctx->ready, &ctx->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+static void tree_wake(tree_ctx_t *ctx)
+{
+#ifndef _WIN32
+    pthread_cond_broadcast(&ctx->ready);
+#else
+    (void)ctx;
+#endif
+}
+
+static ccstring tree_type_name(int type)
+{
+    switch (type)
+    {
+    case FOSSIL_FILESYS_TYPE_FILE:
+        return "file";
+    case FOSSIL_FILESYS_TYPE_DIR:
+        return "dir";
+    case FOSSIL_FILESYS_TYPE_LINK:
+        return "link";
+    default:
+        return "other";
+    }
+}
+
+static ccstring tree_base(ccstring path)
+{
+    ccstring slash = strrchr(path, '/');
+#ifdef _WIN32
+    ccstring back = strrchr(path, '\\');
+    if (back > slash)
+        slash = back;
+#endif
+    return slash ? slash + 1 : path;
+}
+
+static int tree_entry_cmp(const void *lhs, const void *rhs)
+{
+    const fossil_io_filesys_obj_t *a = lhs;
+    const fossil_io_filesys_obj_t *b = rhs;
+    return strcmp(tree_base(a->path), tree_base(b->path));
+}
+
+// Sorted listing of one directory; grows until the whole directory fits
+static fossil_io_filesys_obj_t *tree_list(ccstring path, size_t *count)
+{
+    size_t cap = TREE_LIST_INITIAL;
+    *count = 0;
+    for (;;)
+    {
+        fossil_io_filesys_obj_t *entries =
+            fossil_sys_memory_alloc(cap * sizeof(fossil_io_filesys_obj_t));
+        if (!cnotnull(entries))
+            return cnull;
+        if (fossil_io_filesys_dir_list(path, entries, cap, count) != 0)
         {
-            fossil_io_printf("{red}Error: Failed to open files for text comparison.{normal}\n");
-            return 1;
+            fossil_sys_memory_free(entries);
+            return cnull;
+        }
+        if (*count < cap)
+        {
+            qsort(entries, *count, sizeof(*entries), tree_entry_cmp);
+            return entries;
         }
+        fossil_sys_memory_free(entries);
+        cap *= 2;
+    }
+}
 
-        // Read all lines first
-        cstring *lines1 = cnull, *lines2 = cnull;
-        size_t count1 = 0, count2 = 0;
-        size_t capacity1 = 64, capacity2 = 64;
+static cstring tree_join(ccstring dir, ccstring name)
+{
+    if (dir[0] == '\0')
+        return fossil_io_cstring_dup(name);
+    size_t n = strlen(dir) + strlen(name) + 2;
+    cstring out = fossil_sys_memory_alloc(n);
+    if (cnotnull(out))
+        snprintf(out, n, "%s/%s", dir, name);
+    return out;
+}
 
-        lines1 = (cstring *)fossil_sys_memory_alloc(capacity1 * sizeof(cstring));
-        lines2 = (cstring *)fossil_sys_memory_alloc(capacity2 * sizeof(cstring));
+/*
+ * One jsonl record, counted and flushed under the print lock so walk and
+ * workers never interleave; written around the markup printer so names
+ * stay verbatim.
+ */
+static void tree_emit(tree_ctx_t *ctx, uint64_t *counter, ccstring status, ccstring rel, ccstring type)
+{
+    tree_lock(ctx);
+    (*counter)++;
+    fprintf(stdout, "{\"status\":\"%s\",\"path\":", status);
+    shark_json_string(stdout, rel[0] ? rel : ".");
+    fprintf(stdout, ",\"type\":\"%s\"}\n", type);
+    fflush(stdout);
+    tree_unlock(ctx);
+}
+
+static void tree_error(tree_ctx_t *ctx)
+{
+    tree_lock(ctx);
+    ctx->errors++;
+    tree_unlock(ctx);
+}
 
-        if (!cnotnull(lines1) || !cnotnull(lines2))
+static bool tree_meta_differs(const fossil_io_filesys_obj_t *a, const fossil_io_filesys_obj_t *b)
+{
+    if (a->mode != b->mode)
+        return true;
+    return a->type == FOSSIL_FILESYS_TYPE_FILE && a->modified_at != b->modified_at;
+}
+
+// Workers copy a job out under the lock, so the array may move as it grows
+static void tree_queue(tree_ctx_t *ctx, ccstring rel, ccstring a, ccstring b, bool meta)
+{
+    tree_job_t job = {
+        fossil_io_cstring_dup(rel), fossil_io_cstring_dup(a), fossil_io_cstring_dup(b), meta
+    };
+
+    tree_lock(ctx);
+    if (ctx->count == ctx->cap && cnotnull(job.rel) && cnotnull(job.a) && cnotnull(job.b))
+    {
+        size_t cap = ctx->cap ? ctx->cap * 2 : 64;
+        tree_job_t *grown = fossil_sys_memory_realloc(ctx->jobs, cap * sizeof(tree_job_t));
+        if (cnotnull(grown))
         {
-            if (cnotnull(lines1))
-                fossil_sys_memory_free(lines1);
-            if (cnotnull(lines2))
-                fossil_sys_memory_free(lines2);
-            fossil_io_filesys_file_close(&f1);
-            fossil_io_filesys_file_close(&f2);
-            return 1;
+            ctx->jobs = grown;
+            ctx->cap = cap;
         }
+    }
+    if (ctx->count == ctx->cap || !cnotnull(job.rel) || !cnotnull(job.a) || !cnotnull(job.b))
+    {
+        ctx->errors++;
+        tree_unlock(ctx);
+        if (cnotnull(job.rel))
+            fossil_sys_memory_free(job.rel);
+        if (cnotnull(job.a))
+            fossil_sys_memory_free(job.a);
+        if (cnotnull(job.b))
+            fossil_sys_memory_free(job.b);
+        return;
+    }
+    ctx->jobs[ctx->count++] = job;
+    tree_wake(ctx);
+    tree_unlock(ctx);
+}
 
-        cstring line;
-        while ((line = read_line(&f1)) != cnull)
+static void tree_walk(tree_ctx_t *ctx, ccstring dir_a, ccstring dir_b, ccstring rel)
+{
+    size_t na = 0, nb = 0;
+    fossil_io_filesys_obj_t *la = tree_list(dir_a, &na);
+    fossil_io_filesys_obj_t *lb = tree_list(dir_b, &nb);
+    if (!cnotnull(la) || !cnotnull(lb))
+    {
+        tree_emit(ctx, &ctx->errors, "error", rel, "dir");
+        if (cnotnull(la))
+            fossil_sys_memory_free(la);
+        if (cnotnull(lb))
+            fossil_sys_memory_free(lb);
+        return;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < na || j < nb)
+    {
+        int order;
+        if (i == na)
+            order = 1;
+        else if (j == nb)
+            order = -1;
+        else
+            order = strcmp(tree_base(la[i].path), tree_base(lb[j].path));
+
+        const fossil_io_filesys_obj_t *ea = order <= 0 ? &la[i] : cnull;
+        const fossil_io_filesys_obj_t *eb = order >= 0 ? &lb[j] : cnull;
+        cstring child = tree_join(rel, tree_base(ea ? ea->path : eb->path));
+        if (!cnotnull(child))
         {
-            if (count1 >= capacity1)
-            {
-                capacity1 *= 2;
-                cstring *new_lines = (cstring *)fossil_sys_memory_realloc(lines1, capacity1 * sizeof(cstring));
-                if (!cnotnull(new_lines))
-                {
-                    // Cleanup on realloc failure
-                    for (size_t i = 0; i < count1; i++)
-                        fossil_sys_memory_free(lines1[i]);
-                    fossil_sys_memory_free(lines1);
-                    fossil_sys_memory_free(lines2);
-                    fossil_io_filesys_file_close(&f1);
-                    fossil_io_filesys_file_close(&f2);
-                    return 1;
-                }
-                lines1 = new_lines;
-            }
-            lines1[count1++] = line;
+            tree_error(ctx);
+            break;
         }
 
-        while ((line = read_line(&f2)) != cnull)
+        if (!ea)
         {
-            if (count2 >= capacity2)
-            {
-                capacity2 *= 2;
-                cstring *new_lines = (cstring *)fossil_sys_memory_realloc(lines2, capacity2 * sizeof(cstring));
-                if (!cnotnull(new_lines))
-                {
-                    // Cleanup on realloc failure
-                    for (size_t i = 0; i < count1; i++)
-                        fossil_sys_memory_free(lines1[i]);
-                    for (size_t i = 0; i < count2; i++)
-                        fossil_sys_memory_free(lines2[i]);
-                    fossil_sys_memory_free(lines1);
-                    fossil_sys_memory_free(lines2);
-                    fossil_io_filesys_file_close(&f1);
-                    fossil_io_filesys_file_close(&f2);
-                    return 1;
-                }
-                lines2 = new_lines;
-            }
-            lines2[count2++] = line;
+            tree_emit(ctx, &ctx->added, "added", child, tree_type_name(eb->type));
+        }
+        else if (!eb)
+        {
+            tree_emit(ctx, &ctx->removed, "removed", child, tree_type_name(ea->type));
+        }
+        else if (ea->type != eb->type)
+        {
+            tree_emit(ctx, &ctx->type_changed, "type-changed", child, tree_type_name(eb->type));
+        }
+        else if (ea->type == FOSSIL_FILESYS_TYPE_DIR)
+        {
+            if (tree_meta_differs(ea, eb))
+                tree_emit(ctx, &ctx->meta_changed, "metadata-changed", child, "dir");
+            tree_walk(ctx, ea->path, eb->path, child);
+        }
+        else if (ea->type == FOSSIL_FILESYS_TYPE_FILE && ea->size != eb->size)
+        {
+            // Size alone settles it; no need to read either file
+            tree_emit(ctx, &ctx->content_changed, "content-changed", child, "file");
+        }
+        else if (ea->type == FOSSIL_FILESYS_TYPE_FILE && ea->size > 0)
+        {
+            tree_queue(ctx, child, ea->path, eb->path, tree_meta_differs(ea, eb));
+        }
+        else if (tree_meta_differs(ea, eb))
+        {
+            tree_emit(ctx, &ctx->meta_changed, "metadata-changed", child, tree_type_name(ea->type));
         }
 
-        fossil_io_filesys_file_close(&f1);
-        fossil_io_filesys_file_close(&f2);
+        fossil_sys_memory_free(child);
+        if (order <= 0)
+            i++;
+        if (order >= 0)
+            j++;
+    }
 
-        int differences = 0;
-        size_t max_lines = count1 > count2 ? count1 : count2;
+    fossil_sys_memory_free(la);
+    fossil_sys_memory_free(lb);
+}
 
-        for (size_t i = 0; i < max_lines; i++)
+// 1 when contents match, 0 when they differ, -1 on error
+static int tree_same_content(ccstring a, ccstring b, uint8_t *buf_a, uint8_t *buf_b)
+{
+    fossil_io_filesys_file_t fa, fb;
+    if (fossil_io_filesys_file_open(&fa, a, "rb") != 0)
+        return -1;
+    if (fossil_io_filesys_file_open(&fb, b, "rb") != 0)
+    {
+        fossil_io_filesys_file_close(&fa);
+        return -1;
+    }
+
+    int same = 1;
+    for (;;)
+    {
+        size_t n1 = fossil_io_filesys_file_read(&fa, buf_a, 1, BIN_BLOCK_SIZE);
+        size_t n2 = fossil_io_filesys_file_read(&fb, buf_b, 1, BIN_BLOCK_SIZE);
+        if (n1 != n2 || memcmp(buf_a, buf_b, n1) != 0)
         {
-            cstring line1 = i < count1 ? lines1[i] : cnull;
-            cstring line2 = i < count2 ? lines2[i] : cnull;
+            same = 0;
+            break;
+        }
+        if (n1 < BIN_BLOCK_SIZE)
+            break;
+    }
 
-            if (!cnotnull(line1) || !cnotnull(line2) || !line_equal(line1, line2, ignore_case))
-            {
-                // Print context lines before difference
-                int start_context = (int)i - context_lines;
-                if (start_context < 0)
-                    start_context = 0;
-
-                for (int ctx = start_context; ctx < (int)i; ctx++)
-                {
-                    if (ctx < (int)count1 && cnotnull(lines1[ctx]))
-                    {
-                        fossil_io_printf("  %d: %s\n", ctx + 1, lines1[ctx]);
-                    }
-                }
-
-                fossil_io_printf("{blue}Difference at line %zu:{normal}\n", i + 1);
-                if (cnotnull(line1))
-                    fossil_io_printf("{cyan}< %s{normal}\n", line1);
-                if (cnotnull(line2))
-                    fossil_io_printf("{cyan}> %s{normal}\n", line2);
-
-                // Print context lines after difference
-                int end_context = (int)i + context_lines + 1;
-                if (end_context > (int)max_lines)
-                    end_context = (int)max_lines;
-
-                for (int ctx = (int)i + 1; ctx < end_context; ctx++)
-                {
-                    if (ctx < (int)count1 && cnotnull(lines1[ctx]))
-                    {
-                        fossil_io_printf("  %d: %s\n", ctx + 1, lines1[ctx]);
-                    }
-                }
-                fossil_io_printf("\n");
-                differences++;
-            }
+    fossil_io_filesys_file_close(&fa);
+    fossil_io_filesys_file_close(&fb);
+    return same;
+}
+
+static void *tree_worker(void *arg)
+{
+    tree_ctx_t *ctx = arg;
+    uint8_t *buf_a = fossil_sys_memory_alloc(BIN_BLOCK_SIZE);
+    uint8_t *buf_b = fossil_sys_memory_alloc(BIN_BLOCK_SIZE);
+
+    for (;;)
+    {
+        tree_lock(ctx);
+        tree_wait(ctx);
+        if (ctx->next == ctx->count)
+        {
+            tree_unlock(ctx);
+            break;
         }
+        tree_job_t job = ctx->jobs[ctx->next++];
+        tree_unlock(ctx);
 
-        // Clean up
-        for (size_t i = 0; i < count1; i++)
+        int same = cnotnull(buf_a) && cnotnull(buf_b)
+                       ? tree_same_content(job.a, job.b, buf_a, buf_b)
+                       : -1;
+
+        // Reported as soon as this pair is settled, not after the whole walk
+        if (same < 0)
+            tree_emit(ctx, &ctx->errors, "error", job.rel, "file");
+        else if (same == 0)
+            tree_emit(ctx, &ctx->content_changed, "content-changed", job.rel, "file");
+        else if (job.meta_changed)
+            tree_emit(ctx, &ctx->meta_changed, "metadata-changed", job.rel, "file");
+    }
+
+    if (cnotnull(buf_a))
+        fossil_sys_memory_free(buf_a);
+    if (cnotnull(buf_b))
+        fossil_sys_memory_free(buf_b);
+    return cnull;
+}
+
+// Walk the trees with the worker pool verifying queued pairs alongside
+static void tree_run(tree_ctx_t *ctx, ccstring path1, ccstring path2)
+{
+#ifndef _WIN32
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 0 ? (size_t)cpus : 1;
+    if (workers > TREE_MAX_WORKERS)
+        workers = TREE_MAX_WORKERS;
+
+    ctx->walking = true;
+    pthread_t threads[TREE_MAX_WORKERS];
+    size_t started = 0;
+    for (; started < workers; started++)
+    {
+        if (pthread_create(&threads[started], cnull, tree_worker, ctx) != 0)
+            break;
+    }
+
+    tree_walk(ctx, path1, path2, "");
+
+    tree_lock(ctx);
+    ctx->walking = false;
+    tree_wake(ctx);
+    tree_unlock(ctx);
+
+    // Whatever the pool did not pick up is finished on this thread
+    tree_worker(ctx);
+    for (size_t t = 0; t < started; t++)
+        pthread_join(threads[t], cnull);
+#else
+    tree_walk(ctx, path1, path2, "");
+    tree_worker(ctx);
+#endif
+}
+
+static int tree_compare(ccstring path1, ccstring path2)
+{
+    fossil_io_filesys_obj_t o1, o2;
+    if (fossil_io_filesys_stat(path1, &o1) != 0 || fossil_io_filesys_stat(path2, &o2) != 0 ||
+        o1.type != FOSSIL_FILESYS_TYPE_DIR || o2.type != FOSSIL_FILESYS_TYPE_DIR)
+    {
+        fossil_io_fprintf(FOSSIL_STDERR, "{red}Error: Recursive compare needs two directories.{normal}\n");
+        return 1;
+    }
+
+    tree_ctx_t ctx = {0};
+#ifndef _WIN32
+    pthread_mutex_init(&ctx.lock, cnull);
+    pthread_cond_init(&ctx.ready, cnull);
+#endif
+
+    tree_run(&ctx, path1, path2);
+
+    fprintf(stdout, "{\"added\":%llu,\"removed\":%llu,\"type_changed\":%llu,"
+            "\"metadata_changed\":%llu,\"content_changed\":%llu,\"errors\":%llu}\n",
+            (unsigned long long)ctx.added, (unsigned long long)ctx.removed,
+            (unsigned long long)ctx.type_changed, (unsigned long long)ctx.meta_changed,
+            (unsigned long long)ctx.content_changed, (unsigned long long)ctx.errors);
+    fflush(stdout);
+
+    for (size_t k = 0; k < ctx.count; k++)
+    {
+        fossil_sys_memory_free(ctx.jobs[k].rel);
+        fossil_sys_memory_free(ctx.jobs[k].a);
+        fossil_sys_memory_free(ctx.jobs[k].b);
+    }
+    if (cnotnull(ctx.jobs))
+        fossil_sys_memory_free(ctx.jobs);
+#ifndef _WIN32
+    pthread_cond_destroy(&ctx.ready);
+    pthread_mutex_destroy(&ctx.lock);
+#endif
+
+    uint64_t changes = ctx.added + ctx.removed + ctx.type_changed + ctx.meta_changed +
+                       ctx.content_changed + ctx.errors;
+    return changes > 0 ? 1 : 0;
+}
+
+int fossil_shark_compare(ccstring path1, ccstring path2,
+                         bool text_diff, bool binary_diff,
+                         int context_lines, bool ignore_case,
+                         bool all_ranges, bool recursive)
+{
+    if (!cnotnull(path1) || !cnotnull(path2))
+    {
+        fossil_io_printf("{red}Error: Two paths must be specified.{normal}\n");
+        return 1;
+    }
+
+    if (recursive)
+        return tree_compare(path1, path2);
+
+    if (cunlikely(!is_regular_file(path1) || !is_regular_file(path2)))
+    {
+        fossil_io_printf("{red}Error: Failed to access files or not regular files.{normal}\n");
+        return 1;
+    }
+
+    if (binary_diff)
+        return bin_compare(path1, path2, all_ranges);
+
+    if (text_diff)
+    {
+        diff_file_t a = {0}, b = {0};
+        if (cunlikely(diff_load(path1, &a) != 0 || diff_load(path2, &b) != 0))
         {
-            if (cnotnull(lines1[i]))
-                fossil_sys_memory_free(lines1[i]);
+            fossil_io_printf("{red}Error: Failed to open files for text comparison.{normal}\n");
+            diff_free(&a);
+            diff_free(&b);
+            return 1;
         }
-        for (size_t i = 0; i < count2; i++)
+
+        int result = 1;
+        diff_intern_t table = {0};
+        bool *achg = cnull, *bchg = cnull;
+
+        size_t slots = 16;
+        while (slots < 2 * (a.count + b.count))
+            slots <<= 1;
+        table.slots = (diff_slot_t *)fossil_sys_memory_calloc(slots, sizeof(diff_slot_t));
+        table.first = (ccstring *)fossil_sys_memory_alloc((a.count + b.count + 1) * sizeof(ccstring));
+        table.mask = slots - 1;
+        table.ignore_case = ignore_case;
+        achg = (bool *)fossil_sys_memory_calloc(a.count + 1, sizeof(bool));
+        bchg = (bool *)fossil_sys_memory_calloc(b.count + 1, sizeof(bool));
+
+        if (cnotnull(table.slots) && cnotnull(table.first) && cnotnull(achg) && cnotnull(bchg))
         {
-            if (cnotnull(lines2[i]))
-                fossil_sys_memory_free(lines2[i]);
+            diff_intern(&table, &a);
+            diff_intern(&table, &b);
+
+            if (diff_mark_changes(&a, &b, table.next_id, achg, bchg) == 0)
+            {
+                size_t context = context_lines > 0 ? (size_t)context_lines : 0;
+                result = diff_print_hunks(path1, path2, &a, &b, achg, bchg, context) > 0 ? 1 : 0;
+            }
         }
-        fossil_sys_memory_free(lines1);
-        fossil_sys_memory_free(lines2);
 
-        return differences > 0 ? 1 : 0;
+        if (cnotnull(table.slots))
+            fossil_sys_memory_free(table.slots);
+        if (cnotnull(table.first))
+            fossil_sys_memory_free((void *)table.first);
+        if (cnotnull(achg))
+            fossil_sys_memory_free(achg);
+        if (cnotnull(bchg))
+            fossil_sys_memory_free(bchg);
+        diff_free(&a);
+        diff_free(&b);
+        return result;
     }
 
     fossil_io_printf("{red}Error: Specify at least text_diff or binary_diff.{normal}\n");
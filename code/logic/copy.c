@@ -23,6 +23,7 @@
  * -----------------------------------------------------------------------------
  */
 #include "fossil/code/copy.h"
+#include "fossil/code/throttle.h"
 
 static int copy_file(ccstring src, ccstring dest, bool update, bool preserve,
                      bool checksum, bool dry_run)
@@ -79,9 +80,9 @@ static int copy_file(ccstring src, ccstring dest, bool update, bool preserve,
 
     char buffer[8192];
     size_t n;
-    while ((n = fossil_io_filesys_file_read(&src_stream, buffer, 1, sizeof(buffer))) > 0)
+    while ((n = fossil_shark_throttle_read(&src_stream, buffer, sizeof(buffer))) > 0)
     {
-        if (cunlikely(fossil_io_filesys_file_write(&dest_stream, buffer, 1, n) != n))
+        if (cunlikely(fossil_shark_throttle_write(&dest_stream, buffer, n) != n))
         {
             fossil_io_printf("{red}Error: Write failed for '%s'{normal}\n", dest);
             fossil_io_filesys_file_close(&src_stream);
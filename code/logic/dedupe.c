@@ -24,14 +24,528 @@
  */
 #include "fossil/code/dedupe.h"
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 #define MAX_HASH_LEN 128
 
+/* Largest range the kernel will dedupe in one FIDEDUPERANGE call */
+#define REFLINK_BATCH_SIZE (16u * 1024u * 1024u)
+
+/*
+ * Share the extents of `dup` with `orig` through FIDEDUPERANGE.
+ * The kernel locks both ranges and compares the bytes itself, so a false
+ * positive from the size+timestamp mode is rejected rather than corrupting
+ * data. Returns 0 on success, 1 if the contents differ, 2 if the kernel
+ * stopped before the end (the bytes shared so far are still counted), -1
+ * on error.
+ */
+static int dedupe_reflink(const char* orig, const char* dup, size_t size, uint64_t* reclaimed)
+{
+#if defined(__linux__) && defined(FIDEDUPERANGE)
+    int src_fd = open(orig, O_RDONLY);
+    if (src_fd < 0)
+        return -1;
+
+    /* Destination only needs to be readable when we own it */
+    int dst_fd = open(dup, O_RDWR);
+    if (dst_fd < 0)
+        dst_fd = open(dup, O_RDONLY);
+    if (dst_fd < 0) {
+        close(src_fd);
+        return -1;
+    }
+
+    struct file_dedupe_range* range = calloc(
+        1, sizeof(struct file_dedupe_range) + sizeof(struct file_dedupe_range_info)
+    );
+    if (!range) {
+        close(src_fd);
+        close(dst_fd);
+        return -1;
+    }
+
+    int rc = 0;
+    uint64_t offset = 0;
+
+    while (offset < size) {
+        uint64_t length = size - offset;
+        if (length > REFLINK_BATCH_SIZE)
+            length = REFLINK_BATCH_SIZE;
+
+        range->src_offset = offset;
+        range->src_length = length;
+        range->dest_count = 1;
+        range->info[0].dest_fd = dst_fd;
+        range->info[0].dest_offset = offset;
+        range->info[0].bytes_deduped = 0;
+        range->info[0].status = 0;
+
+        if (ioctl(src_fd, FIDEDUPERANGE, range) < 0) {
+            rc = -1;
+            break;
+        }
+
+        if (range->info[0].status == FILE_DEDUPE_RANGE_DIFFERS) {
+            rc = 1;
+            break;
+        }
+        if (range->info[0].status < 0) {
+            errno = -range->info[0].status;
+            rc = -1;
+            break;
+        }
+
+        /* A short dedupe is legal; resume from where the kernel stopped */
+        if (range->info[0].bytes_deduped == 0) {
+            rc = 2;
+            break;
+        }
+
+        *reclaimed += range->info[0].bytes_deduped;
+        offset += range->info[0].bytes_deduped;
+    }
+
+    free(range);
+    close(src_fd);
+    close(dst_fd);
+    return rc;
+#else
+    (void)orig;
+    (void)dup;
+    (void)size;
+    (void)reclaimed;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+ * Report one reflink outcome. Text gets a coloured line; json and fson get a
+ * record on stdout like every other line there, with the path written as is.
+ */
+static void dedupe_reflink_report(const char* fmt, const char* path, int ref_rc,
+                                  uint64_t shared, uint64_t size, int err)
+{
+    const char* status = ref_rc == 0 ? "shared" : ref_rc == 1 ? "differ" : ref_rc == 2 ? "partial" : "failed";
+
+    if (strcmp(fmt, "json") == 0) {
+        fputs("{\"reflink\":", stdout);
+        shark_json_string(stdout, path);
+        printf(",\"status\":\"%s\",\"shared\":%llu,\"size\":%llu", status,
+               (unsigned long long)shared, (unsigned long long)size);
+        if (ref_rc < 0) {
+            fputs(",\"error\":", stdout);
+            shark_json_string(stdout, strerror(err));
+        }
+        fputs("}\n", stdout);
+    } else if (strcmp(fmt, "fson") == 0) {
+        printf("reflink:cstr=%s status:cstr=%s shared:u64=%llu size:u64=%llu\n", path, status,
+               (unsigned long long)shared, (unsigned long long)size);
+    } else if (ref_rc == 1) {
+        fossil_io_printf("{yellow}Contents differ, not shared: %s{normal}\n", path);
+    } else if (ref_rc == 2) {
+        fossil_io_printf(
+            "{yellow}Partly shared, %llu of %llu bytes: %s{normal}\n",
+            (unsigned long long)shared, (unsigned long long)size, path
+        );
+    } else if (ref_rc < 0) {
+        fossil_io_printf("{red}Reflink failed for %s: %s{normal}\n", path, strerror(err));
+    } else {
+        fossil_io_printf("{cyan}Shared %llu bytes: %s{normal}\n", (unsigned long long)shared, path);
+    }
+}
+
+/*
+ * Content-defined chunking analysis (FastCDC, normalized chunking level 2).
+ *
+ * Files are streamed through a Gear rolling hash and cut where the hash
+ * matches a mask, so an insertion only disturbs the chunks around it.
+ * Chunk fingerprints go into a fixed-size index; when it fills up the
+ * index keeps only fingerprints whose low bits are zero (one half more per
+ * level), which bounds memory and turns the report into an estimate.
+ */
+#define CDC_MIN_SIZE      (2u * 1024u)
+#define CDC_NORMAL_SIZE   (8u * 1024u)
+#define CDC_MAX_SIZE      (64u * 1024u)
+#define CDC_MASK_S        0x0003590703530000ULL /* 15 bits, below normal size */
+#define CDC_MASK_L        0x0000d90003530000ULL /* 11 bits, above normal size */
+#define CDC_READ_SIZE     (1024u * 1024u)
+#define CDC_INDEX_SLOTS   (1u << 20)
+#define CDC_INDEX_LOAD    (CDC_INDEX_SLOTS / 4u * 3u)
+#define CDC_TOP_CHUNKS    10
+#define CDC_DIR_ENTRIES   1024
+
+typedef struct {
+    uint64_t h1;
+    uint64_t h2;
+    uint32_t size;
+    uint32_t refs; /* 0 marks an empty slot */
+} cdc_slot_t;
+
+typedef struct {
+    cdc_slot_t* slots;
+    size_t used;
+    unsigned sample_level;
+    uint64_t chunks;
+    uint64_t bytes;
+    uint64_t failed; /* files or directories that could not be read */
+    const char* fmt;
+} cdc_index_t;
+
+typedef struct {
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t sampled_bytes;
+    uint64_t sampled_dup_bytes;
+} cdc_dir_stats_t;
+
+static uint64_t cdc_gear[256];
+
+static void cdc_gear_init(void)
+{
+    static bool ready = false;
+    if (ready)
+        return;
+
+    /* splitmix64 gives a fixed, well-mixed table without a 256-line literal */
+    uint64_t x = 0x5348415252434443ULL;
+    for (size_t i = 0; i < 256; ++i) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        cdc_gear[i] = z ^ (z >> 31);
+    }
+    ready = true;
+}
+
+static inline bool cdc_sampled(const cdc_index_t* idx, uint64_t h1)
+{
+    return (h1 & ((1ULL << idx->sample_level) - 1)) == 0;
+}
+
+static cdc_slot_t* cdc_probe(cdc_slot_t* slots, uint64_t h1, uint64_t h2)
+{
+    size_t i = (size_t)(h1 >> 20) & (CDC_INDEX_SLOTS - 1);
+    while (slots[i].refs != 0 && (slots[i].h1 != h1 || slots[i].h2 != h2))
+        i = (i + 1) & (CDC_INDEX_SLOTS - 1);
+    return &slots[i];
+}
+
+/* Raise the sampling level and drop fingerprints that no longer qualify */
+static bool cdc_resample(cdc_index_t* idx)
+{
+    cdc_slot_t* fresh = calloc(CDC_INDEX_SLOTS, sizeof(cdc_slot_t));
+    if (!fresh)
+        return false;
+
+    idx->sample_level++;
+    idx->used = 0;
+
+    for (size_t i = 0; i < CDC_INDEX_SLOTS; ++i) {
+        cdc_slot_t* old = &idx->slots[i];
+        if (old->refs == 0 || !cdc_sampled(idx, old->h1))
+            continue;
+        *cdc_probe(fresh, old->h1, old->h2) = *old;
+        idx->used++;
+    }
+
+    free(idx->slots);
+    idx->slots = fresh;
+    return true;
+}
+
+static void cdc_add_chunk(cdc_index_t* idx, cdc_dir_stats_t* dir,
+                          uint64_t h1, uint64_t h2, uint32_t size)
+{
+    idx->chunks++;
+    idx->bytes += size;
+    dir->bytes += size;
+
+    if (!cdc_sampled(idx, h1))
+        return;
+
+    dir->sampled_bytes += size;
+
+    cdc_slot_t* slot = cdc_probe(idx->slots, h1, h2);
+    if (slot->refs != 0) {
+        if (slot->refs < UINT32_MAX)
+            slot->refs++;
+        dir->sampled_dup_bytes += size;
+        return;
+    }
+
+    if (idx->used >= CDC_INDEX_LOAD) {
+        if (!cdc_resample(idx) || !cdc_sampled(idx, h1))
+            return;
+        slot = cdc_probe(idx->slots, h1, h2);
+    }
+
+    slot->h1 = h1;
+    slot->h2 = h2;
+    slot->size = size;
+    slot->refs = 1;
+    idx->used++;
+}
+
+/* Stream one file through the chunker, CDC_READ_SIZE bytes at a time */
+static int cdc_scan_file(cdc_index_t* idx, cdc_dir_stats_t* dir,
+                         const char* path, uint8_t* buffer)
+{
+    fossil_io_filesys_file_t f = {0};
+    if (fossil_io_filesys_file_open(&f, path, "rb") != 0)
+        return -1;
+
+    uint64_t fp = 0;
+    uint64_t h1 = 0xcbf29ce484222325ULL;
+    uint64_t h2 = 0x84222325cbf29ce4ULL;
+    uint32_t len = 0;
+    size_t n;
+
+    while ((n = fossil_io_filesys_file_read(&f, buffer, 1, CDC_READ_SIZE)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t b = buffer[i];
+            h1 = (h1 ^ b) * 0x100000001b3ULL;
+            h2 = ((h2 ^ b) << 7 | (h2 ^ b) >> 57) * 0xff51afd7ed558ccdULL;
+            len++;
+
+            /* FastCDC skips hashing below the minimum chunk size */
+            if (len <= CDC_MIN_SIZE)
+                continue;
+
+            fp = (fp << 1) + cdc_gear[b];
+            uint64_t mask = (len < CDC_NORMAL_SIZE) ? CDC_MASK_S : CDC_MASK_L;
+
+            if ((fp & mask) == 0 || len >= CDC_MAX_SIZE) {
+                cdc_add_chunk(idx, dir, h1 ^ len, h2, len);
+                fp = 0;
+                h1 = 0xcbf29ce484222325ULL;
+                h2 = 0x84222325cbf29ce4ULL;
+                len = 0;
+            }
+        }
+    }
+
+    if (len > 0)
+        cdc_add_chunk(idx, dir, h1 ^ len, h2, len);
+
+    fossil_io_filesys_file_close(&f);
+    dir->files++;
+    return 0;
+}
+
+static double cdc_ratio(uint64_t sampled_bytes, uint64_t sampled_dup_bytes)
+{
+    if (sampled_bytes == 0)
+        return 1.0;
+    uint64_t unique = sampled_bytes > sampled_dup_bytes ? sampled_bytes - sampled_dup_bytes : 1;
+    return (double)sampled_bytes / (double)unique;
+}
+
+/* Shared bytes are estimated from the sampled fraction of the directory */
+static uint64_t cdc_estimate_shared(uint64_t bytes, uint64_t sampled_bytes,
+                                    uint64_t sampled_dup_bytes)
+{
+    if (sampled_bytes == 0)
+        return 0;
+    return (uint64_t)((double)bytes * (double)sampled_dup_bytes / (double)sampled_bytes);
+}
+
+static int cdc_scan_dir(cdc_index_t* idx, const char* dir_path, uint8_t* buffer)
+{
+    fossil_io_filesys_obj_t* entries = malloc(sizeof(*entries) * CDC_DIR_ENTRIES);
+    if (!entries)
+        return -1;
+
+    size_t count = 0;
+    int rc = fossil_io_filesys_dir_list(dir_path, entries, CDC_DIR_ENTRIES, &count);
+    if (rc < 0) {
+        free(entries);
+        return rc;
+    }
+
+    cdc_dir_stats_t dir = {0};
+
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].type != FOSSIL_FILESYS_TYPE_FILE)
+            continue;
+        if (cdc_scan_file(idx, &dir, entries[i].path, buffer) != 0) {
+            idx->failed++;
+            fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot read %s{normal}\n", entries[i].path);
+        }
+    }
+
+    if (dir.files > 0) {
+        uint64_t shared = cdc_estimate_shared(dir.bytes, dir.sampled_bytes, dir.sampled_dup_bytes);
+        double ratio = cdc_ratio(dir.sampled_bytes, dir.sampled_dup_bytes);
+
+        if (strcmp(idx->fmt, "json") == 0) {
+            fputs("{\"dir\":", stdout);
+            shark_json_string(stdout, dir_path);
+            fprintf(
+                stdout, ",\"files\":%llu,\"bytes\":%llu,\"shared\":%llu,\"ratio\":%.3f}\n",
+                (unsigned long long)dir.files, (unsigned long long)dir.bytes,
+                (unsigned long long)shared, ratio
+            );
+        } else if (strcmp(idx->fmt, "fson") == 0) {
+            printf(
+                "dir:cstr=%s files:u64=%llu bytes:u64=%llu shared:u64=%llu ratio:f64=%.3f\n",
+                dir_path, (unsigned long long)dir.files, (unsigned long long)dir.bytes,
+                (unsigned long long)shared, ratio
+            );
+        } else {
+            fossil_io_printf(
+                "%s: %llu files, %llu bytes, %llu shared, ratio %.2fx\n",
+                dir_path, (unsigned long long)dir.files, (unsigned long long)dir.bytes,
+                (unsigned long long)shared, ratio
+            );
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].type == FOSSIL_FILESYS_TYPE_DIR &&
+            cdc_scan_dir(idx, entries[i].path, buffer) != 0) {
+            idx->failed++;
+            fossil_io_fprintf(FOSSIL_STDERR, "{yellow}Warning: Cannot read directory %s{normal}\n", entries[i].path);
+        }
+    }
+
+    free(entries);
+    return 0;
+}
+
+static int cdc_slot_compare(const void* a, const void* b)
+{
+    const cdc_slot_t* x = *(const cdc_slot_t* const*)a;
+    const cdc_slot_t* y = *(const cdc_slot_t* const*)b;
+    uint64_t sx = (uint64_t)(x->refs - 1) * x->size;
+    uint64_t sy = (uint64_t)(y->refs - 1) * y->size;
+    return (sx < sy) - (sx > sy);
+}
+
+static int dedupe_chunk_report(const char* dir_path, const char* fmt)
+{
+    cdc_gear_init();
+
+    cdc_index_t idx = {0};
+    idx.fmt = fmt;
+    idx.slots = calloc(CDC_INDEX_SLOTS, sizeof(cdc_slot_t));
+    uint8_t* buffer = malloc(CDC_READ_SIZE);
+
+    if (!idx.slots || !buffer) {
+        free(idx.slots);
+        free(buffer);
+        return -1;
+    }
+
+    int rc = cdc_scan_dir(&idx, dir_path, buffer);
+    free(buffer);
+
+    if (rc < 0) {
+        free(idx.slots);
+        return rc;
+    }
+
+    /*
+     * Every fingerprint still in the index qualified at all earlier sampling
+     * levels, so its reference count is complete; totals taken from the
+     * index are therefore an unbiased sample of the whole scan.
+     */
+    uint64_t sampled_bytes = 0, sampled_unique = 0;
+    for (size_t i = 0; i < CDC_INDEX_SLOTS; ++i) {
+        if (idx.slots[i].refs == 0)
+            continue;
+        sampled_bytes += (uint64_t)idx.slots[i].size * idx.slots[i].refs;
+        sampled_unique += idx.slots[i].size;
+    }
+
+    uint64_t shared = cdc_estimate_shared(idx.bytes, sampled_bytes, sampled_bytes - sampled_unique);
+    double ratio = cdc_ratio(sampled_bytes, sampled_bytes - sampled_unique);
+    bool estimated = idx.sample_level > 0;
+
+    if (strcmp(fmt, "json") == 0) {
+        fossil_io_printf(
+            "{\"total_chunks\":%llu,\"bytes\":%llu,\"shared\":%llu,\"ratio\":%.3f,\"estimated\":%s,\"failed\":%llu}\n",
+            (unsigned long long)idx.chunks, (unsigned long long)idx.bytes,
+            (unsigned long long)shared, ratio, estimated ? "true" : "false",
+            (unsigned long long)idx.failed
+        );
+    } else if (strcmp(fmt, "fson") == 0) {
+        fossil_io_printf(
+            "total_chunks:u64=%llu bytes:u64=%llu shared:u64=%llu ratio:f64=%.3f estimated:bool=%s failed:u64=%llu\n",
+            (unsigned long long)idx.chunks, (unsigned long long)idx.bytes,
+            (unsigned long long)shared, ratio, estimated ? "true" : "false",
+            (unsigned long long)idx.failed
+        );
+    } else {
+        fossil_io_printf(
+            "Total: %llu chunks, %llu bytes, %llu shared, ratio %.2fx%s\n",
+            (unsigned long long)idx.chunks, (unsigned long long)idx.bytes,
+            (unsigned long long)shared, ratio, estimated ? " (sampled estimate)" : ""
+        );
+        if (idx.failed > 0)
+            fossil_io_printf("{yellow}Skipped %llu unreadable entries{normal}\n",
+                             (unsigned long long)idx.failed);
+    }
+
+    /* Rank the most shared chunks by the bytes they would save */
+    cdc_slot_t* top[CDC_TOP_CHUNKS];
+    size_t top_count = 0;
+
+    for (size_t i = 0; i < CDC_INDEX_SLOTS; ++i) {
+        cdc_slot_t* slot = &idx.slots[i];
+        if (slot->refs < 2)
+            continue;
+
+        if (top_count < CDC_TOP_CHUNKS) {
+            top[top_count++] = slot;
+            qsort(top, top_count, sizeof(top[0]), cdc_slot_compare);
+        } else if (cdc_slot_compare(&slot, &top[CDC_TOP_CHUNKS - 1]) < 0) {
+            top[CDC_TOP_CHUNKS - 1] = slot;
+            qsort(top, top_count, sizeof(top[0]), cdc_slot_compare);
+        }
+    }
+
+    if (top_count > 0 && strcmp(fmt, "text") == 0)
+        fossil_io_printf("Top shared chunks:\n");
+
+    for (size_t i = 0; i < top_count; ++i) {
+        if (strcmp(fmt, "json") == 0) {
+            fossil_io_printf(
+                "{\"chunk\":\"%016llx%016llx\",\"size\":%u,\"refs\":%u}\n",
+                (unsigned long long)top[i]->h1, (unsigned long long)top[i]->h2,
+                top[i]->size, top[i]->refs
+            );
+        } else if (strcmp(fmt, "fson") == 0) {
+            fossil_io_printf(
+                "chunk:cstr=%016llx%016llx size:u32=%u refs:u32=%u\n",
+                (unsigned long long)top[i]->h1, (unsigned long long)top[i]->h2,
+                top[i]->size, top[i]->refs
+            );
+        } else {
+            fossil_io_printf(
+                "  %016llx%016llx  %u bytes x %u\n",
+                (unsigned long long)top[i]->h1, (unsigned long long)top[i]->h2,
+                top[i]->size, top[i]->refs
+            );
+        }
+    }
+
+    free(idx.slots);
+    return idx.failed > 0 ? 1 : 0;
+}
+
 int fossil_shark_dedupe(
     const char* dir_path,
     bool use_hash,
     bool interactive,
     bool delete_files,
     bool link_files,
+    bool reflink_files,
+    bool chunk_report,
     const char* media /* "text", "json", "fson" */
 )
 {
@@ -40,6 +554,9 @@ int fossil_shark_dedupe(
     /* Default media */
     const char* fmt = (media) ? media : "text";
 
+    if (chunk_report)
+        return dedupe_chunk_report(dir_path, fmt);
+
     fossil_io_filesys_obj_t entries[1024];
     size_t count = 0;
 
@@ -53,15 +570,18 @@ int fossil_shark_dedupe(
     } file_node_t;
 
     file_node_t* head = NULL;
+    uint64_t reclaimed = 0;
+    size_t unshared = 0; /* reflinked duplicates left (partly) unshared */
 
     /* Output helper */
     #define OUTPUT_DUP(dup, orig)                                     \
         do {                                                          \
             if (strcmp(fmt, "json") == 0) {                           \
-                fossil_io_printf(                                     \
-                    "{\"duplicate\":\"%s\",\"original\":\"%s\"}\n",   \
-                    dup, orig                                         \
-                );                                                    \
+                fputs("{\"duplicate\":", stdout);                     \
+                shark_json_string(stdout, dup);                       \
+                fputs(",\"original\":", stdout);                      \
+                shark_json_string(stdout, orig);                      \
+                fputs("}\n", stdout);                                 \
             } else if (strcmp(fmt, "fson") == 0) {                    \
                 fossil_io_printf(                                     \
                     "duplicate:cstr=%s original:cstr=%s\n",                     \
@@ -132,6 +652,28 @@ int fossil_shark_dedupe(
 
                 OUTPUT_DUP(obj->path, node->path);
 
+                if (reflink_files) {
+                    bool do_reflink = true;
+
+                    if (interactive) {
+                        fossil_io_printf("Reflink %s? (y/n): ", obj->path);
+                        int c = getchar();
+                        while (getchar() != '\n');
+                        do_reflink = (c == 'y' || c == 'Y');
+                    }
+
+                    if (do_reflink) {
+                        uint64_t before = reclaimed;
+                        int ref_rc = dedupe_reflink(node->path, obj->path, obj->size, &reclaimed);
+
+                        int err = errno;
+                        dedupe_reflink_report(fmt, obj->path, ref_rc, reclaimed - before, obj->size, err);
+                        if (ref_rc != 0)
+                            unshared++;
+                    }
+                    break;
+                }
+
                 bool do_delete = delete_files;
 
                 if (interactive) {
@@ -174,6 +716,16 @@ int fossil_shark_dedupe(
         }
     }
 
+    if (reflink_files) {
+        if (strcmp(fmt, "json") == 0) {
+            fossil_io_printf("{\"reclaimed\":%llu}\n", (unsigned long long)reclaimed);
+        } else if (strcmp(fmt, "fson") == 0) {
+            fossil_io_printf("reclaimed:u64=%llu\n", (unsigned long long)reclaimed);
+        } else {
+            fossil_io_printf("Reclaimed by reflink: %llu bytes\n", (unsigned long long)reclaimed);
+        }
+    }
+
     /* Cleanup */
     file_node_t* tmp;
     while (head) {
@@ -182,5 +734,5 @@ int fossil_shark_dedupe(
         free(tmp);
     }
 
-    return 0;
+    return unshared > 0 ? 1 : 0;
 }
@@ -28,6 +28,7 @@
 #include "common.h"
 #include "commands.h"
 #include "magic.h"
+#include "throttle.h"
 
 #define FOSSIL_APP_NAME "Shark Tool"
 #define FOSSIL_APP_VERSION "1.0.1"
@@ -32,23 +32,40 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Options for an archive run; zero-initialise and set what is needed.
+ */
+typedef struct fossil_shark_archive_options_s
+{
+    bool create;              /**< Create new archive */
+    bool extract;             /**< Extract existing archive */
+    bool list;                /**< List contents of archive */
+    ccstring format;          /**< Archive format specification (zip/tar/gz/zst); null for tar */
+    ccstring password;        /**< Password for encrypted archives; null for none */
+    int compress_level;       /**< Compression level (0-9, 0 for no compression; 0-19 for zst,
+                                   where 0 is zstd's default) */
+    bool stdout_output;       /**< Stream a tar or tar.gz to stdout instead of a file; path
+                                   then names the directory to archive */
+    ccstring exclude_pattern; /**< Pattern for files to exclude; null for none */
+    int threads;              /**< Compression threads for tar.gz and tar.zst, and extraction
+                                   workers for archives with an index; 0 for one per CPU */
+    bool index;               /**< Also write a seekable sidecar index, <path>.idx (tar, tar.gz and tar.zst) */
+    ccstring member;          /**< Extract or list only this entry and what lies under it; null for all */
+    bool long_window;         /**< Long-distance matching over a 128 MiB window (zst) */
+    ccstring dict_path;       /**< zstd dictionary file used to write and read the archive; null for none */
+    bool train_dict;          /**< Train dict_path on the files being archived first (zst) */
+    ccstring incremental;     /**< Manifest of an incremental chain: create archives only what changed
+                                   since it, extract replays the chain up to path; null for none */
+} fossil_shark_archive_options_t;
+
 /**
  * Perform archive operations (create, extract, list)
- * @param path Path to archive file or directory to archive
- * @param create Create new archive
- * @param extract Extract existing archive
- * @param list List contents of archive
- * @param format Archive format specification (zip/tar/gz)
- * @param password Password for encrypted archives
- * @param compress_level Compression level (0-9, 0 for no compression)
- * @param stdout_output Output to stdout instead of file
- * @param exclude_pattern Pattern for files to exclude
+ * @param path Path to archive file, or "-" to stream it (stdout for create,
+ *             stdin for extract and list; tar, tar.gz and tar.zst only)
+ * @param opts Archive options; exactly one of create, extract and list must be set
  * @return 0 on success, non-zero on error
  */
-int fossil_shark_archive(ccstring path, bool create, bool extract,
-                            bool list, ccstring format, ccstring password,
-                            int compress_level, bool stdout_output,
-                            ccstring exclude_pattern);
+int fossil_shark_archive(ccstring path, const fossil_shark_archive_options_t *opts);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,458 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#ifndef FOSSIL_APP_ARCHIVE_INTERNAL_H
+#define FOSSIL_APP_ARCHIVE_INTERNAL_H
+
+#include "archive.h"
+#include "throttle.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+
+/*
+ * Shared between the archive translation units; not part of the command API.
+ * fossil_shark_archive() lives in archive.c and hands tar, tar.gz and
+ * tar.zst to the native code, split by stage below.
+ */
+
+/*
+ * Native tar writer with block-parallel compression. The archive library
+ * compresses on one core, so for tar and tar.gz shark builds the tar
+ * stream itself and deflates it the way pigz does: the stream is cut into
+ * 128 KiB blocks, each block is compressed on a worker thread with the
+ * last 32 KiB before it as a preset dictionary (so the ratio stays that
+ * of a serial deflate), and the results are written in order behind one
+ * gzip header, their CRCs combined into the trailer. Readers see a single
+ * ordinary gzip member.
+ *
+ * A writer thread drains finished blocks while the walker is still reading
+ * files, so disk reads, compression and output writes overlap. The ring
+ * holds at least two blocks and bounds memory however slow the output is,
+ * which matters when the archive is streamed into a pipe.
+ *
+ * When an index is wanted, every PACK_CHECKPOINT bytes a block starts
+ * without a dictionary. Inflating can then begin at that block, and its
+ * offsets are recorded as a checkpoint; the ratio cost is one lost 32 KiB
+ * window per checkpoint.
+ *
+ * zstd goes through the same ring, but its own worker pool does the
+ * parallel part: blocks are fed to one multithreaded context on this
+ * thread, and the writer thread still overlaps the output. With an index
+ * a frame ends at every checkpoint instead, so each one can be decoded on
+ * its own.
+ *
+ * File data that would not shrink (media, archives, encrypted files) is
+ * not worth the CPU. Each read of a file is probed by deflating a few
+ * slices of it at the fastest level, and a block made almost entirely of
+ * such data is stored: deflate level 0 for gzip, zstd's fastest level in
+ * a frame of its own for zstd.
+ */
+#define PACK_BLOCK (128 * 1024)
+#define PACK_WINDOW (32 * 1024)
+#define PACK_MAX_WORKERS 64
+#define PACK_READ_BLOCK (1024 * 1024)
+#define PACK_CHECKPOINT (1024 * 1024)
+#define PACK_LONG_WINDOW_LOG 27 // 128 MiB, what zstd --long uses
+#define PACK_PROBE_SLICE (4 * 1024)
+#define PACK_PROBE_SLICES 8
+
+enum
+{
+    PACK_NONE, // plain tar
+    PACK_GZIP,
+    PACK_ZSTD
+};
+
+// zstd settings from the command line, shared by writing and reading
+typedef struct
+{
+    bool long_window;
+    uint8_t *dict;
+    size_t dict_len;
+} zstd_options_t;
+
+enum
+{
+    PACK_FREE,
+    PACK_FILLED, // waiting for a worker
+    PACK_BUSY,
+    PACK_DONE // compressed, waiting to be written
+};
+
+typedef struct
+{
+    uint8_t *in; // dictionary, then data
+    size_t dict_len;
+    size_t len; // data bytes after the dictionary
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    uint32_t crc;
+    uint64_t at; // offset of the data in the uncompressed stream
+    size_t dense; // data bytes the probe found incompressible
+    bool stored;  // compressed at the storing level
+    bool last;
+    int state;
+} pack_block_t;
+
+typedef struct
+{
+    uint64_t in;  // offset in the tar stream of a block inflatable on its own
+    uint64_t out; // offset of its compressed data in the archive
+} pack_point_t;
+
+typedef struct
+{
+    fossil_io_filesys_file_t *out;
+    int codec;
+    int level;
+    pack_block_t *ring; // blocks in flight, reused in turn
+    size_t ring_len;
+    pack_block_t *cur;  // being filled
+    uint64_t filled;    // blocks handed to the workers
+    uint64_t taken;     // blocks a worker has picked up
+    uint64_t written;   // blocks written out
+    uint8_t window[PACK_WINDOW];
+    size_t window_len;
+    pthread_t threads[PACK_MAX_WORKERS];
+    size_t started;
+    pthread_t writer;
+    bool writing;       // the writer thread is running
+    z_stream inline_zs[2]; // compresses here when no worker could be started; [1] stores
+    bool inline_ready;
+    ZSTD_CCtx *zc;
+    size_t zstd_workers;
+    int zstd_level;      // level of the frame being written
+    bool zstd_open;      // a frame has data that has not been ended
+    bool dense;          // what is being written is incompressible
+    z_stream probe;
+    bool probe_ready;
+    uint8_t *probe_out;
+    uint64_t stored_total; // bytes in stored blocks
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // to workers: a block is filled, or we are closing
+    pthread_cond_t done; // to the writer: a block is compressed
+    pthread_cond_t freed; // from the writer: a block can be refilled
+    bool closing;
+    bool failed;
+    uint32_t crc;
+    uint64_t in_total;
+    uint64_t out_total;
+    bool checkpoints;    // cut dictionary-free blocks and record them
+    pack_point_t *points; // filled by whoever writes blocks out
+    size_t point_count;
+    size_t point_cap;
+} pack_t;
+
+/*
+ * Tar stream: POSIX ustar headers, with a pax extended header in front
+ * of any entry whose path, link target, size or ids do not fit.
+ */
+#define TAR_RECORD 512
+
+/*
+ * Sidecar index, written next to the archive as <archive>.idx when asked
+ * for: a header, one fixed-size record per entry in archive order, the
+ * checkpoints, then the path and link strings. Like the sync manifest it
+ * is in native byte order; an index from a machine of the other order
+ * fails the version check and the archive is simply read in full.
+ */
+#define INDEX_SUFFIX ".idx"
+#define INDEX_MAGIC "SHKIDX01"
+#define INDEX_VERSION 3
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t codec;
+    uint64_t count;
+    uint64_t points;
+    uint64_t strings;
+    uint64_t archive_size; // these three must match the archive, or the index is stale
+    uint64_t archive_ino;
+    int64_t archive_mtime_ns;
+    uint64_t stream_size;  // uncompressed tar stream
+    uint64_t create_ns;    // time spent writing the archive
+} index_header_t;
+
+typedef struct
+{
+    uint64_t header; // first header of the entry (pax included) in the tar stream
+    uint64_t size;
+    int64_t mtime;
+    uint64_t path_off; // path, then link, in the string table
+    uint32_t path_len;
+    uint32_t link_len;
+    uint32_t mode;
+    uint32_t type;
+} index_rec_t;
+
+typedef struct
+{
+    cstring path;
+    cstring link;
+    uint64_t header;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mode;
+    char type;
+} tar_index_entry_t;
+
+/*
+ * Incremental archives. The manifest given with --incremental describes
+ * the tree as of the last archive written against it: one record per
+ * entry, sorted by name, with its size, mtime, mode and, for files, a
+ * digest of the contents, followed by the chain of archives so far, base
+ * first. The next archive holds only what is new or changed, plus
+ * tombstones: .shark-deleted members naming what went away, which
+ * extraction removes again. They have a typeflag of their own, so a file
+ * that happens to carry the name is archived as data; other tars extract
+ * them as plain files. Restoring replays the chain in order. Native byte
+ * order, like the index.
+ */
+#define INC_MAGIC "SHKINC01"
+#define INC_VERSION 1
+#define INC_TOMBSTONES ".shark-deleted"
+#define INC_TOMBSTONE_TYPE 'T' // vendor typeflag, from the range POSIX reserves for them
+#define INC_TOMBSTONES_MAX (64 * 1024 * 1024)
+
+#if defined(__APPLE__)
+#define ARCHIVE_MTIME_NS(st) ((int64_t)(st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#else
+#define ARCHIVE_MTIME_NS(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t archives; // length of the chain
+    uint64_t count;
+    uint64_t chain; // bytes of NUL-terminated archive paths after the records
+    uint64_t strings;
+} inc_header_t;
+
+typedef struct
+{
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t digest[2]; // regular files only
+    uint64_t path_off;
+    uint32_t path_len;
+    uint32_t mode;
+    uint32_t type;
+    uint32_t reserved;
+} inc_rec_t;
+
+typedef struct
+{
+    cstring path;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t digest[2];
+    uint32_t mode;
+    char type;
+} inc_entry_t;
+
+typedef struct
+{
+    uint8_t *data; // the manifest as loaded; null on the first run
+    const inc_header_t *hdr;
+    const inc_rec_t *recs;
+    const char *chain;
+    const char *strings;
+    uint64_t count;
+    uint8_t *seen; // one flag per record found again by this walk
+    dev_t dev;     // the manifest itself, when it lies inside the tree
+    ino_t ino;
+    inc_entry_t *entries; // the next manifest
+    size_t entry_count;
+    size_t entry_cap;
+    size_t slot; // entry whose digest the contents being written complete
+    size_t changed;
+    size_t unchanged;
+    size_t deleted;
+} inc_state_t;
+
+typedef struct
+{
+    pack_t pack;
+    ccstring exclude; // glob on the entry's name or relative path; null for none
+    dev_t skip_dev;   // the archive being written, when it lies inside the tree
+    ino_t skip_ino;
+    size_t entries;
+    size_t errors;
+    uint8_t *buf;
+    bool indexed;
+    tar_index_entry_t *index;
+    size_t index_count;
+    size_t index_cap;
+    uint64_t create_ns;
+    inc_state_t *inc; // null unless --incremental
+    uint64_t digest[2];
+    ccstring top; // entry name prefix, "" or "name/"
+} tar_writer_t;
+
+/*
+ * Reading side. A feeder thread reads the archive (a file, or stdin when
+ * streaming) into two alternating buffers while this thread inflates and
+ * writes out the members from the other one, so input, decompression and
+ * output overlap here as well. Gzip and zstd input are recognised by
+ * their magic bytes; anything else must be a plain tar stream.
+ */
+#define UNPACK_CHUNK (1024 * 1024)
+
+typedef struct
+{
+    fossil_io_filesys_file_t *file; // null reads stdin
+    uint8_t *buf[2];
+    size_t len[2];
+    bool full[2];
+    int take; // buffer the reader consumes next
+    bool stop;
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool held; // the reader still holds buffer take
+    const uint8_t *in;
+    size_t in_len;
+    bool eof;
+    bool gzip;
+    bool raw;        // started at a checkpoint inside the deflate data
+    z_stream zs;
+    bool zs_ready;
+    ZSTD_DCtx *zd;   // set for zstd input
+    bool wrong_dict; // written with another zstd dictionary, or none was given
+    bool member_end; // the last gzip member or zstd frame is complete
+    bool trailing;   // past the last member, only padding is left
+    bool failed;
+    uint64_t in_total;
+    uint64_t out_total; // position in the tar stream
+} unpack_t;
+
+typedef struct
+{
+    unpack_t src;
+    fossil_io_filesys_file_t *con;
+    bool list;
+    ccstring member; // only this entry, or what lies under it; null for all
+    size_t member_len;
+    mode_t umask;
+    size_t entries;
+    size_t errors;
+    uint64_t total; // member data bytes
+    char parent[FOSSIL_FILESYS_MAX_PATH]; // last directory checked to hold no symlinks
+    struct tar_dir
+    {
+        char *path;
+        mode_t mode;
+        time_t mtime;
+    } *dirs; // metadata applied once everything inside is written
+    size_t dir_count;
+    size_t dir_cap;
+    uint8_t *buf;
+    const zstd_options_t *zo;
+    size_t deleted; // by tombstones of an incremental archive
+} tar_reader_t;
+
+typedef struct
+{
+    uint8_t *data;
+    const index_header_t *hdr;
+    const index_rec_t *recs;
+    const pack_point_t *points;
+    const char *strings;
+} tar_index_t;
+
+/* ==========================================================================
+    * Tar writer, parallel compression and dictionaries (archive_pack.c)
+    * ========================================================================== */
+
+bool pack_write(pack_t *p, const void *data, size_t len);
+size_t pack_workers(int threads);
+uint64_t archive_clock_ns(void);
+double archive_rate(uint64_t bytes, uint64_t ns);
+bool tar_entry(tar_writer_t *t, ccstring name, char type, const struct stat *st,
+               uint64_t size, ccstring link);
+bool tar_contents(tar_writer_t *t, ccstring path, uint64_t size);
+int tar_create(ccstring path, ccstring src, int codec, int level, int threads, ccstring exclude,
+               bool indexed, const zstd_options_t *zo, ccstring manifest);
+bool dict_train(ccstring src, ccstring exclude, ccstring dict_path, fossil_io_filesys_file_t *con);
+bool dict_load(ccstring dict_path, zstd_options_t *zo, fossil_io_filesys_file_t *con);
+
+/* ==========================================================================
+    * Sidecar index and parallel extraction (archive_index.c)
+    * ========================================================================== */
+
+bool tar_index_save(const tar_writer_t *t, ccstring path);
+void tar_index_free(tar_index_t *ix);
+bool tar_index_load(ccstring path, tar_index_t *ix);
+void tar_index_list(tar_reader_t *r, const tar_index_t *ix);
+bool tar_index_extract(tar_reader_t *r, const tar_index_t *ix, fossil_io_filesys_file_t *file);
+bool tar_index_fanout(tar_reader_t *r, const tar_index_t *ix, ccstring path,
+                      fossil_io_filesys_file_t *file, size_t workers);
+
+/* ==========================================================================
+    * Incremental archives (archive_incremental.c)
+    * ========================================================================== */
+
+void inc_digest(uint64_t d[2], const uint8_t *data, size_t len);
+void inc_free(inc_state_t *inc);
+bool inc_load(ccstring path, inc_state_t *inc, fossil_io_filesys_file_t *con);
+int64_t inc_chain_find(const inc_state_t *inc, ccstring archive);
+bool inc_bury(tar_writer_t *t, uint64_t lo, uint64_t hi, uint64_t self);
+int inc_check(tar_writer_t *t, ccstring path, ccstring name, char type, const struct stat *st);
+bool inc_save(inc_state_t *inc, ccstring path, ccstring archive);
+int tar_replay(ccstring manifest, ccstring path, ccstring member, const zstd_options_t *zo, int threads,
+               fossil_io_filesys_file_t *con);
+
+/* ==========================================================================
+    * Tar reader (archive_read.c)
+    * ========================================================================== */
+
+bool unpack_open_at(unpack_t *u, fossil_io_filesys_file_t *file, uint64_t offset,
+                    uint64_t stream_at, int codec, const zstd_options_t *zo);
+void unpack_close(unpack_t *u);
+bool tar_skip(tar_reader_t *r, uint64_t size);
+bool tar_safe_name(char *name);
+bool tar_parents(tar_reader_t *r, ccstring name, bool create);
+bool tar_extract_entry(tar_reader_t *r, char type, char *name, char *target,
+                       uint64_t size, mode_t mode, time_t mtime);
+void tar_list_entry(tar_reader_t *r, char type, ccstring name, ccstring target,
+                    uint64_t size, mode_t mode, time_t mtime);
+bool tar_member_match(const tar_reader_t *r, ccstring name);
+int tar_read_entry(tar_reader_t *r);
+bool tar_sniff(ccstring path);
+int tar_read(ccstring path, bool list, ccstring member, const zstd_options_t *zo, bool chained,
+             int threads, fossil_io_filesys_file_t *con);
+
+#endif
+
+#endif /* FOSSIL_APP_ARCHIVE_INTERNAL_H */
@@ -66,5 +66,28 @@ static inline __attribute__((unused)) int portable_link(const char *src, const c
 #include <utime.h>
 #include <libgen.h>
 #include <math.h>
+#include <stdio.h>
+
+/*
+ * Write s to out as a JSON string literal. Quotes, backslashes and control
+ * characters are escaped; every other byte is copied as is. JSON records go
+ * straight to the stream because the markup printer would rewrite any
+ * "{...}" in a file name.
+ */
+static inline void shark_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
 
 #endif /* FOSSIL_APP_CODE_H */
@@ -40,11 +40,14 @@ extern "C"
  * @param binary_diff Perform binary difference comparison
  * @param context_lines Number of context lines to show around differences
  * @param ignore_case Ignore case differences in text comparison
+ * @param all_ranges List every differing byte range in binary comparison
+ * @param recursive Compare two directory trees and stream differences as jsonl
  * @return 0 on success, non-zero on error
  */
 int fossil_shark_compare(ccstring path1, ccstring path2,
                             bool text_diff, bool binary_diff,
-                            int context_lines, bool ignore_case);
+                            int context_lines, bool ignore_case,
+                            bool all_ranges, bool recursive);
 
 #ifdef __cplusplus
 }
@@ -39,8 +39,12 @@ extern "C"
  * @param interactive Confirm each deletion if true
  * @param delete Remove duplicate files if true
  * @param link Replace duplicates with links if true
+ * @param reflink Share extents with the original via FIDEDUPERANGE if true
+ * @param chunks Report block-level dedupe potential using content-defined chunks
  * @param media Report duplicates in a selected format type if true
- * @return 0 on success, non-zero on error
+ * @return 0 on success, non-zero on error, when reflink left a duplicate
+ *         unshared or only partly shared, or when the chunk report skipped
+ *         unreadable entries
  */
 int fossil_shark_dedupe(
     const char* dir_path,
@@ -48,6 +52,8 @@ int fossil_shark_dedupe(
     bool interactive,
     bool delete_files,
     bool link_files,
+    bool reflink_files,
+    bool chunk_report,
     const char* media /* "text", "json", "fson" */
 );
 
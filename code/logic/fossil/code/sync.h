@@ -32,17 +32,42 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Options for a sync run; zero-initialise and set what is needed.
+ */
+typedef struct fossil_shark_sync_options_s
+{
+    bool recursive;        /**< Include subdirectories */
+    bool update;           /**< Copy only newer files */
+    bool delete_flag;      /**< Remove extraneous files from target */
+    bool delta;            /**< Rewrite only the changed blocks of existing files */
+    bool checksum;         /**< Decide by content hash instead of size and mtime */
+    bool manifest;         /**< Keep a binary manifest in dest and compare against it */
+    bool dry_run;          /**< Print the planned actions without applying them */
+    bool two_way;          /**< Propagate changes both ways, tracking state in each root; conflicts are reported */
+    ccstring changes_file; /**< Optional list of changed paths; skips the tree walk */
+    ccstring plan_out;     /**< Optional file to write the plan to instead of applying it */
+    ccstring plan_in;      /**< Optional plan file to apply instead of planning (src may be null) */
+    ccstring remote_cmd;   /**< Optional command that reaches the far side (e.g. "ssh host shark");
+                                dest is then a path on that side, served by `sync --server` */
+} fossil_shark_sync_options_t;
+
 /**
  * Synchronize files or directories between source and destination
- * @param src Source path
+ * @param src Source path (may be null when opts->plan_in is set)
  * @param dest Destination path
- * @param recursive Include subdirectories
- * @param update Copy only newer files
- * @param delete Remove extraneous files from target
+ * @param opts Sync options; null means all defaults
+ * @return 0 on success, non-zero on error
+ */
+int fossil_shark_sync(ccstring src, ccstring dest, const fossil_shark_sync_options_t *opts);
+
+/**
+ * Serve a remote sync: speak the sync protocol on stdin/stdout and apply
+ * the client's changes under dest. Nothing else may write to stdout.
+ * @param dest Destination directory on this side
  * @return 0 on success, non-zero on error
  */
-int fossil_shark_sync(ccstring src, ccstring dest,
-                        bool recursive, bool update, bool delete);
+int fossil_shark_sync_server(ccstring dest);
 
 #ifdef __cplusplus
 }
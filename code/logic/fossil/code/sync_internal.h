@@ -0,0 +1,360 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#ifndef FOSSIL_APP_SYNC_INTERNAL_H
+#define FOSSIL_APP_SYNC_INTERNAL_H
+
+#include "sync.h"
+#include "throttle.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/*
+ * Shared between the sync translation units; not part of the command API.
+ * fossil_shark_sync() and the executor live in sync.c, the rest is split
+ * by stage below.
+ */
+
+#define DELTA_MIN_BLOCK (4 * 1024)
+#define DELTA_MAX_BLOCK (1024 * 1024)
+#define DELTA_BUFFER (4 * 1024 * 1024)
+
+/*
+ * Delta transfer in the rsync style. The destination is cut into fixed
+ * blocks, each with a rolling weak sum and a 128-bit strong hash. The
+ * source is scanned with a rolling window; a weak hit is confirmed with
+ * the strong hash and becomes a block copy, everything else is literal.
+ * When every match sits at its own offset the destination is patched in
+ * place, otherwise it is rebuilt through a temp file.
+ */
+typedef struct
+{
+    size_t block;     // block size in bytes
+    size_t count;     // number of full blocks in the destination
+    uint32_t *weak;
+    uint64_t *strong; // two words per block
+    uint32_t *head;   // weak-sum buckets, block index + 1
+    uint32_t *next;   // chain of blocks sharing a bucket, index + 1
+    size_t mask;
+} delta_sig_t;
+
+typedef struct
+{
+    uint64_t src_off;
+    uint64_t len;
+    int64_t block; // -1 for literal data taken from the source
+} delta_op_t;
+
+typedef struct
+{
+    delta_op_t *ops;
+    size_t count;
+    size_t cap;
+} delta_ops_t;
+
+#define DIGEST_BLOCK (1024 * 1024)
+
+#define MANIFEST_NAME ".shark-manifest"
+#define BISYNC_NAME ".shark-bisync"
+#define MANIFEST_MAGIC "SHKMAN01"
+#define MANIFEST_VERSION 1
+#define SYNC_LIST_INITIAL 256
+
+/*
+ * Sync manifest. Stored in the destination root and describes the source
+ * as of the last successful sync: a header, fixed-size records sorted by
+ * relative path, then the path strings. It is mapped read-only on the
+ * next run so unchanged files are settled without touching the
+ * destination. Native byte order; it is a local cache, not an exchange
+ * format.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t strings;
+} manifest_header_t;
+
+typedef struct
+{
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t digest[2]; // zero when the content was never hashed
+    uint32_t path_off;
+    uint32_t path_len;
+    uint32_t type;
+    uint32_t reserved;
+} manifest_rec_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+    const manifest_rec_t *recs;
+    uint32_t count;
+    const char *strings;
+    uint8_t *seen; // one flag per record touched by this run
+} manifest_t;
+
+typedef struct
+{
+    cstring path;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t digest[2];
+    uint32_t type;
+    size_t seq;
+    bool dropped; // its action failed; leave it out so the next run retries
+} manifest_entry_t;
+
+/*
+ * Rename detection. With --delete, files new to the destination are held
+ * back until the walk is over, and files about to be deleted are
+ * collected. A new file whose size and digest match a doomed one is
+ * moved into place instead of copied.
+ */
+typedef struct
+{
+    cstring src;
+    cstring dest;
+    cstring rel;
+    uint64_t size;
+    int64_t mtime_ns;
+} sync_pending_t;
+
+typedef struct
+{
+    cstring path;
+    uint64_t size;
+    uint64_t digest[2];
+    bool hashed;
+    bool used;
+} sync_doomed_t;
+
+/*
+ * Planner/executor split. The planner walks both trees and records what
+ * has to happen as a flat action list; nothing on disk changes until the
+ * executor runs it. The list can be printed (--dry-run), written out
+ * (--plan-out) and applied later (--plan-in).
+ */
+enum
+{
+    SYNC_MKDIR,
+    SYNC_COPY,
+    SYNC_DELTA,
+    SYNC_CHMOD,
+    SYNC_RENAME,
+    SYNC_DELETE,
+    SYNC_RMDIR,
+    SYNC_ACTION_KINDS
+};
+
+typedef struct
+{
+    int kind;
+    cstring dest;  // path the action creates, changes or removes
+    cstring src;   // copy/delta: source file; rename: source whose mtime is stamped
+    cstring from;  // rename: existing destination file to move
+    uint32_t mode; // copy/chmod: permission bits
+    size_t slot;   // manifest entry to drop on failure, SIZE_MAX for none
+} sync_action_t;
+
+extern const char *const sync_action_names[SYNC_ACTION_KINDS];
+
+// Same-size pair whose content decides (--checksum); hashed in parallel
+typedef struct
+{
+    cstring src;
+    cstring dest;
+    uint32_t src_mode;
+    uint32_t dest_mode;
+    size_t slot;
+    uint64_t digest[2];
+    bool same;
+} sync_verify_t;
+
+typedef struct
+{
+    bool recursive;
+    bool update;
+    bool delete_flag;
+    bool delta;
+    bool checksum;
+    bool use_manifest;
+    bool loaded;
+    manifest_t old;
+    manifest_entry_t *entries;
+    size_t count;
+    size_t cap;
+    sync_pending_t *pending;
+    size_t pending_count;
+    size_t pending_cap;
+    sync_doomed_t *doomed;
+    size_t doomed_count;
+    size_t doomed_cap;
+    cstring *doomed_dirs;
+    size_t doomed_dir_count;
+    size_t doomed_dir_cap;
+    sync_action_t *actions;
+    size_t action_count;
+    size_t action_cap;
+    sync_verify_t *verify;
+    size_t verify_count;
+    size_t verify_cap;
+    size_t *jobs; // action, verify or subtree indices handed to the worker pool
+    size_t job_count;
+    size_t next_job;
+    struct sync_scan_s *scan; // top-level subtrees planned in parallel, if any
+    int errors;
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} sync_ctx_t;
+
+/*
+ * Two-way sync. Each root keeps its own state from the last run in
+ * BISYNC_NAME, in the manifest format. A path has changed on a side when
+ * its type, size or mtime differs from that side's record, so paths that
+ * changed nowhere are settled from the stat data alone and only the
+ * changes are compared, hashed or copied. A change on one side is copied
+ * to the other; changes on both sides are a conflict unless the contents
+ * ended up identical. Conflicting paths are left alone and keep their old
+ * records, so they are reported again until resolved.
+ */
+typedef struct
+{
+    cstring rel;
+    uint32_t type;
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t digest[2]; // remote listings with --checksum only
+} bisync_item_t;
+
+typedef struct
+{
+    size_t action; // index of the planned rmdir
+    int side;      // the side the directory was deleted on
+} bisync_doomed_t;
+
+typedef struct
+{
+    ccstring root[2];
+    bisync_item_t *items[2];
+    size_t count[2];
+    size_t cap[2];
+    sync_ctx_t state[2]; // old records loaded from each root, new ones pushed
+    bisync_doomed_t *doomed; // planned rmdir actions enclosing the current path
+    size_t doomed_depth;
+    size_t doomed_cap;
+    size_t conflicts;
+    bool flat; // top level only
+} bisync_t;
+
+#define SYNC_MAX_WORKERS 8
+
+typedef void (*sync_job_fn)(sync_ctx_t *ctx, size_t index);
+
+/* ==========================================================================
+    * Delta transfer, mtimes and content digests (sync_delta.c)
+    * ========================================================================== */
+
+size_t delta_block_size(uint64_t size);
+void delta_sig_free(delta_sig_t *sig);
+int delta_sig_alloc(delta_sig_t *sig);
+int delta_sig_index(delta_sig_t *sig);
+int delta_signature(ccstring path, uint64_t size, size_t block, delta_sig_t *sig);
+int delta_match(ccstring src, uint64_t src_size, const delta_sig_t *sig, delta_ops_t *list);
+int sync_delta(ccstring src, ccstring dest, uint64_t src_size, uint64_t dest_size);
+int64_t sync_mtime_ns(ccstring path, const fossil_io_filesys_obj_t *obj);
+void sync_set_mtime(ccstring path, int64_t ns);
+void sync_copy_mtime(ccstring src, ccstring dest, const fossil_io_filesys_obj_t *src_obj);
+int sync_digest(ccstring path, uint64_t out[2]);
+
+/* ==========================================================================
+    * Manifest (sync_manifest.c)
+    * ========================================================================== */
+
+void manifest_unload(manifest_t *m);
+int manifest_load(ccstring path, manifest_t *m);
+uint32_t manifest_lower(const manifest_t *m, ccstring key, size_t len);
+int64_t manifest_find(const manifest_t *m, ccstring rel);
+size_t manifest_push(sync_ctx_t *ctx, ccstring rel, size_t rel_len, uint64_t size,
+                     int64_t mtime_ns, const uint64_t digest[2], uint32_t type);
+void manifest_carry(sync_ctx_t *ctx, uint32_t i);
+int manifest_save(sync_ctx_t *ctx, ccstring dest, ccstring name);
+
+/* ==========================================================================
+    * Planner and plan files (sync_plan.c)
+    * ========================================================================== */
+
+fossil_io_filesys_obj_t *sync_list(ccstring path, size_t *count);
+void sync_join(char *out, size_t out_len, ccstring dir, ccstring name);
+bool sync_reserve(void **items, size_t *cap, size_t count, size_t size);
+void sync_lock(sync_ctx_t *ctx);
+void sync_unlock(sync_ctx_t *ctx);
+void sync_plan(sync_ctx_t *ctx, int kind, ccstring dest, ccstring src, ccstring from,
+               uint32_t mode, size_t slot);
+void sync_plan_file(sync_ctx_t *ctx, ccstring src, ccstring dest,
+                    const fossil_io_filesys_obj_t *src_obj, size_t slot);
+bool sync_state_file(ccstring name, ccstring base);
+void sync_tree(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring rel);
+void sync_finish_manifest(sync_ctx_t *ctx, ccstring dest);
+bool sync_rel_safe(ccstring rel);
+void sync_changes(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring changes_file);
+void sync_resolve(sync_ctx_t *ctx);
+void sync_ctx_free(sync_ctx_t *ctx);
+void sync_print_plan(const sync_ctx_t *ctx);
+int sync_write_plan(const sync_ctx_t *ctx, ccstring path);
+int sync_read_plan(sync_ctx_t *ctx, ccstring path);
+
+/* ==========================================================================
+    * Executor (sync.c)
+    * ========================================================================== */
+
+void sync_parallel(sync_ctx_t *ctx, sync_job_fn fn);
+bool sync_jobs_alloc(sync_ctx_t *ctx, size_t count);
+
+/* ==========================================================================
+    * Two-way sync (sync_bisync.c)
+    * ========================================================================== */
+
+int bisync_path_cmp(ccstring a, ccstring b);
+int bisync_item_cmp(const void *lhs, const void *rhs);
+void bisync_scan(sync_ctx_t *ctx, bisync_t *bi, int side, ccstring dir, ccstring rel);
+void bisync_plan(sync_ctx_t *ctx, bisync_t *bi);
+int bisync_finish(sync_ctx_t *ctx, bisync_t *bi);
+void bisync_free(bisync_t *bi);
+
+/* ==========================================================================
+    * Remote sync (sync_remote.c)
+    * ========================================================================== */
+
+int sync_remote(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring remote_cmd, bool dry_run);
+
+#endif /* FOSSIL_APP_SYNC_INTERNAL_H */
@@ -0,0 +1,113 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#ifndef FOSSIL_APP_THROTTLE_H
+#define FOSSIL_APP_THROTTLE_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* ==========================================================================
+    * I/O Throttling
+    * ========================================================================== */
+
+/**
+ * @brief Configure the process-wide I/O limiter.
+ *
+ * One limiter is shared by every bulk data path (sync, copy, merge and
+ * archive), including sync's worker threads, so the limits hold for the
+ * process as a whole. Bandwidth counts bytes read plus bytes written; IOPS
+ * counts read and write calls. Passing 0 for both disables throttling.
+ *
+ * @param bytes_per_sec Bandwidth cap in bytes per second, 0 for none
+ * @param ops_per_sec Operation cap per second, 0 for none
+ * @param adaptive Scale both caps down while measured read latency is elevated
+ */
+void fossil_shark_throttle_set(uint64_t bytes_per_sec, uint64_t ops_per_sec, bool adaptive);
+
+/**
+ * @brief Report whether any limit is configured.
+ */
+bool fossil_shark_throttle_active(void);
+
+/**
+ * @brief Parse a rate such as "512", "64K", "10M" or "1G" (binary units).
+ *
+ * @return The rate, or 0 if the text is not a positive number
+ */
+uint64_t fossil_shark_throttle_parse_rate(ccstring text);
+
+/**
+ * @brief Read up to size bytes, waiting for the limiter first.
+ *
+ * @return Number of bytes read
+ */
+size_t fossil_shark_throttle_read(fossil_io_filesys_file_t *file, void *buffer, size_t size);
+
+/**
+ * @brief Write size bytes, waiting for the limiter first.
+ *
+ * @return Number of bytes written
+ */
+size_t fossil_shark_throttle_write(fossil_io_filesys_file_t *file, const void *buffer, size_t size);
+
+#ifndef _WIN32
+/**
+ * @brief Write size bytes to a POSIX descriptor, waiting for the limiter first.
+ *
+ * For callers that need the descriptor itself, e.g. to preallocate the file.
+ *
+ * @return Number of bytes written
+ */
+size_t fossil_shark_throttle_write_fd(int fd, const void *buffer, size_t size);
+#endif
+
+/**
+ * @brief Seek to an absolute offset that may not fit in a long.
+ *
+ * The filesystem layer seeks with a long, which is 32 bits on Windows and
+ * in 32-bit builds. Offsets past LONG_MAX are reached with relative steps
+ * from the start, so large files either land exactly or fail.
+ *
+ * @return 0 on success, non-zero on error
+ */
+int fossil_shark_file_seek(fossil_io_filesys_file_t *file, uint64_t offset);
+
+/**
+ * @brief Lower the process I/O priority for work the limiter cannot pace.
+ *
+ * Used where the I/O happens inside a library call (archive creation and
+ * extraction). Does nothing when no limit is configured.
+ */
+void fossil_shark_throttle_background(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FOSSIL_APP_THROTTLE_H */
@@ -32,16 +32,31 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Options for a watch; zero-initialise and set what is needed.
+ */
+typedef struct fossil_shark_watch_options_s
+{
+    ccstring roots_file; /**< Optional file listing more paths, one per line ('#' starts a comment) */
+    bool recursive;      /**< Monitor subdirectories */
+    ccstring events;     /**< Events to report ("create", "modify", "delete", "rename"), null for all */
+    int interval;        /**< Poll interval in seconds; 1 when not positive */
+    bool poll;           /**< Poll snapshots even where change notification is available */
+    int settle_ms;       /**< Quiet time in milliseconds before a batch of merged events is reported */
+    ccstring exec_cmd;   /**< Optional command run once per batch with the changed paths on stdin */
+    bool json;           /**< Print events as JSON lines with a sequence number, timestamp and root */
+    size_t queue_max;    /**< Events held before new ones are dropped and counted (0 for the default) */
+    size_t passes;       /**< Stop after this many poll passes; 0 watches until interrupted */
+} fossil_shark_watch_options_t;
+
 /**
  * Continuously monitor files or directories for changes
- * @param path Path to monitor
- * @param recursive Monitor subdirectories
- * @param events List of events to filter ("create", "modify", "delete")
- * @param interval Poll interval in seconds
+ * @param paths Paths to monitor, all served by one event loop
+ * @param path_count Number of entries in paths
+ * @param opts Watch options; null means all defaults
  * @return 0 on success, non-zero on error
  */
-int fossil_shark_watch(ccstring path, bool recursive,
-                        ccstring events, int interval);
+int fossil_shark_watch(ccstring *paths, size_t path_count, const fossil_shark_watch_options_t *opts);
 
 #ifdef __cplusplus
 }
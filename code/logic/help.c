@@ -341,6 +341,9 @@ int fossil_shark_help(ccstring command, ccstring ask, bool show_examples, bool f
         fossil_io_printf("  {cyan,bold}--verbose{normal}   - Enable detailed output\n");
         fossil_io_printf("  {cyan,bold}--color{normal}     - Colorize output where applicable\n");
         fossil_io_printf("  {cyan,bold}--clear{normal}     - Clear the terminal screen\n");
+        fossil_io_printf("  {cyan,bold}--bwlimit{normal}   - Cap disk bandwidth of sync/copy/merge/archive\n");
+        fossil_io_printf("  {cyan,bold}--iops-limit{normal} - Cap read/write operations per second\n");
+        fossil_io_printf("  {cyan,bold}--adaptive-io{normal} - Back off while read latency is elevated\n");
         fossil_io_printf("{black,italic}------------------------------------------------------------{normal}\n");
         return 0;
     }
@@ -465,21 +468,30 @@ int fossil_shark_help(ccstring command, ccstring ask, bool show_examples, bool f
             fossil_io_printf("  {cyan,bold}-c, --create{normal}        Create new archive\n");
             fossil_io_printf("  {cyan,bold}-x, --extract{normal}       Extract archive\n");
             fossil_io_printf("  {cyan,bold}-l, --list{normal}          List archive contents\n");
-            fossil_io_printf("  {cyan,bold}-f <format>{normal}         Format: zip/tar/gz\n");
+            fossil_io_printf("  {cyan,bold}-f <format>{normal}         Format: zip/tar/gz/zst\n");
             fossil_io_printf("  {cyan,bold}-p, --password <pw>{normal} Encrypt with password\n");
-            fossil_io_printf("  {cyan,bold}--stdout{normal}            Output to stdout\n");
-            fossil_io_printf("  {cyan,bold}--compress <n>{normal}      Compression level (0-9)\n");
+            fossil_io_printf("  {cyan,bold}--stdout{normal}            Stream a tar/gz/zst of <path> to stdout (- as path: extract/list stdin)\n");
+            fossil_io_printf("  {cyan,bold}--compress <n>{normal}      Compression level (0-9; 0-19 for zst)\n");
             fossil_io_printf("  {cyan,bold}--exclude <pat>{normal}     Exclude files\n");
+            fossil_io_printf("  {cyan,bold}-j, --threads <n>{normal}   Threads for tar.gz/zst, and to extract indexed archives (default: all CPUs)\n");
+            fossil_io_printf("  {cyan,bold}--index{normal}             Write a seekable <archive>.idx for fast list and --member\n");
+            fossil_io_printf("  {cyan,bold}--member <path>{normal}     Extract or list only this entry and what lies under it\n");
+            fossil_io_printf("  {cyan,bold}--long{normal}              Long-distance matching over a 128 MiB window (zst)\n");
+            fossil_io_printf("  {cyan,bold}--dict <file>{normal}       zstd dictionary; needed again to extract or list\n");
+            fossil_io_printf("  {cyan,bold}--train-dict{normal}        Train --dict on the files being archived (many small files)\n");
+            fossil_io_printf("  {cyan,bold}--incremental <file>{normal} Archive only changes since the manifest; with -x, restore the chain\n");
             fossil_io_printf("  {cyan,bold}--format{normal}          Pretty format\n");
         }
         else if (fossil_io_cstring_equals(command, "compare"))
         {
             fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}compare [options] <path1> <path2>{normal}\n");
             fossil_io_printf("{blue,bold,underline}Options:{normal}\n");
-            fossil_io_printf("  {cyan,bold}-t, --text{normal}       Line diff\n");
+            fossil_io_printf("  {cyan,bold}-t, --text{normal}       Unified line diff\n");
             fossil_io_printf("  {cyan,bold}-b, --binary{normal}     Binary diff\n");
             fossil_io_printf("  {cyan,bold}--context <n>{normal}    Context lines\n");
             fossil_io_printf("  {cyan,bold}--ignore-case{normal}    Ignore case\n");
+            fossil_io_printf("  {cyan,bold}--all{normal}            List every differing byte range\n");
+            fossil_io_printf("  {cyan,bold}-r, --recursive{normal}  Compare directory trees (jsonl)\n");
         }
         else if (fossil_io_cstring_equals(command, "help"))
         {
@@ -496,14 +508,29 @@ int fossil_shark_help(ccstring command, ccstring ask, bool show_examples, bool f
             fossil_io_printf("  {cyan,bold}-r, --recursive{normal}  Include subdirs\n");
             fossil_io_printf("  {cyan,bold}-u, --update{normal}     Only newer\n");
             fossil_io_printf("  {cyan,bold}--delete{normal}         Remove extraneous files\n");
+            fossil_io_printf("  {cyan,bold}--delta{normal}          Rewrite only changed blocks\n");
+            fossil_io_printf("  {cyan,bold}-c, --checksum{normal}   Compare content, not size+mtime\n");
+            fossil_io_printf("  {cyan,bold}--manifest{normal}       Keep a state manifest in dest\n");
+            fossil_io_printf("  {cyan,bold}--changes <file>{normal} Sync only the listed paths\n");
+            fossil_io_printf("  {cyan,bold}--dry-run{normal}        Print the plan, change nothing\n");
+            fossil_io_printf("  {cyan,bold}--plan-out <file>{normal} Write the plan instead of applying it\n");
+            fossil_io_printf("  {cyan,bold}--plan-in <file>{normal} Apply a saved plan (src may be omitted)\n");
+            fossil_io_printf("  {cyan,bold}--two-way{normal}        Propagate changes both ways, report conflicts\n");
+            fossil_io_printf("  {cyan,bold}--remote-cmd <cmd>{normal} Push to dest via `<cmd> sync --server`\n");
         }
         else if (fossil_io_cstring_equals(command, "watch"))
         {
-            fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}watch [options] <path>{normal}\n");
+            fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}watch [options] <path>...{normal}\n");
             fossil_io_printf("{blue,bold,underline}Options:{normal}\n");
             fossil_io_printf("  {cyan,bold}-r, --recursive{normal}      Include subdirs\n");
             fossil_io_printf("  {cyan,bold}-e, --events <list>{normal}  Event filter\n");
-            fossil_io_printf("  {cyan,bold}-t, --interval <n>{normal}   Poll interval\n");
+            fossil_io_printf("  {cyan,bold}-t, --interval <n>{normal}   Poll interval (when polling)\n");
+            fossil_io_printf("  {cyan,bold}--poll{normal}               Poll snapshots (network filesystems)\n");
+            fossil_io_printf("  {cyan,bold}--settle <ms>{normal}        Merge events until quiet this long (100)\n");
+            fossil_io_printf("  {cyan,bold}--exec <cmd>{normal}         Run per batch, changed paths on stdin\n");
+            fossil_io_printf("  {cyan,bold}--json{normal}               Print events as JSON lines (seq, ts, root)\n");
+            fossil_io_printf("  {cyan,bold}--roots <file>{normal}       Also watch the paths listed in file, one per line\n");
+            fossil_io_printf("  {cyan,bold}--queue <n>{normal}          Events held before new ones are dropped (65536)\n");
         }
         else if (fossil_io_cstring_equals(command, "rewrite"))
         {
@@ -579,6 +606,8 @@ int fossil_shark_help(ccstring command, ccstring ask, bool show_examples, bool f
             fossil_io_printf("  {cyan,bold}-i, --interactive{normal} Confirm deletions\n");
             fossil_io_printf("  {cyan,bold}-d, --delete{normal}     Remove duplicates\n");
             fossil_io_printf("  {cyan,bold}-l, --link{normal}       Replace duplicates with links\n");
+            fossil_io_printf("  {cyan,bold}--reflink{normal}        Share extents with original (btrfs/XFS)\n");
+            fossil_io_printf("  {cyan,bold}--chunks{normal}         Report block-level dedupe ratio\n");
             fossil_io_printf("  {cyan,bold}--media <text/fson/json>{normal}  Outputs as selected type text by default\n");
         }
         else if (fossil_io_cstring_equals(command, "link"))
@@ -652,6 +681,21 @@ int fossil_shark_help(ccstring command, ccstring ask, bool show_examples, bool f
             fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}--clear{normal}\n");
             fossil_io_printf("{blue,bold,underline}Description:{normal} Clear the terminal screen\n");
         }
+        else if (fossil_io_cstring_equals(command, "--bwlimit"))
+        {
+            fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}--bwlimit <rate> <command> ...{normal}\n");
+            fossil_io_printf("{blue,bold,underline}Description:{normal} Cap bytes read plus written per second by sync, copy and merge (suffixes K, M, G); archive runs at idle I/O priority\n");
+        }
+        else if (fossil_io_cstring_equals(command, "--iops-limit"))
+        {
+            fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}--iops-limit <n> <command> ...{normal}\n");
+            fossil_io_printf("{blue,bold,underline}Description:{normal} Cap read and write operations per second for sync, copy and merge\n");
+        }
+        else if (fossil_io_cstring_equals(command, "--adaptive-io"))
+        {
+            fossil_io_printf("{blue,bold,underline}Usage:{normal} {green}--adaptive-io --bwlimit <rate> <command> ...{normal}\n");
+            fossil_io_printf("{blue,bold,underline}Description:{normal} Scale the configured limits down (to 1/16) while read latency is well above its baseline\n");
+        }
         else
         {
             fossil_io_fprintf(FOSSIL_STDERR, "{red,bold,blink}Unknown command: %s{normal}\n", command);
@@ -23,6 +23,7 @@
  * -----------------------------------------------------------------------------
  */
 #include "fossil/code/merge.h"
+#include "fossil/code/throttle.h"
 
 typedef int (*pattern_matcher)(const char *filename, const char *pattern);
 
@@ -66,9 +67,9 @@ static int copy_file(const char *src, const char *dest, bool force)
 
     char buffer[8192];
     size_t bytes;
-    while ((bytes = fossil_io_filesys_file_read(&src_stream, buffer, 1, sizeof(buffer))) > 0)
+    while ((bytes = fossil_shark_throttle_read(&src_stream, buffer, sizeof(buffer))) > 0)
     {
-        fossil_io_filesys_file_write(&dest_stream, buffer, 1, bytes);
+        fossil_shark_throttle_write(&dest_stream, buffer, bytes);
     }
 
     fossil_io_filesys_file_close(&src_stream);
@@ -101,9 +102,9 @@ static int merge_file(const char *src, const char *dest, bool force)
     char buffer[8192];
     size_t bytes;
 
-    while ((bytes = fossil_io_filesys_file_read(&src_stream, buffer, 1, sizeof(buffer))) > 0)
+    while ((bytes = fossil_shark_throttle_read(&src_stream, buffer, sizeof(buffer))) > 0)
     {
-        fossil_io_filesys_file_write(&dest_stream, buffer, 1, bytes);
+        fossil_shark_throttle_write(&dest_stream, buffer, bytes);
     }
 
     fossil_io_filesys_file_close(&src_stream);
@@ -24,6 +24,13 @@
  */
 #include "fossil/code/show.h"
 
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 #define INDENT_SIZE 4
 
 static void print_size(size_t size, bool human_readable)
@@ -44,12 +51,13 @@ static void print_size(size_t size, bool human_readable)
     fossil_io_printf("{blue,underline}%.1f%s{normal} ", sz, units[i]);
 }
 
-static void print_permissions_advanced(const fossil_io_filesys_obj_t *obj)
+// Owner bits of mode, the way the library reports permissions
+static void print_permissions_advanced(unsigned mode)
 {
     fossil_io_printf("{yellow,bold}%c{normal}", '-');
-    fossil_io_printf("{green}%c{normal}", obj->perms.read ? 'r' : '-');
-    fossil_io_printf("{green}%c{normal}", obj->perms.write ? 'w' : '-');
-    fossil_io_printf("{green}%c{normal}", obj->perms.execute ? 'x' : '-');
+    fossil_io_printf("{green}%c{normal}", (mode & 0400) ? 'r' : '-');
+    fossil_io_printf("{green}%c{normal}", (mode & 0200) ? 'w' : '-');
+    fossil_io_printf("{green}%c{normal}", (mode & 0100) ? 'x' : '-');
     fossil_io_printf("{magenta}---{normal}");
     fossil_io_printf("{cyan}---{normal} ");
 }
@@ -83,35 +91,249 @@ static bool parse_size_filter(ccstring size_filter, size_t file_size)
     }
 }
 
-static bool matches_filters(const fossil_io_filesys_obj_t *entry, ccstring match_pattern,
-                            ccstring type_filter, ccstring size_filter)
+/*
+ * One directory level, read into a growing array with the names packed
+ * into one buffer. Names and types come from readdir (d_type), which
+ * costs no stat; size, mode and mtime are fetched only when the listing
+ * prints them or a size filter needs them, and only for entries that got
+ * past the name and type filters.
+ */
+typedef struct
 {
-    if (match_pattern && strstr(entry->path, match_pattern) == NULL)
-        return false;
-    if (type_filter)
+    size_t name;      // offset into show_dir_t.names
+    int type;         // FOSSIL_FILESYS_TYPE_*
+    uint64_t size;
+    uint64_t modified_at;
+    unsigned mode;
+} show_entry_t;
+
+typedef struct
+{
+    show_entry_t *entries;
+    size_t count;
+    size_t cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+} show_dir_t;
+
+// What the listing needs beyond names and types
+typedef struct
+{
+    bool show_all;
+    bool stat; // size, mode or mtime is printed or filtered on
+    bool mtime;
+    ccstring match_pattern;
+    ccstring size_filter;
+    ccstring type_filter;
+} show_filter_t;
+
+#define MAX_ENTRIES 1024
+
+static void show_dir_free(show_dir_t *dir)
+{
+    if (cnotnull(dir->entries))
+        fossil_sys_memory_free(dir->entries);
+    if (cnotnull(dir->names))
+        fossil_sys_memory_free(dir->names);
+    memset(dir, 0, sizeof(*dir));
+}
+
+static const char *show_name(const show_dir_t *dir, const show_entry_t *entry)
+{
+    return dir->names + entry->name;
+}
+
+// Append an entry named name; null when memory ran out
+static show_entry_t *show_dir_add(show_dir_t *dir, ccstring name, int type)
+{
+    size_t len = strlen(name) + 1;
+    if (dir->count == dir->cap)
     {
-        if (strcmp(type_filter, "file") == 0 && entry->type != FOSSIL_FILESYS_TYPE_FILE)
-            return false;
-        if (strcmp(type_filter, "dir") == 0 && entry->type != FOSSIL_FILESYS_TYPE_DIR)
-            return false;
-        if (strcmp(type_filter, "link") == 0 && entry->type != FOSSIL_FILESYS_TYPE_LINK)
-            return false;
+        size_t cap = dir->cap ? dir->cap * 2 : 64;
+        show_entry_t *grown = fossil_sys_memory_realloc(dir->entries, cap * sizeof(*grown));
+        if (!cnotnull(grown))
+            return cnull;
+        dir->entries = grown;
+        dir->cap = cap;
     }
-    if (!parse_size_filter(size_filter, entry->size))
+    if (dir->names_len + len > dir->names_cap)
+    {
+        size_t cap = dir->names_cap ? dir->names_cap * 2 : 4096;
+        while (cap < dir->names_len + len)
+            cap *= 2;
+        char *grown = fossil_sys_memory_realloc(dir->names, cap);
+        if (!cnotnull(grown))
+            return cnull;
+        dir->names = grown;
+        dir->names_cap = cap;
+    }
+    show_entry_t *entry = &dir->entries[dir->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = dir->names_len;
+    entry->type = type;
+    memcpy(dir->names + dir->names_len, name, len);
+    dir->names_len += len;
+    return entry;
+}
+
+static bool show_type_wanted(int type, ccstring type_filter)
+{
+    if (!type_filter)
+        return true;
+    if (strcmp(type_filter, "file") == 0)
+        return type == FOSSIL_FILESYS_TYPE_FILE;
+    if (strcmp(type_filter, "dir") == 0)
+        return type == FOSSIL_FILESYS_TYPE_DIR;
+    if (strcmp(type_filter, "link") == 0)
+        return type == FOSSIL_FILESYS_TYPE_LINK;
+    return true;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static int show_type_of(mode_t mode)
+{
+    return S_ISDIR(mode) ? FOSSIL_FILESYS_TYPE_DIR : S_ISLNK(mode) ? FOSSIL_FILESYS_TYPE_LINK : FOSSIL_FILESYS_TYPE_FILE;
+}
+
+// Size, mode and (when wanted) mtime of name in the directory fd, without following links
+static bool show_stat(int fd, ccstring name, bool mtime, show_entry_t *entry)
+{
+#if defined(__linux__) && defined(STATX_SIZE)
+    struct statx stx;
+    unsigned mask = STATX_MODE | STATX_SIZE | (mtime ? STATX_MTIME : 0);
+    if (statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) != 0)
         return false;
+    entry->size = stx.stx_size;
+    entry->mode = stx.stx_mode & 07777;
+    entry->modified_at = mtime ? (uint64_t)stx.stx_mtime.tv_sec : 0;
+#else
+    (void)mtime;
+    struct stat st;
+    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return false;
+    entry->size = (uint64_t)st.st_size;
+    entry->mode = (unsigned)(st.st_mode & 07777);
+    entry->modified_at = (uint64_t)st.st_mtime;
+#endif
     return true;
 }
 
-#define MAX_ENTRIES 1024
+// The entries of path that pass the filters, in directory order
+static int32_t show_read_dir(ccstring path, const show_filter_t *filter, show_dir_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    DIR *dir = opendir(path);
+    if (!cnotnull(dir))
+        return -errno;
+    int fd = dirfd(dir);
+    int32_t result = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != cnull)
+    {
+        ccstring name = ent->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+        if (!filter->show_all && name[0] == '.')
+            continue;
+        if (filter->match_pattern && strstr(name, filter->match_pattern) == NULL)
+            continue;
 
-static int show_list(ccstring path, bool show_all, bool long_format,
-                     bool human_readable, bool recursive, ccstring format,
-                     bool show_time, int depth, ccstring sort_key,
-                     ccstring match_pattern, ccstring size_filter, ccstring type_filter)
+        struct stat st;
+        int type = ent->d_type == DT_DIR   ? FOSSIL_FILESYS_TYPE_DIR
+                   : ent->d_type == DT_LNK ? FOSSIL_FILESYS_TYPE_LINK
+                                           : FOSSIL_FILESYS_TYPE_FILE;
+        if (ent->d_type == DT_UNKNOWN)
+        {
+            // Some filesystems leave d_type unset
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = show_type_of(st.st_mode);
+        }
+        if (!show_type_wanted(type, filter->type_filter))
+            continue;
+
+        show_entry_t *entry = show_dir_add(out, name, type);
+        if (!cnotnull(entry))
+        {
+            result = -ENOMEM;
+            break;
+        }
+        if (filter->stat && !show_stat(fd, name, filter->mtime, entry))
+        {
+            out->count--; // gone since readdir
+            continue;
+        }
+        if (!parse_size_filter(filter->size_filter, (size_t)entry->size))
+            out->count--;
+    }
+    closedir(dir);
+    if (result < 0)
+        show_dir_free(out);
+    return result;
+}
+#else
+// The last component of path, after either kind of separator
+static ccstring show_base_name(ccstring path)
+{
+    ccstring base = path;
+    for (ccstring c = path; *c; c++)
+    {
+        if ((*c == '/' || *c == '\\') && c[1] != '\0')
+            base = c + 1;
+    }
+    return base;
+}
+
+static int32_t show_read_dir(ccstring path, const show_filter_t *filter, show_dir_t *out)
 {
-    fossil_io_filesys_obj_t entries[MAX_ENTRIES];
+    memset(out, 0, sizeof(*out));
+    fossil_io_filesys_obj_t *objs = fossil_sys_memory_alloc(MAX_ENTRIES * sizeof(*objs));
+    if (!cnotnull(objs))
+        return -ENOMEM;
     size_t count = 0;
-    int32_t list_result = fossil_io_filesys_dir_list(path, entries, MAX_ENTRIES, &count);
+    int32_t result = fossil_io_filesys_dir_list(path, objs, MAX_ENTRIES, &count);
+    for (size_t i = 0; result >= 0 && i < count; ++i)
+    {
+        const fossil_io_filesys_obj_t *obj = &objs[i];
+        // dir_list hands back full paths; the filters and show_child want the entry name
+        ccstring name = show_base_name(obj->path);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || (!filter->show_all && name[0] == '.'))
+            continue;
+        if ((filter->match_pattern && strstr(name, filter->match_pattern) == NULL) ||
+            !show_type_wanted(obj->type, filter->type_filter) ||
+            !parse_size_filter(filter->size_filter, obj->size))
+            continue;
+        show_entry_t *entry = show_dir_add(out, name, obj->type);
+        if (!cnotnull(entry))
+        {
+            result = -ENOMEM;
+            break;
+        }
+        entry->size = obj->size;
+        entry->modified_at = (uint64_t)obj->modified_at;
+        entry->mode = (obj->perms.read ? 0400 : 0) | (obj->perms.write ? 0200 : 0) | (obj->perms.execute ? 0100 : 0);
+    }
+    fossil_sys_memory_free(objs);
+    if (result < 0)
+        show_dir_free(out);
+    return result;
+}
+#endif
+
+// Path of a child of path; false when it does not fit
+static bool show_child(char *child, size_t size, ccstring path, ccstring name)
+{
+    int n = snprintf(child, size, "%s/%s", path, name);
+    return n >= 0 && (size_t)n < size;
+}
+
+static int show_list(ccstring path, const show_filter_t *filter, bool long_format,
+                     bool human_readable, bool recursive, ccstring format,
+                     bool show_time, int depth, ccstring sort_key)
+{
+    show_dir_t dir;
+    int32_t list_result = show_read_dir(path, filter, &dir);
     if (list_result < 0)
         return list_result;
 
@@ -120,14 +342,10 @@ static int show_list(ccstring path, bool show_all, bool long_format,
         fossil_io_printf("{bold,underline,blue}Directory Listing: %s{normal}\n", path);
     }
 
-    for (size_t i = 0; i < count; ++i)
+    for (size_t i = 0; i < dir.count; ++i)
     {
-        fossil_io_filesys_obj_t *entry = &entries[i];
-        const char *name = entry->path;
-        if (!show_all && name[0] == '.')
-            continue;
-        if (!matches_filters(entry, match_pattern, type_filter, size_filter))
-            continue;
+        const show_entry_t *entry = &dir.entries[i];
+        const char *name = show_name(&dir, entry);
 
         for (int j = 0; j < depth; ++j)
         {
@@ -136,7 +354,7 @@ static int show_list(ccstring path, bool show_all, bool long_format,
 
         if (long_format)
         {
-            print_permissions_advanced(entry);
+            print_permissions_advanced(entry->mode);
             print_size(entry->size, human_readable);
             if (show_time)
             {
@@ -156,26 +374,25 @@ static int show_list(ccstring path, bool show_all, bool long_format,
 
         fossil_io_printf("{cyan}%s{normal}\n", name);
 
-        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR &&
-            strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        char child[FOSSIL_FILESYS_MAX_PATH];
+        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR && show_child(child, sizeof(child), path, name))
         {
-            show_list(entry->path, show_all, long_format, human_readable, recursive, format,
-                      show_time, depth + 1, sort_key, match_pattern, size_filter, type_filter);
+            show_list(child, filter, long_format, human_readable, recursive, format,
+                      show_time, depth + 1, sort_key);
         }
     }
 
+    show_dir_free(&dir);
     fossil_io_flush();
     return 0;
 }
 
-static int show_tree(ccstring path, bool show_all, bool long_format,
+static int show_tree(ccstring path, const show_filter_t *filter, bool long_format,
                      bool human_readable, bool recursive, ccstring format,
-                     bool show_time, int depth, ccstring sort_key,
-                     ccstring match_pattern, ccstring size_filter, ccstring type_filter)
+                     bool show_time, int depth, ccstring sort_key)
 {
-    fossil_io_filesys_obj_t entries[MAX_ENTRIES];
-    size_t count = 0;
-    int32_t list_result = fossil_io_filesys_dir_list(path, entries, MAX_ENTRIES, &count);
+    show_dir_t dir;
+    int32_t list_result = show_read_dir(path, filter, &dir);
     if (list_result < 0)
         return list_result;
 
@@ -184,14 +401,10 @@ static int show_tree(ccstring path, bool show_all, bool long_format,
         fossil_io_printf("{bold,underline,blue}Directory Tree: %s{normal}\n", path);
     }
 
-    for (size_t i = 0; i < count; ++i)
+    for (size_t i = 0; i < dir.count; ++i)
     {
-        fossil_io_filesys_obj_t *entry = &entries[i];
-        const char *name = entry->path;
-        if (!show_all && name[0] == '.')
-            continue;
-        if (!matches_filters(entry, match_pattern, type_filter, size_filter))
-            continue;
+        const show_entry_t *entry = &dir.entries[i];
+        const char *name = show_name(&dir, entry);
 
         for (int j = 0; j < depth; ++j)
         {
@@ -201,7 +414,7 @@ static int show_tree(ccstring path, bool show_all, bool long_format,
 
         if (long_format)
         {
-            print_permissions_advanced(entry);
+            print_permissions_advanced(entry->mode);
             print_size(entry->size, human_readable);
             if (show_time)
             {
@@ -221,26 +434,25 @@ static int show_tree(ccstring path, bool show_all, bool long_format,
 
         fossil_io_printf("{cyan}%s{normal}\n", name);
 
-        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR &&
-            strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        char child[FOSSIL_FILESYS_MAX_PATH];
+        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR && show_child(child, sizeof(child), path, name))
         {
-            show_tree(entry->path, show_all, long_format, human_readable, recursive, format,
-                      show_time, depth + 1, sort_key, match_pattern, size_filter, type_filter);
+            show_tree(child, filter, long_format, human_readable, recursive, format,
+                      show_time, depth + 1, sort_key);
         }
     }
 
+    show_dir_free(&dir);
     fossil_io_flush();
     return 0;
 }
 
-static int show_graph(ccstring path, bool show_all, bool long_format,
+static int show_graph(ccstring path, const show_filter_t *filter, bool long_format,
                       bool human_readable, bool recursive, ccstring format,
-                      bool show_time, int depth, ccstring sort_key,
-                      ccstring match_pattern, ccstring size_filter, ccstring type_filter)
+                      bool show_time, int depth, ccstring sort_key)
 {
-    fossil_io_filesys_obj_t entries[MAX_ENTRIES];
-    size_t count = 0;
-    int32_t list_result = fossil_io_filesys_dir_list(path, entries, MAX_ENTRIES, &count);
+    show_dir_t dir;
+    int32_t list_result = show_read_dir(path, filter, &dir);
     if (list_result < 0)
         return list_result;
 
@@ -249,14 +461,10 @@ static int show_graph(ccstring path, bool show_all, bool long_format,
         fossil_io_printf("{bold,underline,blue}Directory Graph: %s{normal}\n", path);
     }
 
-    for (size_t i = 0; i < count; ++i)
+    for (size_t i = 0; i < dir.count; ++i)
     {
-        fossil_io_filesys_obj_t *entry = &entries[i];
-        const char *name = entry->path;
-        if (!show_all && name[0] == '.')
-            continue;
-        if (!matches_filters(entry, match_pattern, type_filter, size_filter))
-            continue;
+        const show_entry_t *entry = &dir.entries[i];
+        const char *name = show_name(&dir, entry);
 
         for (int j = 0; j < depth; ++j)
         {
@@ -266,7 +474,7 @@ static int show_graph(ccstring path, bool show_all, bool long_format,
 
         if (long_format)
         {
-            print_permissions_advanced(entry);
+            print_permissions_advanced(entry->mode);
             print_size(entry->size, human_readable);
             if (show_time)
             {
@@ -275,14 +483,15 @@ static int show_graph(ccstring path, bool show_all, bool long_format,
         }
         fossil_io_printf("{magenta}%s{normal}\n", name);
 
-        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR &&
-            strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        char child[FOSSIL_FILESYS_MAX_PATH];
+        if (recursive && entry->type == FOSSIL_FILESYS_TYPE_DIR && show_child(child, sizeof(child), path, name))
         {
-            show_graph(entry->path, show_all, long_format, human_readable, recursive, format,
-                       show_time, depth + 1, sort_key, match_pattern, size_filter, type_filter);
+            show_graph(child, filter, long_format, human_readable, recursive, format,
+                       show_time, depth + 1, sort_key);
         }
     }
 
+    show_dir_free(&dir);
     fossil_io_flush();
     return 0;
 }
@@ -311,18 +520,22 @@ int fossil_shark_show(ccstring path, bool show_all, bool long_format,
 
     fossil_io_clear_screen();
 
+    // Entries are only stat'ed when something below prints or filters on the result
+    show_filter_t filter = {show_all, long_format || size_filter != NULL, long_format && show_time,
+                            match_pattern, size_filter, type_filter};
+
     int result = 0;
     if (cunlikely(!format) || fossil_io_cstring_equals(format, "list"))
     {
-        result = show_list(path, show_all, long_format, human_readable, recursive, format, show_time, depth, sort_key, match_pattern, size_filter, type_filter);
+        result = show_list(path, &filter, long_format, human_readable, recursive, format, show_time, depth, sort_key);
     }
     else if (fossil_io_cstring_equals(format, "tree"))
     {
-        result = show_tree(path, show_all, long_format, human_readable, recursive, format, show_time, depth, sort_key, match_pattern, size_filter, type_filter);
+        result = show_tree(path, &filter, long_format, human_readable, recursive, format, show_time, depth, sort_key);
     }
     else if (fossil_io_cstring_equals(format, "graph"))
     {
-        result = show_graph(path, show_all, long_format, human_readable, recursive, format, show_time, depth, sort_key, match_pattern, size_filter, type_filter);
+        result = show_graph(path, &filter, long_format, human_readable, recursive, format, show_time, depth, sort_key);
     }
     else
     {
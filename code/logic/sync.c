@@ -22,142 +22,396 @@
  * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
  * -----------------------------------------------------------------------------
  */
-#include "fossil/code/sync.h"
+#include "fossil/code/sync_internal.h"
 
-#define PATH_MAX_LEN 1024
-
-static int compute_file_hash(ccstring path, char *hash_out, size_t hash_out_len)
+typedef struct
 {
-    // Use SHA256 for demonstration; adjust as needed
-    unsigned char hash_bin[32];
-    int rc = fossil_io_filesys_file_hash(path, hash_bin, sizeof(hash_bin), "sha256");
-    if (rc != 0)
-        return rc;
+    sync_ctx_t *ctx;
+    sync_job_fn fn;
+} sync_pool_t;
 
-    // Convert binary hash to hex string
-    for (size_t i = 0; i < sizeof(hash_bin) && (i * 2 + 1) < hash_out_len; ++i)
-        sprintf(hash_out + i * 2, "%02x", hash_bin[i]);
-    hash_out[sizeof(hash_bin) * 2] = '\0';
-    return 0;
+static void *sync_worker(void *arg)
+{
+    sync_pool_t *pool = arg;
+    sync_ctx_t *ctx = pool->ctx;
+    for (;;)
+    {
+        sync_lock(ctx);
+        size_t at = ctx->next_job < ctx->job_count ? ctx->next_job++ : ctx->job_count;
+        sync_unlock(ctx);
+        if (at == ctx->job_count)
+            break;
+        pool->fn(ctx, ctx->jobs[at]);
+    }
+    return cnull;
 }
 
-static int sync_file(ccstring src, ccstring dest, bool update)
+// Run fn over ctx->jobs on a small thread pool (serially on Windows)
+void sync_parallel(sync_ctx_t *ctx, sync_job_fn fn)
 {
-    fossil_io_filesys_obj_t src_obj, dest_obj;
-    int rc = fossil_io_filesys_stat(src, &src_obj);
-    if (rc != 0)
+    sync_pool_t pool = {ctx, fn};
+    ctx->next_job = 0;
+#ifndef _WIN32
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 0 ? (size_t)cpus : 1;
+    if (workers > SYNC_MAX_WORKERS)
+        workers = SYNC_MAX_WORKERS;
+    if (workers > ctx->job_count)
+        workers = ctx->job_count;
+
+    pthread_t threads[SYNC_MAX_WORKERS];
+    size_t started = 0;
+    for (; started + 1 < workers; started++)
     {
-        perror("stat src");
-        return rc;
+        if (pthread_create(&threads[started], cnull, sync_worker, &pool) != 0)
+            break;
     }
+    sync_worker(&pool);
+    for (size_t t = 0; t < started; t++)
+        pthread_join(threads[t], cnull);
+#else
+    sync_worker(&pool);
+#endif
+}
+
+bool sync_jobs_alloc(sync_ctx_t *ctx, size_t count)
+{
+    if (cnotnull(ctx->jobs))
+        fossil_sys_memory_free(ctx->jobs);
+    ctx->jobs = fossil_sys_memory_alloc((count ? count : 1) * sizeof(size_t));
+    ctx->job_count = 0;
+    return cnotnull(ctx->jobs);
+}
 
-    rc = fossil_io_filesys_stat(dest, &dest_obj);
-    bool dest_exists = (rc == 0);
+static void sync_verify_job(sync_ctx_t *ctx, size_t index)
+{
+    sync_verify_t *v = &ctx->verify[index];
+    uint64_t other[2];
+    v->same = sync_digest(v->src, v->digest) == 0 && sync_digest(v->dest, other) == 0 &&
+              v->digest[0] == other[0] && v->digest[1] == other[1];
+}
 
-    if (dest_exists && update)
+// Hash every --checksum candidate pair, then plan the ones that differ
+static void sync_run_verify(sync_ctx_t *ctx)
+{
+    if (ctx->verify_count == 0)
+        return;
+    if (!sync_jobs_alloc(ctx, ctx->verify_count))
     {
-        if (dest_obj.modified_at >= src_obj.modified_at)
+        ctx->errors++;
+        return;
+    }
+    for (size_t i = 0; i < ctx->verify_count; i++)
+        ctx->jobs[ctx->job_count++] = i;
+    sync_parallel(ctx, sync_verify_job);
+
+    for (size_t i = 0; i < ctx->verify_count; i++)
+    {
+        sync_verify_t *v = &ctx->verify[i];
+        if (v->slot != SIZE_MAX)
         {
-            // Destination is newer, skip
-            return 0;
+            ctx->entries[v->slot].digest[0] = v->digest[0];
+            ctx->entries[v->slot].digest[1] = v->digest[1];
         }
+        if (!v->same)
+        {
+            sync_plan(ctx, ctx->delta ? SYNC_DELTA : SYNC_COPY, v->dest, v->src, cnull, v->src_mode, v->slot);
+        }
+#ifndef _WIN32
+        else if (v->src_mode != v->dest_mode)
+        {
+            sync_plan(ctx, SYNC_CHMOD, v->dest, cnull, cnull, v->src_mode, v->slot);
+        }
+#endif
+    }
+}
+
+// Whole-file copy; streamed through the limiter when one is configured
+static int sync_copy(ccstring src, ccstring dest)
+{
+    if (!fossil_shark_throttle_active())
+        return fossil_io_filesys_copy(src, dest, true);
+
+    uint8_t *buf = fossil_sys_memory_alloc(DIGEST_BLOCK);
+    if (!cnotnull(buf))
+        return -1;
+    fossil_io_filesys_file_t in, out;
+    if (fossil_io_filesys_file_open(&in, src, "rb") != 0)
+    {
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+    if (fossil_io_filesys_file_open(&out, dest, "wb") != 0)
+    {
+        fossil_io_filesys_file_close(&in);
+        fossil_sys_memory_free(buf);
+        return -1;
     }
 
-    // Compare hashes, skip copy if identical
-    char src_hash[65], dest_hash[65];
-    if (compute_file_hash(src, src_hash, sizeof(src_hash)) == 0 &&
-        dest_exists &&
-        compute_file_hash(dest, dest_hash, sizeof(dest_hash)) == 0)
+    int rc = 0;
+    size_t n;
+    while ((n = fossil_shark_throttle_read(&in, buf, DIGEST_BLOCK)) > 0)
     {
-        if (strcmp(src_hash, dest_hash) == 0)
+        if (fossil_shark_throttle_write(&out, buf, n) != n)
         {
-            // Files are identical, skip copy
-            return 0;
+            rc = -1;
+            break;
         }
     }
+    fossil_io_filesys_file_close(&in);
+    if (fossil_io_filesys_file_close(&out) != 0)
+        rc = -1;
+    fossil_sys_memory_free(buf);
+    return rc;
+}
 
-    return fossil_io_filesys_copy(src, dest, true);
+static void sync_fail(sync_ctx_t *ctx, const sync_action_t *a)
+{
+    sync_lock(ctx);
+    fossil_io_printf("{red}Error: %s %s failed.{normal}\n", sync_action_names[a->kind], a->dest);
+    ctx->errors++;
+    if (a->slot != SIZE_MAX && a->slot < ctx->count)
+        ctx->entries[a->slot].dropped = true;
+    sync_unlock(ctx);
 }
 
-// Main sync function
-int fossil_shark_sync(ccstring src, ccstring dest,
-                      bool recursive, bool update, bool delete_flag)
+// Give dest the source's permissions and mtime after its content landed
+static void sync_finish_file(sync_ctx_t *ctx, const sync_action_t *a)
 {
-    int32_t rc = 0;
     fossil_io_filesys_obj_t src_obj;
-    rc = fossil_io_filesys_stat(src, &src_obj);
+    if (!cnotnull(a->src) || fossil_io_filesys_stat(a->src, &src_obj) != 0)
+        return;
+#ifndef _WIN32
+    // A delta patched in place or rebuilt in a temp file has the old or default mode
+    if (a->kind == SYNC_COPY || a->kind == SYNC_DELTA)
+        chmod(a->dest, a->mode);
+#endif
+    sync_copy_mtime(a->src, a->dest, &src_obj);
+    if (ctx->use_manifest && ctx->checksum && a->slot != SIZE_MAX && a->slot < ctx->count &&
+        (ctx->entries[a->slot].digest[0] | ctx->entries[a->slot].digest[1]) == 0)
+        sync_digest(a->src, ctx->entries[a->slot].digest);
+}
+
+// Content actions touch disjoint files, so they run concurrently
+static void sync_transfer_job(sync_ctx_t *ctx, size_t index)
+{
+    const sync_action_t *a = &ctx->actions[index];
+    int rc = 0;
+    if (a->kind == SYNC_CHMOD)
+    {
+#ifndef _WIN32
+        rc = chmod(a->dest, a->mode);
+#endif
+    }
+    else
+    {
+        rc = 1;
+        fossil_io_filesys_obj_t src_obj, dest_obj;
+        if (a->kind == SYNC_DELTA && fossil_io_filesys_stat(a->src, &src_obj) == 0 &&
+            fossil_io_filesys_stat(a->dest, &dest_obj) == 0)
+            rc = sync_delta(a->src, a->dest, src_obj.size, dest_obj.size);
+        if (rc == 1)
+            rc = sync_copy(a->src, a->dest);
+        if (rc == 0)
+            sync_finish_file(ctx, a);
+    }
     if (rc != 0)
-        return rc;
+        sync_fail(ctx, a);
+}
 
-    if (src_obj.type != FOSSIL_FILESYS_TYPE_DIR)
+/*
+ * Run the plan in dependency order: directories first (parents precede
+ * children in plan order), then renames, which must move files out of
+ * doomed directories before anything is deleted, then all content
+ * transfers in parallel, and finally deletions.
+ */
+static void sync_execute(sync_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->action_count; i++)
     {
-        return sync_file(src, dest, update);
+        const sync_action_t *a = &ctx->actions[i];
+        if (a->kind == SYNC_MKDIR && fossil_io_filesys_exists(a->dest) != 1 &&
+            fossil_io_filesys_dir_create(a->dest, true) != 0)
+            sync_fail(ctx, a);
     }
 
-    // Create destination directory if needed
-    if (fossil_io_filesys_exists(dest) != 1)
+    for (size_t i = 0; i < ctx->action_count; i++)
     {
-        rc = fossil_io_filesys_dir_create(dest, false);
-        if (rc != 0)
-            return rc;
+        const sync_action_t *a = &ctx->actions[i];
+        if (a->kind != SYNC_RENAME)
+            continue;
+        if (fossil_io_filesys_move(a->from, a->dest, false) != 0)
+            sync_fail(ctx, a);
+        else
+            sync_finish_file(ctx, a);
     }
 
-    // List source directory entries
-    fossil_io_filesys_obj_t entries[256];
-    size_t entry_count = 0;
-    rc = fossil_io_filesys_dir_list(src, entries, 256, &entry_count);
-    if (rc != 0)
-        return rc;
+    if (!sync_jobs_alloc(ctx, ctx->action_count))
+    {
+        ctx->errors++;
+        return;
+    }
+    for (size_t i = 0; i < ctx->action_count; i++)
+    {
+        int kind = ctx->actions[i].kind;
+        if (kind == SYNC_COPY || kind == SYNC_DELTA || kind == SYNC_CHMOD)
+            ctx->jobs[ctx->job_count++] = i;
+    }
+    sync_parallel(ctx, sync_transfer_job);
 
-    for (size_t i = 0; i < entry_count; ++i)
+    for (size_t i = 0; i < ctx->action_count; i++)
     {
-        fossil_io_filesys_obj_t *entry = &entries[i];
-        if (strcmp(entry->path, ".") == 0 || strcmp(entry->path, "..") == 0)
-            continue;
+        const sync_action_t *a = &ctx->actions[i];
+        if ((a->kind == SYNC_DELETE || a->kind == SYNC_RMDIR) &&
+            fossil_io_filesys_exists(a->dest) == 1 &&
+            fossil_io_filesys_remove(a->dest, a->kind == SYNC_RMDIR) != 0)
+            sync_fail(ctx, a);
+    }
+}
 
-        char dest_path[FOSSIL_FILESYS_MAX_PATH];
-        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, entry->path + strlen(src) + 1);
+// Main sync function
+int fossil_shark_sync(ccstring src, ccstring dest, const fossil_shark_sync_options_t *opts)
+{
+    static const fossil_shark_sync_options_t defaults = {0};
+    if (!cnotnull(opts))
+        opts = &defaults;
+    ccstring changes_file = opts->changes_file, plan_out = opts->plan_out;
+    ccstring plan_in = opts->plan_in, remote_cmd = opts->remote_cmd;
+    bool dry_run = opts->dry_run, two_way = opts->two_way;
 
-        if (entry->type == FOSSIL_FILESYS_TYPE_DIR)
-        {
-            if (recursive)
-            {
-                fossil_shark_sync(entry->path, dest_path, recursive, update, delete_flag);
-            }
-        }
-        else if (entry->type == FOSSIL_FILESYS_TYPE_FILE)
+    if (!cnotnull(dest) || (!cnotnull(src) && !cnotnull(plan_in)))
+        return 1;
+    if (cnotnull(remote_cmd) && (!cnotnull(src) || cnotnull(plan_out) || cnotnull(plan_in) || two_way))
+    {
+        fossil_io_printf("{red}Error: --remote-cmd cannot be combined with plans or --two-way.{normal}\n");
+        return 1;
+    }
+
+    sync_ctx_t ctx = {0};
+    ctx.recursive = opts->recursive;
+    ctx.update = opts->update;
+    ctx.delete_flag = opts->delete_flag;
+    ctx.delta = opts->delta;
+    ctx.checksum = opts->checksum;
+    ctx.use_manifest = opts->manifest && !cnotnull(plan_in);
+#ifndef _WIN32
+    pthread_mutex_init(&ctx.lock, cnull);
+#endif
+
+    if (cnotnull(remote_cmd))
+    {
+        int rc = sync_remote(&ctx, src, dest, remote_cmd, dry_run);
+        sync_ctx_free(&ctx);
+        return rc;
+    }
+
+    char manifest_path[FOSSIL_FILESYS_MAX_PATH];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/%s", dest, MANIFEST_NAME);
+
+    bisync_t bi = {0};
+    bi.root[0] = src;
+    bi.root[1] = dest;
+#ifndef _WIN32
+    pthread_mutex_init(&bi.state[0].lock, cnull);
+    pthread_mutex_init(&bi.state[1].lock, cnull);
+#endif
+    two_way = two_way && !cnotnull(plan_in);
+
+    if (cnotnull(plan_in))
+    {
+        // A reviewed plan is applied as is; nothing is re-planned
+        if (sync_read_plan(&ctx, plan_in) != 0)
         {
-            sync_file(entry->path, dest_path, update);
+            fossil_io_printf("{red}Error: Cannot load sync plan %s.{normal}\n", plan_in);
+            ctx.errors++;
         }
-        // Symlinks and other types can be handled here if needed
     }
-
-    // Delete extraneous files in dest
-    if (delete_flag)
+    else
     {
-        fossil_io_filesys_obj_t dest_entries[256];
-        size_t dest_entry_count = 0;
-        rc = fossil_io_filesys_dir_list(dest, dest_entries, 256, &dest_entry_count);
+        fossil_io_filesys_obj_t src_obj;
+        int32_t rc = fossil_io_filesys_stat(src, &src_obj);
         if (rc != 0)
+        {
+            bisync_free(&bi);
+            sync_ctx_free(&ctx);
             return rc;
+        }
 
-        for (size_t i = 0; i < dest_entry_count; ++i)
+        if (two_way)
         {
-            fossil_io_filesys_obj_t *dentry = &dest_entries[i];
-            if (strcmp(dentry->path, ".") == 0 || strcmp(dentry->path, "..") == 0)
-                continue;
-
-            char src_path[FOSSIL_FILESYS_MAX_PATH];
-            snprintf(src_path, sizeof(src_path), "%s/%s", src, dentry->path + strlen(dest) + 1);
-
-            int exists = fossil_io_filesys_exists(src_path);
+            if (src_obj.type != FOSSIL_FILESYS_TYPE_DIR)
+            {
+                fossil_io_printf("{red}Error: Two-way sync needs two directories.{normal}\n");
+                ctx.errors++;
+            }
+            else
+            {
+                // Pair records only; the executor marks the ones whose action failed
+                ctx.use_manifest = true;
+                bisync_plan(&ctx, &bi);
+            }
+        }
+        else if (src_obj.type != FOSSIL_FILESYS_TYPE_DIR)
+        {
+            ctx.use_manifest = false;
+            sync_plan_file(&ctx, src, dest, &src_obj, SIZE_MAX);
+        }
+        else
+        {
+            if (ctx.use_manifest)
+                ctx.loaded = manifest_load(manifest_path, &ctx.old) == 0;
 
-            if (exists != 1)
+            if (cnotnull(changes_file))
+            {
+                if (fossil_io_filesys_exists(dest) != 1)
+                    sync_plan(&ctx, SYNC_MKDIR, dest, cnull, cnull, 0, SIZE_MAX);
+                sync_changes(&ctx, src, dest, changes_file);
+            }
+            else
             {
-                fossil_io_filesys_remove(dentry->path, dentry->type == FOSSIL_FILESYS_TYPE_DIR);
+                sync_tree(&ctx, src, dest, "");
+                if (ctx.loaded)
+                    sync_finish_manifest(&ctx, dest);
             }
+            sync_resolve(&ctx);
         }
+        sync_run_verify(&ctx);
     }
 
-    return 0;
+    if (cnotnull(plan_out) && sync_write_plan(&ctx, plan_out) != 0)
+    {
+        fossil_io_printf("{red}Error: Cannot write sync plan %s.{normal}\n", plan_out);
+        ctx.errors++;
+    }
+    if (dry_run)
+        sync_print_plan(&ctx);
+
+    if (!dry_run && !cnotnull(plan_out) && ctx.errors == 0)
+    {
+        sync_execute(&ctx);
+
+        if (two_way)
+        {
+            if (bisync_finish(&ctx, &bi) != 0)
+                ctx.errors++;
+        }
+        else if (ctx.use_manifest && manifest_save(&ctx, dest, MANIFEST_NAME) != 0)
+        {
+            fossil_io_printf("{red}Error: Failed to write sync manifest %s.{normal}\n", manifest_path);
+            ctx.errors++;
+        }
+        else if (cnotnull(plan_in) && fossil_io_filesys_exists(manifest_path) == 1)
+        {
+            // The plan changed dest behind the manifest's back; the next run rebuilds it
+            fossil_io_filesys_remove(manifest_path, false);
+        }
+    }
+
+    if (bi.conflicts > 0)
+        fossil_io_printf("{yellow}%zu conflict(s) left untouched{normal}\n", bi.conflicts);
+
+    int errors = ctx.errors + (bi.conflicts > 0 ? 1 : 0);
+    bisync_free(&bi);
+    sync_ctx_free(&ctx);
+    return errors > 0 ? 1 : 0;
 }
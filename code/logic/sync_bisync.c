@@ -0,0 +1,333 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/sync_internal.h"
+
+// Path order: '/' sorts first, so a directory's subtree directly follows it
+int bisync_path_cmp(ccstring a, ccstring b)
+{
+    for (;; a++, b++)
+    {
+        unsigned char ca = (unsigned char)*a, cb = (unsigned char)*b;
+        if (ca != cb)
+        {
+            if (ca == '/' || cb == '/')
+                return ca == '/' ? (cb == '\0' ? 1 : -1) : (ca == '\0' ? -1 : 1);
+            return ca < cb ? -1 : 1;
+        }
+        if (ca == '\0')
+            return 0;
+    }
+}
+
+int bisync_item_cmp(const void *lhs, const void *rhs)
+{
+    return bisync_path_cmp(((const bisync_item_t *)lhs)->rel, ((const bisync_item_t *)rhs)->rel);
+}
+
+static bool bisync_ignored(ccstring rel, ccstring name)
+{
+    return rel[0] == '\0' && (sync_state_file(name, MANIFEST_NAME) ||
+                              sync_state_file(name, BISYNC_NAME));
+}
+
+void bisync_scan(sync_ctx_t *ctx, bisync_t *bi, int side, ccstring dir, ccstring rel)
+{
+    size_t entry_count = 0;
+    fossil_io_filesys_obj_t *entries = sync_list(dir, &entry_count);
+    if (!cnotnull(entries))
+    {
+        ctx->errors++;
+        return;
+    }
+
+    for (size_t i = 0; i < entry_count; ++i)
+    {
+        fossil_io_filesys_obj_t *entry = &entries[i];
+        if (strcmp(entry->path, ".") == 0 || strcmp(entry->path, "..") == 0)
+            continue;
+        if (entry->type != FOSSIL_FILESYS_TYPE_FILE && entry->type != FOSSIL_FILESYS_TYPE_DIR)
+            continue;
+        ccstring name = entry->path + strlen(dir) + 1;
+        if (bisync_ignored(rel, name))
+            continue;
+
+        if (!sync_reserve((void **)&bi->items[side], &bi->cap[side], bi->count[side], sizeof(bisync_item_t)))
+        {
+            ctx->errors++;
+            break;
+        }
+        char child[FOSSIL_FILESYS_MAX_PATH];
+        sync_join(child, sizeof(child), rel, name);
+        bisync_item_t *item = &bi->items[side][bi->count[side]++];
+        item->rel = fossil_io_cstring_dup(child);
+        item->type = entry->type;
+        item->mode = entry->mode & 07777;
+        item->size = entry->type == FOSSIL_FILESYS_TYPE_FILE ? entry->size : 0;
+        item->mtime_ns = entry->type == FOSSIL_FILESYS_TYPE_FILE ? sync_mtime_ns(entry->path, entry) : 0;
+        item->digest[0] = item->digest[1] = 0;
+
+        if (entry->type == FOSSIL_FILESYS_TYPE_DIR && !bi->flat)
+            bisync_scan(ctx, bi, side, entry->path, child);
+    }
+    fossil_sys_memory_free(entries);
+}
+
+// Whether a side differs from its record; *idx gets the record or -1
+static bool bisync_changed(const manifest_t *old, ccstring rel, const bisync_item_t *item, int64_t *idx)
+{
+    *idx = manifest_find(old, rel);
+    if (*idx < 0 || item == cnull)
+        return (*idx < 0) != (item == cnull);
+    const manifest_rec_t *r = &old->recs[*idx];
+    if (r->type != item->type)
+        return true;
+    return item->type == FOSSIL_FILESYS_TYPE_FILE && (r->size != item->size || r->mtime_ns != item->mtime_ns);
+}
+
+static void bisync_record(bisync_t *bi, int side, const bisync_item_t *item, const uint64_t digest[2])
+{
+    manifest_push(&bi->state[side], item->rel, strlen(item->rel), item->size, item->mtime_ns, digest, item->type);
+}
+
+static void bisync_carry(bisync_t *bi, int side, int64_t idx)
+{
+    if (idx >= 0)
+        manifest_carry(&bi->state[side], (uint32_t)idx);
+}
+
+/*
+ * A directory deleted on one side is removed on the other only if
+ * nothing beneath it has to be kept there; otherwise the removal turns
+ * into re-creating it on the side that deleted it.
+ */
+static void bisync_keep_doomed(sync_ctx_t *ctx, bisync_t *bi)
+{
+    for (size_t k = 0; k < bi->doomed_depth; k++)
+    {
+        sync_action_t *a = &ctx->actions[bi->doomed[k].action];
+        if (a->kind != SYNC_RMDIR)
+            continue;
+        char path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", bi->root[bi->doomed[k].side], ctx->entries[a->slot].path);
+        cstring dest = fossil_io_cstring_dup(path);
+        if (!cnotnull(dest))
+        {
+            ctx->errors++;
+            continue;
+        }
+        fossil_sys_memory_free(a->dest);
+        a->dest = dest;
+        a->kind = SYNC_MKDIR;
+    }
+}
+
+static void bisync_path(sync_ctx_t *ctx, bisync_t *bi, ccstring rel,
+                        const bisync_item_t *a, const bisync_item_t *b)
+{
+    const bisync_item_t *item[2] = {a, b};
+    int64_t idx[2];
+    bool changed[2] = {bisync_changed(&bi->state[0].old, rel, a, &idx[0]),
+                       bisync_changed(&bi->state[1].old, rel, b, &idx[1])};
+
+    // Paths arrive sorted, so leaving a doomed directory's subtree means leaving it for good
+    while (bi->doomed_depth > 0)
+    {
+        ccstring dir = ctx->entries[ctx->actions[bi->doomed[bi->doomed_depth - 1].action].slot].path;
+        size_t len = strlen(dir);
+        if (strncmp(rel, dir, len) == 0 && rel[len] == '/')
+            break;
+        bi->doomed_depth--;
+    }
+
+    char path[2][FOSSIL_FILESYS_MAX_PATH];
+    for (int side = 0; side < 2; side++)
+        snprintf(path[side], sizeof(path[side]), "%s/%s", bi->root[side], rel);
+
+    if (!changed[0] && !changed[1])
+    {
+        bisync_carry(bi, 0, idx[0]);
+        bisync_carry(bi, 1, idx[1]);
+        return;
+    }
+
+    if (changed[0] && changed[1])
+    {
+        uint64_t digest[2][2] = {{0, 0}, {0, 0}};
+        bool same = a && b && a->type == b->type &&
+                    (a->type == FOSSIL_FILESYS_TYPE_DIR ||
+                     (a->size == b->size && sync_digest(path[0], digest[0]) == 0 &&
+                      sync_digest(path[1], digest[1]) == 0 &&
+                      digest[0][0] == digest[1][0] && digest[0][1] == digest[1][1]));
+        if (same)
+        {
+            bisync_record(bi, 0, a, digest[0]);
+            bisync_record(bi, 1, b, digest[1]);
+            return;
+        }
+        if (a || b)
+        {
+            fossil_io_printf("{red}Conflict{normal} %s (%s)\n", rel,
+                             a && b ? "changed on both sides" : "deleted on one side, changed on the other");
+            bi->conflicts++;
+            bisync_keep_doomed(ctx, bi);
+        }
+        bisync_carry(bi, 0, idx[0]);
+        bisync_carry(bi, 1, idx[1]);
+        return;
+    }
+
+    int from = changed[0] ? 0 : 1;
+    int to = 1 - from;
+    const bisync_item_t *have = item[from];
+    const bisync_item_t *other = item[to];
+    if (have && other && have->type != other->type)
+    {
+        fossil_io_printf("{red}Conflict{normal} %s (file replaced by a directory or back)\n", rel);
+        bi->conflicts++;
+        bisync_keep_doomed(ctx, bi);
+        bisync_carry(bi, 0, idx[0]);
+        bisync_carry(bi, 1, idx[1]);
+        return;
+    }
+
+    // The executor re-stats both sides of this path once it has run
+    size_t slot = manifest_push(ctx, rel, strlen(rel), 0, 0, cnull, have ? have->type : other->type);
+    if (!have)
+    {
+        if (other->type == FOSSIL_FILESYS_TYPE_DIR)
+        {
+            if (slot == SIZE_MAX)
+                return;
+            // Without its place on the stack the rmdir could not be undone for a kept child
+            if (!sync_reserve((void **)&bi->doomed, &bi->doomed_cap, bi->doomed_depth, sizeof(bisync_doomed_t)))
+            {
+                ctx->errors++;
+                return;
+            }
+            size_t planned = ctx->action_count;
+            sync_plan(ctx, SYNC_RMDIR, path[to], cnull, cnull, 0, slot);
+            if (ctx->action_count == planned)
+                return;
+            bi->doomed[bi->doomed_depth].action = planned;
+            bi->doomed[bi->doomed_depth++].side = from;
+        }
+        else
+        {
+            sync_plan(ctx, SYNC_DELETE, path[to], cnull, cnull, 0, slot);
+        }
+        return;
+    }
+
+    bisync_keep_doomed(ctx, bi);
+    if (have->type == FOSSIL_FILESYS_TYPE_DIR)
+        sync_plan(ctx, SYNC_MKDIR, path[to], cnull, cnull, 0, slot);
+    else
+        sync_plan(ctx, other && ctx->delta ? SYNC_DELTA : SYNC_COPY, path[to], path[from], cnull, have->mode, slot);
+}
+void bisync_plan(sync_ctx_t *ctx, bisync_t *bi)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        char state_path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(state_path, sizeof(state_path), "%s/%s", bi->root[side], BISYNC_NAME);
+        bi->state[side].use_manifest = true;
+        bi->state[side].loaded = manifest_load(state_path, &bi->state[side].old) == 0;
+
+        if (fossil_io_filesys_exists(bi->root[side]) == 1)
+            bisync_scan(ctx, bi, side, bi->root[side], "");
+        else
+            sync_plan(ctx, SYNC_MKDIR, bi->root[side], cnull, cnull, 0, SIZE_MAX);
+        if (bi->count[side] > 1)
+            qsort(bi->items[side], bi->count[side], sizeof(bisync_item_t), bisync_item_cmp);
+    }
+
+    size_t i = 0, j = 0;
+    while (i < bi->count[0] || j < bi->count[1])
+    {
+        const bisync_item_t *a = i < bi->count[0] ? &bi->items[0][i] : cnull;
+        const bisync_item_t *b = j < bi->count[1] ? &bi->items[1][j] : cnull;
+        int c = !a ? 1 : !b ? -1 : bisync_path_cmp(a->rel, b->rel);
+        bisync_path(ctx, bi, c <= 0 ? a->rel : b->rel, c <= 0 ? a : cnull, c >= 0 ? b : cnull);
+        if (c <= 0)
+            i++;
+        if (c >= 0)
+            j++;
+    }
+}
+
+// After the executor ran: record both sides of every path it touched
+int bisync_finish(sync_ctx_t *ctx, bisync_t *bi)
+{
+    for (size_t k = 0; k < ctx->count; k++)
+    {
+        const manifest_entry_t *e = &ctx->entries[k];
+        for (int side = 0; side < 2; side++)
+        {
+            if (e->dropped)
+            {
+                // Failed: keep the old view so the change is seen again next run
+                bisync_carry(bi, side, manifest_find(&bi->state[side].old, e->path));
+                continue;
+            }
+            char path[FOSSIL_FILESYS_MAX_PATH];
+            snprintf(path, sizeof(path), "%s/%s", bi->root[side], e->path);
+            fossil_io_filesys_obj_t obj;
+            if (fossil_io_filesys_stat(path, &obj) != 0)
+                continue;
+            bisync_item_t item = {e->path, obj.type, 0, 0, 0, {0, 0}};
+            if (obj.type == FOSSIL_FILESYS_TYPE_FILE)
+            {
+                item.size = obj.size;
+                item.mtime_ns = sync_mtime_ns(path, &obj);
+            }
+            bisync_record(bi, side, &item, cnull);
+        }
+    }
+
+    int rc = 0;
+    for (int side = 0; side < 2; side++)
+    {
+        if (manifest_save(&bi->state[side], bi->root[side], BISYNC_NAME) != 0)
+        {
+            fossil_io_printf("{red}Error: Failed to write sync state in %s.{normal}\n", bi->root[side]);
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+void bisync_free(bisync_t *bi)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        for (size_t k = 0; k < bi->count[side]; k++)
+            fossil_sys_memory_free(bi->items[side][k].rel);
+        if (cnotnull(bi->items[side]))
+            fossil_sys_memory_free(bi->items[side]);
+        sync_ctx_free(&bi->state[side]);
+    }
+    if (cnotnull(bi->doomed))
+        fossil_sys_memory_free(bi->doomed);
+}
@@ -0,0 +1,563 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/sync_internal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+size_t delta_block_size(uint64_t size)
+{
+    // Around sqrt(size), page aligned, so signatures stay small
+    size_t block = DELTA_MIN_BLOCK;
+    while (block < DELTA_MAX_BLOCK && (uint64_t)block * block < size)
+        block *= 2;
+    return block;
+}
+
+static uint32_t delta_weak(const uint8_t *data, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        a += data[i];
+        b += (uint32_t)(len - i) * data[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+static uint64_t delta_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Fast 128-bit block hash; it only guards against accidental collisions
+static void delta_strong(const uint8_t *data, size_t len, uint64_t out[2])
+{
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t h2 = 0xc2b2ae3d27d4eb4fULL + len;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h1 = (h1 ^ w) * 0x87c37b91114253d5ULL;
+        h1 = (h1 << 31) | (h1 >> 33);
+        h2 = (h2 + w) * 0x4cf5ad432745937fULL;
+        h2 = (h2 << 27) | (h2 >> 37);
+        h2 += h1;
+    }
+    for (; i < len; i++)
+    {
+        h1 = (h1 ^ data[i]) * 0x87c37b91114253d5ULL;
+        h2 = (h2 + data[i]) * 0x4cf5ad432745937fULL;
+    }
+    out[0] = delta_mix(h1 + h2);
+    out[1] = delta_mix(h2 ^ (h1 >> 1));
+}
+
+void delta_sig_free(delta_sig_t *sig)
+{
+    if (cnotnull(sig->weak))
+        fossil_sys_memory_free(sig->weak);
+    if (cnotnull(sig->strong))
+        fossil_sys_memory_free(sig->strong);
+    if (cnotnull(sig->head))
+        fossil_sys_memory_free(sig->head);
+    if (cnotnull(sig->next))
+        fossil_sys_memory_free(sig->next);
+}
+
+// Allocate the per-block sums for sig->count blocks of sig->block bytes
+int delta_sig_alloc(delta_sig_t *sig)
+{
+    if (sig->count == 0 || sig->count >= UINT32_MAX)
+        return -1;
+    sig->weak = fossil_sys_memory_alloc(sig->count * sizeof(uint32_t));
+    sig->strong = fossil_sys_memory_alloc(sig->count * 2 * sizeof(uint64_t));
+    if (!cnotnull(sig->weak) || !cnotnull(sig->strong))
+    {
+        delta_sig_free(sig);
+        return -1;
+    }
+    return 0;
+}
+
+// Hash the weak sums into buckets once all blocks are summed
+int delta_sig_index(delta_sig_t *sig)
+{
+    size_t buckets = 1;
+    while (buckets < sig->count * 2)
+        buckets <<= 1;
+    sig->mask = buckets - 1;
+    sig->head = fossil_sys_memory_calloc(buckets, sizeof(uint32_t));
+    sig->next = fossil_sys_memory_calloc(sig->count, sizeof(uint32_t));
+    if (!cnotnull(sig->head) || !cnotnull(sig->next))
+    {
+        delta_sig_free(sig);
+        return -1;
+    }
+    // Insert in reverse so each chain lists lower block indices first
+    for (size_t i = sig->count; i-- > 0;)
+    {
+        size_t bucket = delta_mix(sig->weak[i]) & sig->mask;
+        sig->next[i] = sig->head[bucket];
+        sig->head[bucket] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+int delta_signature(ccstring path, uint64_t size, size_t block, delta_sig_t *sig)
+{
+    memset(sig, 0, sizeof(*sig));
+    sig->block = block;
+    sig->count = (size_t)(size / block);
+    if (delta_sig_alloc(sig) != 0)
+        return -1;
+
+    uint8_t *buf = fossil_sys_memory_alloc(block);
+    fossil_io_filesys_file_t file;
+    if (!cnotnull(buf) || fossil_io_filesys_file_open(&file, path, "rb") != 0)
+    {
+        if (cnotnull(buf))
+            fossil_sys_memory_free(buf);
+        delta_sig_free(sig);
+        return -1;
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < sig->count; i++)
+    {
+        if (fossil_shark_throttle_read(&file, buf, block) != block)
+        {
+            rc = -1;
+            break;
+        }
+        sig->weak[i] = delta_weak(buf, block);
+        delta_strong(buf, block, &sig->strong[i * 2]);
+    }
+
+    fossil_io_filesys_file_close(&file);
+    fossil_sys_memory_free(buf);
+    if (rc == 0)
+        return delta_sig_index(sig);
+    delta_sig_free(sig);
+    return rc;
+}
+
+static int delta_push(delta_ops_t *list, uint64_t src_off, uint64_t len, int64_t block, size_t block_size)
+{
+    if (list->count > 0)
+    {
+        delta_op_t *last = &list->ops[list->count - 1];
+        bool contiguous = last->src_off + last->len == src_off;
+        if (contiguous && block < 0 && last->block < 0)
+        {
+            last->len += len;
+            return 0;
+        }
+        if (contiguous && block >= 0 && last->block >= 0 &&
+            (uint64_t)last->block * block_size + last->len == (uint64_t)block * block_size)
+        {
+            last->len += len;
+            return 0;
+        }
+    }
+    if (list->count == list->cap)
+    {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        delta_op_t *grown = fossil_sys_memory_realloc(list->ops, cap * sizeof(delta_op_t));
+        if (!cnotnull(grown))
+            return -1;
+        list->ops = grown;
+        list->cap = cap;
+    }
+    list->ops[list->count++] = (delta_op_t){src_off, len, block};
+    return 0;
+}
+
+// Find a destination block for the window, preferring the aligned one
+static int64_t delta_lookup(const delta_sig_t *sig, uint32_t weak, const uint8_t *window, uint64_t offset)
+{
+    uint32_t at = sig->head[delta_mix(weak) & sig->mask];
+    bool hashed = false;
+    uint64_t strong[2];
+    int64_t found = -1;
+    uint64_t aligned = offset % sig->block == 0 ? offset / sig->block : UINT64_MAX;
+
+    for (; at != 0; at = sig->next[at - 1])
+    {
+        size_t idx = at - 1;
+        if (sig->weak[idx] != weak)
+            continue;
+        if (!hashed)
+        {
+            delta_strong(window, sig->block, strong);
+            hashed = true;
+        }
+        if (sig->strong[idx * 2] != strong[0] || sig->strong[idx * 2 + 1] != strong[1])
+            continue;
+        if (idx == aligned)
+            return (int64_t)idx;
+        if (found < 0)
+            found = (int64_t)idx;
+    }
+    return found;
+}
+
+// Scan the source with a rolling window and record copy/literal ops
+int delta_match(ccstring src, uint64_t src_size, const delta_sig_t *sig, delta_ops_t *list)
+{
+    size_t block = sig->block;
+    size_t cap = DELTA_BUFFER > block * 4 ? DELTA_BUFFER : block * 4;
+    uint8_t *buf = fossil_sys_memory_alloc(cap);
+    fossil_io_filesys_file_t file;
+    if (!cnotnull(buf))
+        return -1;
+    if (fossil_io_filesys_file_open(&file, src, "rb") != 0)
+    {
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+
+    uint64_t base = 0, literal = 0;
+    size_t pos = 0, end = 0;
+    bool eof = false, have_sum = false;
+    uint32_t a = 0, b = 0;
+    int rc = 0;
+
+    for (;;)
+    {
+        // Keep one byte past the window so the sum can roll
+        if (!eof && end - pos < block + 1)
+        {
+            memmove(buf, buf + pos, end - pos);
+            base += pos;
+            end -= pos;
+            pos = 0;
+            size_t n = fossil_shark_throttle_read(&file, buf + end, cap - end);
+            end += n;
+            if (n == 0)
+                eof = true;
+            continue;
+        }
+        if (end - pos < block)
+            break;
+
+        if (!have_sum)
+        {
+            uint32_t weak = delta_weak(buf + pos, block);
+            a = weak & 0xFFFF;
+            b = weak >> 16;
+            have_sum = true;
+        }
+
+        int64_t idx = delta_lookup(sig, (a & 0xFFFF) | (b << 16), buf + pos, base + pos);
+        if (idx >= 0)
+        {
+            uint64_t offset = base + pos;
+            if (offset > literal)
+                rc |= delta_push(list, literal, offset - literal, -1, block);
+            rc |= delta_push(list, offset, block, idx, block);
+            pos += block;
+            literal = base + pos;
+            have_sum = false;
+            if (rc != 0)
+                break;
+            continue;
+        }
+
+        if (pos + block >= end)
+        {
+            pos = end;
+            break;
+        }
+        uint8_t out = buf[pos], in = buf[pos + block];
+        a = (a - out + in) & 0xFFFF;
+        b = (b - (uint32_t)block * out + a) & 0xFFFF;
+        pos++;
+    }
+
+    if (rc == 0 && src_size > literal)
+        rc = delta_push(list, literal, src_size - literal, -1, block);
+
+    fossil_io_filesys_file_close(&file);
+    fossil_sys_memory_free(buf);
+    return rc;
+}
+
+// Append len bytes read from `from` at from_off to `to`
+static int delta_transfer(fossil_io_filesys_file_t *from, uint64_t from_off,
+                          fossil_io_filesys_file_t *to, uint64_t len, uint8_t *buf)
+{
+    if (fossil_shark_file_seek(from, from_off) != 0)
+        return -1;
+    while (len > 0)
+    {
+        size_t chunk = len < DELTA_BUFFER ? (size_t)len : DELTA_BUFFER;
+        if (fossil_shark_throttle_read(from, buf, chunk) != chunk ||
+            fossil_shark_throttle_write(to, buf, chunk) != chunk)
+            return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Overwrite dest bytes in place, skipping chunks that already match
+static int delta_patch(fossil_io_filesys_file_t *in, fossil_io_filesys_file_t *out,
+                       uint64_t off, uint64_t len, uint64_t dest_size,
+                       uint8_t *buf, uint8_t *cur, uint64_t *written)
+{
+    while (len > 0)
+    {
+        size_t chunk = len < DELTA_BUFFER ? (size_t)len : DELTA_BUFFER;
+        if (fossil_shark_file_seek(in, off) != 0 ||
+            fossil_shark_throttle_read(in, buf, chunk) != chunk)
+            return -1;
+
+        size_t have = 0;
+        if (off < dest_size)
+        {
+            size_t want = dest_size - off < chunk ? (size_t)(dest_size - off) : chunk;
+            if (fossil_shark_file_seek(out, off) != 0)
+                return -1;
+            have = fossil_shark_throttle_read(out, cur, want);
+        }
+        if (have != chunk || memcmp(buf, cur, chunk) != 0)
+        {
+            if (fossil_shark_file_seek(out, off) != 0 ||
+                fossil_shark_throttle_write(out, buf, chunk) != chunk)
+                return -1;
+            *written += chunk;
+        }
+        off += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int delta_apply(ccstring src, ccstring dest, uint64_t src_size, uint64_t dest_size,
+                       const delta_ops_t *list, size_t block, uint64_t *written)
+{
+    bool aligned = true;
+    for (size_t i = 0; i < list->count && aligned; i++)
+    {
+        const delta_op_t *op = &list->ops[i];
+        if (op->block >= 0 && (uint64_t)op->block * block != op->src_off)
+            aligned = false;
+    }
+
+    uint8_t *buf = fossil_sys_memory_alloc(DELTA_BUFFER);
+    if (!cnotnull(buf))
+        return -1;
+
+    fossil_io_filesys_file_t in, out;
+    int rc = 0;
+    *written = 0;
+    if (aligned)
+    {
+        // Every reused block is already in place: patch only the literals
+        uint8_t *cur = fossil_sys_memory_alloc(DELTA_BUFFER);
+        if (!cnotnull(cur) || fossil_io_filesys_file_open(&in, src, "rb") != 0)
+        {
+            if (cnotnull(cur))
+                fossil_sys_memory_free(cur);
+            fossil_sys_memory_free(buf);
+            return -1;
+        }
+        if (fossil_io_filesys_file_open(&out, dest, "r+b") != 0)
+        {
+            fossil_io_filesys_file_close(&in);
+            fossil_sys_memory_free(cur);
+            fossil_sys_memory_free(buf);
+            return -1;
+        }
+        for (size_t i = 0; i < list->count && rc == 0; i++)
+        {
+            const delta_op_t *op = &list->ops[i];
+            if (op->block < 0)
+                rc = delta_patch(&in, &out, op->src_off, op->len, dest_size, buf, cur, written);
+        }
+        fossil_io_filesys_file_close(&in);
+        fossil_io_filesys_file_close(&out);
+        if (rc == 0 && dest_size != src_size)
+            rc = fossil_io_filesys_file_truncate(dest, (size_t)src_size);
+        fossil_sys_memory_free(cur);
+        fossil_sys_memory_free(buf);
+        return rc;
+    }
+
+    // Blocks moved: assemble the new file next to the old one
+    char temp[FOSSIL_FILESYS_MAX_PATH];
+    snprintf(temp, sizeof(temp), "%s.shark-delta", dest);
+    fossil_io_filesys_file_t old;
+    if (fossil_io_filesys_file_open(&in, src, "rb") != 0)
+    {
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+    if (fossil_io_filesys_file_open(&old, dest, "rb") != 0)
+    {
+        fossil_io_filesys_file_close(&in);
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+    if (fossil_io_filesys_file_open(&out, temp, "wb") != 0)
+    {
+        fossil_io_filesys_file_close(&in);
+        fossil_io_filesys_file_close(&old);
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+    for (size_t i = 0; i < list->count && rc == 0; i++)
+    {
+        const delta_op_t *op = &list->ops[i];
+        if (op->block < 0)
+        {
+            rc = delta_transfer(&in, op->src_off, &out, op->len, buf);
+            *written += op->len;
+        }
+        else
+        {
+            rc = delta_transfer(&old, (uint64_t)op->block * block, &out, op->len, buf);
+        }
+    }
+    fossil_io_filesys_file_close(&in);
+    fossil_io_filesys_file_close(&old);
+    fossil_io_filesys_file_close(&out);
+    fossil_sys_memory_free(buf);
+
+    if (rc == 0)
+        rc = fossil_io_filesys_move(temp, dest, true);
+    if (rc != 0)
+        fossil_io_filesys_remove(temp, false);
+    return rc;
+}
+
+/*
+ * Bring dest up to date with src by rewriting only what changed.
+ * Returns 1 when the files are too small or too different for a delta
+ * to pay off, so the caller falls back to a plain copy.
+ */
+int sync_delta(ccstring src, ccstring dest, uint64_t src_size, uint64_t dest_size)
+{
+    size_t block = delta_block_size(src_size > dest_size ? src_size : dest_size);
+    delta_sig_t sig;
+    if (dest_size < block || delta_signature(dest, dest_size, block, &sig) != 0)
+        return 1;
+
+    delta_ops_t list = {0};
+    int rc = delta_match(src, src_size, &sig, &list);
+    delta_sig_free(&sig);
+    if (rc != 0)
+    {
+        if (cnotnull(list.ops))
+            fossil_sys_memory_free(list.ops);
+        return 1;
+    }
+
+    uint64_t written = 0;
+    rc = delta_apply(src, dest, src_size, dest_size, &list, block, &written);
+    if (cnotnull(list.ops))
+        fossil_sys_memory_free(list.ops);
+    if (rc == 0 && (written > 0 || src_size != dest_size))
+    {
+        fossil_io_printf("{cyan}Delta %s: %llu of %llu bytes written{normal}\n", dest,
+                         (unsigned long long)written, (unsigned long long)src_size);
+    }
+    return rc;
+}
+
+// Modification time in nanoseconds, for the size+mtime quick check
+int64_t sync_mtime_ns(ccstring path, const fossil_io_filesys_obj_t *obj)
+{
+#if defined(__APPLE__)
+    struct stat st;
+    if (stat(path, &st) == 0)
+        return (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+    struct stat st;
+    if (stat(path, &st) == 0)
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    (void)path;
+#endif
+    return (int64_t)obj->modified_at * 1000000000;
+}
+
+void sync_set_mtime(ccstring path, int64_t ns)
+{
+#ifndef _WIN32
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = (time_t)(ns / 1000000000);
+    times[1].tv_nsec = (long)(ns % 1000000000);
+    utimensat(AT_FDCWD, path, times, 0);
+#else
+    struct utimbuf times = {(time_t)(ns / 1000000000), (time_t)(ns / 1000000000)};
+    utime(path, &times);
+#endif
+}
+
+// Stamp dest with the source mtime so the next quick check can skip it
+void sync_copy_mtime(ccstring src, ccstring dest, const fossil_io_filesys_obj_t *src_obj)
+{
+    sync_set_mtime(dest, sync_mtime_ns(src, src_obj));
+}
+
+// Streaming 128-bit content digest for --checksum (not cryptographic)
+int sync_digest(ccstring path, uint64_t out[2])
+{
+    fossil_io_filesys_file_t file;
+    uint8_t *buf = fossil_sys_memory_alloc(DIGEST_BLOCK);
+    if (!cnotnull(buf))
+        return -1;
+    if (fossil_io_filesys_file_open(&file, path, "rb") != 0)
+    {
+        fossil_sys_memory_free(buf);
+        return -1;
+    }
+
+    out[0] = 0;
+    out[1] = 0;
+    size_t n;
+    while ((n = fossil_shark_throttle_read(&file, buf, DIGEST_BLOCK)) > 0)
+    {
+        uint64_t part[2];
+        delta_strong(buf, n, part);
+        out[0] = delta_mix(out[0] ^ part[0]) + part[1];
+        out[1] = delta_mix(out[1] + part[1]) ^ part[0];
+    }
+
+    fossil_io_filesys_file_close(&file);
+    fossil_sys_memory_free(buf);
+    return 0;
+}
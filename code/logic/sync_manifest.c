@@ -0,0 +1,273 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/sync_internal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+void manifest_unload(manifest_t *m)
+{
+    if (cnotnull(m->data))
+    {
+#ifndef _WIN32
+        if (m->mapped)
+            munmap((void *)m->data, m->size);
+        else
+#endif
+            fossil_sys_memory_free((void *)m->data);
+    }
+    if (cnotnull(m->seen))
+        fossil_sys_memory_free(m->seen);
+    memset(m, 0, sizeof(*m));
+}
+
+int manifest_load(ccstring path, manifest_t *m)
+{
+    memset(m, 0, sizeof(*m));
+    fossil_io_filesys_obj_t obj;
+    if (fossil_io_filesys_stat(path, &obj) != 0 || obj.size < sizeof(manifest_header_t))
+        return -1;
+    m->size = obj.size;
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        void *map = mmap(cnull, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map != MAP_FAILED)
+        {
+            m->data = map;
+            m->mapped = true;
+        }
+    }
+#endif
+    if (!cnotnull(m->data))
+    {
+        uint8_t *buf = fossil_sys_memory_alloc(m->size);
+        fossil_io_filesys_file_t file;
+        if (!cnotnull(buf))
+            return -1;
+        if (fossil_io_filesys_file_open(&file, path, "rb") != 0)
+        {
+            fossil_sys_memory_free(buf);
+            return -1;
+        }
+        size_t n = fossil_io_filesys_file_read(&file, buf, 1, m->size);
+        fossil_io_filesys_file_close(&file);
+        m->data = buf;
+        if (n != m->size)
+        {
+            manifest_unload(m);
+            return -1;
+        }
+    }
+
+    // Validate everything up front so lookups can trust the offsets
+    const manifest_header_t *hdr = (const manifest_header_t *)m->data;
+    uint64_t table = sizeof(*hdr) + (uint64_t)hdr->count * sizeof(manifest_rec_t);
+    if (memcmp(hdr->magic, MANIFEST_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != MANIFEST_VERSION || table + hdr->strings != m->size)
+    {
+        manifest_unload(m);
+        return -1;
+    }
+    m->recs = (const manifest_rec_t *)(m->data + sizeof(*hdr));
+    m->count = hdr->count;
+    m->strings = (const char *)(m->data + table);
+    for (uint32_t i = 0; i < m->count; i++)
+    {
+        if ((uint64_t)m->recs[i].path_off + m->recs[i].path_len > hdr->strings)
+        {
+            manifest_unload(m);
+            return -1;
+        }
+    }
+
+    m->seen = fossil_sys_memory_calloc(m->count ? m->count : 1, 1);
+    if (!cnotnull(m->seen))
+    {
+        manifest_unload(m);
+        return -1;
+    }
+    return 0;
+}
+
+// Byte order of the stored path against key, the same order strcmp gives
+static int manifest_cmp(const manifest_t *m, uint32_t i, ccstring key, size_t len)
+{
+    const manifest_rec_t *r = &m->recs[i];
+    size_t n = r->path_len < len ? r->path_len : len;
+    int c = memcmp(m->strings + r->path_off, key, n);
+    if (c != 0)
+        return c;
+    return r->path_len < len ? -1 : (r->path_len > len ? 1 : 0);
+}
+
+// First record not ordered before key
+uint32_t manifest_lower(const manifest_t *m, ccstring key, size_t len)
+{
+    uint32_t lo = 0, hi = m->count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (manifest_cmp(m, mid, key, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int64_t manifest_find(const manifest_t *m, ccstring rel)
+{
+    size_t len = strlen(rel);
+    uint32_t i = manifest_lower(m, rel, len);
+    return (i < m->count && manifest_cmp(m, i, rel, len) == 0) ? (int64_t)i : -1;
+}
+
+size_t manifest_push(sync_ctx_t *ctx, ccstring rel, size_t rel_len, uint64_t size,
+                     int64_t mtime_ns, const uint64_t digest[2], uint32_t type)
+{
+    if (!ctx->use_manifest)
+        return SIZE_MAX;
+    if (ctx->count == ctx->cap)
+    {
+        size_t cap = ctx->cap ? ctx->cap * 2 : 256;
+        manifest_entry_t *grown = fossil_sys_memory_realloc(ctx->entries, cap * sizeof(manifest_entry_t));
+        if (!cnotnull(grown))
+        {
+            ctx->errors++;
+            return SIZE_MAX;
+        }
+        ctx->entries = grown;
+        ctx->cap = cap;
+    }
+    cstring path = fossil_sys_memory_alloc(rel_len + 1);
+    if (!cnotnull(path))
+    {
+        ctx->errors++;
+        return SIZE_MAX;
+    }
+    memcpy(path, rel, rel_len);
+    path[rel_len] = '\0';
+
+    manifest_entry_t *e = &ctx->entries[ctx->count];
+    e->path = path;
+    e->size = size;
+    e->mtime_ns = mtime_ns;
+    e->digest[0] = digest ? digest[0] : 0;
+    e->digest[1] = digest ? digest[1] : 0;
+    e->type = type;
+    e->dropped = false;
+    e->seq = ctx->count++;
+    return e->seq;
+}
+
+// Keep an old record as is in the next manifest
+void manifest_carry(sync_ctx_t *ctx, uint32_t i)
+{
+    const manifest_rec_t *r = &ctx->old.recs[i];
+    ctx->old.seen[i] = 1;
+    manifest_push(ctx, ctx->old.strings + r->path_off, r->path_len, r->size, r->mtime_ns, r->digest, r->type);
+}
+
+static int manifest_entry_cmp(const void *lhs, const void *rhs)
+{
+    const manifest_entry_t *a = lhs;
+    const manifest_entry_t *b = rhs;
+    int c = strcmp(a->path, b->path);
+    if (c != 0)
+        return c;
+    return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+int manifest_save(sync_ctx_t *ctx, ccstring dest, ccstring name)
+{
+    if (ctx->count > 1)
+        qsort(ctx->entries, ctx->count, sizeof(manifest_entry_t), manifest_entry_cmp);
+
+    // The same path may have been pushed twice; the latest one wins
+    size_t unique = 0;
+    uint64_t strings = 0;
+    for (size_t i = 0; i < ctx->count; i++)
+    {
+        if (ctx->entries[i].dropped ||
+            (i + 1 < ctx->count && strcmp(ctx->entries[i].path, ctx->entries[i + 1].path) == 0))
+        {
+            fossil_sys_memory_free(ctx->entries[i].path);
+            continue;
+        }
+        ctx->entries[unique++] = ctx->entries[i];
+        strings += strlen(ctx->entries[i].path);
+    }
+    ctx->count = unique;
+
+    char path[FOSSIL_FILESYS_MAX_PATH], temp[FOSSIL_FILESYS_MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", dest, name);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, temp, "wb") != 0)
+        return -1;
+
+    manifest_header_t hdr = {0};
+    memcpy(hdr.magic, MANIFEST_MAGIC, sizeof(hdr.magic));
+    hdr.version = MANIFEST_VERSION;
+    hdr.count = (uint32_t)ctx->count;
+    hdr.strings = strings;
+    bool ok = fossil_io_filesys_file_write(&file, &hdr, sizeof(hdr), 1) == 1;
+
+    uint32_t off = 0;
+    for (size_t i = 0; ok && i < ctx->count; i++)
+    {
+        const manifest_entry_t *e = &ctx->entries[i];
+        manifest_rec_t rec = {0};
+        rec.size = e->size;
+        rec.mtime_ns = e->mtime_ns;
+        rec.digest[0] = e->digest[0];
+        rec.digest[1] = e->digest[1];
+        rec.path_off = off;
+        rec.path_len = (uint32_t)strlen(e->path);
+        rec.type = e->type;
+        off += rec.path_len;
+        ok = fossil_io_filesys_file_write(&file, &rec, sizeof(rec), 1) == 1;
+    }
+    for (size_t i = 0; ok && i < ctx->count; i++)
+    {
+        size_t len = strlen(ctx->entries[i].path);
+        ok = fossil_io_filesys_file_write(&file, ctx->entries[i].path, 1, len) == len;
+    }
+    fossil_io_filesys_file_close(&file);
+
+    if (!ok || fossil_io_filesys_move(temp, path, true) != 0)
+    {
+        fossil_io_filesys_remove(temp, false);
+        return -1;
+    }
+    return 0;
+}
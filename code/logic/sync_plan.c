@@ -0,0 +1,1020 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/sync_internal.h"
+
+const char *const sync_action_names[SYNC_ACTION_KINDS] = {
+    "mkdir", "copy", "delta", "chmod", "rename", "delete", "rmdir"};
+
+fossil_io_filesys_obj_t *sync_list(ccstring path, size_t *count)
+{
+    size_t cap = SYNC_LIST_INITIAL;
+    *count = 0;
+    for (;;)
+    {
+        fossil_io_filesys_obj_t *entries = fossil_sys_memory_alloc(cap * sizeof(fossil_io_filesys_obj_t));
+        if (!cnotnull(entries))
+            return cnull;
+        if (fossil_io_filesys_dir_list(path, entries, cap, count) != 0)
+        {
+            fossil_sys_memory_free(entries);
+            return cnull;
+        }
+        if (*count < cap)
+            return entries;
+        fossil_sys_memory_free(entries);
+        cap *= 2;
+    }
+}
+
+void sync_join(char *out, size_t out_len, ccstring dir, ccstring name)
+{
+    if (dir[0] == '\0')
+        snprintf(out, out_len, "%s", name);
+    else
+        snprintf(out, out_len, "%s/%s", dir, name);
+}
+
+// Make room for one more element in a growable array
+bool sync_reserve(void **items, size_t *cap, size_t count, size_t size)
+{
+    if (count < *cap)
+        return true;
+    size_t grown_cap = *cap ? *cap * 2 : 64;
+    void *grown = fossil_sys_memory_realloc(*items, grown_cap * size);
+    if (!cnotnull(grown))
+        return false;
+    *items = grown;
+    *cap = grown_cap;
+    return true;
+}
+
+static void sync_defer(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring rel,
+                       uint64_t size, int64_t mtime_ns)
+{
+    if (!sync_reserve((void **)&ctx->pending, &ctx->pending_cap, ctx->pending_count, sizeof(sync_pending_t)))
+    {
+        ctx->errors++;
+        return;
+    }
+    sync_pending_t *p = &ctx->pending[ctx->pending_count++];
+    p->src = fossil_io_cstring_dup(src);
+    p->dest = fossil_io_cstring_dup(dest);
+    p->rel = fossil_io_cstring_dup(rel);
+    p->size = size;
+    p->mtime_ns = mtime_ns;
+}
+
+static void sync_doom_file(sync_ctx_t *ctx, ccstring path, uint64_t size)
+{
+    if (!sync_reserve((void **)&ctx->doomed, &ctx->doomed_cap, ctx->doomed_count, sizeof(sync_doomed_t)))
+    {
+        ctx->errors++;
+        return;
+    }
+    sync_doomed_t *d = &ctx->doomed[ctx->doomed_count++];
+    memset(d, 0, sizeof(*d));
+    d->path = fossil_io_cstring_dup(path);
+    d->size = size;
+}
+
+// Doom a destination directory and, as rename sources, every file below it
+static void sync_doom_dir(sync_ctx_t *ctx, ccstring path, bool top)
+{
+    if (top)
+    {
+        if (!sync_reserve((void **)&ctx->doomed_dirs, &ctx->doomed_dir_cap, ctx->doomed_dir_count, sizeof(cstring)))
+        {
+            ctx->errors++;
+            return;
+        }
+        ctx->doomed_dirs[ctx->doomed_dir_count++] = fossil_io_cstring_dup(path);
+    }
+
+    size_t count = 0;
+    fossil_io_filesys_obj_t *entries = sync_list(path, &count);
+    if (!cnotnull(entries))
+        return;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (entries[i].type == FOSSIL_FILESYS_TYPE_DIR)
+            sync_doom_dir(ctx, entries[i].path, false);
+        else if (entries[i].type == FOSSIL_FILESYS_TYPE_FILE)
+            sync_doom_file(ctx, entries[i].path, entries[i].size);
+    }
+    fossil_sys_memory_free(entries);
+}
+
+void sync_lock(sync_ctx_t *ctx)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&ctx->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+void sync_unlock(sync_ctx_t *ctx)
+{
+#ifndef _WIN32
+    pthread_mutex_unlock(&ctx->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+void sync_plan(sync_ctx_t *ctx, int kind, ccstring dest, ccstring src, ccstring from,
+               uint32_t mode, size_t slot)
+{
+    if (!sync_reserve((void **)&ctx->actions, &ctx->action_cap, ctx->action_count, sizeof(sync_action_t)))
+    {
+        ctx->errors++;
+        return;
+    }
+    sync_action_t *a = &ctx->actions[ctx->action_count++];
+    a->kind = kind;
+    a->dest = fossil_io_cstring_dup(dest);
+    a->src = cnotnull(src) ? fossil_io_cstring_dup(src) : cnull;
+    a->from = cnotnull(from) ? fossil_io_cstring_dup(from) : cnull;
+    a->mode = mode & 07777;
+    a->slot = slot;
+}
+
+// Decide what one source file needs; plans nothing when dest is current
+void sync_plan_file(sync_ctx_t *ctx, ccstring src, ccstring dest,
+                    const fossil_io_filesys_obj_t *src_obj, size_t slot)
+{
+    fossil_io_filesys_obj_t dest_obj;
+    bool dest_exists = fossil_io_filesys_stat(dest, &dest_obj) == 0 &&
+                       dest_obj.type == FOSSIL_FILESYS_TYPE_FILE;
+
+    if (dest_exists && ctx->update && dest_obj.modified_at >= src_obj->modified_at)
+    {
+        // Destination is newer, skip
+        return;
+    }
+
+    if (dest_exists && src_obj->size == dest_obj.size)
+    {
+        if (ctx->checksum)
+        {
+            // Only same-size files are candidates for a content hash
+            if (!sync_reserve((void **)&ctx->verify, &ctx->verify_cap, ctx->verify_count, sizeof(sync_verify_t)))
+            {
+                ctx->errors++;
+                return;
+            }
+            sync_verify_t *v = &ctx->verify[ctx->verify_count++];
+            memset(v, 0, sizeof(*v));
+            v->src = fossil_io_cstring_dup(src);
+            v->dest = fossil_io_cstring_dup(dest);
+            v->src_mode = src_obj->mode & 07777;
+            v->dest_mode = dest_obj.mode & 07777;
+            v->slot = slot;
+            return;
+        }
+        if (sync_mtime_ns(src, src_obj) == sync_mtime_ns(dest, &dest_obj))
+        {
+            // Quick check: same size and same mtime means unchanged
+#ifndef _WIN32
+            if ((src_obj->mode & 07777) != (dest_obj.mode & 07777))
+                sync_plan(ctx, SYNC_CHMOD, dest, cnull, cnull, src_obj->mode, slot);
+#endif
+            return;
+        }
+    }
+
+    sync_plan(ctx, dest_exists && ctx->delta ? SYNC_DELTA : SYNC_COPY, dest, src, cnull, src_obj->mode, slot);
+}
+
+static void sync_entry(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring rel,
+                       const fossil_io_filesys_obj_t *obj)
+{
+    int64_t mtime = ctx->use_manifest ? sync_mtime_ns(src, obj) : 0;
+    uint64_t digest[2] = {0, 0};
+    int64_t idx = ctx->use_manifest ? manifest_find(&ctx->old, rel) : -1;
+    if (idx >= 0)
+    {
+        const manifest_rec_t *r = &ctx->old.recs[idx];
+        ctx->old.seen[idx] = 1;
+        if (r->type == FOSSIL_FILESYS_TYPE_FILE && r->size == obj->size)
+        {
+            // Settled from the manifest alone; the destination is not touched
+            if (!ctx->checksum && r->mtime_ns == mtime)
+            {
+                manifest_carry(ctx, (uint32_t)idx);
+                return;
+            }
+            if (ctx->checksum && (r->digest[0] | r->digest[1]) != 0 &&
+                sync_digest(src, digest) == 0 &&
+                digest[0] == r->digest[0] && digest[1] == r->digest[1])
+            {
+                manifest_push(ctx, rel, strlen(rel), obj->size, mtime, digest, FOSSIL_FILESYS_TYPE_FILE);
+                return;
+            }
+        }
+    }
+
+    if (ctx->delete_flag && fossil_io_filesys_exists(dest) != 1)
+    {
+        // New to the destination: may turn out to be a rename
+        sync_defer(ctx, src, dest, rel, obj->size, mtime);
+        return;
+    }
+    size_t slot = manifest_push(ctx, rel, strlen(rel), obj->size, mtime, cnull, FOSSIL_FILESYS_TYPE_FILE);
+    sync_plan_file(ctx, src, dest, obj, slot);
+}
+
+// The manifest (or bisync state) named base, or the temp file it is saved through
+bool sync_state_file(ccstring name, ccstring base)
+{
+    size_t len = strlen(base);
+    return strncmp(name, base, len) == 0 && (name[len] == '\0' || strcmp(name + len, ".tmp") == 0);
+}
+
+// Mark an old record and everything below it as handled by this run
+static void sync_mark_subtree(sync_ctx_t *ctx, ccstring rel)
+{
+    int64_t idx = manifest_find(&ctx->old, rel);
+    if (idx >= 0)
+        ctx->old.seen[idx] = 1;
+
+    char prefix[FOSSIL_FILESYS_MAX_PATH];
+    size_t len = (size_t)snprintf(prefix, sizeof(prefix), "%s/", rel);
+    for (uint32_t k = manifest_lower(&ctx->old, prefix, len);
+         k < ctx->old.count && ctx->old.recs[k].path_len >= len &&
+         memcmp(ctx->old.strings + ctx->old.recs[k].path_off, prefix, len) == 0;
+         k++)
+        ctx->old.seen[k] = 1;
+}
+
+/*
+ * Parallel scan. With -r each top-level source directory is walked on a
+ * worker into a private context that shares the loaded manifest read-only;
+ * the subtrees flag disjoint records as seen. The top-level walk then takes
+ * each subtree's plan over where it would have recursed, so the actions
+ * come out in the same order as a serial walk.
+ */
+typedef struct sync_scan_s
+{
+    sync_ctx_t *parts;
+    cstring *src;
+    cstring *dest;
+    cstring *rel;
+    size_t count;
+    size_t next; // next part the top-level walk takes over
+} sync_scan_t;
+
+static void sync_scan_job(sync_ctx_t *ctx, size_t index)
+{
+    sync_scan_t *scan = ctx->scan;
+    sync_tree(&scan->parts[index], scan->src[index], scan->dest[index], scan->rel[index]);
+}
+
+static void sync_scan_free(sync_ctx_t *ctx)
+{
+    sync_scan_t *scan = ctx->scan;
+    for (size_t i = 0; i < scan->count; i++)
+    {
+        // The manifest belongs to ctx
+        memset(&scan->parts[i].old, 0, sizeof(scan->parts[i].old));
+        sync_ctx_free(&scan->parts[i]);
+        fossil_sys_memory_free(scan->src[i]);
+        fossil_sys_memory_free(scan->dest[i]);
+        fossil_sys_memory_free(scan->rel[i]);
+    }
+    if (cnotnull(scan->parts))
+        fossil_sys_memory_free(scan->parts);
+    if (cnotnull(scan->src))
+        fossil_sys_memory_free(scan->src);
+    if (cnotnull(scan->dest))
+        fossil_sys_memory_free(scan->dest);
+    if (cnotnull(scan->rel))
+        fossil_sys_memory_free(scan->rel);
+    fossil_sys_memory_free(scan);
+    ctx->scan = cnull;
+}
+
+// Plan every top-level directory of src in parallel; a no-op for fewer than two
+static void sync_scan_start(sync_ctx_t *ctx, ccstring src, ccstring dest,
+                            const fossil_io_filesys_obj_t *entries, size_t entry_count)
+{
+    size_t dirs = 0;
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        if (entries[i].type == FOSSIL_FILESYS_TYPE_DIR &&
+            strcmp(entries[i].path, ".") != 0 && strcmp(entries[i].path, "..") != 0)
+            dirs++;
+    }
+    if (dirs < 2)
+        return;
+
+    sync_scan_t *scan = fossil_sys_memory_calloc(1, sizeof(*scan));
+    if (!cnotnull(scan))
+        return;
+    scan->parts = fossil_sys_memory_calloc(dirs, sizeof(*scan->parts));
+    scan->src = fossil_sys_memory_calloc(dirs, sizeof(cstring));
+    scan->dest = fossil_sys_memory_calloc(dirs, sizeof(cstring));
+    scan->rel = fossil_sys_memory_calloc(dirs, sizeof(cstring));
+    ctx->scan = scan;
+    if (!cnotnull(scan->parts) || !cnotnull(scan->src) || !cnotnull(scan->dest) ||
+        !cnotnull(scan->rel) || !sync_jobs_alloc(ctx, dirs))
+    {
+        // Nothing planned yet; fall back to the serial walk
+        sync_scan_free(ctx);
+        return;
+    }
+
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        const fossil_io_filesys_obj_t *entry = &entries[i];
+        if (entry->type != FOSSIL_FILESYS_TYPE_DIR ||
+            strcmp(entry->path, ".") == 0 || strcmp(entry->path, "..") == 0)
+            continue;
+
+        // Same skips as sync_tree, so the parts line up with its walk
+        ccstring name = entry->path + strlen(src) + 1;
+        if (ctx->use_manifest && sync_state_file(name, MANIFEST_NAME))
+            continue;
+        char dest_path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, name);
+
+        sync_ctx_t *part = &scan->parts[scan->count];
+        part->recursive = ctx->recursive;
+        part->update = ctx->update;
+        part->delete_flag = ctx->delete_flag;
+        part->delta = ctx->delta;
+        part->checksum = ctx->checksum;
+        part->use_manifest = ctx->use_manifest;
+        part->loaded = ctx->loaded;
+        part->old = ctx->old;
+#ifndef _WIN32
+        pthread_mutex_init(&part->lock, cnull);
+#endif
+        scan->src[scan->count] = fossil_io_cstring_dup(entry->path);
+        scan->dest[scan->count] = fossil_io_cstring_dup(dest_path);
+        scan->rel[scan->count] = fossil_io_cstring_dup(name);
+        ctx->jobs[ctx->job_count++] = scan->count++;
+    }
+    sync_parallel(ctx, sync_scan_job);
+}
+
+// Make room for n more elements at once, so a subtree moves over whole or not at all
+static bool sync_reserve_more(void **items, size_t *cap, size_t count, size_t n, size_t size)
+{
+    if (count + n <= *cap)
+        return true;
+    size_t grown_cap = *cap ? *cap : 64;
+    while (grown_cap < count + n)
+        grown_cap *= 2;
+    void *grown = fossil_sys_memory_realloc(*items, grown_cap * size);
+    if (!cnotnull(grown))
+        return false;
+    *items = grown;
+    *cap = grown_cap;
+    return true;
+}
+
+// Append n elements from `from`, reserving room for all of them first
+static bool sync_append(void **items, size_t *cap, size_t *count, const void *from, size_t n, size_t size)
+{
+    if (n == 0)
+        return true;
+    if (!sync_reserve_more(items, cap, *count, n, size))
+        return false;
+    memcpy((uint8_t *)*items + *count * size, from, n * size);
+    *count += n;
+    return true;
+}
+
+// Append the next subtree's plan to ctx, renumbering its manifest slots
+static void sync_scan_take(sync_ctx_t *ctx)
+{
+    sync_scan_t *scan = ctx->scan;
+    sync_ctx_t *part = &scan->parts[scan->next++];
+    size_t base = ctx->count;
+
+    ctx->errors += part->errors;
+    if (sync_reserve_more((void **)&ctx->entries, &ctx->cap, ctx->count, part->count, sizeof(manifest_entry_t)))
+    {
+        for (size_t i = 0; i < part->count; i++)
+        {
+            ctx->entries[ctx->count] = part->entries[i];
+            ctx->entries[ctx->count].seq = ctx->count;
+            ctx->count++;
+        }
+        part->count = 0;
+    }
+    else
+        ctx->errors++;
+
+    if (sync_reserve_more((void **)&ctx->actions, &ctx->action_cap, ctx->action_count, part->action_count, sizeof(sync_action_t)))
+    {
+        for (size_t i = 0; i < part->action_count; i++)
+        {
+            sync_action_t *a = &ctx->actions[ctx->action_count++];
+            *a = part->actions[i];
+            if (a->slot != SIZE_MAX)
+                a->slot += base;
+        }
+        part->action_count = 0;
+    }
+    else
+        ctx->errors++;
+
+    if (sync_reserve_more((void **)&ctx->verify, &ctx->verify_cap, ctx->verify_count, part->verify_count, sizeof(sync_verify_t)))
+    {
+        for (size_t i = 0; i < part->verify_count; i++)
+        {
+            sync_verify_t *v = &ctx->verify[ctx->verify_count++];
+            *v = part->verify[i];
+            if (v->slot != SIZE_MAX)
+                v->slot += base;
+        }
+        part->verify_count = 0;
+    }
+    else
+        ctx->errors++;
+
+    if (sync_append((void **)&ctx->pending, &ctx->pending_cap, &ctx->pending_count, part->pending, part->pending_count, sizeof(sync_pending_t)))
+        part->pending_count = 0;
+    else
+        ctx->errors++;
+
+    if (sync_append((void **)&ctx->doomed, &ctx->doomed_cap, &ctx->doomed_count, part->doomed, part->doomed_count, sizeof(sync_doomed_t)))
+        part->doomed_count = 0;
+    else
+        ctx->errors++;
+
+    if (sync_append((void **)&ctx->doomed_dirs, &ctx->doomed_dir_cap, &ctx->doomed_dir_count, part->doomed_dirs, part->doomed_dir_count, sizeof(cstring)))
+        part->doomed_dir_count = 0;
+    else
+        ctx->errors++;
+}
+
+void sync_tree(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring rel)
+{
+    // Create destination directory if needed
+    bool dest_exists = fossil_io_filesys_exists(dest) == 1;
+    if (!dest_exists)
+        sync_plan(ctx, SYNC_MKDIR, dest, cnull, cnull, 0, SIZE_MAX);
+
+    size_t entry_count = 0;
+    fossil_io_filesys_obj_t *entries = sync_list(src, &entry_count);
+    if (!cnotnull(entries))
+    {
+        ctx->errors++;
+        return;
+    }
+    if (ctx->recursive && rel[0] == '\0')
+        sync_scan_start(ctx, src, dest, entries, entry_count);
+
+    for (size_t i = 0; i < entry_count; ++i)
+    {
+        fossil_io_filesys_obj_t *entry = &entries[i];
+        if (strcmp(entry->path, ".") == 0 || strcmp(entry->path, "..") == 0)
+            continue;
+
+        ccstring name = entry->path + strlen(src) + 1;
+        if (ctx->use_manifest && rel[0] == '\0' && sync_state_file(name, MANIFEST_NAME))
+            continue;
+
+        char dest_path[FOSSIL_FILESYS_MAX_PATH], child[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, name);
+        sync_join(child, sizeof(child), rel, name);
+
+        if (entry->type == FOSSIL_FILESYS_TYPE_DIR)
+        {
+            if (ctx->use_manifest)
+            {
+                int64_t idx = manifest_find(&ctx->old, child);
+                if (idx >= 0)
+                    ctx->old.seen[idx] = 1;
+                manifest_push(ctx, child, strlen(child), 0, 0, cnull, FOSSIL_FILESYS_TYPE_DIR);
+            }
+            if (ctx->recursive && cnotnull(ctx->scan) && rel[0] == '\0')
+            {
+                sync_scan_take(ctx);
+            }
+            else if (ctx->recursive)
+            {
+                sync_tree(ctx, entry->path, dest_path, child);
+            }
+            else if (ctx->use_manifest)
+            {
+                // Not walked this time: whatever was below it stays as recorded
+                char prefix[FOSSIL_FILESYS_MAX_PATH];
+                size_t len = (size_t)snprintf(prefix, sizeof(prefix), "%s/", child);
+                for (uint32_t k = manifest_lower(&ctx->old, prefix, len);
+                     k < ctx->old.count && ctx->old.recs[k].path_len >= len &&
+                     memcmp(ctx->old.strings + ctx->old.recs[k].path_off, prefix, len) == 0;
+                     k++)
+                    manifest_carry(ctx, k);
+            }
+        }
+        else if (entry->type == FOSSIL_FILESYS_TYPE_FILE)
+        {
+            sync_entry(ctx, entry->path, dest_path, child, entry);
+        }
+        // Symlinks and other types can be handled here if needed
+    }
+    fossil_sys_memory_free(entries);
+    if (cnotnull(ctx->scan) && rel[0] == '\0')
+        sync_scan_free(ctx);
+
+    // Delete extraneous files in dest. dest is listed even with a manifest, since
+    // files the manifest never recorded would otherwise survive --delete
+    if (ctx->delete_flag && dest_exists)
+    {
+        size_t dest_entry_count = 0;
+        fossil_io_filesys_obj_t *dest_entries = sync_list(dest, &dest_entry_count);
+        if (!cnotnull(dest_entries))
+        {
+            ctx->errors++;
+            return;
+        }
+
+        for (size_t i = 0; i < dest_entry_count; ++i)
+        {
+            fossil_io_filesys_obj_t *dentry = &dest_entries[i];
+            if (strcmp(dentry->path, ".") == 0 || strcmp(dentry->path, "..") == 0)
+                continue;
+
+            ccstring name = dentry->path + strlen(dest) + 1;
+            if (ctx->use_manifest && rel[0] == '\0' && sync_state_file(name, MANIFEST_NAME))
+                continue;
+
+            char src_path[FOSSIL_FILESYS_MAX_PATH];
+            snprintf(src_path, sizeof(src_path), "%s/%s", src, name);
+
+            int exists = fossil_io_filesys_exists(src_path);
+
+            if (exists != 1)
+            {
+                if (ctx->loaded)
+                {
+                    // Settled here, so sync_finish_manifest does not doom it again
+                    char child[FOSSIL_FILESYS_MAX_PATH];
+                    sync_join(child, sizeof(child), rel, name);
+                    sync_mark_subtree(ctx, child);
+                }
+                if (dentry->type == FOSSIL_FILESYS_TYPE_DIR)
+                    sync_doom_dir(ctx, dentry->path, true);
+                else if (dentry->type == FOSSIL_FILESYS_TYPE_FILE)
+                    sync_doom_file(ctx, dentry->path, dentry->size);
+                else
+                    sync_plan(ctx, SYNC_DELETE, dentry->path, cnull, cnull, 0, SIZE_MAX);
+            }
+        }
+        fossil_sys_memory_free(dest_entries);
+    }
+}
+
+// Old records this run never saw: gone from the source
+void sync_finish_manifest(sync_ctx_t *ctx, ccstring dest)
+{
+    for (uint32_t i = 0; i < ctx->old.count; i++)
+    {
+        if (ctx->old.seen[i])
+            continue;
+        if (!ctx->delete_flag)
+        {
+            manifest_carry(ctx, i);
+            continue;
+        }
+        char rel[FOSSIL_FILESYS_MAX_PATH], dest_path[FOSSIL_FILESYS_MAX_PATH];
+        const manifest_rec_t *r = &ctx->old.recs[i];
+        snprintf(rel, sizeof(rel), "%.*s", (int)r->path_len, ctx->old.strings + r->path_off);
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, rel);
+
+        fossil_io_filesys_obj_t obj;
+        if (fossil_io_filesys_stat(dest_path, &obj) != 0)
+            continue;
+        if (obj.type == FOSSIL_FILESYS_TYPE_DIR)
+            sync_doom_dir(ctx, dest_path, true);
+        else if (obj.type == FOSSIL_FILESYS_TYPE_FILE)
+            sync_doom_file(ctx, dest_path, obj.size);
+        else
+            sync_plan(ctx, SYNC_DELETE, dest_path, cnull, cnull, 0, SIZE_MAX);
+    }
+}
+
+// Relative, and never climbing out through a ".." component
+bool sync_rel_safe(ccstring rel)
+{
+    if (rel[0] == '/')
+        return false;
+    for (ccstring p = rel; *p;)
+    {
+        ccstring end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.')
+            return false;
+        p += len;
+        if (*p == '/')
+            p++;
+    }
+    return true;
+}
+
+/*
+ * Sync only the paths named in a change list (one per line, relative to
+ * src or prefixed with it), as produced by a watcher. No tree is walked;
+ * every manifest record outside the list is carried forward unchanged.
+ */
+void sync_changes(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring changes_file)
+{
+    fossil_io_filesys_obj_t obj;
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_stat(changes_file, &obj) != 0 ||
+        fossil_io_filesys_file_open(&file, changes_file, "rb") != 0)
+    {
+        fossil_io_printf("{red}Error: Cannot read change list %s.{normal}\n", changes_file);
+        ctx->errors++;
+        return;
+    }
+    cstring text = fossil_sys_memory_alloc(obj.size + 1);
+    if (!cnotnull(text))
+    {
+        fossil_io_filesys_file_close(&file);
+        ctx->errors++;
+        return;
+    }
+    size_t n = fossil_io_filesys_file_read(&file, text, 1, obj.size);
+    fossil_io_filesys_file_close(&file);
+    text[n] = '\0';
+
+    size_t src_len = strlen(src);
+    for (cstring line = text; *line;)
+    {
+        cstring eol = strchr(line, '\n');
+        cstring next = eol ? eol + 1 : line + strlen(line);
+        if (eol)
+            *eol = '\0';
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '/'))
+            line[--len] = '\0';
+
+        ccstring rel = line;
+        if (strncmp(rel, src, src_len) == 0 && rel[src_len] == '/')
+            rel += src_len + 1;
+        while (strncmp(rel, "./", 2) == 0)
+            rel += 2;
+
+        if (rel[0] == '\0' || !sync_rel_safe(rel))
+        {
+            if (rel[0] != '\0')
+                fossil_io_printf("{yellow}Skipping change entry outside source: %s{normal}\n", line);
+            line = next;
+            continue;
+        }
+
+        char src_path[FOSSIL_FILESYS_MAX_PATH], dest_path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(src_path, sizeof(src_path), "%s/%s", src, rel);
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, rel);
+
+        fossil_io_filesys_obj_t entry;
+        if (fossil_io_filesys_stat(src_path, &entry) == 0)
+        {
+            char parent[FOSSIL_FILESYS_MAX_PATH];
+            fossil_io_filesys_dirname(dest_path, parent, sizeof(parent));
+            if (parent[0] != '\0' && fossil_io_filesys_exists(parent) != 1)
+                sync_plan(ctx, SYNC_MKDIR, parent, cnull, cnull, 0, SIZE_MAX);
+
+            if (entry.type == FOSSIL_FILESYS_TYPE_DIR)
+            {
+                sync_mark_subtree(ctx, rel);
+                manifest_push(ctx, rel, strlen(rel), 0, 0, cnull, FOSSIL_FILESYS_TYPE_DIR);
+                sync_tree(ctx, src_path, dest_path, rel);
+            }
+            else if (entry.type == FOSSIL_FILESYS_TYPE_FILE)
+            {
+                sync_entry(ctx, src_path, dest_path, rel, &entry);
+            }
+        }
+        else if (ctx->delete_flag)
+        {
+            // Gone from the source: drop it from dest and from the manifest
+            sync_mark_subtree(ctx, rel);
+            fossil_io_filesys_obj_t gone;
+            if (fossil_io_filesys_stat(dest_path, &gone) == 0)
+            {
+                if (gone.type == FOSSIL_FILESYS_TYPE_DIR)
+                    sync_doom_dir(ctx, dest_path, true);
+                else if (gone.type == FOSSIL_FILESYS_TYPE_FILE)
+                    sync_doom_file(ctx, dest_path, gone.size);
+                else
+                    sync_plan(ctx, SYNC_DELETE, dest_path, cnull, cnull, 0, SIZE_MAX);
+            }
+        }
+        line = next;
+    }
+    fossil_sys_memory_free(text);
+
+    for (uint32_t i = 0; i < ctx->old.count; i++)
+        if (!ctx->old.seen[i])
+            manifest_carry(ctx, i);
+}
+
+static int sync_doomed_cmp(const void *lhs, const void *rhs)
+{
+    const sync_doomed_t *a = lhs;
+    const sync_doomed_t *b = rhs;
+    return a->size < b->size ? -1 : (a->size > b->size ? 1 : 0);
+}
+
+/*
+ * Pair held-back new files with doomed ones. Only equal sizes are ever
+ * hashed, and each side at most once. Whatever is left is copied or
+ * deleted as usual.
+ */
+void sync_resolve(sync_ctx_t *ctx)
+{
+    if (ctx->doomed_count > 1)
+        qsort(ctx->doomed, ctx->doomed_count, sizeof(sync_doomed_t), sync_doomed_cmp);
+
+    uint64_t renamed = 0, saved = 0;
+    for (size_t i = 0; i < ctx->pending_count; i++)
+    {
+        sync_pending_t *p = &ctx->pending[i];
+        uint64_t digest[2] = {0, 0};
+        bool moved = false;
+
+        size_t lo = 0, hi = ctx->doomed_count;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ctx->doomed[mid].size < p->size)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        bool hashed = false;
+        for (size_t k = lo; p->size > 0 && k < ctx->doomed_count && ctx->doomed[k].size == p->size; k++)
+        {
+            sync_doomed_t *d = &ctx->doomed[k];
+            if (d->used)
+                continue;
+            if (!hashed)
+            {
+                if (sync_digest(p->src, digest) != 0)
+                    break;
+                hashed = true;
+            }
+            if (!d->hashed)
+            {
+                if (sync_digest(d->path, d->digest) != 0)
+                    continue;
+                d->hashed = true;
+            }
+            if (d->digest[0] != digest[0] || d->digest[1] != digest[1])
+                continue;
+
+            size_t slot = manifest_push(ctx, p->rel, strlen(p->rel), p->size, p->mtime_ns,
+                                        ctx->checksum ? digest : cnull, FOSSIL_FILESYS_TYPE_FILE);
+            sync_plan(ctx, SYNC_RENAME, p->dest, p->src, d->path, 0, slot);
+            d->used = true;
+            moved = true;
+            renamed++;
+            saved += p->size;
+            break;
+        }
+
+        fossil_io_filesys_obj_t src_obj;
+        if (!moved && fossil_io_filesys_stat(p->src, &src_obj) == 0)
+        {
+            size_t slot = manifest_push(ctx, p->rel, strlen(p->rel), p->size, p->mtime_ns,
+                                        cnull, FOSSIL_FILESYS_TYPE_FILE);
+            sync_plan_file(ctx, p->src, p->dest, &src_obj, slot);
+        }
+    }
+
+    for (size_t k = 0; k < ctx->doomed_count; k++)
+    {
+        if (!ctx->doomed[k].used)
+            sync_plan(ctx, SYNC_DELETE, ctx->doomed[k].path, cnull, cnull, 0, SIZE_MAX);
+    }
+    for (size_t k = 0; k < ctx->doomed_dir_count; k++)
+        sync_plan(ctx, SYNC_RMDIR, ctx->doomed_dirs[k], cnull, cnull, 0, SIZE_MAX);
+
+    if (renamed > 0)
+    {
+        fossil_io_printf("{cyan}Detected %llu renamed file(s), %llu bytes need no copy{normal}\n",
+                         (unsigned long long)renamed, (unsigned long long)saved);
+    }
+}
+
+void sync_ctx_free(sync_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->count; i++)
+        fossil_sys_memory_free(ctx->entries[i].path);
+    if (cnotnull(ctx->entries))
+        fossil_sys_memory_free(ctx->entries);
+    for (size_t i = 0; i < ctx->pending_count; i++)
+    {
+        fossil_sys_memory_free(ctx->pending[i].src);
+        fossil_sys_memory_free(ctx->pending[i].dest);
+        fossil_sys_memory_free(ctx->pending[i].rel);
+    }
+    if (cnotnull(ctx->pending))
+        fossil_sys_memory_free(ctx->pending);
+    for (size_t i = 0; i < ctx->doomed_count; i++)
+        fossil_sys_memory_free(ctx->doomed[i].path);
+    if (cnotnull(ctx->doomed))
+        fossil_sys_memory_free(ctx->doomed);
+    for (size_t i = 0; i < ctx->doomed_dir_count; i++)
+        fossil_sys_memory_free(ctx->doomed_dirs[i]);
+    if (cnotnull(ctx->doomed_dirs))
+        fossil_sys_memory_free(ctx->doomed_dirs);
+    for (size_t i = 0; i < ctx->action_count; i++)
+    {
+        fossil_sys_memory_free(ctx->actions[i].dest);
+        if (cnotnull(ctx->actions[i].src))
+            fossil_sys_memory_free(ctx->actions[i].src);
+        if (cnotnull(ctx->actions[i].from))
+            fossil_sys_memory_free(ctx->actions[i].from);
+    }
+    if (cnotnull(ctx->actions))
+        fossil_sys_memory_free(ctx->actions);
+    for (size_t i = 0; i < ctx->verify_count; i++)
+    {
+        fossil_sys_memory_free(ctx->verify[i].src);
+        fossil_sys_memory_free(ctx->verify[i].dest);
+    }
+    if (cnotnull(ctx->verify))
+        fossil_sys_memory_free(ctx->verify);
+    if (cnotnull(ctx->jobs))
+        fossil_sys_memory_free(ctx->jobs);
+    manifest_unload(&ctx->old);
+#ifndef _WIN32
+    pthread_mutex_destroy(&ctx->lock);
+#endif
+}
+
+void sync_print_plan(const sync_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->action_count; i++)
+    {
+        const sync_action_t *a = &ctx->actions[i];
+        ccstring name = sync_action_names[a->kind];
+        switch (a->kind)
+        {
+        case SYNC_COPY:
+        case SYNC_DELTA:
+            fossil_io_printf("{cyan}%-6s{normal} %s -> %s\n", name, a->src, a->dest);
+            break;
+        case SYNC_RENAME:
+            fossil_io_printf("{cyan}%-6s{normal} %s -> %s\n", name, a->from, a->dest);
+            break;
+        case SYNC_CHMOD:
+            fossil_io_printf("{cyan}%-6s{normal} %s %04o\n", name, a->dest, (unsigned)a->mode);
+            break;
+        default:
+            fossil_io_printf("{cyan}%-6s{normal} %s\n", name, a->dest);
+            break;
+        }
+    }
+    fossil_io_printf("{blue}%zu planned action(s){normal}\n", ctx->action_count);
+}
+
+// Plan files are tab separated; tabs, newlines and backslashes are escaped
+static void sync_write_field(fossil_io_filesys_file_t *file, ccstring text)
+{
+    for (ccstring c = cnotnull(text) ? text : ""; *c; c++)
+    {
+        ccstring esc = *c == '\t' ? "\\t" : *c == '\n' ? "\\n" : *c == '\r' ? "\\r" : *c == '\\' ? "\\\\" : cnull;
+        if (cnotnull(esc))
+            fossil_io_filesys_file_write(file, esc, 1, 2);
+        else
+            fossil_io_filesys_file_write(file, c, 1, 1);
+    }
+}
+
+int sync_write_plan(const sync_ctx_t *ctx, ccstring path)
+{
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, path, "wb") != 0)
+        return -1;
+
+    static const char header[] = "# shark sync plan v1: action\tdest\tsrc\tfrom\tmode\n";
+    fossil_io_filesys_file_write(&file, header, 1, sizeof(header) - 1);
+    for (size_t i = 0; i < ctx->action_count; i++)
+    {
+        const sync_action_t *a = &ctx->actions[i];
+        char mode[16];
+        int n = snprintf(mode, sizeof(mode), "\t%04o\n", (unsigned)a->mode);
+        sync_write_field(&file, sync_action_names[a->kind]);
+        fossil_io_filesys_file_write(&file, "\t", 1, 1);
+        sync_write_field(&file, a->dest);
+        fossil_io_filesys_file_write(&file, "\t", 1, 1);
+        sync_write_field(&file, a->src);
+        fossil_io_filesys_file_write(&file, "\t", 1, 1);
+        sync_write_field(&file, a->from);
+        fossil_io_filesys_file_write(&file, mode, 1, (size_t)n);
+    }
+    return fossil_io_filesys_file_close(&file);
+}
+
+// Split one plan line in place into its tab separated, unescaped fields
+static size_t sync_split_fields(cstring line, cstring *fields, size_t max)
+{
+    size_t count = 0;
+    cstring out = line;
+    fields[count++] = out;
+    for (cstring c = line; *c; c++)
+    {
+        if (*c == '\t' && count < max)
+        {
+            *out++ = '\0';
+            fields[count++] = out;
+        }
+        else if (*c == '\\' && c[1] != '\0')
+        {
+            c++;
+            *out++ = *c == 't' ? '\t' : *c == 'n' ? '\n' : *c == 'r' ? '\r' : *c;
+        }
+        else
+        {
+            *out++ = *c;
+        }
+    }
+    *out = '\0';
+    return count;
+}
+
+int sync_read_plan(sync_ctx_t *ctx, ccstring path)
+{
+    fossil_io_filesys_obj_t obj;
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_stat(path, &obj) != 0 || fossil_io_filesys_file_open(&file, path, "rb") != 0)
+        return -1;
+    cstring text = fossil_sys_memory_alloc(obj.size + 1);
+    if (!cnotnull(text))
+    {
+        fossil_io_filesys_file_close(&file);
+        return -1;
+    }
+    size_t n = fossil_io_filesys_file_read(&file, text, 1, obj.size);
+    fossil_io_filesys_file_close(&file);
+    text[n] = '\0';
+
+    int rc = 0;
+    size_t line_no = 0;
+    for (cstring line = text; *line && rc == 0;)
+    {
+        cstring eol = strchr(line, '\n');
+        cstring next = eol ? eol + 1 : line + strlen(line);
+        if (eol)
+            *eol = '\0';
+        line_no++;
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            line = next;
+            continue;
+        }
+
+        cstring fields[5];
+        int kind = -1;
+        if (sync_split_fields(line, fields, 5) == 5)
+        {
+            for (int k = 0; k < SYNC_ACTION_KINDS; k++)
+                if (strcmp(fields[0], sync_action_names[k]) == 0)
+                    kind = k;
+        }
+        bool needs_src = kind == SYNC_COPY || kind == SYNC_DELTA || kind == SYNC_RENAME;
+        if (kind < 0 || fields[1][0] == '\0' || (needs_src && fields[2][0] == '\0') ||
+            (kind == SYNC_RENAME && fields[3][0] == '\0'))
+        {
+            fossil_io_printf("{red}Error: Invalid plan entry at %s:%zu.{normal}\n", path, line_no);
+            rc = -1;
+            break;
+        }
+        sync_plan(ctx, kind, fields[1], fields[2][0] ? fields[2] : cnull,
+                  fields[3][0] ? fields[3] : cnull, (uint32_t)strtoul(fields[4], cnull, 8), SIZE_MAX);
+        line = next;
+    }
+    fossil_sys_memory_free(text);
+    return rc;
+}
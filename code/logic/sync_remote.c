@@ -0,0 +1,1069 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/sync_internal.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+/*
+ * Remote sync over a pipe. The local side spawns `<remote-cmd> sync
+ * --server <dest>` and speaks a framed protocol over the child's stdin and
+ * stdout. Each phase is one batch in one direction, so a run costs a fixed
+ * handful of round trips however many files it covers:
+ *
+ *   server: greeting, then the whole destination listing
+ *   client: signature requests for the files worth a delta
+ *   server: their block signatures
+ *   client: deletes, directories, file contents (literals and block copies)
+ *   server: a result summary
+ *
+ * A frame is a type byte and a little-endian u32 payload length. Anything
+ * the transport prints before the greeting (login banners) is skipped.
+ */
+#define REMOTE_MAGIC "SHKSYNC1"
+#define REMOTE_VERSION 1
+#define REMOTE_BUFFER (64 * 1024)
+#define REMOTE_CHUNK (256 * 1024)
+#define REMOTE_FRAME_MAX (256u * 1024 * 1024)
+#define REMOTE_BANNER_MAX (64 * 1024)
+#define REMOTE_ENTRY_SIZE 37 // type, mode, size, mtime, digest
+
+enum
+{
+    REMOTE_HELLO = 'H',
+    REMOTE_ENTRY = 'E',
+    REMOTE_LIST_END = 'e',
+    REMOTE_SIG_REQ = 'S',
+    REMOTE_SIG_REQ_END = 's',
+    REMOTE_SIG = 'G',
+    REMOTE_SIG_END = 'g',
+    REMOTE_DELETE = 'X',
+    REMOTE_MKDIR = 'D',
+    REMOTE_CHMOD = 'P',
+    REMOTE_FILE = 'F',
+    REMOTE_LITERAL = 'L',
+    REMOTE_COPY = 'C',
+    REMOTE_FILE_END = 'f',
+    REMOTE_DONE = 'q',
+    REMOTE_RESULT = 'R'
+};
+
+enum
+{
+    REMOTE_RECURSIVE = 1,
+    REMOTE_CHECKSUM = 2,
+    REMOTE_DRY_RUN = 4
+};
+
+#ifndef _WIN32
+typedef struct
+{
+    int in;
+    int out;
+    bool failed;
+    uint8_t wbuf[REMOTE_BUFFER];
+    size_t wlen;
+    uint8_t rbuf[REMOTE_BUFFER];
+    size_t rpos;
+    size_t rlen;
+    uint8_t *frame; // payload of the last frame received, NUL terminated
+    size_t frame_cap;
+} remote_io_t;
+
+static void remote_put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void remote_put64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t remote_get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t remote_get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void remote_flush(remote_io_t *io)
+{
+    size_t off = 0;
+    while (!io->failed && off < io->wlen)
+    {
+        ssize_t n = write(io->out, io->wbuf + off, io->wlen - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            io->failed = true;
+        else
+            off += (size_t)n;
+    }
+    io->wlen = 0;
+}
+
+static void remote_write(remote_io_t *io, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0 && !io->failed)
+    {
+        if (io->wlen == REMOTE_BUFFER)
+            remote_flush(io);
+        size_t n = REMOTE_BUFFER - io->wlen < len ? REMOTE_BUFFER - io->wlen : len;
+        memcpy(io->wbuf + io->wlen, p, n);
+        io->wlen += n;
+        p += n;
+        len -= n;
+    }
+}
+
+// One frame: a fixed header part followed by a variable part (path or data)
+static void remote_send(remote_io_t *io, int type, const void *head, size_t head_len,
+                        const void *body, size_t body_len)
+{
+    uint8_t hdr[5];
+    hdr[0] = (uint8_t)type;
+    remote_put32(hdr + 1, (uint32_t)(head_len + body_len));
+    remote_write(io, hdr, sizeof(hdr));
+    if (head_len > 0)
+        remote_write(io, head, head_len);
+    if (body_len > 0)
+        remote_write(io, body, body_len);
+}
+
+static void remote_send_path(remote_io_t *io, int type, const void *head, size_t head_len, ccstring rel)
+{
+    remote_send(io, type, head, head_len, rel, strlen(rel));
+}
+
+static bool remote_read(remote_io_t *io, void *data, size_t len)
+{
+    uint8_t *p = data;
+    while (len > 0)
+    {
+        if (io->rpos == io->rlen)
+        {
+            if (io->failed)
+                return false;
+            ssize_t n = read(io->in, io->rbuf, REMOTE_BUFFER);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                io->failed = true;
+                return false;
+            }
+            io->rpos = 0;
+            io->rlen = (size_t)n;
+        }
+        size_t n = io->rlen - io->rpos < len ? io->rlen - io->rpos : len;
+        memcpy(p, io->rbuf + io->rpos, n);
+        io->rpos += n;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool remote_read_payload(remote_io_t *io, size_t len)
+{
+    if (len > REMOTE_FRAME_MAX)
+    {
+        io->failed = true;
+        return false;
+    }
+    if (len + 1 > io->frame_cap)
+    {
+        uint8_t *grown = fossil_sys_memory_realloc(io->frame, len + 1);
+        if (!cnotnull(grown))
+        {
+            io->failed = true;
+            return false;
+        }
+        io->frame = grown;
+        io->frame_cap = len + 1;
+    }
+    if (!remote_read(io, io->frame, len))
+        return false;
+    io->frame[len] = '\0';
+    return true;
+}
+
+// Next frame type with its payload in io->frame, or -1 once the peer is gone
+static int remote_recv(remote_io_t *io, size_t *len)
+{
+    uint8_t hdr[5];
+    if (!remote_read(io, hdr, sizeof(hdr)))
+        return -1;
+    *len = remote_get32(hdr + 1);
+    if (!remote_read_payload(io, *len))
+        return -1;
+    return hdr[0];
+}
+
+static void remote_hello(remote_io_t *io, uint32_t flags)
+{
+    uint8_t head[16];
+    memcpy(head, REMOTE_MAGIC, 8);
+    remote_put32(head + 8, REMOTE_VERSION);
+    remote_put32(head + 12, flags);
+    remote_send(io, REMOTE_HELLO, head, sizeof(head), cnull, 0);
+}
+
+// Wait for the peer's greeting, skipping whatever the transport printed first
+static bool remote_await_hello(remote_io_t *io, uint32_t *flags)
+{
+    uint8_t window[13] = {0}; // frame header + magic
+    for (size_t seen = 0; seen < REMOTE_BANNER_MAX; seen++)
+    {
+        memmove(window, window + 1, sizeof(window) - 1);
+        if (!remote_read(io, &window[sizeof(window) - 1], 1))
+            return false;
+        if (seen + 1 < sizeof(window) || window[0] != REMOTE_HELLO ||
+            memcmp(window + 5, REMOTE_MAGIC, 8) != 0)
+            continue;
+        size_t len = remote_get32(window + 1);
+        if (len != 16 || !remote_read_payload(io, len - 8))
+            return false;
+        *flags = remote_get32(io->frame + 4);
+        return remote_get32(io->frame) == REMOTE_VERSION;
+    }
+    return false;
+}
+
+static remote_io_t *remote_open(int in, int out)
+{
+    remote_io_t *io = fossil_sys_memory_calloc(1, sizeof(remote_io_t));
+    if (cnotnull(io))
+    {
+        io->in = in;
+        io->out = out;
+    }
+    return io;
+}
+
+static void remote_close(remote_io_t *io)
+{
+    if (cnotnull(io->frame))
+        fossil_sys_memory_free(io->frame);
+    fossil_sys_memory_free(io);
+}
+
+// --- server side --------------------------------------------------------
+
+typedef struct
+{
+    ccstring root;
+    fossil_io_filesys_file_t out; // temp file being assembled
+    fossil_io_filesys_file_t old; // basis for block copies
+    bool open;
+    bool has_old;
+    bool ok;
+    char path[FOSSIL_FILESYS_MAX_PATH];
+    char temp[FOSSIL_FILESYS_MAX_PATH];
+    uint32_t mode;
+    int64_t mtime_ns;
+    uint8_t *buf;
+    uint32_t errors;
+    uint64_t written;
+} remote_server_t;
+
+// Destination path for a peer-supplied relative path; refuses escapes
+static bool remote_path(const remote_server_t *sv, ccstring rel, char *out, size_t out_len)
+{
+    if (rel[0] == '\0' || !sync_rel_safe(rel))
+        return false;
+    int n = snprintf(out, out_len, "%s/%s", sv->root, rel);
+    return n > 0 && (size_t)n < out_len;
+}
+
+static void remote_server_list(remote_io_t *io, ccstring root, uint32_t flags)
+{
+    sync_ctx_t scan = {0};
+    bisync_t bi = {0};
+    bi.flat = (flags & REMOTE_RECURSIVE) == 0;
+    if (fossil_io_filesys_exists(root) == 1)
+        bisync_scan(&scan, &bi, 0, root, "");
+
+    uint8_t head[REMOTE_ENTRY_SIZE];
+    for (size_t i = 0; i < bi.count[0] && !io->failed; i++)
+    {
+        bisync_item_t *item = &bi.items[0][i];
+        uint64_t digest[2] = {0, 0};
+        if ((flags & REMOTE_CHECKSUM) && item->type == FOSSIL_FILESYS_TYPE_FILE)
+        {
+            char path[FOSSIL_FILESYS_MAX_PATH];
+            snprintf(path, sizeof(path), "%s/%s", root, item->rel);
+            sync_digest(path, digest);
+        }
+        head[0] = (uint8_t)item->type;
+        remote_put32(head + 1, item->mode);
+        remote_put64(head + 5, item->size);
+        remote_put64(head + 13, (uint64_t)item->mtime_ns);
+        remote_put64(head + 21, digest[0]);
+        remote_put64(head + 29, digest[1]);
+        remote_send_path(io, REMOTE_ENTRY, head, sizeof(head), item->rel);
+    }
+    remote_send(io, REMOTE_LIST_END, cnull, 0, cnull, 0);
+    remote_flush(io);
+    bisync_free(&bi);
+}
+
+static void remote_server_sigs(remote_io_t *io, remote_server_t *sv)
+{
+    // Requests are small; collect them all before answering
+    size_t len;
+    uint8_t *reqs = cnull;
+    size_t req_len = 0;
+    int type;
+    while ((type = remote_recv(io, &len)) == REMOTE_SIG_REQ)
+    {
+        uint8_t *grown = fossil_sys_memory_realloc(reqs, req_len + len + 4);
+        if (!cnotnull(grown))
+        {
+            io->failed = true;
+            break;
+        }
+        reqs = grown;
+        remote_put32(reqs + req_len, (uint32_t)len);
+        memcpy(reqs + req_len + 4, io->frame, len);
+        req_len += len + 4;
+    }
+    if (type != REMOTE_SIG_REQ_END)
+        io->failed = true;
+
+    for (size_t at = 0; at < req_len && !io->failed;)
+    {
+        size_t n = remote_get32(reqs + at);
+        const uint8_t *req = reqs + at + 4;
+        at += n + 4;
+        if (n < 12)
+            continue;
+
+        char rel[FOSSIL_FILESYS_MAX_PATH], path[FOSSIL_FILESYS_MAX_PATH];
+        size_t rel_len = n - 12 < sizeof(rel) - 1 ? n - 12 : sizeof(rel) - 1;
+        memcpy(rel, req + 12, rel_len);
+        rel[rel_len] = '\0';
+
+        uint8_t head[12];
+        memcpy(head, req, 4); // request id
+        delta_sig_t sig = {0};
+        fossil_io_filesys_obj_t obj;
+        size_t block = (size_t)remote_get64(req + 4);
+        bool have = block >= DELTA_MIN_BLOCK && block <= DELTA_MAX_BLOCK &&
+                    remote_path(sv, rel, path, sizeof(path)) &&
+                    fossil_io_filesys_stat(path, &obj) == 0 && obj.size >= block &&
+                    delta_signature(path, obj.size, block, &sig) == 0;
+        remote_put32(head + 4, have ? (uint32_t)block : 0);
+        remote_put32(head + 8, have ? (uint32_t)sig.count : 0);
+        if (!have)
+        {
+            remote_send(io, REMOTE_SIG, head, sizeof(head), cnull, 0);
+            continue;
+        }
+
+        uint8_t hdr[5];
+        size_t body = sig.count * 20;
+        hdr[0] = REMOTE_SIG;
+        remote_put32(hdr + 1, (uint32_t)(sizeof(head) + body));
+        remote_write(io, hdr, sizeof(hdr));
+        remote_write(io, head, sizeof(head));
+        for (size_t i = 0; i < sig.count; i++)
+        {
+            uint8_t rec[20];
+            remote_put32(rec, sig.weak[i]);
+            remote_put64(rec + 4, sig.strong[i * 2]);
+            remote_put64(rec + 12, sig.strong[i * 2 + 1]);
+            remote_write(io, rec, sizeof(rec));
+        }
+        delta_sig_free(&sig);
+    }
+    if (cnotnull(reqs))
+        fossil_sys_memory_free(reqs);
+    remote_send(io, REMOTE_SIG_END, cnull, 0, cnull, 0);
+    remote_flush(io);
+}
+
+static void remote_server_file_begin(remote_server_t *sv, const uint8_t *frame, size_t len)
+{
+    sv->ok = false;
+    sv->open = false;
+    sv->has_old = false;
+    if (len < 21)
+        return;
+    sv->mode = remote_get32(frame);
+    sv->mtime_ns = (int64_t)remote_get64(frame + 4);
+    bool basis = frame[20] != 0;
+    if (!remote_path(sv, (ccstring)frame + 21, sv->path, sizeof(sv->path)))
+        return;
+    snprintf(sv->temp, sizeof(sv->temp), "%s.shark-delta", sv->path);
+    if (basis)
+        sv->has_old = fossil_io_filesys_file_open(&sv->old, sv->path, "rb") == 0;
+    sv->open = fossil_io_filesys_file_open(&sv->out, sv->temp, "wb") == 0;
+    sv->ok = sv->open && (sv->has_old || !basis);
+}
+
+static void remote_server_copy(remote_server_t *sv, const uint8_t *frame, size_t len)
+{
+    if (!sv->ok || !sv->has_old || len < 16)
+    {
+        sv->ok = false;
+        return;
+    }
+    uint64_t off = remote_get64(frame);
+    uint64_t left = remote_get64(frame + 8);
+    if (fossil_shark_file_seek(&sv->old, off) != 0)
+    {
+        sv->ok = false;
+        return;
+    }
+    while (left > 0 && sv->ok)
+    {
+        size_t chunk = left < REMOTE_CHUNK ? (size_t)left : REMOTE_CHUNK;
+        sv->ok = fossil_shark_throttle_read(&sv->old, sv->buf, chunk) == chunk &&
+                 fossil_shark_throttle_write(&sv->out, sv->buf, chunk) == chunk;
+        left -= chunk;
+    }
+}
+
+static void remote_server_file_end(remote_server_t *sv)
+{
+    if (sv->has_old)
+        fossil_io_filesys_file_close(&sv->old);
+    if (sv->open && fossil_io_filesys_file_close(&sv->out) != 0)
+        sv->ok = false;
+    if (sv->ok && fossil_io_filesys_move(sv->temp, sv->path, true) == 0)
+    {
+        chmod(sv->path, sv->mode & 07777);
+        sync_set_mtime(sv->path, sv->mtime_ns);
+    }
+    else
+    {
+        if (sv->open)
+            fossil_io_filesys_remove(sv->temp, false);
+        sv->errors++;
+    }
+    sv->open = false;
+    sv->has_old = false;
+    sv->ok = false;
+}
+
+// Apply the client's changes until it says it is done
+static void remote_server_apply(remote_io_t *io, remote_server_t *sv)
+{
+    size_t len;
+    int type;
+    char path[FOSSIL_FILESYS_MAX_PATH];
+    while ((type = remote_recv(io, &len)) >= 0 && type != REMOTE_DONE)
+    {
+        const uint8_t *f = io->frame;
+        switch (type)
+        {
+        case REMOTE_DELETE:
+            if (len < 1 || !remote_path(sv, (ccstring)f + 1, path, sizeof(path)))
+                sv->errors++;
+            else if (fossil_io_filesys_exists(path) == 1 && fossil_io_filesys_remove(path, f[0] != 0) != 0)
+                sv->errors++;
+            break;
+        case REMOTE_MKDIR:
+            if (!remote_path(sv, (ccstring)f, path, sizeof(path)))
+                sv->errors++;
+            else if (fossil_io_filesys_exists(path) != 1 && fossil_io_filesys_dir_create(path, true) != 0)
+                sv->errors++;
+            break;
+        case REMOTE_CHMOD:
+            if (len < 4 || !remote_path(sv, (ccstring)f + 4, path, sizeof(path)) ||
+                chmod(path, remote_get32(f) & 07777) != 0)
+                sv->errors++;
+            break;
+        case REMOTE_FILE:
+            remote_server_file_begin(sv, f, len);
+            break;
+        case REMOTE_LITERAL:
+            if (sv->ok)
+            {
+                sv->ok = fossil_shark_throttle_write(&sv->out, f, len) == len;
+                sv->written += len;
+            }
+            break;
+        case REMOTE_COPY:
+            remote_server_copy(sv, f, len);
+            break;
+        case REMOTE_FILE_END:
+            remote_server_file_end(sv);
+            break;
+        default:
+            io->failed = true;
+            break;
+        }
+    }
+    if (sv->open)
+        remote_server_file_end(sv);
+    if (type != REMOTE_DONE)
+        sv->errors++;
+}
+#endif
+
+int fossil_shark_sync_server(ccstring dest)
+{
+#ifndef _WIN32
+    if (!cnotnull(dest))
+        return 1;
+
+    // stdout carries the protocol; keep everything else off it
+    remote_io_t *io = remote_open(STDIN_FILENO, STDOUT_FILENO);
+    remote_server_t sv = {0};
+    sv.root = dest;
+    sv.buf = fossil_sys_memory_alloc(REMOTE_CHUNK);
+    if (!cnotnull(io) || !cnotnull(sv.buf))
+    {
+        if (cnotnull(io))
+            remote_close(io);
+        if (cnotnull(sv.buf))
+            fossil_sys_memory_free(sv.buf);
+        return 1;
+    }
+
+    uint32_t flags = 0;
+    remote_hello(io, 0);
+    remote_flush(io);
+    if (remote_await_hello(io, &flags))
+    {
+        // A dry run only lists; a missing root is listed as empty
+        if ((flags & REMOTE_DRY_RUN) == 0 && fossil_io_filesys_exists(dest) != 1)
+            fossil_io_filesys_dir_create(dest, true);
+        remote_server_list(io, dest, flags);
+        remote_server_sigs(io, &sv);
+        remote_server_apply(io, &sv);
+
+        uint8_t result[12];
+        remote_put32(result, sv.errors);
+        remote_put64(result + 4, sv.written);
+        remote_send(io, REMOTE_RESULT, result, sizeof(result), cnull, 0);
+        remote_flush(io);
+    }
+    else
+    {
+        sv.errors++;
+    }
+
+    int rc = io->failed || sv.errors > 0 ? 1 : 0;
+    fossil_sys_memory_free(sv.buf);
+    remote_close(io);
+    return rc;
+#else
+    (void)dest;
+    fossil_io_printf("{red}Error: sync --server is not supported on this platform.{normal}\n");
+    return 1;
+#endif
+}
+
+#ifndef _WIN32
+// --- client side --------------------------------------------------------
+
+// Start `<cmd> sync --server '<dest>'` under /bin/sh with both pipes attached
+static pid_t remote_spawn(ccstring cmd, ccstring dest, int *to_peer, int *from_peer)
+{
+    size_t cap = strlen(cmd) + strlen(dest) * 4 + 32;
+    cstring line = fossil_sys_memory_alloc(cap);
+    if (!cnotnull(line))
+        return -1;
+    size_t n = (size_t)snprintf(line, cap, "%s sync --server '", cmd);
+    for (ccstring c = dest; *c; c++)
+    {
+        if (*c == '\'')
+        {
+            memcpy(line + n, "'\\''", 4);
+            n += 4;
+        }
+        else
+        {
+            line[n++] = *c;
+        }
+    }
+    line[n++] = '\'';
+    line[n] = '\0';
+
+    int down[2], up[2];
+    if (pipe(down) != 0)
+    {
+        fossil_sys_memory_free(line);
+        return -1;
+    }
+    if (pipe(up) != 0)
+    {
+        close(down[0]);
+        close(down[1]);
+        fossil_sys_memory_free(line);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(down[0], STDIN_FILENO);
+        dup2(up[1], STDOUT_FILENO);
+        close(down[0]);
+        close(down[1]);
+        close(up[0]);
+        close(up[1]);
+        execl("/bin/sh", "sh", "-c", line, (char *)cnull);
+        _exit(127);
+    }
+    close(down[0]);
+    close(up[1]);
+    fossil_sys_memory_free(line);
+    if (pid < 0)
+    {
+        close(down[1]);
+        close(up[0]);
+        return -1;
+    }
+    *to_peer = down[1];
+    *from_peer = up[0];
+    return pid;
+}
+
+static bool remote_read_listing(remote_io_t *io, sync_ctx_t *ctx, bisync_t *bi)
+{
+    size_t len;
+    int type;
+    while ((type = remote_recv(io, &len)) == REMOTE_ENTRY)
+    {
+        if (len <= REMOTE_ENTRY_SIZE)
+            continue;
+        if (!sync_reserve((void **)&bi->items[1], &bi->cap[1], bi->count[1], sizeof(bisync_item_t)))
+        {
+            ctx->errors++;
+            return false;
+        }
+        const uint8_t *f = io->frame;
+        bisync_item_t *item = &bi->items[1][bi->count[1]++];
+        item->type = f[0];
+        item->mode = remote_get32(f + 1);
+        item->size = remote_get64(f + 5);
+        item->mtime_ns = (int64_t)remote_get64(f + 13);
+        item->digest[0] = remote_get64(f + 21);
+        item->digest[1] = remote_get64(f + 29);
+        item->rel = fossil_io_cstring_dup((ccstring)f + REMOTE_ENTRY_SIZE);
+    }
+    if (bi->count[1] > 1)
+        qsort(bi->items[1], bi->count[1], sizeof(bisync_item_t), bisync_item_cmp);
+    return type == REMOTE_LIST_END;
+}
+
+// Same decisions as a local run, with the listing standing in for dest
+static void remote_plan(sync_ctx_t *ctx, bisync_t *bi, ccstring src)
+{
+    size_t i = 0, j = 0;
+    ccstring removed = cnull; // last directory planned for removal
+    while (i < bi->count[0] || j < bi->count[1])
+    {
+        const bisync_item_t *l = i < bi->count[0] ? &bi->items[0][i] : cnull;
+        const bisync_item_t *r = j < bi->count[1] ? &bi->items[1][j] : cnull;
+        int c = !l ? 1 : !r ? -1 : bisync_path_cmp(l->rel, r->rel);
+        if (c <= 0)
+            i++;
+        if (c >= 0)
+            j++;
+        if (c < 0)
+            r = cnull;
+        if (c > 0)
+            l = cnull;
+
+        ccstring rel = l ? l->rel : r->rel;
+        if (cnotnull(removed) && strncmp(rel, removed, strlen(removed)) == 0 && rel[strlen(removed)] == '/')
+            continue;
+
+        if (r && (!l || l->type != r->type))
+        {
+            if (!l && !ctx->delete_flag)
+                continue;
+            // Extraneous, or in the way of a different type
+            bool dir = r->type == FOSSIL_FILESYS_TYPE_DIR;
+            sync_plan(ctx, dir ? SYNC_RMDIR : SYNC_DELETE, rel, cnull, cnull, 0, SIZE_MAX);
+            if (dir)
+                removed = rel;
+            if (!l)
+                continue;
+            r = cnull;
+        }
+        if (l->type == FOSSIL_FILESYS_TYPE_DIR)
+        {
+            if (!r)
+                sync_plan(ctx, SYNC_MKDIR, rel, cnull, cnull, 0, SIZE_MAX);
+            continue;
+        }
+
+        char path[FOSSIL_FILESYS_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", src, rel);
+        if (r)
+        {
+            if (ctx->update && r->mtime_ns >= l->mtime_ns)
+                continue;
+            uint64_t digest[2];
+            bool same = l->size == r->size &&
+                        (ctx->checksum ? sync_digest(path, digest) == 0 &&
+                                             digest[0] == r->digest[0] && digest[1] == r->digest[1]
+                                       : l->mtime_ns == r->mtime_ns);
+            if (same)
+            {
+                if (l->mode != r->mode)
+                    sync_plan(ctx, SYNC_CHMOD, rel, cnull, cnull, l->mode, SIZE_MAX);
+                continue;
+            }
+        }
+        bool delta = r && ctx->delta && r->size >= DELTA_MIN_BLOCK;
+        // A delta action remembers the remote size in its slot for the block choice
+        sync_plan(ctx, delta ? SYNC_DELTA : SYNC_COPY, rel, path, cnull, l->mode, delta ? (size_t)r->size : SIZE_MAX);
+    }
+}
+
+static void remote_stream_literal(remote_io_t *io, fossil_io_filesys_file_t *file, uint64_t off,
+                                  uint64_t len, uint8_t *buf, uint64_t *sent, int *rc)
+{
+    if (fossil_shark_file_seek(file, off) != 0)
+    {
+        *rc = -1;
+        return;
+    }
+    while (len > 0 && *rc == 0 && !io->failed)
+    {
+        size_t chunk = len < REMOTE_CHUNK ? (size_t)len : REMOTE_CHUNK;
+        if (fossil_shark_throttle_read(file, buf, chunk) != chunk)
+        {
+            *rc = -1;
+            return;
+        }
+        remote_send(io, REMOTE_LITERAL, buf, chunk, cnull, 0);
+        *sent += chunk;
+        len -= chunk;
+    }
+}
+
+// Send one file as literals, or as literals plus block copies given a signature
+static int remote_send_file(remote_io_t *io, const sync_action_t *a, const delta_sig_t *sig,
+                            uint8_t *buf, uint64_t *sent, uint64_t *matched)
+{
+    fossil_io_filesys_obj_t obj;
+    if (fossil_io_filesys_stat(a->src, &obj) != 0)
+        return -1;
+
+    delta_ops_t list = {0};
+    bool delta = sig->count > 0 && delta_match(a->src, obj.size, sig, &list) == 0;
+
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_file_open(&file, a->src, "rb") != 0)
+    {
+        if (cnotnull(list.ops))
+            fossil_sys_memory_free(list.ops);
+        return -1;
+    }
+
+    uint8_t head[21];
+    remote_put32(head, a->mode);
+    remote_put64(head + 4, (uint64_t)sync_mtime_ns(a->src, &obj));
+    remote_put64(head + 12, obj.size);
+    head[20] = delta ? 1 : 0;
+    remote_send_path(io, REMOTE_FILE, head, sizeof(head), a->dest);
+
+    int rc = 0;
+    if (delta)
+    {
+        for (size_t k = 0; k < list.count && rc == 0; k++)
+        {
+            const delta_op_t *op = &list.ops[k];
+            if (op->block < 0)
+            {
+                remote_stream_literal(io, &file, op->src_off, op->len, buf, sent, &rc);
+                continue;
+            }
+            uint8_t copy[16];
+            remote_put64(copy, (uint64_t)op->block * sig->block);
+            remote_put64(copy + 8, op->len);
+            remote_send(io, REMOTE_COPY, copy, sizeof(copy), cnull, 0);
+            *matched += op->len;
+        }
+    }
+    else
+    {
+        remote_stream_literal(io, &file, 0, obj.size, buf, sent, &rc);
+    }
+    // Always close the frame sequence; a short file makes the server discard it
+    remote_send(io, REMOTE_FILE_END, cnull, 0, cnull, 0);
+
+    fossil_io_filesys_file_close(&file);
+    if (cnotnull(list.ops))
+        fossil_sys_memory_free(list.ops);
+    return rc;
+}
+
+// Ask for every needed signature in one batch, then read them all back
+static delta_sig_t *remote_fetch_sigs(remote_io_t *io, sync_ctx_t *ctx)
+{
+    delta_sig_t *sigs = fossil_sys_memory_calloc(ctx->action_count ? ctx->action_count : 1, sizeof(delta_sig_t));
+    if (!cnotnull(sigs))
+        return cnull;
+
+    for (size_t k = 0; k < ctx->action_count; k++)
+    {
+        const sync_action_t *a = &ctx->actions[k];
+        if (a->kind != SYNC_DELTA)
+            continue;
+        fossil_io_filesys_obj_t obj;
+        uint64_t size = fossil_io_filesys_stat(a->src, &obj) == 0 ? obj.size : 0;
+        uint8_t head[12];
+        remote_put32(head, (uint32_t)k);
+        remote_put64(head + 4, delta_block_size(size > a->slot ? size : a->slot));
+        remote_send_path(io, REMOTE_SIG_REQ, head, sizeof(head), a->dest);
+    }
+    remote_send(io, REMOTE_SIG_REQ_END, cnull, 0, cnull, 0);
+    remote_flush(io);
+
+    size_t len;
+    int type;
+    while ((type = remote_recv(io, &len)) == REMOTE_SIG)
+    {
+        if (len < 12)
+            continue;
+        const uint8_t *f = io->frame;
+        size_t k = remote_get32(f);
+        delta_sig_t *sig = &sigs[k < ctx->action_count ? k : 0];
+        if (k >= ctx->action_count || sig->count > 0)
+            continue;
+        sig->block = remote_get32(f + 4);
+        sig->count = remote_get32(f + 8);
+        if (sig->block < DELTA_MIN_BLOCK || sig->block > DELTA_MAX_BLOCK || sig->count == 0 ||
+            len != 12 + sig->count * 20 || delta_sig_alloc(sig) != 0)
+        {
+            memset(sig, 0, sizeof(*sig));
+            continue;
+        }
+        for (size_t i = 0; i < sig->count; i++)
+        {
+            const uint8_t *rec = f + 12 + i * 20;
+            sig->weak[i] = remote_get32(rec);
+            sig->strong[i * 2] = remote_get64(rec + 4);
+            sig->strong[i * 2 + 1] = remote_get64(rec + 12);
+        }
+        if (delta_sig_index(sig) != 0)
+            memset(sig, 0, sizeof(*sig));
+    }
+    if (type != REMOTE_SIG_END)
+        io->failed = true;
+    return sigs;
+}
+
+static void remote_push(remote_io_t *io, sync_ctx_t *ctx, delta_sig_t *sigs)
+{
+    uint8_t *buf = fossil_sys_memory_alloc(REMOTE_CHUNK);
+    if (!cnotnull(buf))
+    {
+        ctx->errors++;
+        return;
+    }
+
+    // Removals first (they may clear the way for a new type), then directories, contents, modes
+    static const int phases[][2] = {{SYNC_DELETE, SYNC_RMDIR}, {SYNC_MKDIR, SYNC_MKDIR},
+                                    {SYNC_COPY, SYNC_DELTA}, {SYNC_CHMOD, SYNC_CHMOD}};
+    uint64_t sent = 0, matched = 0;
+    size_t files = 0;
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++)
+    {
+        for (size_t k = 0; k < ctx->action_count && !io->failed; k++)
+        {
+            const sync_action_t *a = &ctx->actions[k];
+            if (a->kind != phases[p][0] && a->kind != phases[p][1])
+                continue;
+            uint8_t head[4];
+            switch (a->kind)
+            {
+            case SYNC_DELETE:
+            case SYNC_RMDIR:
+                head[0] = a->kind == SYNC_RMDIR;
+                remote_send_path(io, REMOTE_DELETE, head, 1, a->dest);
+                break;
+            case SYNC_MKDIR:
+                remote_send_path(io, REMOTE_MKDIR, cnull, 0, a->dest);
+                break;
+            case SYNC_CHMOD:
+                remote_put32(head, a->mode);
+                remote_send_path(io, REMOTE_CHMOD, head, sizeof(head), a->dest);
+                break;
+            default:
+                if (remote_send_file(io, a, &sigs[k], buf, &sent, &matched) != 0)
+                {
+                    fossil_io_printf("{red}Error: Cannot send %s.{normal}\n", a->src);
+                    ctx->errors++;
+                }
+                files++;
+                break;
+            }
+        }
+    }
+    remote_send(io, REMOTE_DONE, cnull, 0, cnull, 0);
+    remote_flush(io);
+    fossil_sys_memory_free(buf);
+
+    size_t len;
+    if (remote_recv(io, &len) != REMOTE_RESULT || len < 12)
+    {
+        io->failed = true;
+        return;
+    }
+    uint32_t remote_errors = remote_get32(io->frame);
+    if (remote_errors > 0)
+    {
+        fossil_io_printf("{red}Error: %u change(s) failed on the remote side.{normal}\n", remote_errors);
+        ctx->errors += (int)remote_errors;
+    }
+    fossil_io_printf("{cyan}Remote sync: %zu file(s), %llu bytes sent, %llu bytes reused{normal}\n",
+                     files, (unsigned long long)sent, (unsigned long long)matched);
+}
+#endif
+
+/*
+ * Push src to dest on the far side of remote_cmd. Returns non-zero when
+ * the transport fails or any change could not be applied.
+ */
+int sync_remote(sync_ctx_t *ctx, ccstring src, ccstring dest, ccstring remote_cmd, bool dry_run)
+{
+#ifndef _WIN32
+    fossil_io_filesys_obj_t src_obj;
+    if (fossil_io_filesys_stat(src, &src_obj) != 0 || src_obj.type != FOSSIL_FILESYS_TYPE_DIR)
+    {
+        fossil_io_printf("{red}Error: Remote sync needs a source directory.{normal}\n");
+        return 1;
+    }
+
+    int to_peer = -1, from_peer = -1;
+    pid_t pid = remote_spawn(remote_cmd, dest, &to_peer, &from_peer);
+    if (pid < 0)
+    {
+        fossil_io_printf("{red}Error: Cannot start remote command.{normal}\n");
+        return 1;
+    }
+    // A dead peer must surface as a write error, not kill us
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    remote_io_t *io = remote_open(from_peer, to_peer);
+    bisync_t bi = {0};
+    bi.flat = !ctx->recursive;
+    delta_sig_t *sigs = cnull;
+    uint32_t flags = 0;
+    if (!cnotnull(io))
+    {
+        ctx->errors++;
+    }
+    else if (!remote_await_hello(io, &flags))
+    {
+        fossil_io_printf("{red}Error: Remote command did not start a sync server.{normal}\n");
+        ctx->errors++;
+    }
+    else
+    {
+        remote_hello(io, (ctx->recursive ? REMOTE_RECURSIVE : 0) | (ctx->checksum ? REMOTE_CHECKSUM : 0) |
+                             (dry_run ? REMOTE_DRY_RUN : 0));
+        remote_flush(io);
+
+        // The remote listing arrives while we walk the local tree
+        if (remote_read_listing(io, ctx, &bi))
+        {
+            bisync_scan(ctx, &bi, 0, src, "");
+            if (bi.count[0] > 1)
+                qsort(bi.items[0], bi.count[0], sizeof(bisync_item_t), bisync_item_cmp);
+            remote_plan(ctx, &bi, src);
+            if (dry_run)
+            {
+                // Walk the server through its phases without changing anything
+                size_t len;
+                sync_print_plan(ctx);
+                remote_send(io, REMOTE_SIG_REQ_END, cnull, 0, cnull, 0);
+                remote_flush(io);
+                if (remote_recv(io, &len) != REMOTE_SIG_END)
+                    io->failed = true;
+                remote_send(io, REMOTE_DONE, cnull, 0, cnull, 0);
+                remote_flush(io);
+                if (remote_recv(io, &len) != REMOTE_RESULT)
+                    io->failed = true;
+            }
+            else if (cnotnull(sigs = remote_fetch_sigs(io, ctx)))
+            {
+                remote_push(io, ctx, sigs);
+            }
+            else
+            {
+                ctx->errors++;
+            }
+        }
+        if (io->failed)
+        {
+            fossil_io_printf("{red}Error: Lost connection to the remote sync server.{normal}\n");
+            ctx->errors++;
+        }
+    }
+
+    if (cnotnull(sigs))
+    {
+        for (size_t k = 0; k < ctx->action_count; k++)
+            delta_sig_free(&sigs[k]);
+        fossil_sys_memory_free(sigs);
+    }
+    if (cnotnull(io))
+        remote_close(io);
+    close(to_peer);
+    close(from_peer);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    signal(SIGPIPE, old_pipe);
+    bisync_free(&bi);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ctx->errors++;
+    return ctx->errors > 0 ? 1 : 0;
+#else
+    (void)ctx;
+    (void)src;
+    (void)dest;
+    (void)remote_cmd;
+    (void)dry_run;
+    fossil_io_printf("{red}Error: --remote-cmd is not supported on this platform.{normal}\n");
+    return 1;
+#endif
+}
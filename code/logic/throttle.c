@@ -0,0 +1,281 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include "fossil/code/throttle.h"
+
+#include <limits.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/*
+ * Token buckets kept as GCRA virtual clocks: each charge pushes the
+ * bucket's clock forward by cost / rate, and a caller only sleeps for the
+ * part that runs more than THROTTLE_BURST_NS ahead of real time. The
+ * reservation is taken under the lock and the sleep happens outside it,
+ * so concurrent sync workers queue up behind each other fairly.
+ */
+#define THROTTLE_BURST_NS 100000000LL   // 100 ms of credit
+#define THROTTLE_ADAPT_NS 100000000LL   // re-evaluate latency every 100 ms
+#define THROTTLE_MIN_FACTOR (1.0 / 16.0) // never back off below 1/16 of the cap
+
+typedef struct
+{
+    uint64_t bytes_per_sec;
+    uint64_t ops_per_sec;
+    bool adaptive;
+    int64_t bytes_clock;
+    int64_t ops_clock;
+    double factor;     // adaptive scale applied to both caps
+    double fast_ns;    // short-term read latency average
+    double slow_ns;    // long-term read latency average, the baseline
+    int64_t adapt_at;
+} throttle_state_t;
+
+static throttle_state_t throttle = {0, 0, false, 0, 0, 1.0, 0.0, 0.0, 0};
+static volatile bool throttle_on = false;
+
+#ifndef _WIN32
+static pthread_mutex_t throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+#define THROTTLE_LOCK() pthread_mutex_lock(&throttle_lock)
+#define THROTTLE_UNLOCK() pthread_mutex_unlock(&throttle_lock)
+#else
+#define THROTTLE_LOCK() ((void)0)
+#define THROTTLE_UNLOCK() ((void)0)
+#endif
+
+static int64_t throttle_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (int64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static void throttle_sleep(int64_t ns)
+{
+#ifdef _WIN32
+    Sleep((DWORD)((ns + 999999) / 1000000));
+#else
+    struct timespec ts = {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+#endif
+}
+
+// Push one bucket's clock forward and return how far it now runs ahead
+static int64_t throttle_charge(int64_t *clock, int64_t now, double cost, uint64_t rate)
+{
+    if (rate == 0)
+        return 0;
+    if (*clock < now)
+        *clock = now;
+    *clock += (int64_t)(cost * 1e9 / ((double)rate * throttle.factor));
+    return *clock - now - THROTTLE_BURST_NS;
+}
+
+static void throttle_wait(size_t bytes)
+{
+    THROTTLE_LOCK();
+    int64_t now = throttle_now();
+    int64_t wait = throttle_charge(&throttle.bytes_clock, now, (double)bytes, throttle.bytes_per_sec);
+    int64_t ops_wait = throttle_charge(&throttle.ops_clock, now, 1.0, throttle.ops_per_sec);
+    THROTTLE_UNLOCK();
+
+    if (ops_wait > wait)
+        wait = ops_wait;
+    if (wait > 0)
+        throttle_sleep(wait);
+}
+
+/*
+ * Adaptive mode compares a short-term read latency average against a
+ * long-term baseline. While reads are clearly slower than usual (someone
+ * else is loading the disk) the caps are halved, down to 1/16; once latency
+ * is back near the baseline they recover in 1/16 steps.
+ */
+static void throttle_observe(int64_t latency_ns, size_t bytes)
+{
+    // Normalise to a 64 KiB read so large and small reads compare
+    double sample = (double)latency_ns / (1.0 + (double)bytes / 65536.0);
+
+    THROTTLE_LOCK();
+    if (throttle.slow_ns == 0.0)
+    {
+        throttle.fast_ns = sample;
+        throttle.slow_ns = sample;
+    }
+    throttle.fast_ns += (sample - throttle.fast_ns) / 8.0;
+    throttle.slow_ns += (sample - throttle.slow_ns) / 256.0;
+
+    int64_t now = throttle_now();
+    if (now >= throttle.adapt_at)
+    {
+        throttle.adapt_at = now + THROTTLE_ADAPT_NS;
+        if (throttle.fast_ns > 2.0 * throttle.slow_ns)
+        {
+            throttle.factor /= 2.0;
+            if (throttle.factor < THROTTLE_MIN_FACTOR)
+                throttle.factor = THROTTLE_MIN_FACTOR;
+        }
+        else if (throttle.fast_ns < 1.25 * throttle.slow_ns && throttle.factor < 1.0)
+        {
+            throttle.factor += THROTTLE_MIN_FACTOR;
+            if (throttle.factor > 1.0)
+                throttle.factor = 1.0;
+        }
+    }
+    THROTTLE_UNLOCK();
+}
+
+void fossil_shark_throttle_set(uint64_t bytes_per_sec, uint64_t ops_per_sec, bool adaptive)
+{
+    THROTTLE_LOCK();
+    throttle.bytes_per_sec = bytes_per_sec;
+    throttle.ops_per_sec = ops_per_sec;
+    throttle.adaptive = adaptive;
+    throttle.bytes_clock = 0;
+    throttle.ops_clock = 0;
+    throttle.factor = 1.0;
+    throttle.fast_ns = 0.0;
+    throttle.slow_ns = 0.0;
+    throttle.adapt_at = 0;
+    throttle_on = bytes_per_sec > 0 || ops_per_sec > 0;
+    THROTTLE_UNLOCK();
+}
+
+bool fossil_shark_throttle_active(void)
+{
+    return throttle_on;
+}
+
+uint64_t fossil_shark_throttle_parse_rate(ccstring text)
+{
+    if (!cnotnull(text))
+        return 0;
+    char *end = cnull;
+    double value = strtod(text, &end);
+    if (end == text || value <= 0.0)
+        return 0;
+
+    switch (*end)
+    {
+    case 'k': case 'K': value *= 1024.0; end++; break;
+    case 'm': case 'M': value *= 1024.0 * 1024.0; end++; break;
+    case 'g': case 'G': value *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    default: break;
+    }
+    if (*end == 'i' || *end == 'I')
+        end++;
+    if (*end == 'b' || *end == 'B')
+        end++;
+    if (*end != '\0' || value < 1.0 || value > 1e18)
+        return 0;
+    return (uint64_t)value;
+}
+
+size_t fossil_shark_throttle_read(fossil_io_filesys_file_t *file, void *buffer, size_t size)
+{
+    if (!throttle_on)
+        return fossil_io_filesys_file_read(file, buffer, 1, size);
+
+    throttle_wait(size);
+    int64_t start = throttle.adaptive ? throttle_now() : 0;
+    size_t n = fossil_io_filesys_file_read(file, buffer, 1, size);
+    if (throttle.adaptive && n > 0)
+        throttle_observe(throttle_now() - start, n);
+    return n;
+}
+
+size_t fossil_shark_throttle_write(fossil_io_filesys_file_t *file, const void *buffer, size_t size)
+{
+    if (throttle_on)
+        throttle_wait(size);
+    return fossil_io_filesys_file_write(file, buffer, 1, size);
+}
+
+#ifndef _WIN32
+size_t fossil_shark_throttle_write_fd(int fd, const void *buffer, size_t size)
+{
+    if (throttle_on)
+        throttle_wait(size);
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = write(fd, (const char *)buffer + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    return done;
+}
+#endif
+
+int fossil_shark_file_seek(fossil_io_filesys_file_t *file, uint64_t offset)
+{
+    if (offset <= (uint64_t)LONG_MAX)
+        return fossil_io_filesys_file_seek(file, (long)offset, SEEK_SET);
+
+    if (fossil_io_filesys_file_seek(file, 0, SEEK_SET) != 0)
+        return -1;
+    while (offset > 0)
+    {
+        long step = offset > (uint64_t)LONG_MAX ? LONG_MAX : (long)offset;
+        if (fossil_io_filesys_file_seek(file, step, SEEK_CUR) != 0)
+            return -1;
+        offset -= (uint64_t)step;
+    }
+    return 0;
+}
+
+void fossil_shark_throttle_background(void)
+{
+    if (!throttle_on)
+        return;
+#if defined(_WIN32)
+    SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__) && defined(SYS_ioprio_set)
+    // IOPRIO_WHO_PROCESS, this process, IOPRIO_CLASS_IDLE
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#elif defined(__APPLE__)
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_THROTTLE);
+#endif
+}
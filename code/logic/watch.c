@@ -24,73 +24,1428 @@
  */
 #include "fossil/code/watch.h"
 
-__attribute__((unused)) static void fossil_shark_watch_file(const char *path, const char *events, fossil_io_filesys_obj_t *prev_obj)
+#include <stdio.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+/*
+ * Every backend hands its events to one queue. Events for the same path
+ * are merged while they wait (a create followed by writes is one create,
+ * a create followed by a delete is nothing), and the queue is flushed as
+ * one batch once the tree has been quiet for the settle window, or after
+ * ten windows under a steady stream so a busy tree still reports. The
+ * queue is bounded: events for new paths beyond the limit are dropped and
+ * counted, and the counts go out ahead of the next batch so a consumer
+ * knows to rescan.
+ */
+#define WATCH_SETTLE_CAP 10
+#define WATCH_QUEUE_DEFAULT 65536
+
+enum
 {
-    fossil_io_filesys_obj_t curr_obj;
-    int rc = fossil_io_filesys_stat(path, &curr_obj);
-    if (rc != 0)
+    WATCH_EV_NONE, // merged away
+    WATCH_EV_CREATE,
+    WATCH_EV_MODIFY,
+    WATCH_EV_DELETE,
+    WATCH_EV_RENAME
+};
+
+static const char *watch_event_names[] = {"", "create", "modify", "delete", "rename"};
+
+typedef struct
+{
+    int kind;
+    uint32_t root; // index into the watched roots
+    int64_t ts_ns; // wall clock of the latest change merged in
+    cstring path;
+    cstring from; // renames
+} watch_event_t;
+
+typedef struct
+{
+    ccstring events; // filter, null for all
+    ccstring exec;   // run once per batch with the changed paths on stdin
+    bool json;
+    int64_t settle_ns;
+    ccstring *roots;
+    size_t max;      // queued paths before new ones are dropped
+    uint64_t seq;    // last sequence number written
+    uint64_t dropped; // since the last batch: queue full
+    uint64_t lost;    // since the last batch: kernel queue overflows
+    uint64_t dropped_total;
+    uint64_t lost_total;
+    watch_event_t *queue;
+    size_t count;
+    size_t cap;
+    uint32_t *index; // open addressing on path, queue index + 1
+    size_t index_cap;
+    int64_t first_ns; // arrival of the oldest and newest queued events
+    int64_t last_ns;
+} watch_sink_t;
+
+static int64_t watch_wall_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t watch_now_ns(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return (int64_t)GetTickCount64() * 1000000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t watch_hash(ccstring s)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+static bool watch_reindex(watch_sink_t *sink, size_t cap)
+{
+    uint32_t *index = fossil_sys_memory_calloc(cap, sizeof(uint32_t));
+    if (!cnotnull(index))
+        return false;
+    for (size_t i = 0; i < sink->count; i++)
     {
-        if (errno == ENOENT && fossil_io_cstring_icontains(events, "delete"))
+        size_t slot = watch_hash(sink->queue[i].path) & (cap - 1);
+        while (index[slot] != 0)
+            slot = (slot + 1) & (cap - 1);
+        index[slot] = (uint32_t)(i + 1);
+    }
+    if (cnotnull(sink->index))
+        fossil_sys_memory_free(sink->index);
+    sink->index = index;
+    sink->index_cap = cap;
+    return true;
+}
+
+static watch_event_t *watch_queued(watch_sink_t *sink, ccstring path)
+{
+    if (sink->index_cap == 0)
+        return cnull;
+    size_t slot = watch_hash(path) & (sink->index_cap - 1);
+    for (; sink->index[slot] != 0; slot = (slot + 1) & (sink->index_cap - 1))
+    {
+        watch_event_t *ev = &sink->queue[sink->index[slot] - 1];
+        if (strcmp(ev->path, path) == 0)
+            return ev;
+    }
+    return cnull;
+}
+
+// The queued event for path, or a new empty one at the end of the queue
+static watch_event_t *watch_slot(watch_sink_t *sink, ccstring path)
+{
+    watch_event_t *queued = watch_queued(sink, path);
+    if (cnotnull(queued))
+        return queued;
+    if (sink->count >= sink->max)
+    {
+        sink->dropped++;
+        return cnull;
+    }
+    if ((sink->count + 1) * 2 > sink->index_cap && !watch_reindex(sink, sink->index_cap ? sink->index_cap * 2 : 256))
+    {
+        sink->dropped++;
+        return cnull;
+    }
+    if (sink->count == sink->cap)
+    {
+        size_t cap = sink->cap ? sink->cap * 2 : 128;
+        watch_event_t *grown = fossil_sys_memory_realloc(sink->queue, cap * sizeof(watch_event_t));
+        if (!cnotnull(grown))
+        {
+            sink->dropped++;
+            return cnull;
+        }
+        sink->queue = grown;
+        sink->cap = cap;
+    }
+    size_t slot = watch_hash(path) & (sink->index_cap - 1);
+    while (sink->index[slot] != 0)
+        slot = (slot + 1) & (sink->index_cap - 1);
+    sink->index[slot] = (uint32_t)(sink->count + 1);
+    watch_event_t *ev = &sink->queue[sink->count++];
+    ev->kind = WATCH_EV_NONE;
+    ev->path = fossil_io_cstring_dup(path);
+    ev->from = cnull;
+    return ev;
+}
+
+static void watch_touch(watch_sink_t *sink)
+{
+    int64_t now = watch_now_ns();
+    if (sink->count == 0 && sink->dropped == 0 && sink->lost == 0)
+        sink->first_ns = now;
+    sink->last_ns = now;
+}
+
+static void watch_emit(watch_sink_t *sink, uint32_t root, int kind, ccstring path, ccstring from)
+{
+    if (cnotnull(sink->events) && !fossil_io_cstring_icontains(sink->events, watch_event_names[kind]))
+        return;
+    watch_touch(sink);
+
+    if (kind == WATCH_EV_RENAME)
+    {
+        // Queued events inside a renamed directory follow it to its new name
+        size_t from_len = strlen(from);
+        bool moved = false;
+        for (size_t i = 0; i < sink->count; i++)
+        {
+            cstring queued = sink->queue[i].path;
+            if (strncmp(queued, from, from_len) != 0 || queued[from_len] != '/')
+                continue;
+            sink->queue[i].path = fossil_io_cstring_format("%s%s", path, queued + from_len);
+            fossil_io_cstring_free(queued);
+            moved = true;
+        }
+        if (moved)
+        {
+            // A new directory keeps its place ahead of its contents
+            watch_event_t *dir = watch_queued(sink, from);
+            if (cnotnull(dir) && dir->kind == WATCH_EV_CREATE && !cnotnull(watch_queued(sink, path)))
+            {
+                fossil_io_cstring_free(dir->path);
+                dir->path = fossil_io_cstring_dup(path);
+                watch_reindex(sink, sink->index_cap);
+                return;
+            }
+            watch_reindex(sink, sink->index_cap);
+        }
+
+        // Something created in this batch and renamed is simply created
+        watch_event_t *old = watch_queued(sink, from);
+        if (cnotnull(old) && old->kind == WATCH_EV_CREATE)
         {
-            cstring del_msg = fossil_io_cstring_format("{red}File deleted:{normal} %s\n", path);
-            fossil_io_filesys_file_write(FOSSIL_STDOUT, del_msg, fossil_io_cstring_length(del_msg), 1);
-            fossil_io_cstring_free(del_msg);
+            old->kind = WATCH_EV_NONE;
+            kind = WATCH_EV_CREATE;
+            from = cnull;
         }
+    }
+    watch_event_t *ev = watch_slot(sink, path);
+    if (!cnotnull(ev))
+        return;
+    int was = ev->kind;
+    if ((was == WATCH_EV_CREATE || was == WATCH_EV_RENAME) && kind == WATCH_EV_MODIFY)
         return;
+    cstring renamed_from = ev->from;
+    ev->from = kind == WATCH_EV_RENAME ? fossil_io_cstring_dup(from) : cnull;
+    if (was == WATCH_EV_CREATE && kind == WATCH_EV_DELETE)
+        kind = WATCH_EV_NONE;
+    else if (was == WATCH_EV_DELETE && kind == WATCH_EV_CREATE)
+        kind = WATCH_EV_MODIFY;
+    ev->kind = kind;
+    ev->root = root;
+    ev->ts_ns = watch_wall_ns();
+    if (was == WATCH_EV_RENAME && kind == WATCH_EV_DELETE)
+    {
+        // Renamed, then deleted: what is gone is the original
+        ev->kind = WATCH_EV_NONE;
+        watch_emit(sink, root, WATCH_EV_DELETE, renamed_from, cnull);
     }
+    if (cnotnull(renamed_from))
+        fossil_io_cstring_free(renamed_from);
+}
 
-    // Check modification time
-    if (curr_obj.modified_at != prev_obj->modified_at && fossil_io_cstring_icontains(events, "modify"))
+// The kernel dropped events before they reached us
+static void watch_lost(watch_sink_t *sink)
+{
+    watch_touch(sink);
+    sink->lost++;
+}
+
+// Nanoseconds until the queue is due, 0 when it is, -1 when it is empty
+static int64_t watch_due_ns(const watch_sink_t *sink, int64_t now)
+{
+    if (sink->count == 0 && sink->dropped == 0 && sink->lost == 0)
+        return -1;
+    int64_t due = sink->last_ns + sink->settle_ns;
+    int64_t cap = sink->first_ns + sink->settle_ns * WATCH_SETTLE_CAP;
+    if (cap < due)
+        due = cap;
+    return due > now ? due - now : 0;
+}
+
+static void watch_print(const watch_event_t *ev)
+{
+    switch (ev->kind)
     {
-        cstring mod_msg = fossil_io_cstring_format("{yellow}File modified:{normal} %s\n", path);
-        fossil_io_filesys_file_write(FOSSIL_STDOUT, mod_msg, fossil_io_cstring_length(mod_msg), 1);
-        fossil_io_cstring_free(mod_msg);
+    case WATCH_EV_CREATE:
+        fossil_io_printf("{green}created:{normal} %s\n", ev->path);
+        break;
+    case WATCH_EV_DELETE:
+        fossil_io_printf("{red}deleted:{normal} %s\n", ev->path);
+        break;
+    case WATCH_EV_RENAME:
+        fossil_io_printf("{cyan}renamed:{normal} %s -> %s\n", ev->from, ev->path);
+        break;
+    default:
+        fossil_io_printf("{yellow}modified:{normal} %s\n", ev->path);
+        break;
     }
+}
+
+// Start a JSON record: sequence number and UTC timestamp
+static void watch_json_head(watch_sink_t *sink, int64_t ts_ns)
+{
+    time_t secs = (time_t)(ts_ns / 1000000000);
+    struct tm tm;
+#if defined(_WIN32) || defined(_WIN64)
+    gmtime_s(&tm, &secs);
+#else
+    gmtime_r(&secs, &tm);
+#endif
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(stdout, "{\"seq\":%llu,\"ts\":\"%s.%03dZ\"", (unsigned long long)++sink->seq, stamp,
+            (int)(ts_ns / 1000000 % 1000));
+}
 
-    // Check size change
-    if (curr_obj.size != prev_obj->size && fossil_io_cstring_icontains(events, "modify"))
+static void watch_print_json(watch_sink_t *sink, const watch_event_t *ev)
+{
+    watch_json_head(sink, ev->ts_ns);
+    fputs(",\"root\":", stdout);
+    shark_json_string(stdout, sink->roots[ev->root]);
+    fprintf(stdout, ",\"event\":\"%s\",\"path\":", watch_event_names[ev->kind]);
+    shark_json_string(stdout, ev->path);
+    if (ev->kind == WATCH_EV_RENAME)
     {
-        cstring size_msg = fossil_io_cstring_format("{cyan}File size changed:{normal} %s\n", path);
-        fossil_io_filesys_file_write(FOSSIL_STDOUT, size_msg, fossil_io_cstring_length(size_msg), 1);
-        fossil_io_cstring_free(size_msg);
+        fputs(",\"from\":", stdout);
+        shark_json_string(stdout, ev->from);
     }
+    fputs("}\n", stdout);
+}
 
-    *prev_obj = curr_obj;
+// Feed the batch's paths to the --exec command and wait for it
+static void watch_run_exec(const watch_sink_t *sink)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    FILE *pipe = _popen(sink->exec, "w");
+#else
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN); // the command need not read its input
+    FILE *pipe = popen(sink->exec, "w");
+#endif
+    if (cnotnull(pipe))
+    {
+        for (size_t i = 0; i < sink->count; i++)
+        {
+            const watch_event_t *ev = &sink->queue[i];
+            if (ev->kind == WATCH_EV_RENAME)
+                fprintf(pipe, "%s\n", ev->from);
+            if (ev->kind != WATCH_EV_NONE)
+                fprintf(pipe, "%s\n", ev->path);
+        }
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    int status = cnotnull(pipe) ? _pclose(pipe) : -1;
+#else
+    int status = cnotnull(pipe) ? pclose(pipe) : -1;
+    signal(SIGPIPE, old_pipe);
+#endif
+    if (status != 0)
+    {
+        cstring msg = fossil_io_cstring_format("{yellow}--exec command failed:{reset} %s\n", sink->exec);
+        fossil_io_filesys_file_write(FOSSIL_STDERR, msg, fossil_io_cstring_length(msg), 1);
+        fossil_io_cstring_free(msg);
+    }
+}
+
+// Events that never made it into the queue, reported ahead of the batch
+static void watch_print_overflow(watch_sink_t *sink)
+{
+    sink->dropped_total += sink->dropped;
+    sink->lost_total += sink->lost;
+    if (sink->json)
+    {
+        watch_json_head(sink, watch_wall_ns());
+        fprintf(stdout, ",\"event\":\"overflow\",\"dropped\":%llu,\"lost\":%llu,"
+                        "\"dropped_total\":%llu,\"lost_total\":%llu}\n",
+                (unsigned long long)sink->dropped, (unsigned long long)sink->lost,
+                (unsigned long long)sink->dropped_total, (unsigned long long)sink->lost_total);
+    }
+    else
+    {
+        cstring msg = fossil_io_cstring_format(
+            "{yellow}Events missed:{reset} %llu dropped (queue full), %llu kernel overflow(s); rescan to catch up\n",
+            (unsigned long long)sink->dropped, (unsigned long long)sink->lost);
+        fossil_io_filesys_file_write(FOSSIL_STDERR, msg, fossil_io_cstring_length(msg), 1);
+        fossil_io_cstring_free(msg);
+    }
+    sink->dropped = 0;
+    sink->lost = 0;
+}
+
+static void watch_flush(watch_sink_t *sink)
+{
+    bool any = false;
+    if (sink->dropped > 0 || sink->lost > 0)
+        watch_print_overflow(sink);
+    for (size_t i = 0; i < sink->count; i++)
+    {
+        const watch_event_t *ev = &sink->queue[i];
+        if (ev->kind == WATCH_EV_NONE)
+            continue;
+        if (sink->json)
+            watch_print_json(sink, ev);
+        else
+            watch_print(ev);
+        any = true;
+    }
+    fflush(stdout);
+    if (any && cnotnull(sink->exec))
+        watch_run_exec(sink);
+
+    for (size_t i = 0; i < sink->count; i++)
+    {
+        fossil_io_cstring_free(sink->queue[i].path);
+        if (cnotnull(sink->queue[i].from))
+            fossil_io_cstring_free(sink->queue[i].from);
+    }
+    sink->count = 0;
+    if (sink->index_cap > 0)
+        memset(sink->index, 0, sink->index_cap * sizeof(uint32_t));
+}
+
+static void watch_sink_free(watch_sink_t *sink)
+{
+    watch_flush(sink);
+    if (cnotnull(sink->queue))
+        fossil_sys_memory_free(sink->queue);
+    if (cnotnull(sink->index))
+        fossil_sys_memory_free(sink->index);
+}
+
+// Diagnostics go to stderr so --json output stays parseable
+static void watch_warn(ccstring text, ccstring path)
+{
+    cstring msg = fossil_io_cstring_format("{yellow}%s{reset} %s\n", text, cnotnull(path) ? path : "");
+    fossil_io_filesys_file_write(FOSSIL_STDERR, msg, fossil_io_cstring_length(msg), 1);
+    fossil_io_cstring_free(msg);
+}
+
+static bool watch_grow(void **items, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap)
+        return true;
+    size_t grown_cap = *cap ? *cap : 256;
+    while (grown_cap < need)
+        grown_cap *= 2;
+    void *grown = fossil_sys_memory_realloc(*items, grown_cap * size);
+    if (!cnotnull(grown))
+        return false;
+    *items = grown;
+    *cap = grown_cap;
+    return true;
 }
 
 #if !defined(_WIN32) && !defined(_WIN64)
-__attribute__((unused)) static void fossil_shark_watch_dir(const char *dir_path, const char *events, int interval)
+/*
+ * Polling backend, for platforms without change notification and for
+ * network filesystems, where the local kernel never hears about changes
+ * made by other clients. Each pass builds a compact snapshot of the tree
+ * and diffs it against the previous one. A node holds a name offset and a
+ * parent link rather than a full path, and every directory's children sit
+ * in one block sorted by name, so both lookup and diff are merges of two
+ * sorted blocks. A directory whose mtime has not moved has the same entries
+ * as before: its listing is taken from the previous snapshot and only its
+ * children are stat'ed, so readdir (the expensive call on NFS/SMB) is paid
+ * only where something was added, removed or renamed.
+ */
+#define WATCH_NONE UINT32_MAX
+#define WATCH_RACY_NS 2000000000LL // mtimes this close to a scan may still change unseen
+
+#if defined(__APPLE__)
+#define WATCH_MTIME_NS(st) ((int64_t)(st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#else
+#define WATCH_MTIME_NS(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+enum
+{
+    WATCH_FILE,
+    WATCH_DIR,
+    WATCH_OTHER
+};
+
+typedef struct
+{
+    uint32_t name;   // offset in the names buffer; the root's is the watched path
+    uint32_t parent; // WATCH_NONE for the root
+    uint32_t first;  // directories: children, sorted by name, at [first, first + count)
+    uint32_t count;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t ino;
+    uint64_t dev;
+    uint8_t type;
+    bool covered; // inside a renamed directory; reported with it
+} watch_node_t;
+
+typedef struct
+{
+    watch_node_t *nodes;
+    size_t count;
+    size_t cap;
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    int64_t taken_ns; // when the scan started
+} watch_snap_t;
+
+typedef struct
+{
+    watch_sink_t *sink;
+    uint32_t root;
+    bool recursive;
+    bool report; // false while taking the first snapshot
+    bool done;   // given up on (out of memory)
+    watch_snap_t snaps[2];
+    watch_snap_t *old; // into snaps
+    watch_snap_t *cur;
+    uint32_t *created; // nodes of cur
+    size_t created_count;
+    size_t created_cap;
+    uint32_t *deleted; // nodes of old
+    size_t deleted_count;
+    size_t deleted_cap;
+    bool failed;
+} watch_poll_t;
+
+static const watch_snap_t *watch_sort_snap; // qsort has no context argument
+
+static ccstring watch_name(const watch_snap_t *s, uint32_t i)
+{
+    return s->names + s->nodes[i].name;
+}
+
+static int watch_name_cmp(const void *lhs, const void *rhs)
+{
+    const watch_node_t *a = lhs, *b = rhs;
+    return strcmp(watch_sort_snap->names + a->name, watch_sort_snap->names + b->name);
+}
+
+static uint32_t watch_push(watch_poll_t *p, ccstring name, uint32_t parent, const struct stat *st)
+{
+    watch_snap_t *s = p->cur;
+    size_t len = strlen(name) + 1;
+    if (s->count >= WATCH_NONE || s->names_len + len >= UINT32_MAX ||
+        !watch_grow((void **)&s->nodes, &s->cap, s->count + 1, sizeof(watch_node_t)) ||
+        !watch_grow((void **)&s->names, &s->names_cap, s->names_len + len, 1))
+    {
+        p->failed = true;
+        return WATCH_NONE;
+    }
+    memcpy(s->names + s->names_len, name, len);
+    watch_node_t *n = &s->nodes[s->count];
+    memset(n, 0, sizeof(*n));
+    n->name = (uint32_t)s->names_len;
+    n->parent = parent;
+    n->type = S_ISDIR(st->st_mode) ? WATCH_DIR : S_ISREG(st->st_mode) ? WATCH_FILE : WATCH_OTHER;
+    n->size = n->type == WATCH_FILE ? (uint64_t)st->st_size : 0;
+    n->mtime_ns = WATCH_MTIME_NS(*st);
+    n->ino = (uint64_t)st->st_ino;
+    n->dev = (uint64_t)st->st_dev;
+    s->names_len += len;
+    return (uint32_t)s->count++;
+}
+
+static void watch_note(watch_poll_t *p, uint32_t **list, size_t *count, size_t *cap, uint32_t node)
+{
+    if (!watch_grow((void **)list, cap, *count + 1, sizeof(uint32_t)))
+    {
+        p->failed = true;
+        return;
+    }
+    (*list)[(*count)++] = node;
+}
+
+// An old node is gone, and with it everything below
+static void watch_note_deleted(watch_poll_t *p, uint32_t oi)
+{
+    if (!p->report)
+        return;
+    watch_note(p, &p->deleted, &p->deleted_count, &p->deleted_cap, oi);
+    const watch_node_t *n = &p->old->nodes[oi];
+    if (n->type == WATCH_DIR)
+    {
+        for (uint32_t k = 0; k < n->count; k++)
+            watch_note_deleted(p, n->first + k);
+    }
+}
+
+static void watch_scan_dir(watch_poll_t *p, uint32_t ni, uint32_t oi, char *path, size_t len);
+
+// Compare a path across the two snapshots; either side may be absent
+static void watch_pair(watch_poll_t *p, uint32_t ni, uint32_t oi, char *path, size_t len)
+{
+    if (ni == WATCH_NONE)
+    {
+        watch_note_deleted(p, oi);
+        return;
+    }
+    const watch_node_t *n = &p->cur->nodes[ni];
+    if (oi != WATCH_NONE && p->old->nodes[oi].type != n->type)
+    {
+        watch_note_deleted(p, oi);
+        oi = WATCH_NONE;
+    }
+    if (oi == WATCH_NONE)
+    {
+        if (p->report)
+            watch_note(p, &p->created, &p->created_count, &p->created_cap, ni);
+    }
+    else if (n->type == WATCH_FILE)
+    {
+        const watch_node_t *o = &p->old->nodes[oi];
+        if (o->size != n->size || o->mtime_ns != n->mtime_ns || o->ino != n->ino)
+            watch_emit(p->sink, p->root, WATCH_EV_MODIFY, path, cnull);
+    }
+    if (n->type == WATCH_DIR && (ni == 0 || p->recursive))
+        watch_scan_dir(p, ni, oi, path, len);
+}
+
+static void watch_scan_dir(watch_poll_t *p, uint32_t ni, uint32_t oi, char *path, size_t len)
+{
+    const watch_snap_t *old = p->old;
+    const watch_node_t *o = oi != WATCH_NONE ? &old->nodes[oi] : cnull;
+    const watch_node_t *n = &p->cur->nodes[ni];
+    bool same = cnotnull(o) && o->mtime_ns == n->mtime_ns && o->ino == n->ino &&
+                o->mtime_ns < old->taken_ns - WATCH_RACY_NS;
+    uint32_t first = (uint32_t)p->cur->count;
+    struct stat st;
+
+    if (same)
+    {
+        // Unchanged directory: same names, already sorted
+        for (uint32_t k = 0; k < o->count; k++)
+        {
+            ccstring name = watch_name(old, o->first + k);
+            if (snprintf(path + len, PATH_MAX - len, "/%s", name) < (int)(PATH_MAX - len) &&
+                lstat(path, &st) == 0)
+                watch_push(p, name, ni, &st);
+        }
+    }
+    else
+    {
+        DIR *dir = opendir(path);
+        struct dirent *ent;
+        while (cnotnull(dir) && (ent = readdir(dir)) != cnull)
+        {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            if (snprintf(path + len, PATH_MAX - len, "/%s", ent->d_name) < (int)(PATH_MAX - len) &&
+                lstat(path, &st) == 0)
+                watch_push(p, ent->d_name, ni, &st);
+        }
+        if (cnotnull(dir))
+            closedir(dir);
+        uint32_t count = (uint32_t)p->cur->count - first;
+        if (count > 1)
+        {
+            watch_sort_snap = p->cur;
+            qsort(&p->cur->nodes[first], count, sizeof(watch_node_t), watch_name_cmp);
+        }
+    }
+    path[len] = '\0';
+    p->cur->nodes[ni].first = first;
+    p->cur->nodes[ni].count = (uint32_t)p->cur->count - first;
+
+    // Merge the two sorted child blocks; recursion appends past this block
+    uint32_t i = 0, j = 0;
+    uint32_t count = p->cur->nodes[ni].count;
+    uint32_t old_count = cnotnull(o) && o->type == WATCH_DIR ? o->count : 0;
+    uint32_t old_first = cnotnull(o) ? o->first : 0;
+    while (i < count || j < old_count)
+    {
+        int c = i == count ? 1 : j == old_count ? -1
+                                 : strcmp(watch_name(p->cur, first + i), watch_name(old, old_first + j));
+        uint32_t a = c <= 0 ? first + i++ : WATCH_NONE;
+        uint32_t b = c >= 0 ? old_first + j++ : WATCH_NONE;
+        ccstring name = a != WATCH_NONE ? watch_name(p->cur, a) : watch_name(old, b);
+        int n_len = snprintf(path + len, PATH_MAX - len, "/%s", name);
+        if (n_len > 0 && n_len < (int)(PATH_MAX - len))
+            watch_pair(p, a, b, path, len + (size_t)n_len);
+        path[len] = '\0';
+    }
+}
+
+static void watch_snapshot(watch_poll_t *p, ccstring root)
+{
+    watch_snap_t *s = p->cur;
+    s->count = 0;
+    s->names_len = 0;
+    s->taken_ns = watch_wall_ns();
+    p->created_count = 0;
+    p->deleted_count = 0;
+    p->failed = false;
+
+    char path[PATH_MAX];
+    size_t len = (size_t)snprintf(path, sizeof(path), "%s", root);
+    struct stat st;
+    uint32_t ni = stat(root, &st) == 0 && len < sizeof(path) ? watch_push(p, root, WATCH_NONE, &st) : WATCH_NONE;
+    uint32_t oi = cnotnull(p->old) && p->old->count > 0 ? 0 : WATCH_NONE;
+    if (ni != WATCH_NONE || oi != WATCH_NONE)
+        watch_pair(p, ni, oi, path, len);
+}
+
+// Full path of a node, rebuilt from its parent chain
+static void watch_node_path(const watch_snap_t *s, uint32_t i, char *out, size_t out_len)
+{
+    if (s->nodes[i].parent == WATCH_NONE)
+    {
+        snprintf(out, out_len, "%s", watch_name(s, i));
+        return;
+    }
+    watch_node_path(s, s->nodes[i].parent, out, out_len);
+    size_t len = strlen(out);
+    snprintf(out + len, out_len - len, "/%s", watch_name(s, i));
+}
+
+static void watch_cover(watch_snap_t *s, uint32_t i)
 {
-    fossil_io_filesys_obj_t entries[256];
-    size_t entry_count = 0;
-    if (fossil_io_filesys_dir_list(dir_path, entries, 256, &entry_count) != 0)
+    s->nodes[i].covered = true;
+    if (s->nodes[i].type != WATCH_DIR)
         return;
+    for (uint32_t k = 0; k < s->nodes[i].count; k++)
+        watch_cover(s, s->nodes[i].first + k);
+}
+
+static int watch_inode_cmp(const void *lhs, const void *rhs)
+{
+    const watch_node_t *a = &watch_sort_snap->nodes[*(const uint32_t *)lhs];
+    const watch_node_t *b = &watch_sort_snap->nodes[*(const uint32_t *)rhs];
+    if (a->dev != b->dev)
+        return a->dev < b->dev ? -1 : 1;
+    if (a->ino != b->ino)
+        return a->ino < b->ino ? -1 : 1;
+    return 0;
+}
 
-    for (size_t i = 0; i < entry_count; ++i)
+// Pair creations with deletions of the same inode, then report what is left
+static void watch_report_changes(watch_poll_t *p)
+{
+    watch_snap_t *old = p->old, *cur = p->cur;
+    char from[PATH_MAX], to[PATH_MAX];
+    uint32_t *by_inode = cnull;
+    if (p->created_count > 0 && p->deleted_count > 0)
     {
-        fossil_io_filesys_obj_t *entry = &entries[i];
-        // Skip "." and ".."
-        if (strcmp(entry->path, ".") == 0 || strcmp(entry->path, "..") == 0)
+        by_inode = fossil_sys_memory_alloc(p->deleted_count * sizeof(uint32_t));
+        if (cnotnull(by_inode))
+        {
+            memcpy(by_inode, p->deleted, p->deleted_count * sizeof(uint32_t));
+            watch_sort_snap = old;
+            qsort(by_inode, p->deleted_count, sizeof(uint32_t), watch_inode_cmp);
+        }
+    }
+
+    // Creations come parent first, so a renamed directory covers its subtree
+    for (size_t k = 0; k < p->created_count; k++)
+    {
+        uint32_t ni = p->created[k];
+        const watch_node_t *n = &cur->nodes[ni];
+        if (n->covered)
             continue;
+        uint32_t match = WATCH_NONE;
+        size_t lo = 0, hi = cnotnull(by_inode) ? p->deleted_count : 0;
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            const watch_node_t *o = &old->nodes[by_inode[mid]];
+            if (o->dev < n->dev || (o->dev == n->dev && o->ino < n->ino))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; cnotnull(by_inode) && lo < p->deleted_count; lo++)
+        {
+            const watch_node_t *o = &old->nodes[by_inode[lo]];
+            if (o->dev != n->dev || o->ino != n->ino)
+                break;
+            if (!o->covered && o->type == n->type)
+            {
+                match = by_inode[lo];
+                break;
+            }
+        }
 
-        if (entry->type == FOSSIL_FILESYS_TYPE_DIR)
+        watch_node_path(cur, ni, to, sizeof(to));
+        if (match == WATCH_NONE)
         {
-            fossil_shark_watch_dir(entry->path, events, interval);
+            watch_emit(p->sink, p->root, WATCH_EV_CREATE, to, cnull);
+            continue;
         }
-        else if (entry->type == FOSSIL_FILESYS_TYPE_FILE)
+        const watch_node_t *o = &old->nodes[match];
+        watch_node_path(old, match, from, sizeof(from));
+        watch_emit(p->sink, p->root, WATCH_EV_RENAME, to, from);
+        if (n->type == WATCH_FILE && (o->size != n->size || o->mtime_ns != n->mtime_ns))
+            watch_emit(p->sink, p->root, WATCH_EV_MODIFY, to, cnull);
+        watch_cover(cur, ni);
+        watch_cover(old, match);
+    }
+
+    // Deletions in path order, a directory before its contents
+    for (size_t k = 0; k < p->deleted_count; k++)
+    {
+        if (old->nodes[p->deleted[k]].covered)
+            continue;
+        watch_node_path(old, p->deleted[k], from, sizeof(from));
+        watch_emit(p->sink, p->root, WATCH_EV_DELETE, from, cnull);
+    }
+    if (cnotnull(by_inode))
+        fossil_sys_memory_free(by_inode);
+}
+
+static void watch_snap_free(watch_snap_t *s)
+{
+    if (cnotnull(s->nodes))
+        fossil_sys_memory_free(s->nodes);
+    if (cnotnull(s->names))
+        fossil_sys_memory_free(s->names);
+}
+
+// Take the baseline snapshot; nothing is reported for it
+static void watch_poll_start(watch_poll_t *p)
+{
+    p->cur = &p->snaps[0];
+    watch_snapshot(p, p->sink->roots[p->root]);
+    p->report = true;
+    p->done = p->failed;
+}
+
+// Rescan and report what changed since the last pass
+static void watch_poll_pass(watch_poll_t *p)
+{
+    p->old = p->cur;
+    p->cur = p->cur == &p->snaps[0] ? &p->snaps[1] : &p->snaps[0];
+    watch_snapshot(p, p->sink->roots[p->root]);
+    if (!p->failed)
+        watch_report_changes(p);
+    p->done = p->failed;
+}
+
+static void watch_poll_free(watch_poll_t *p)
+{
+    watch_snap_free(&p->snaps[0]);
+    watch_snap_free(&p->snaps[1]);
+    if (cnotnull(p->created))
+        fossil_sys_memory_free(p->created);
+    if (cnotnull(p->deleted))
+        fossil_sys_memory_free(p->deleted);
+}
+#endif
+
+#if defined(__linux__)
+/*
+ * Event-driven backend: one inotify instance covers every root and a
+ * single thread sleeps in epoll_wait until the kernel has something to
+ * say, so an idle watch costs no CPU and changes are reported as soon as
+ * they happen. New directories are picked up as they appear; a rename is
+ * reported once, as old -> new, when both halves arrive together.
+ */
+#define WATCH_INOTIFY_MASK (IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define WATCH_BUFFER (64 * 1024)
+#define WATCH_MOVE_WAIT_MS 10 // how long a rename's first half waits for its second
+
+typedef struct
+{
+    int wd;
+    uint32_t root;
+    bool top;     // the root directory itself
+    bool partial; // only the parent of watched files; other names are ignored
+    cstring path; // null once the directory left the tree
+} watch_dir_t;
+
+typedef struct
+{
+    int wd; // of the parent directory
+    uint32_t root;
+    ccstring name;
+} watch_file_t;
+
+typedef struct
+{
+    watch_sink_t *sink;
+    bool recursive;
+    int fd;
+    watch_dir_t *dirs; // sorted by wd
+    size_t count;
+    size_t cap;
+    watch_file_t *files; // roots that are single files
+    size_t file_count;
+    size_t file_cap;
+    uint32_t *trees; // roots that are directories, watched again after an overflow
+    size_t tree_count;
+    size_t tree_cap;
+    bool full_warned;
+    uint32_t move_cookie; // first half of a rename, waiting for the second
+    uint32_t move_root;
+    cstring move_from;
+    bool move_dir;
+} watch_inotify_t;
+
+static size_t watch_find(const watch_inotify_t *w, int wd)
+{
+    size_t lo = 0, hi = w->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (w->dirs[mid].wd < wd)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static watch_dir_t *watch_lookup(watch_inotify_t *w, int wd)
+{
+    size_t i = watch_find(w, wd);
+    return i < w->count && w->dirs[i].wd == wd ? &w->dirs[i] : cnull;
+}
+
+// Watch one directory; returns its descriptor, or -1 when it could not be watched
+static int watch_add(watch_inotify_t *w, ccstring path, uint32_t root, bool partial)
+{
+    int wd = inotify_add_watch(w->fd, path, WATCH_INOTIFY_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC && !w->full_warned)
+        {
+            watch_warn("inotify watch limit reached (fs.inotify.max_user_watches); not watched:", path);
+            w->full_warned = true;
+        }
+        return -1;
+    }
+
+    watch_dir_t *known = watch_lookup(w, wd);
+    if (cnotnull(known))
+    {
+        // Overlapping roots: the first to watch a directory in full reports for it
+        if (cnotnull(known->path) && known->root != root && (partial || !known->partial))
+            return wd;
+        // Same directory reached under a new name
+        cstring old = known->path;
+        known->path = fossil_io_cstring_dup(path);
+        known->root = root;
+        known->partial = partial;
+        if (cnotnull(old))
+            fossil_io_cstring_free(old);
+        return wd;
+    }
+    if (w->count == w->cap)
+    {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        watch_dir_t *grown = fossil_sys_memory_realloc(w->dirs, cap * sizeof(watch_dir_t));
+        if (!cnotnull(grown))
+        {
+            inotify_rm_watch(w->fd, wd);
+            return -1;
+        }
+        w->dirs = grown;
+        w->cap = cap;
+    }
+    size_t i = watch_find(w, wd);
+    memmove(&w->dirs[i + 1], &w->dirs[i], (w->count - i) * sizeof(watch_dir_t));
+    w->dirs[i].wd = wd;
+    w->dirs[i].root = root;
+    w->dirs[i].top = false;
+    w->dirs[i].partial = partial;
+    w->dirs[i].path = fossil_io_cstring_dup(path);
+    w->count++;
+    return wd;
+}
+
+/*
+ * Watch a directory and everything below it. For a directory that just
+ * appeared, entries created before its watch was in place are reported as
+ * creations so nothing slips through the gap.
+ */
+static int watch_add_tree(watch_inotify_t *w, ccstring path, uint32_t root, bool report)
+{
+    int wd = watch_add(w, path, root, false);
+    if (wd < 0 || !w->recursive)
+        return wd;
+    DIR *dir = opendir(path);
+    if (!cnotnull(dir))
+        return wd;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != cnull)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char child[PATH_MAX];
+        int n = snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (n < 0 || (size_t)n >= sizeof(child))
+            continue;
+        bool is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            is_dir = lstat(child, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (report)
+            watch_emit(w->sink, root, WATCH_EV_CREATE, child, cnull);
+        if (is_dir)
+            watch_add_tree(w, child, root, report);
+    }
+    closedir(dir);
+    return wd;
+}
+
+// Start watching one root; false when inotify cannot take it
+static bool watch_add_root(watch_inotify_t *w, uint32_t root, const fossil_io_filesys_obj_t *st)
+{
+    ccstring path = w->sink->roots[root];
+    if (st->type == FOSSIL_FILESYS_TYPE_DIR)
+    {
+        if (!watch_grow((void **)&w->trees, &w->tree_cap, w->tree_count + 1, sizeof(uint32_t)))
+            return false;
+        int wd = watch_add_tree(w, path, root, false);
+        if (wd < 0)
+            return false;
+        watch_dir_t *dir = watch_lookup(w, wd);
+        if (cnotnull(dir) && dir->root == root)
+            dir->top = true;
+        w->trees[w->tree_count++] = root;
+        return true;
+    }
+
+    // A single file is watched through its directory, so replacing it is seen too
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", path);
+    cstring slash = strrchr(parent, '/');
+    ccstring name = cnotnull(slash) ? path + (slash - parent) + 1 : path;
+    if (cnotnull(slash))
+        *slash = '\0';
+    else
+        snprintf(parent, sizeof(parent), ".");
+    if (!watch_grow((void **)&w->files, &w->file_cap, w->file_count + 1, sizeof(watch_file_t)))
+        return false;
+    int wd = watch_add(w, parent[0] != '\0' ? parent : "/", root, true);
+    if (wd < 0)
+        return false;
+    w->files[w->file_count].wd = wd;
+    w->files[w->file_count].root = root;
+    w->files[w->file_count].name = name;
+    w->file_count++;
+    return true;
+}
+
+// A watched directory moved from old to new: rename it and its subtree
+static void watch_rename_tree(watch_inotify_t *w, ccstring from, ccstring to)
+{
+    size_t len = strlen(from);
+    for (size_t i = 0; i < w->count; i++)
+    {
+        cstring path = w->dirs[i].path;
+        if (!cnotnull(path) || strncmp(path, from, len) != 0 || (path[len] != '\0' && path[len] != '/'))
+            continue;
+        w->dirs[i].path = fossil_io_cstring_format("%s%s", to, path + len);
+        fossil_io_cstring_free(path);
+    }
+}
+
+// A watched directory left the tree: stop reporting anything under it
+static void watch_drop_tree(watch_inotify_t *w, ccstring path)
+{
+    size_t len = strlen(path);
+    for (size_t i = 0; i < w->count; i++)
+    {
+        cstring p = w->dirs[i].path;
+        if (!cnotnull(p) || strncmp(p, path, len) != 0 || (p[len] != '\0' && p[len] != '/'))
+            continue;
+        inotify_rm_watch(w->fd, w->dirs[i].wd);
+        fossil_io_cstring_free(p);
+        w->dirs[i].path = cnull;
+    }
+}
+
+// The first half of a rename never got its second: it moved out of the tree
+static void watch_flush_move(watch_inotify_t *w)
+{
+    if (!cnotnull(w->move_from))
+        return;
+    watch_emit(w->sink, w->move_root, WATCH_EV_DELETE, w->move_from, cnull);
+    if (w->move_dir)
+        watch_drop_tree(w, w->move_from);
+    fossil_io_cstring_free(w->move_from);
+    w->move_from = cnull;
+}
+
+// The kernel has forgotten a watch: forget it too
+static void watch_forget(watch_inotify_t *w, size_t i)
+{
+    int wd = w->dirs[i].wd;
+    if (cnotnull(w->dirs[i].path))
+        fossil_io_cstring_free(w->dirs[i].path);
+    memmove(&w->dirs[i], &w->dirs[i + 1], (w->count - i - 1) * sizeof(watch_dir_t));
+    w->count--;
+    for (size_t k = 0; k < w->file_count;)
+    {
+        if (w->files[k].wd == wd)
+            w->files[k] = w->files[--w->file_count];
+        else
+            k++;
+    }
+}
+
+static void watch_handle(watch_inotify_t *w, const struct inotify_event *ev)
+{
+    // The kernel queues both halves of a rename back to back
+    if (cnotnull(w->move_from) && !((ev->mask & IN_MOVED_TO) && ev->cookie == w->move_cookie))
+        watch_flush_move(w);
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        // Events were lost: say so, and make sure every directory is watched again
+        watch_lost(w->sink);
+        for (size_t k = 0; k < w->tree_count; k++)
+            watch_add_tree(w, w->sink->roots[w->trees[k]], w->trees[k], false);
+        return;
+    }
+
+    size_t i = watch_find(w, ev->wd);
+    if (i >= w->count || w->dirs[i].wd != ev->wd)
+        return;
+    if (ev->mask & IN_IGNORED)
+    {
+        watch_forget(w, i);
+        return;
+    }
+    const watch_dir_t *d = &w->dirs[i];
+    ccstring dir = d->path;
+    if (!cnotnull(dir))
+        return;
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        if (d->top)
+            watch_emit(w->sink, d->root, WATCH_EV_DELETE, dir, cnull);
+        return;
+    }
+    if (ev->len == 0)
+        return;
+
+    // Names that are roots of their own report under that root
+    uint32_t root = d->root;
+    bool wanted = !d->partial;
+    for (size_t k = 0; k < w->file_count; k++)
+    {
+        if (w->files[k].wd == ev->wd && strcmp(w->files[k].name, ev->name) == 0)
         {
-            fossil_io_filesys_obj_t st;
-            if (fossil_io_filesys_stat(entry->path, &st) == 0)
+            root = w->files[k].root;
+            wanted = true;
+            break;
+        }
+    }
+    if (!wanted)
+        return;
+
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%s", dir, ev->name);
+    if (n < 0 || (size_t)n >= sizeof(path))
+        return;
+    bool is_dir = (ev->mask & IN_ISDIR) != 0;
+
+    // A rename across roots is a delete in one and a create in the other
+    if ((ev->mask & IN_MOVED_TO) && cnotnull(w->move_from) && w->move_root != root)
+        watch_flush_move(w);
+
+    if (ev->mask & IN_MOVED_FROM)
+    {
+        w->move_cookie = ev->cookie;
+        w->move_root = root;
+        w->move_from = fossil_io_cstring_dup(path);
+        w->move_dir = is_dir;
+    }
+    else if (ev->mask & IN_MOVED_TO)
+    {
+        if (cnotnull(w->move_from))
+        {
+            watch_emit(w->sink, root, WATCH_EV_RENAME, path, w->move_from);
+            if (is_dir)
+                watch_rename_tree(w, w->move_from, path);
+            fossil_io_cstring_free(w->move_from);
+            w->move_from = cnull;
+        }
+        else
+        {
+            // Moved in from outside the tree
+            watch_emit(w->sink, root, WATCH_EV_CREATE, path, cnull);
+            if (is_dir && w->recursive && !d->partial)
+                watch_add_tree(w, path, root, true);
+        }
+    }
+    else if (ev->mask & IN_CREATE)
+    {
+        watch_emit(w->sink, root, WATCH_EV_CREATE, path, cnull);
+        if (is_dir && w->recursive && !d->partial)
+            watch_add_tree(w, path, root, true);
+    }
+    else if (ev->mask & IN_DELETE)
+    {
+        watch_emit(w->sink, root, WATCH_EV_DELETE, path, cnull);
+    }
+    else if ((ev->mask & IN_MODIFY) && !is_dir)
+    {
+        watch_emit(w->sink, root, WATCH_EV_MODIFY, path, cnull);
+    }
+}
+
+// Handle everything the kernel has queued
+static void watch_drain(watch_inotify_t *w, uint8_t *buf)
+{
+    ssize_t len;
+    while ((len = read(w->fd, buf, WATCH_BUFFER)) > 0)
+    {
+        for (ssize_t off = 0; off < len;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+            watch_handle(w, ev);
+            off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+        }
+    }
+}
+
+static void watch_inotify_free(watch_inotify_t *w)
+{
+    watch_flush_move(w);
+    for (size_t i = 0; i < w->count; i++)
+    {
+        if (cnotnull(w->dirs[i].path))
+            fossil_io_cstring_free(w->dirs[i].path);
+    }
+    if (cnotnull(w->dirs))
+        fossil_sys_memory_free(w->dirs);
+    if (cnotnull(w->files))
+        fossil_sys_memory_free(w->files);
+    if (cnotnull(w->trees))
+        fossil_sys_memory_free(w->trees);
+    if (w->fd >= 0)
+        close(w->fd);
+}
+
+// Filesystems whose changes may come from other machines, unseen by inotify
+static bool watch_is_remote(ccstring path)
+{
+    static const long remote[] = {
+        0x6969,              // NFS
+        0x517B,              // SMB
+        (long)0xFF534D42,    // CIFS
+        (long)0xFE534D42,    // SMB2
+        0x73757245,          // Coda
+        0x5346414F,          // AFS
+        0x01021997,          // 9P
+    };
+    struct statfs fs;
+    if (statfs(path, &fs) != 0)
+        return false;
+    for (size_t i = 0; i < sizeof(remote) / sizeof(remote[0]); i++)
+    {
+        if ((long)fs.f_type == remote[i] || (uint32_t)fs.f_type == (uint32_t)remote[i])
+            return true;
+    }
+    return false;
+}
+
+#endif
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static void watch_sleep_ms(int ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * One loop serves every root. Roots under inotify wake it through epoll;
+ * the rest (--poll, network filesystems, anything inotify refused) are
+ * rescanned each interval. It sleeps until the nearest of those, a
+ * pending rename half, or the settle deadline, and runs until no root is
+ * left to watch.
+ */
+static int watch_run(watch_sink_t *sink, size_t root_count, const fossil_shark_watch_options_t *opts)
+{
+    bool recursive = opts->recursive;
+    int interval = opts->interval;
+    size_t passes = 0;
+    watch_poll_t *polls = fossil_sys_memory_calloc(root_count, sizeof(watch_poll_t));
+    if (!cnotnull(polls))
+        return ENOMEM;
+    size_t poll_count = 0, live = 0;
+    int rc = 0;
+
+#if defined(__linux__)
+    watch_inotify_t w = {0};
+    w.sink = sink;
+    w.recursive = recursive;
+    w.fd = -1;
+    int ep = -1;
+    uint8_t *buf = cnull;
+    if (!opts->poll)
+    {
+        int err = 0;
+        w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        struct epoll_event reg = {.events = EPOLLIN, .data.fd = w.fd};
+        if (w.fd < 0)
+            err = errno;
+        else if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, w.fd, &reg) != 0)
+            err = errno;
+        else if (!cnotnull(buf = fossil_sys_memory_alloc(WATCH_BUFFER)))
+            err = ENOMEM;
+        if (err != 0)
+        {
+            watch_warn("inotify unavailable; polling instead:", strerror(err));
+            if (w.fd >= 0)
+                close(w.fd);
+            w.fd = -1;
+        }
+    }
+#endif
+
+    for (uint32_t r = 0; r < root_count; r++)
+    {
+        ccstring path = sink->roots[r];
+        fossil_io_filesys_obj_t st;
+        if (fossil_io_filesys_stat(path, &st) != 0)
+        {
+            rc = errno ? errno : ENOENT;
+            cstring err_msg = fossil_io_cstring_format(
+                "{red,bold}Failed to stat path:{reset} %s\n", path);
+            fossil_io_filesys_file_write(
+                FOSSIL_STDERR,
+                err_msg,
+                fossil_io_cstring_length(err_msg),
+                1);
+            fossil_io_cstring_free(err_msg);
+            continue;
+        }
+
+        bool notified = false;
+#if defined(__linux__)
+        if (w.fd >= 0 && watch_is_remote(path))
+            watch_warn("Network filesystem; polling for changes:", path);
+        else if (w.fd >= 0 && !(notified = watch_add_root(&w, r, &st)))
+            watch_warn("inotify cannot watch this root; polling instead:", path);
+#endif
+        if (!sink->json && notified)
+            fossil_io_printf("{green,bold}Watching %s for changes...{reset}%s\n",
+                             path, recursive ? " (recursive enabled)" : "");
+        else if (!sink->json)
+            fossil_io_printf("{green,bold}Watching %s every %d seconds...{reset}%s\n",
+                             path, interval, recursive ? " (recursive enabled)" : "");
+        if (notified)
+            continue;
+
+        watch_poll_t *p = &polls[poll_count++];
+        p->sink = sink;
+        p->root = r;
+        p->recursive = recursive;
+        watch_poll_start(p);
+        if (p->done)
+            watch_warn("Out of memory while polling", path);
+        else
+            live++;
+    }
+
+    int64_t step_ns = (int64_t)interval * 1000000000;
+    int64_t next_poll = watch_now_ns() + step_ns;
+    for (;;)
+    {
+        bool notified = false;
+#if defined(__linux__)
+        notified = w.fd >= 0 && w.count > 0;
+#endif
+        if (!notified && live == 0)
+            break;
+
+        // Sleep until the kernel has events, a poll or rename half is due or the batch is
+        int64_t now = watch_now_ns();
+        int64_t wait = watch_due_ns(sink, now);
+        if (live > 0 && (wait < 0 || next_poll - now < wait))
+            wait = next_poll > now ? next_poll - now : 0;
+        int timeout = wait < 0 ? -1 : (int)((wait + 999999) / 1000000);
+#if defined(__linux__)
+        if (cnotnull(w.move_from) && (timeout < 0 || timeout > WATCH_MOVE_WAIT_MS))
+            timeout = WATCH_MOVE_WAIT_MS;
+        struct epoll_event ready;
+        int n = 0;
+        if (notified && timeout != 0)
+            n = epoll_wait(ep, &ready, 1, timeout);
+        else if (timeout > 0)
+            watch_sleep_ms(timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            rc = errno;
+            break;
+        }
+        if (n > 0)
+            watch_drain(&w, buf);
+        else if (n == 0)
+            watch_flush_move(&w);
+#else
+        if (timeout > 0)
+            watch_sleep_ms(timeout);
+#endif
+
+        now = watch_now_ns();
+        if (live > 0 && now >= next_poll)
+        {
+            for (size_t k = 0; k < poll_count; k++)
             {
-                fossil_io_filesys_obj_t prev_obj = st;
-                while (1)
-                {
-                    sleep(interval);
-                    fossil_shark_watch_file(entry->path, events, &prev_obj);
-                }
+                if (polls[k].done)
+                    continue;
+                watch_poll_pass(&polls[k]);
+                if (!polls[k].done)
+                    continue;
+                watch_warn("Out of memory while polling", sink->roots[polls[k].root]);
+                rc = ENOMEM;
+                live--;
             }
+            next_poll += step_ns;
+            if (next_poll <= now)
+                next_poll = now + step_ns;
+            if (opts->passes > 0 && ++passes >= opts->passes)
+                break;
         }
+
+        // A pass's changes share the queue with the other roots' events, so
+        // the batch waits out the same settle window
+        if (watch_due_ns(sink, watch_now_ns()) == 0)
+            watch_flush(sink);
     }
+
+#if defined(__linux__)
+    watch_inotify_free(&w);
+    if (ep >= 0)
+        close(ep);
+    if (cnotnull(buf))
+        fossil_sys_memory_free(buf);
+#endif
+    for (size_t k = 0; k < poll_count; k++)
+        watch_poll_free(&polls[k]);
+    fossil_sys_memory_free(polls);
+    return rc;
 }
 #endif
 
@@ -108,9 +1463,42 @@ static wchar_t *fossil_utf8_to_wide(const char *s)
     return w;
 }
 
+#define WATCH_WINDOWS_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | \
+                              FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+/*
+ * Wait for the next buffer of changes. While events are queued the wait
+ * ends at the settle deadline, and the batch goes out then, so one read
+ * is not reported on its own when more changes follow within --settle.
+ */
+static bool watch_windows_read(HANDLE dir, HANDLE event, BYTE *buffer, DWORD size,
+                               BOOL subtree, watch_sink_t *sink, DWORD *bytes)
+{
+    OVERLAPPED ov = {0};
+    ov.hEvent = event;
+    if (!ReadDirectoryChangesW(dir, buffer, size, subtree, WATCH_WINDOWS_FILTER, NULL, &ov, NULL))
+        return false;
+    for (;;)
+    {
+        int64_t due = watch_due_ns(sink, watch_now_ns());
+        DWORD timeout = due < 0 ? INFINITE : (DWORD)((due + 999999) / 1000000);
+        DWORD rc = WaitForSingleObject(event, timeout);
+        if (rc == WAIT_OBJECT_0)
+            return GetOverlappedResult(dir, &ov, bytes, FALSE) != 0;
+        if (rc != WAIT_TIMEOUT)
+        {
+            CancelIo(dir);
+            GetOverlappedResult(dir, &ov, bytes, TRUE);
+            return false;
+        }
+        if (watch_due_ns(sink, watch_now_ns()) == 0)
+            watch_flush(sink);
+    }
+}
+
 static int fossil_shark_watch_windows_recursive(
     const char *path,
-    const char *events)
+    watch_sink_t *sink)
 {
     wchar_t *wpath = fossil_utf8_to_wide(path);
     if (!wpath)
@@ -122,7 +1510,7 @@ static int fossil_shark_watch_windows_recursive(
         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
         NULL,
         OPEN_EXISTING,
-        FILE_FLAG_BACKUP_SEMANTICS,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
         NULL);
 
     free(wpath);
@@ -130,23 +1518,21 @@ static int fossil_shark_watch_windows_recursive(
     if (dir == INVALID_HANDLE_VALUE)
         return GetLastError();
 
+    HANDLE event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!event)
+    {
+        DWORD err = GetLastError();
+        CloseHandle(dir);
+        return err;
+    }
+
     BYTE buffer[64 * 1024];
     DWORD bytes;
+    char renamed_from[1024] = "";
 
     while (1)
     {
-        if (!ReadDirectoryChangesW(
-                dir,
-                buffer,
-                sizeof(buffer),
-                TRUE, /* recursive */
-                FILE_NOTIFY_CHANGE_FILE_NAME |
-                    FILE_NOTIFY_CHANGE_DIR_NAME |
-                    FILE_NOTIFY_CHANGE_SIZE |
-                    FILE_NOTIFY_CHANGE_LAST_WRITE,
-                &bytes,
-                NULL,
-                NULL))
+        if (!watch_windows_read(dir, event, buffer, sizeof(buffer), TRUE /* recursive */, sink, &bytes))
             break;
 
         FILE_NOTIFY_INFORMATION *fni =
@@ -165,57 +1551,44 @@ static int fossil_shark_watch_windows_recursive(
                 NULL);
             filename[flen] = '\0';
 
-            bool emit = false;
-            const char *etype = NULL;
-
             switch (fni->Action)
             {
             case FILE_ACTION_ADDED:
-                emit = fossil_io_cstring_icontains(events, "create");
-                etype = "created";
+                watch_emit(sink, 0, WATCH_EV_CREATE, filename, cnull);
                 break;
             case FILE_ACTION_REMOVED:
-                emit = fossil_io_cstring_icontains(events, "delete");
-                etype = "deleted";
+                watch_emit(sink, 0, WATCH_EV_DELETE, filename, cnull);
                 break;
             case FILE_ACTION_MODIFIED:
-                emit = fossil_io_cstring_icontains(events, "modify");
-                etype = "modified";
+                watch_emit(sink, 0, WATCH_EV_MODIFY, filename, cnull);
                 break;
             case FILE_ACTION_RENAMED_OLD_NAME:
+                snprintf(renamed_from, sizeof(renamed_from), "%s", filename);
+                break;
             case FILE_ACTION_RENAMED_NEW_NAME:
-                emit = fossil_io_cstring_icontains(events, "rename");
-                etype = "renamed";
+                watch_emit(sink, 0, WATCH_EV_RENAME, filename, renamed_from);
                 break;
             }
 
-            if (emit)
-            {
-                cstring msg = fossil_io_cstring_format(
-                    "{yellow}%s:{normal} %s\n",
-                    etype, filename);
-                fossil_io_filesys_file_write(
-                    FOSSIL_STDOUT,
-                    msg,
-                    fossil_io_cstring_length(msg),
-                    1);
-                fossil_io_cstring_free(msg);
-            }
-
             if (!fni->NextEntryOffset)
                 break;
 
             fni = (FILE_NOTIFY_INFORMATION *)((BYTE *)fni + fni->NextEntryOffset);
         } while (1);
+
+        // Without --settle each buffer is a batch; otherwise the read waits it out
+        if (watch_due_ns(sink, watch_now_ns()) == 0)
+            watch_flush(sink);
     }
 
+    CloseHandle(event);
     CloseHandle(dir);
     return 0;
 }
 
 static int fossil_shark_watch_windows(
     const char *path,
-    const char *events)
+    watch_sink_t *sink)
 {
     wchar_t *wpath = fossil_utf8_to_wide(path);
     if (!wpath)
@@ -227,7 +1600,7 @@ static int fossil_shark_watch_windows(
         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
         NULL,
         OPEN_EXISTING,
-        FILE_FLAG_BACKUP_SEMANTICS,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
         NULL);
 
     free(wpath);
@@ -235,23 +1608,21 @@ static int fossil_shark_watch_windows(
     if (dir == INVALID_HANDLE_VALUE)
         return GetLastError();
 
+    HANDLE event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (!event)
+    {
+        DWORD err = GetLastError();
+        CloseHandle(dir);
+        return err;
+    }
+
     BYTE buffer[64 * 1024];
     DWORD bytes;
+    char renamed_from[1024] = "";
 
     while (1)
     {
-        if (!ReadDirectoryChangesW(
-                dir,
-                buffer,
-                sizeof(buffer),
-                FALSE, /* non-recursive */
-                FILE_NOTIFY_CHANGE_FILE_NAME |
-                    FILE_NOTIFY_CHANGE_DIR_NAME |
-                    FILE_NOTIFY_CHANGE_SIZE |
-                    FILE_NOTIFY_CHANGE_LAST_WRITE,
-                &bytes,
-                NULL,
-                NULL))
+        if (!watch_windows_read(dir, event, buffer, sizeof(buffer), FALSE /* non-recursive */, sink, &bytes))
             break;
 
         FILE_NOTIFY_INFORMATION *fni =
@@ -270,137 +1641,176 @@ static int fossil_shark_watch_windows(
                 NULL);
             filename[flen] = '\0';
 
-            bool emit = false;
-            const char *etype = NULL;
-
             switch (fni->Action)
             {
             case FILE_ACTION_ADDED:
-                emit = fossil_io_cstring_icontains(events, "create");
-                etype = "created";
+                watch_emit(sink, 0, WATCH_EV_CREATE, filename, cnull);
                 break;
             case FILE_ACTION_REMOVED:
-                emit = fossil_io_cstring_icontains(events, "delete");
-                etype = "deleted";
+                watch_emit(sink, 0, WATCH_EV_DELETE, filename, cnull);
                 break;
             case FILE_ACTION_MODIFIED:
-                emit = fossil_io_cstring_icontains(events, "modify");
-                etype = "modified";
+                watch_emit(sink, 0, WATCH_EV_MODIFY, filename, cnull);
                 break;
             case FILE_ACTION_RENAMED_OLD_NAME:
+                snprintf(renamed_from, sizeof(renamed_from), "%s", filename);
+                break;
             case FILE_ACTION_RENAMED_NEW_NAME:
-                emit = fossil_io_cstring_icontains(events, "rename");
-                etype = "renamed";
+                watch_emit(sink, 0, WATCH_EV_RENAME, filename, renamed_from);
                 break;
             }
 
-            if (emit)
-            {
-                cstring msg = fossil_io_cstring_format(
-                    "{yellow}%s:{normal} %s\n",
-                    etype,
-                    filename);
-                fossil_io_filesys_file_write(
-                    FOSSIL_STDOUT,
-                    msg,
-                    fossil_io_cstring_length(msg),
-                    1);
-                fossil_io_cstring_free(msg);
-            }
-
             if (!fni->NextEntryOffset)
                 break;
 
             fni = (FILE_NOTIFY_INFORMATION *)((BYTE *)fni + fni->NextEntryOffset);
         } while (1);
+
+        // Without --settle each buffer is a batch; otherwise the read waits it out
+        if (watch_due_ns(sink, watch_now_ns()) == 0)
+            watch_flush(sink);
     }
 
+    CloseHandle(event);
     CloseHandle(dir);
     return 0;
 }
 
 #endif
 
-int fossil_shark_watch(const char *path, bool recursive,
-                       const char *events, int interval)
+// Add the paths listed in a roots file, one per line; '#' starts a comment
+static bool watch_read_roots(ccstring roots_file, cstring *text, ccstring **roots, size_t *count, size_t *cap)
 {
-    if (interval <= 0)
+    fossil_io_filesys_obj_t obj;
+    fossil_io_filesys_file_t file;
+    if (fossil_io_filesys_stat(roots_file, &obj) != 0 ||
+        fossil_io_filesys_file_open(&file, roots_file, "rb") != 0)
+        return false;
+    *text = fossil_sys_memory_alloc(obj.size + 1);
+    if (!cnotnull(*text))
     {
-        interval = 1; /* safety default */
+        fossil_io_filesys_file_close(&file);
+        return false;
     }
+    size_t n = fossil_io_filesys_file_read(&file, *text, 1, obj.size);
+    fossil_io_filesys_file_close(&file);
+    (*text)[n] = '\0';
 
-#if defined(_WIN32) || defined(_WIN64)
-
-    cstring msg = fossil_io_cstring_format(
-        "{green,bold}Watching %s every %d seconds...{reset}%s\n",
-        path,
-        interval,
-        recursive ? " (recursive enabled)" : "");
-    fossil_io_filesys_file_write(
-        FOSSIL_STDOUT,
-        msg,
-        fossil_io_cstring_length(msg),
-        1);
-    fossil_io_cstring_free(msg);
-
-    while (1)
+    for (cstring line = *text; *line;)
     {
-        if (recursive)
-        {
-            fossil_shark_watch_windows_recursive(path, events);
-        }
-        else
+        cstring eol = strchr(line, '\n');
+        cstring next = eol ? eol + 1 : line + strlen(line);
+        if (eol)
+            *eol = '\0';
+        while (*line == ' ' || *line == '\t')
+            line++;
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = '\0';
+        while (len > 1 && line[len - 1] == '/')
+            line[--len] = '\0';
+        if (len > 0 && line[0] != '#')
         {
-            fossil_shark_watch_windows(path, events);
+            if (!watch_grow((void **)roots, cap, *count + 1, sizeof(ccstring)))
+                return false;
+            (*roots)[(*count)++] = line;
         }
+        line = next;
+    }
+    return true;
+}
 
-        /* Windows sleep uses milliseconds */
-        Sleep((DWORD)(interval * 1000));
+int fossil_shark_watch(ccstring *paths, size_t path_count, const fossil_shark_watch_options_t *opts)
+{
+    fossil_shark_watch_options_t o = {0};
+    if (cnotnull(opts))
+        o = *opts;
+    if (o.interval <= 0)
+    {
+        o.interval = 1; /* safety default */
     }
+    ccstring roots_file = o.roots_file;
 
-#else /* POSIX */
+    ccstring *roots = cnull;
+    size_t root_count = 0, root_cap = 0;
+    cstring roots_text = cnull;
+    for (size_t i = 0; i < path_count; i++)
+    {
+        if (cnotnull(paths[i]) && watch_grow((void **)&roots, &root_cap, root_count + 1, sizeof(ccstring)))
+            roots[root_count++] = paths[i];
+    }
+    int rc = 0;
+    if (cnotnull(roots_file) && !watch_read_roots(roots_file, &roots_text, &roots, &root_count, &root_cap))
+    {
+        rc = errno ? errno : EIO;
+        fossil_io_printf("{red,bold}Cannot read roots file:{reset} %s\n", roots_file);
+    }
+    else if (root_count == 0)
+    {
+        rc = EINVAL;
+        fossil_io_printf("{red,bold}No paths to watch{reset}\n");
+    }
+    if (rc != 0)
+    {
+        if (cnotnull(roots))
+            fossil_sys_memory_free(roots);
+        if (cnotnull(roots_text))
+            fossil_sys_memory_free(roots_text);
+        return rc;
+    }
+
+    watch_sink_t sink = {0};
+    sink.events = o.events;
+    sink.exec = o.exec_cmd;
+    sink.json = o.json;
+    sink.settle_ns = (int64_t)(o.settle_ms > 0 ? o.settle_ms : 0) * 1000000;
+    sink.roots = roots;
+    sink.max = o.queue_max > 0 ? o.queue_max : WATCH_QUEUE_DEFAULT;
+
+#if defined(_WIN32) || defined(_WIN64)
 
-    fossil_io_filesys_obj_t st;
-    if (fossil_io_filesys_stat(path, &st) != 0)
+    ccstring path = roots[0];
+    for (size_t i = 1; i < root_count; i++)
+        watch_warn("Only the first root is watched on Windows; ignoring", roots[i]);
+    if (!o.json)
     {
-        cstring err_msg = fossil_io_cstring_format(
-            "{red,bold}Failed to stat path:{reset} %s\n", path);
+        cstring msg = fossil_io_cstring_format(
+            "{green,bold}Watching %s every %d seconds...{reset}%s\n",
+            path,
+            o.interval,
+            o.recursive ? " (recursive enabled)" : "");
         fossil_io_filesys_file_write(
-            FOSSIL_STDERR,
-            err_msg,
-            fossil_io_cstring_length(err_msg),
+            FOSSIL_STDOUT,
+            msg,
+            fossil_io_cstring_length(msg),
             1);
-        fossil_io_cstring_free(err_msg);
-        return errno;
-    }
-
-    cstring msg = fossil_io_cstring_format(
-        "{green,bold}Watching %s every %d seconds...{reset}%s\n",
-        path,
-        interval,
-        recursive ? " (recursive enabled)" : "");
-    fossil_io_filesys_file_write(
-        FOSSIL_STDOUT,
-        msg,
-        fossil_io_cstring_length(msg),
-        1);
-    fossil_io_cstring_free(msg);
-
-    if (recursive && st.type == FOSSIL_FILESYS_TYPE_DIR)
-    {
-        fossil_shark_watch_dir(path, events, interval);
+        fossil_io_cstring_free(msg);
     }
-    else
+
+    for (size_t passes = 0; o.passes == 0 || passes < o.passes; passes++)
     {
-        fossil_io_filesys_obj_t prev_obj = st;
-        while (1)
+        if (o.recursive)
+        {
+            fossil_shark_watch_windows_recursive(path, &sink);
+        }
+        else
         {
-            sleep(interval);
-            fossil_shark_watch_file(path, events, &prev_obj);
+            fossil_shark_watch_windows(path, &sink);
         }
+
+        /* Windows sleep uses milliseconds */
+        Sleep((DWORD)(o.interval * 1000));
     }
 
+#else /* POSIX */
+
+    rc = watch_run(&sink, root_count, &o);
+
 #endif
 
-    return 0;
+    watch_sink_free(&sink);
+    fossil_sys_memory_free(roots);
+    if (cnotnull(roots_text))
+        fossil_sys_memory_free(roots_text);
+    return rc;
 }
@@ -0,0 +1,624 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include <fossil/maip/framework.h>
+
+#include "fossil/code/app.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Utilites
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// Setup steps for things like test fixtures and
+// mock objects are set here.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+// Define the test suite and add test cases
+FOSSIL_SUITE(c_archive_command_suite);
+
+// Setup function for the test suite
+FOSSIL_SETUP(c_archive_command_suite)
+{
+    // Setup code here
+}
+
+// Teardown function for the test suite
+FOSSIL_TEARDOWN(c_archive_command_suite)
+{
+    // Teardown code here
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+// Helper: run an archive operation from inside dir, answering the create prompt
+// with "y" and sending stdout to out when it is set
+static int archive_test_run(ccstring dir, ccstring path, const fossil_shark_archive_options_t *opts, ccstring out)
+{
+    char cwd[FOSSIL_FILESYS_MAX_PATH];
+    ASSUME_NOT_CNULL(getcwd(cwd, sizeof(cwd)));
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_yes.txt", "y\n");
+
+    fflush(stdout);
+    int saved_in = dup(STDIN_FILENO), saved_out = dup(STDOUT_FILENO);
+    int answer = open("test_archive_yes.txt", O_RDONLY);
+    int capture = cnotnull(out) ? open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    dup2(answer, STDIN_FILENO);
+    close(answer);
+    if (capture >= 0)
+    {
+        dup2(capture, STDOUT_FILENO);
+        close(capture);
+    }
+    clearerr(stdin);
+
+    int result = chdir(dir) == 0 ? fossil_shark_archive(path, opts) : -1;
+    ASSUME_ITS_EQUAL_I32(chdir(cwd), 0);
+
+    fflush(stdout);
+    dup2(saved_in, STDIN_FILENO);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_in);
+    close(saved_out);
+    clearerr(stdin);
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_archive_yes.txt");
+    return result;
+}
+
+// Helper: whether the file at path contains text
+static bool archive_test_contains(ccstring path, ccstring text)
+{
+    char buf[8192];
+    FILE *file = fopen(path, "r");
+    if (!cnotnull(file))
+        return false;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+    buf[n] = '\0';
+    return cnotnull(strstr(buf, text));
+}
+
+// Helper: whether two files hold the same bytes
+static bool archive_test_same(ccstring lhs, ccstring rhs)
+{
+    FILE *a = fopen(lhs, "rb"), *b = fopen(rhs, "rb");
+    bool same = cnotnull(a) && cnotnull(b);
+    while (same)
+    {
+        int ca = fgetc(a), cb = fgetc(b);
+        same = ca == cb;
+        if (ca == EOF || cb == EOF)
+            break;
+    }
+    if (cnotnull(a))
+        fclose(a);
+    if (cnotnull(b))
+        fclose(b);
+    return same;
+}
+
+// Helper: write size bytes of text, or of noise no compressor can shrink when noise is set
+static void archive_test_fill(ccstring path, size_t size, bool noise)
+{
+    FILE *file = fopen(path, "wb");
+    ASSUME_NOT_CNULL(file);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        fputc(noise ? (int)(state & 0xFF) : "shark archive line\n"[i % 19], file);
+    }
+    fclose(file);
+}
+
+// Helper: append one ustar member to a hand-built archive
+static void archive_test_member(FILE *file, ccstring name, char type, ccstring link, ccstring data)
+{
+    uint8_t h[512] = {0};
+    size_t size = cnotnull(data) ? strlen(data) : 0;
+    snprintf((char *)h, 100, "%s", name);
+    snprintf((char *)h + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+    snprintf((char *)h + 108, 8, "%07o", 0);
+    snprintf((char *)h + 116, 8, "%07o", 0);
+    snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+    snprintf((char *)h + 136, 12, "%011llo", (unsigned long long)time(cnull));
+    h[156] = (uint8_t)type;
+    if (cnotnull(link))
+        snprintf((char *)h + 157, 100, "%s", link);
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof(h); i++)
+        sum += h[i];
+    snprintf((char *)h + 148, 8, "%06o", sum);
+    fwrite(h, 1, sizeof(h), file);
+    if (size > 0)
+    {
+        uint8_t pad[512] = {0};
+        fwrite(data, 1, size, file);
+        fwrite(pad, 1, (512 - size % 512) % 512, file);
+    }
+}
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Cases
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// The test cases below are provided as samples, inspired
+// by the Meson build system's approach of using test cases
+// as samples for library usage.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST(c_test_archive_null_path)
+{
+    int result = fossil_shark_archive(cnull, &(fossil_shark_archive_options_t){ .list = true });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+}
+
+FOSSIL_TEST(c_test_archive_needs_one_operation)
+{
+    int result = fossil_shark_archive("test_archive_none.tar", cnull);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+    result = fossil_shark_archive("test_archive_none.tar", &(fossil_shark_archive_options_t){ .create = true, .list = true });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+}
+
+FOSSIL_TEST(c_test_archive_missing_archive)
+{
+    int result = fossil_shark_archive("nonexistent_archive.tar", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar" });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+FOSSIL_TEST(c_test_archive_threads_identical)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ti");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ti/src");
+    archive_test_fill("test_archive_ti/src/text.txt", 600 * 1024, false);
+    archive_test_fill("test_archive_ti/src/noise.bin", 300 * 1024, true);
+
+    // Blocks deflated on four threads join into the stream one thread writes
+    int result = archive_test_run("test_archive_ti/src", "../one.tar.gz", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.gz", .compress_level = 6, .threads = 1 }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = archive_test_run("test_archive_ti/src", "../four.tar.gz", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.gz", .compress_level = 6, .threads = 4 }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_ti/one.tar.gz", "test_archive_ti/four.tar.gz"));
+
+    // One valid gzip member to the stock tool, when it is installed
+    if (system("command -v gzip > /dev/null 2>&1") == 0)
+        ASSUME_ITS_EQUAL_I32(system("gzip -t test_archive_ti/four.tar.gz"), 0);
+
+    fossil_io_filesys_remove("test_archive_ti", true);
+}
+
+FOSSIL_TEST(c_test_archive_round_trip)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_rt");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_rt/src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_rt/src/sub");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_rt/src/empty");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_rt/src/a.txt", "alpha\n");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_archive_rt/src/zero.txt");
+    archive_test_fill("test_archive_rt/src/sub/text.txt", 600 * 1024, false);
+    archive_test_fill("test_archive_rt/src/sub/noise.bin", 300 * 1024, true);
+    ASSUME_ITS_EQUAL_I32(symlink("a.txt", "test_archive_rt/src/link"), 0);
+
+    static const char *const formats[] = {"tar", "tar.gz", "tar.zst"};
+    static const int threads[] = {1, 4};
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "../rt.%s", formats[f]);
+            int result = archive_test_run("test_archive_rt/src", path, &(fossil_shark_archive_options_t){ .create = true, .format = formats[f], .compress_level = 6, .threads = threads[t] }, cnull);
+            ASSUME_ITS_EQUAL_I32(result, 0);
+
+            FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_rt/out");
+            result = archive_test_run("test_archive_rt/out", path, &(fossil_shark_archive_options_t){ .extract = true, .format = formats[f], .threads = threads[t] }, cnull);
+            ASSUME_ITS_EQUAL_I32(result, 0);
+            result = fossil_shark_compare("test_archive_rt/src", "test_archive_rt/out", false, false, 0, false, false, true);
+            ASSUME_ITS_EQUAL_I32(result, 0);
+            ASSUME_ITS_TRUE(archive_test_same("test_archive_rt/src/sub/text.txt", "test_archive_rt/out/sub/text.txt"));
+            ASSUME_ITS_TRUE(archive_test_same("test_archive_rt/src/sub/noise.bin", "test_archive_rt/out/sub/noise.bin"));
+            ASSUME_ITS_TRUE(archive_test_same("test_archive_rt/src/zero.txt", "test_archive_rt/out/zero.txt"));
+            ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_archive_rt/out/empty") == 1);
+
+            char target[16] = "";
+            ASSUME_ITS_EQUAL_I32(readlink("test_archive_rt/out/link", target, sizeof(target) - 1), 5);
+            ASSUME_ITS_TRUE(strcmp(target, "a.txt") == 0);
+            fossil_io_filesys_remove("test_archive_rt/out", true);
+        }
+    }
+
+    fossil_io_filesys_remove("test_archive_rt", true);
+}
+
+FOSSIL_TEST(c_test_archive_stream_round_trip)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_pipe");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_pipe/src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_pipe/src/sub");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_pipe/src/a.txt", "alpha\n");
+    archive_test_fill("test_archive_pipe/src/sub/text.txt", 600 * 1024, false);
+    archive_test_fill("test_archive_pipe/src/sub/noise.bin", 300 * 1024, true);
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_pipe/out");
+
+    // `archive --stdout src | archive -x -`: the writer is a child on the far
+    // end of a pipe, with its stderr kept apart
+    int pipe_fd[2];
+    ASSUME_ITS_EQUAL_I32(pipe(pipe_fd), 0);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int err = chdir("test_archive_pipe") == 0 ? open("create.err", O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+        int none = open("/dev/null", O_RDONLY);
+        dup2(pipe_fd[1], STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        dup2(none, STDIN_FILENO);
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        int rc = err < 0 ? 1 : fossil_shark_archive("src", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.gz", .stdout_output = true });
+        fflush(stdout);
+        fflush(stderr);
+        _exit(rc == 0 ? 0 : 1);
+    }
+    ASSUME_ITS_TRUE(pid > 0);
+    close(pipe_fd[1]);
+
+    // The reader gets the pipe itself, so nothing can seek back
+    char cwd[FOSSIL_FILESYS_MAX_PATH];
+    ASSUME_NOT_CNULL(getcwd(cwd, sizeof(cwd)));
+    int saved_in = dup(STDIN_FILENO), saved_out = dup(STDOUT_FILENO);
+    int capture = open("test_archive_pipe/extract.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(pipe_fd[0], STDIN_FILENO);
+    dup2(capture, STDOUT_FILENO);
+    close(pipe_fd[0]);
+    close(capture);
+    clearerr(stdin);
+    int result = chdir("test_archive_pipe/out") == 0
+                     ? fossil_shark_archive("-", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar.gz" })
+                     : -1;
+    ASSUME_ITS_EQUAL_I32(chdir(cwd), 0);
+    fflush(stdout);
+    dup2(saved_in, STDIN_FILENO);
+    dup2(saved_out, STDOUT_FILENO);
+    close(saved_in);
+    close(saved_out);
+    clearerr(stdin);
+
+    int status = 0;
+    ASSUME_ITS_EQUAL_I32((int)waitpid(pid, &status, 0), (int)pid);
+    ASSUME_ITS_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // Status went to the writer's stderr; the bytes on the pipe were only the archive
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_pipe/create.err", "Archive created successfully"));
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_pipe/extract.out", "Extracting archive: stdin"));
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_pipe/src/a.txt", "test_archive_pipe/out/src/a.txt"));
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_pipe/src/sub/text.txt", "test_archive_pipe/out/src/sub/text.txt"));
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_pipe/src/sub/noise.bin", "test_archive_pipe/out/src/sub/noise.bin"));
+
+    fossil_io_filesys_remove("test_archive_pipe", true);
+}
+
+FOSSIL_TEST(c_test_archive_rejects_unsafe_members)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_bad");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_bad/out");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_bad/outside");
+
+    // Escapes by "..", by an absolute name, and through a symlinked parent,
+    // around one harmless member that must still come out
+    FILE *file = fopen("test_archive_bad/bad.tar", "wb");
+    ASSUME_NOT_CNULL(file);
+    archive_test_member(file, "../escaped.txt", '0', cnull, "dotdot\n");
+    archive_test_member(file, "/tmp/test_archive_absolute.txt", '0', cnull, "absolute\n");
+    archive_test_member(file, "ok.txt", '0', cnull, "fine\n");
+    archive_test_member(file, "hop", '2', "../outside", cnull);
+    archive_test_member(file, "hop/through.txt", '0', cnull, "symlink\n");
+    uint8_t end[1024] = {0};
+    fwrite(end, 1, sizeof(end), file);
+    fclose(file);
+
+    int result = archive_test_run("test_archive_bad/out", "../bad.tar", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar" }, cnull);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_archive_bad/out/ok.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_archive_bad/escaped.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("/tmp/test_archive_absolute.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_archive_bad/outside/through.txt") == 1);
+
+    fossil_io_filesys_remove("test_archive_bad", true);
+}
+
+FOSSIL_TEST(c_test_archive_member_from_index)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/src/keep");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/src/skip");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_ix/src/keep/a.txt", "kept\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_ix/src/skip/b.txt", "skipped\n");
+    archive_test_fill("test_archive_ix/src/keep/big.txt", 3 * 1024 * 1024, false);
+
+    int result = archive_test_run("test_archive_ix/src", "../ix.tar.gz", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.gz", .compress_level = 6, .index = true }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_archive_ix/ix.tar.gz.idx") == 1);
+
+    // Listing a member comes from the index, extracting one seeks to it
+    result = archive_test_run("test_archive_ix", "ix.tar.gz", &(fossil_shark_archive_options_t){ .list = true, .format = "tar.gz", .member = "keep" }, "test_archive_ix_list.txt");
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_ix_list.txt", "(from index)"));
+    ASSUME_ITS_FALSE(archive_test_contains("test_archive_ix_list.txt", "b.txt"));
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/out");
+    result = archive_test_run("test_archive_ix/out", "../ix.tar.gz", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar.gz", .threads = 1, .member = "keep" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_ix/src/keep/big.txt", "test_archive_ix/out/keep/big.txt"));
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_archive_ix/out/skip") == 1);
+    fossil_io_filesys_remove("test_archive_ix/out", true);
+
+    // Rewrite the archive with other contents but keep the old index: it no
+    // longer matches, so it is ignored and the archive is read in full
+    ASSUME_ITS_EQUAL_I32(rename("test_archive_ix/ix.tar.gz.idx", "test_archive_ix/idx.bak"), 0);
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_ix/src/keep/new.txt", "added later\n");
+    result = archive_test_run("test_archive_ix/src", "../ix.tar.gz", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.gz", .compress_level = 6 }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_EQUAL_I32(rename("test_archive_ix/idx.bak", "test_archive_ix/ix.tar.gz.idx"), 0);
+
+    result = archive_test_run("test_archive_ix", "ix.tar.gz", &(fossil_shark_archive_options_t){ .list = true, .format = "tar.gz", .member = "keep" }, "test_archive_ix_list.txt");
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(archive_test_contains("test_archive_ix_list.txt", "(from index)"));
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_ix_list.txt", "new.txt"));
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/out");
+    result = archive_test_run("test_archive_ix/out", "../ix.tar.gz", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar.gz", .threads = 4, .member = "keep/new.txt" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_ix/src/keep/new.txt", "test_archive_ix/out/keep/new.txt"));
+    fossil_io_filesys_remove("test_archive_ix/out", true);
+
+    // A rewrite to the very same size must not pass for the old archive either
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/same");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_ix/same/one.txt", "first\n");
+    result = archive_test_run("test_archive_ix/same", "../same.tar", &(fossil_shark_archive_options_t){ .create = true, .format = "tar", .index = true }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    struct stat before, after;
+    ASSUME_ITS_EQUAL_I32(stat("test_archive_ix/same.tar", &before), 0);
+    ASSUME_ITS_EQUAL_I32(rename("test_archive_ix/same.tar.idx", "test_archive_ix/idx.bak"), 0);
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_ix/same/one.txt", "other\n");
+    result = archive_test_run("test_archive_ix/same", "../same.tar", &(fossil_shark_archive_options_t){ .create = true, .format = "tar" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_EQUAL_I32(rename("test_archive_ix/idx.bak", "test_archive_ix/same.tar.idx"), 0);
+    ASSUME_ITS_EQUAL_I32(stat("test_archive_ix/same.tar", &after), 0);
+    ASSUME_ITS_EQUAL_U64((uint64_t)after.st_size, (uint64_t)before.st_size);
+
+    result = archive_test_run("test_archive_ix", "same.tar", &(fossil_shark_archive_options_t){ .list = true, .format = "tar", .member = "one.txt" }, "test_archive_ix_list.txt");
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(archive_test_contains("test_archive_ix_list.txt", "(from index)"));
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_ix/out");
+    result = archive_test_run("test_archive_ix/out", "../same.tar", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar", .threads = 4, .member = "one.txt" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_ix/same/one.txt", "test_archive_ix/out/one.txt"));
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_archive_ix_list.txt");
+    fossil_io_filesys_remove("test_archive_ix", true);
+}
+
+FOSSIL_TEST(c_test_archive_incremental_chain)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_inc");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_inc/src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_inc/src/gone");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/a.txt", "first\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/b.txt", "doomed\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/gone/c.txt", "doomed too\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/same.txt", "unchanged\n");
+
+    int result = archive_test_run("test_archive_inc/src", "../inc0.tar.zst", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.zst", .incremental = "../inc.manifest" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // Edit, delete a file and a whole directory, add one
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/a.txt", "second, longer\n");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_archive_inc/src/b.txt");
+    fossil_io_filesys_remove("test_archive_inc/src/gone", true);
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_inc/src/d.txt", "new\n");
+    result = archive_test_run("test_archive_inc/src", "../inc1.tar.zst", &(fossil_shark_archive_options_t){ .create = true, .format = "tar.zst", .incremental = "../inc.manifest" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // The second archive holds only the changes and the tombstones
+    result = archive_test_run("test_archive_inc", "inc1.tar.zst", &(fossil_shark_archive_options_t){ .list = true, .format = "tar.zst" }, "test_archive_inc_list.txt");
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_inc_list.txt", "d.txt"));
+    ASSUME_ITS_FALSE(archive_test_contains("test_archive_inc_list.txt", "same.txt"));
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_inc_list.txt", "deleted"));
+
+    // Replaying the chain restores the latest tree, removals included
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_inc/out");
+    result = archive_test_run("test_archive_inc/out", "../inc1.tar.zst", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar.zst", .incremental = "../inc.manifest" }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_archive_inc/src", "test_archive_inc/out", false, false, 0, false, false, true);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_same("test_archive_inc/src/a.txt", "test_archive_inc/out/a.txt"));
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_archive_inc/out/b.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_archive_inc/out/gone") == 1);
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_archive_inc_list.txt");
+    fossil_io_filesys_remove("test_archive_inc", true);
+}
+
+FOSSIL_TEST(c_test_archive_tombstone_name_is_data)
+{
+    // A file that only shares the tombstones' name, naming a file that is
+    // already at the destination: it must come out as itself and delete nothing
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_tn");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_tn/src");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_tn/src/.shark-deleted", "victim.txt");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_tn/src/other.txt", "other\n");
+    int result = archive_test_run("test_archive_tn/src", "../tn.tar", &(fossil_shark_archive_options_t){ .create = true, .format = "tar", .index = true }, cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    result = archive_test_run("test_archive_tn", "tn.tar", &(fossil_shark_archive_options_t){ .list = true, .format = "tar" }, "test_archive_tn_list.txt");
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(archive_test_contains("test_archive_tn_list.txt", ".shark-deleted"));
+    ASSUME_ITS_FALSE(archive_test_contains("test_archive_tn_list.txt", "deleted    "));
+
+    // Read straight through, and fanned out through the index
+    static const int threads[] = {1, 4};
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    {
+        FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_tn/out");
+        FOSSIL_SANITY_SYS_WRITE_FILE("test_archive_tn/out/victim.txt", "still here\n");
+        result = archive_test_run("test_archive_tn/out", "../tn.tar", &(fossil_shark_archive_options_t){ .extract = true, .format = "tar", .threads = threads[i] }, cnull);
+        ASSUME_ITS_EQUAL_I32(result, 0);
+        ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_archive_tn/out/victim.txt") == 1);
+        ASSUME_ITS_TRUE(archive_test_same("test_archive_tn/src/.shark-deleted", "test_archive_tn/out/.shark-deleted"));
+        ASSUME_ITS_TRUE(archive_test_same("test_archive_tn/src/other.txt", "test_archive_tn/out/other.txt"));
+        fossil_io_filesys_remove("test_archive_tn/out", true);
+    }
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_archive_tn_list.txt");
+    fossil_io_filesys_remove("test_archive_tn", true);
+}
+
+FOSSIL_TEST(c_test_archive_parallel_extract)
+{
+    // Several checkpoints' worth of files in two directories, and a symlink
+    // that can only be made once its target is written
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_px");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_px/src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_px/src/one");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_px/src/two");
+    static const char *const files[] = {"one/a.txt", "one/b.bin", "one/c.txt", "two/d.txt", "two/e.bin", "two/f.txt"};
+    char path[FOSSIL_FILESYS_MAX_PATH], copy[FOSSIL_FILESYS_MAX_PATH];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        snprintf(path, sizeof(path), "test_archive_px/src/%s", files[i]);
+        archive_test_fill(path, 700 * 1024, strstr(files[i], ".bin") != cnull);
+    }
+    ASSUME_ITS_EQUAL_I32(symlink("../one/a.txt", "test_archive_px/src/two/link"), 0);
+
+    static const char *const formats[] = {"tar", "tar.gz", "tar.zst"};
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        char archive[64];
+        snprintf(archive, sizeof(archive), "../px.%s", formats[f]);
+        int result = archive_test_run("test_archive_px/src", archive, &(fossil_shark_archive_options_t){ .create = true, .format = formats[f], .compress_level = 6, .threads = 4, .index = true }, cnull);
+        ASSUME_ITS_EQUAL_I32(result, 0);
+
+        // Four workers take the spans the index cuts the archive into
+        FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_px/out");
+        result = archive_test_run("test_archive_px/out", archive, &(fossil_shark_archive_options_t){ .extract = true, .format = formats[f], .threads = 4 }, cnull);
+        ASSUME_ITS_EQUAL_I32(result, 0);
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        {
+            snprintf(path, sizeof(path), "test_archive_px/src/%s", files[i]);
+            snprintf(copy, sizeof(copy), "test_archive_px/out/%s", files[i]);
+            ASSUME_ITS_TRUE(archive_test_same(path, copy));
+        }
+
+        char target[16] = "";
+        ASSUME_ITS_EQUAL_I32(readlink("test_archive_px/out/two/link", target, sizeof(target) - 1), 12);
+        ASSUME_ITS_TRUE(strcmp(target, "../one/a.txt") == 0);
+        fossil_io_filesys_remove("test_archive_px/out", true);
+    }
+
+    fossil_io_filesys_remove("test_archive_px", true);
+}
+
+FOSSIL_TEST(c_test_archive_stored_blocks)
+{
+    // Mostly noise, so most blocks are stored rather than compressed
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_st");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_st/src");
+    archive_test_fill("test_archive_st/src/noise.bin", 2 * 1024 * 1024, true);
+    archive_test_fill("test_archive_st/src/text.txt", 256 * 1024, false);
+
+    static const char *const formats[] = {"tar.gz", "tar.zst"};
+    static const char *const checks[] = {"gzip -t", "zstd -q -t"};
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        char path[64], command[128];
+        snprintf(path, sizeof(path), "../st.%s", formats[f]);
+        int result = archive_test_run("test_archive_st/src", path, &(fossil_shark_archive_options_t){ .create = true, .format = formats[f], .compress_level = 9, .threads = 4, .index = true }, cnull);
+        ASSUME_ITS_EQUAL_I32(result, 0);
+
+        // Stored blocks cost a few bytes each, not a failed attempt at compressing
+        fossil_io_filesys_obj_t obj;
+        snprintf(command, sizeof(command), "test_archive_st/st.%s", formats[f]);
+        ASSUME_ITS_EQUAL_I32(fossil_io_filesys_stat(command, &obj), 0);
+        ASSUME_ITS_TRUE(obj.size < 2 * 1024 * 1024 + 64 * 1024);
+
+        // Still one valid stream to the stock tools, when they are installed
+        snprintf(command, sizeof(command), "command -v %.4s > /dev/null 2>&1", checks[f]);
+        if (system(command) == 0)
+        {
+            snprintf(command, sizeof(command), "%s test_archive_st/st.%s", checks[f], formats[f]);
+            ASSUME_ITS_EQUAL_I32(system(command), 0);
+        }
+
+        // And to ours, both in one pass and fanned out through the index
+        for (int threads = 1; threads <= 4; threads += 3)
+        {
+            FOSSIL_SANITY_SYS_CREATE_DIR("test_archive_st/out");
+            result = archive_test_run("test_archive_st/out", path, &(fossil_shark_archive_options_t){ .extract = true, .format = formats[f], .threads = threads }, cnull);
+            ASSUME_ITS_EQUAL_I32(result, 0);
+            ASSUME_ITS_TRUE(archive_test_same("test_archive_st/src/noise.bin", "test_archive_st/out/noise.bin"));
+            ASSUME_ITS_TRUE(archive_test_same("test_archive_st/src/text.txt", "test_archive_st/out/text.txt"));
+            fossil_io_filesys_remove("test_archive_st/out", true);
+        }
+    }
+
+    fossil_io_filesys_remove("test_archive_st", true);
+}
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Pool
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST_GROUP(c_archive_command_tests)
+{
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_null_path);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_needs_one_operation);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_missing_archive);
+#if !defined(_WIN32) && !defined(_WIN64)
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_threads_identical);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_round_trip);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_stream_round_trip);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_rejects_unsafe_members);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_member_from_index);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_incremental_chain);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_tombstone_name_is_data);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_parallel_extract);
+    FOSSIL_ADD_TEST(c_archive_command_suite, c_test_archive_stored_blocks);
+#endif
+
+    FOSSIL_ADD_SUITE(c_archive_command_suite);
+}
@@ -26,6 +26,8 @@
 
 #include "fossil/code/app.h"
 
+#include <fcntl.h>
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Test Utilites
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -48,6 +50,56 @@ FOSSIL_TEARDOWN(c_compare_command_suite)
     // Teardown code here
 }
 
+// Run a compare with stdout sent to a file and return its result; what it
+// printed is left in out
+static int compare_captured_as(ccstring path1, ccstring path2, bool text, bool binary,
+                               int context, bool all_ranges, bool recursive,
+                               char *out, size_t size)
+{
+    // Plain text, so lines start with their diff markers
+    int color = FOSSIL_IO_COLOR_ENABLE;
+    FOSSIL_IO_COLOR_ENABLE = false;
+    fflush(stdout);
+    int saved = dup(fileno(stdout));
+    int fd = open("compare_captured.out", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, fileno(stdout));
+    close(fd);
+
+    int result = fossil_shark_compare(path1, path2, text, binary, context, false, all_ranges, recursive);
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+    FOSSIL_IO_COLOR_ENABLE = color;
+
+    FILE *file = fopen("compare_captured.out", "r");
+    size_t n = file ? fread(out, 1, size - 1, file) : 0;
+    out[n] = '\0';
+    if (file)
+        fclose(file);
+    remove("compare_captured.out");
+    return result;
+}
+
+// Text diff, or a recursive compare when recursive is set
+static int compare_captured(ccstring path1, ccstring path2, int context, bool recursive,
+                            char *out, size_t size)
+{
+    return compare_captured_as(path1, path2, !recursive, false, context, false, recursive, out, size);
+}
+
+// Number of lines in text that start with prefix
+static int count_lines(ccstring text, ccstring prefix)
+{
+    int count = 0;
+    size_t len = strlen(prefix);
+    for (ccstring line = text; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : cnull)
+    {
+        if (strncmp(line, prefix, len) == 0)
+            count++;
+    }
+    return count;
+}
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Test Cases
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -61,15 +113,15 @@ FOSSIL_TEARDOWN(c_compare_command_suite)
 FOSSIL_TEST(c_test_compare_null_parameters)
 {
     // Test with null path1
-    int result = fossil_shark_compare(cnull, "test.txt", true, false, 0, false);
+    int result = fossil_shark_compare(cnull, "test.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Test with null path2
-    result = fossil_shark_compare("test.txt", cnull, true, false, 0, false);
+    result = fossil_shark_compare("test.txt", cnull, true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Test with both null
-    result = fossil_shark_compare(cnull, cnull, true, false, 0, false);
+    result = fossil_shark_compare(cnull, cnull, true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 }
 
@@ -87,7 +139,7 @@ FOSSIL_TEST(c_test_compare_identical_text_files)
     fclose(file2);
 
     // Compare identical files
-    int result = fossil_shark_compare("identical1.txt", "identical2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("identical1.txt", "identical2.txt", true, false, 0, false, false, false);
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Clean up
@@ -109,7 +161,7 @@ FOSSIL_TEST(c_test_compare_different_text_files)
     fclose(file2);
 
     // Compare different files
-    int result = fossil_shark_compare("different1.txt", "different2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("different1.txt", "different2.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -132,7 +184,7 @@ FOSSIL_TEST(c_test_compare_identical_binary_files)
     fclose(file2);
 
     // Compare identical binary files
-    int result = fossil_shark_compare("binary1.bin", "binary2.bin", false, true, 0, false);
+    int result = fossil_shark_compare("binary1.bin", "binary2.bin", false, true, 0, false, false, false);
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Clean up
@@ -156,7 +208,7 @@ FOSSIL_TEST(c_test_compare_different_binary_files)
     fclose(file2);
 
     // Compare different binary files
-    int result = fossil_shark_compare("binary_diff1.bin", "binary_diff2.bin", false, true, 0, false);
+    int result = fossil_shark_compare("binary_diff1.bin", "binary_diff2.bin", false, true, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -178,7 +230,7 @@ FOSSIL_TEST(c_test_compare_case_sensitive)
     fclose(file2);
 
     // Compare with case sensitivity (should find differences)
-    int result = fossil_shark_compare("case1.txt", "case2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("case1.txt", "case2.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -200,7 +252,7 @@ FOSSIL_TEST(c_test_compare_case_insensitive)
     fclose(file2);
 
     // Compare with case insensitivity (should be identical)
-    int result = fossil_shark_compare("case_ignore1.txt", "case_ignore2.txt", true, false, 0, true);
+    int result = fossil_shark_compare("case_ignore1.txt", "case_ignore2.txt", true, false, 0, true, false, false);
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Clean up
@@ -222,7 +274,7 @@ FOSSIL_TEST(c_test_compare_with_context_lines)
     fclose(file2);
 
     // Compare with context lines
-    int result = fossil_shark_compare("context1.txt", "context2.txt", true, false, 2, false);
+    int result = fossil_shark_compare("context1.txt", "context2.txt", true, false, 2, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -242,7 +294,7 @@ FOSSIL_TEST(c_test_compare_empty_files)
     fclose(file2);
 
     // Compare empty files
-    int result = fossil_shark_compare("empty1.txt", "empty2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("empty1.txt", "empty2.txt", true, false, 0, false, false, false);
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Clean up
@@ -264,7 +316,7 @@ FOSSIL_TEST(c_test_compare_different_length_files)
     fclose(file2);
 
     // Compare files with different lengths
-    int result = fossil_shark_compare("short.txt", "long.txt", true, false, 0, false);
+    int result = fossil_shark_compare("short.txt", "long.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -275,7 +327,7 @@ FOSSIL_TEST(c_test_compare_different_length_files)
 FOSSIL_TEST(c_test_compare_nonexistent_files)
 {
     // Try to compare non-existent files
-    int result = fossil_shark_compare("nonexistent1.txt", "nonexistent2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("nonexistent1.txt", "nonexistent2.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 }
 
@@ -288,7 +340,7 @@ FOSSIL_TEST(c_test_compare_one_nonexistent_file)
     fclose(file1);
 
     // Try to compare existing file with non-existent file
-    int result = fossil_shark_compare("exists.txt", "nonexistent.txt", true, false, 0, false);
+    int result = fossil_shark_compare("exists.txt", "nonexistent.txt", true, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -309,7 +361,7 @@ FOSSIL_TEST(c_test_compare_neither_text_nor_binary)
     fclose(file2);
 
     // Try to compare without specifying text or binary mode
-    int result = fossil_shark_compare("neither1.txt", "neither2.txt", false, false, 0, false);
+    int result = fossil_shark_compare("neither1.txt", "neither2.txt", false, false, 0, false, false, false);
     ASSUME_NOT_EQUAL_I32(0, result);
 
     // Clean up
@@ -337,7 +389,7 @@ FOSSIL_TEST(c_test_compare_large_files)
     fclose(file2);
 
     // Compare large identical files
-    int result = fossil_shark_compare("large1.txt", "large2.txt", true, false, 0, false);
+    int result = fossil_shark_compare("large1.txt", "large2.txt", true, false, 0, false, false, false);
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Clean up
@@ -345,6 +397,190 @@ FOSSIL_TEST(c_test_compare_large_files)
     remove("large2.txt");
 }
 
+FOSSIL_TEST(c_test_compare_inserted_line)
+{
+    // Same content with one line inserted near the top
+    FILE *file1 = fopen("insert1.txt", "w");
+    ASSUME_NOT_CNULL(file1);
+    for (int i = 0; i < 100; i++)
+    {
+        fprintf(file1, "Line %d\n", i);
+    }
+    fclose(file1);
+
+    FILE *file2 = fopen("insert2.txt", "w");
+    ASSUME_NOT_CNULL(file2);
+    for (int i = 0; i < 100; i++)
+    {
+        if (i == 2)
+            fprintf(file2, "Inserted line\n");
+        fprintf(file2, "Line %d\n", i);
+    }
+    fclose(file2);
+
+    // One hunk holding the inserted line and three lines of context either side,
+    // rather than every later line reported as changed
+    char output[8192];
+    int result = compare_captured("insert1.txt", "insert2.txt", 3, false, output, sizeof(output));
+    ASSUME_NOT_EQUAL_I32(0, result);
+    ASSUME_ITS_EQUAL_I32(1, count_lines(output, "@@"));
+    ASSUME_NOT_CNULL(strstr(output, "@@ -1,5 +1,6 @@\n"));
+    ASSUME_ITS_EQUAL_I32(1, count_lines(output, "+") - count_lines(output, "+++"));
+    ASSUME_ITS_EQUAL_I32(0, count_lines(output, "-") - count_lines(output, "---"));
+    ASSUME_NOT_CNULL(strstr(output, "+Inserted line\n"));
+
+    // A file always matches itself
+    result = fossil_shark_compare("insert1.txt", "insert1.txt", true, false, 3, false, false, false);
+    ASSUME_ITS_EQUAL_I32(0, result);
+
+    // Clean up
+    remove("insert1.txt");
+    remove("insert2.txt");
+}
+
+FOSSIL_TEST(c_test_compare_diff_lines_verbatim)
+{
+    // Lines that look like markup or hold format specifiers
+    FILE *file1 = fopen("verbatim1.txt", "w");
+    ASSUME_NOT_CNULL(file1);
+    fprintf(file1, "keep\n{red}old %%s{normal}\n");
+    fclose(file1);
+
+    FILE *file2 = fopen("verbatim2.txt", "w");
+    ASSUME_NOT_CNULL(file2);
+    fprintf(file2, "keep\n{green}new %%d\n");
+    fclose(file2);
+
+    // File text comes through byte for byte, not interpreted
+    char output[4096];
+    int result = compare_captured("verbatim1.txt", "verbatim2.txt", 1, false, output, sizeof(output));
+    ASSUME_NOT_EQUAL_I32(0, result);
+    ASSUME_NOT_CNULL(strstr(output, "-{red}old %s{normal}\n"));
+    ASSUME_NOT_CNULL(strstr(output, "+{green}new %d\n"));
+    ASSUME_NOT_CNULL(strstr(output, " keep\n"));
+
+    // Clean up
+    remove("verbatim1.txt");
+    remove("verbatim2.txt");
+}
+
+FOSSIL_TEST(c_test_compare_binary_all_ranges)
+{
+    // Two separate differing ranges plus a trailing size difference
+    FILE *file1 = fopen("ranges1.bin", "wb");
+    ASSUME_NOT_CNULL(file1);
+    unsigned char data1[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+    fwrite(data1, 1, sizeof(data1), file1);
+    fclose(file1);
+
+    FILE *file2 = fopen("ranges2.bin", "wb");
+    ASSUME_NOT_CNULL(file2);
+    unsigned char data2[] = {0x00, 0xAA, 0xBB, 0x03, 0x04, 0x05, 0xCC, 0x07, 0x08, 0x09, 0x0A};
+    fwrite(data2, 1, sizeof(data2), file2);
+    fclose(file2);
+
+    // Both ranges are listed with exact offsets, then the size difference
+    char output[4096];
+    int result = compare_captured_as("ranges1.bin", "ranges2.bin", false, true, 0, true, false,
+                                     output, sizeof(output));
+    ASSUME_NOT_EQUAL_I32(0, result);
+    ASSUME_ITS_EQUAL_I32(2, count_lines(output, "Differs at bytes "));
+    ASSUME_NOT_CNULL(strstr(output, "Differs at bytes 1-2 (2 bytes)\n"));
+    ASSUME_NOT_CNULL(strstr(output, "Differs at bytes 6-6 (1 bytes)\n"));
+    ASSUME_NOT_CNULL(strstr(output, "Binary files differ in size: 10 != 11\n"));
+    ASSUME_NOT_CNULL(strstr(output, "2 differing range(s)\n"));
+
+    // Identical files report no ranges
+    result = compare_captured_as("ranges1.bin", "ranges1.bin", false, true, 0, true, false,
+                                 output, sizeof(output));
+    ASSUME_ITS_EQUAL_I32(0, result);
+    ASSUME_ITS_EQUAL_I32(0, count_lines(output, "Differs at bytes "));
+    ASSUME_NOT_CNULL(strstr(output, "0 differing range(s)\n"));
+
+    // Clean up
+    remove("ranges1.bin");
+    remove("ranges2.bin");
+}
+
+FOSSIL_TEST(c_test_compare_recursive_directories)
+{
+    // Two small trees: one shared file, one changed, one added
+    fossil_io_filesys_dir_create("tree_a", false);
+    fossil_io_filesys_dir_create("tree_b", false);
+
+    FILE *file = fopen("tree_a/same.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "same\n");
+    fclose(file);
+    file = fopen("tree_b/same.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "same\n");
+    fclose(file);
+
+    file = fopen("tree_a/changed.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "old\n");
+    fclose(file);
+    file = fopen("tree_b/changed.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "new\n");
+    fclose(file);
+
+    file = fopen("tree_b/added.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "added\n");
+    fclose(file);
+
+    // Equal timestamps, so the identical pair carries no metadata change
+    struct utimbuf times = {1000000000, 1000000000};
+    utime("tree_a/same.txt", &times);
+    utime("tree_b/same.txt", &times);
+
+    // Same-size pair settled by a worker, the addition by the walk; the
+    // identical file produces no record
+    char output[4096];
+    int result = compare_captured("tree_a", "tree_b", 0, true, output, sizeof(output));
+    ASSUME_NOT_EQUAL_I32(0, result);
+    ASSUME_NOT_CNULL(strstr(output, "{\"status\":\"content-changed\",\"path\":\"changed.txt\",\"type\":\"file\"}\n"));
+    ASSUME_NOT_CNULL(strstr(output, "{\"status\":\"added\",\"path\":\"added.txt\",\"type\":\"file\"}\n"));
+    ASSUME_ITS_CNULL(strstr(output, "same.txt"));
+    ASSUME_ITS_EQUAL_I32(3, count_lines(output, "{"));
+    ASSUME_NOT_CNULL(strstr(output, "{\"added\":1,\"removed\":0,\"type_changed\":0,"
+                                    "\"metadata_changed\":0,\"content_changed\":1,\"errors\":0}\n"));
+
+    // A tree always matches itself
+    result = compare_captured("tree_a", "tree_a", 0, true, output, sizeof(output));
+    ASSUME_ITS_EQUAL_I32(0, result);
+    ASSUME_ITS_EQUAL_I32(1, count_lines(output, "{"));
+    ASSUME_NOT_CNULL(strstr(output, "\"content_changed\":0,\"errors\":0}\n"));
+
+    // Clean up
+    fossil_io_filesys_remove("tree_a", true);
+    fossil_io_filesys_remove("tree_b", true);
+}
+
+FOSSIL_TEST(c_test_compare_recursive_json_escapes_names)
+{
+#ifndef _WIN32 // quotes and backslashes cannot appear in Windows file names
+    fossil_io_filesys_dir_create("tree_esc_a", false);
+    fossil_io_filesys_dir_create("tree_esc_b", false);
+
+    FILE *file = fopen("tree_esc_b/say \"{red}\\.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "added\n");
+    fclose(file);
+
+    // Quote and backslash are escaped, the braces pass through as text
+    char output[4096];
+    int result = compare_captured("tree_esc_a", "tree_esc_b", 0, true, output, sizeof(output));
+    ASSUME_NOT_EQUAL_I32(0, result);
+    ASSUME_NOT_CNULL(strstr(output, "{\"status\":\"added\",\"path\":\"say \\\"{red}\\\\.txt\",\"type\":\"file\"}\n"));
+
+    fossil_io_filesys_remove("tree_esc_a", true);
+    fossil_io_filesys_remove("tree_esc_b", true);
+#endif
+}
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Test Pool
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -365,6 +601,11 @@ FOSSIL_TEST_GROUP(c_compare_command_tests)
     FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_one_nonexistent_file);
     FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_neither_text_nor_binary);
     FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_large_files);
+    FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_inserted_line);
+    FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_diff_lines_verbatim);
+    FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_binary_all_ranges);
+    FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_recursive_directories);
+    FOSSIL_ADD_TEST(c_compare_command_suite, c_test_compare_recursive_json_escapes_names);
 
     FOSSIL_ADD_SUITE(c_compare_command_suite);
 }
@@ -26,6 +26,8 @@
 
 #include "fossil/code/app.h"
 
+#include <fcntl.h>
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Dedupe Test Suite
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -51,16 +53,78 @@ static void create_file(const char* path, const char* content)
     fclose(f);
 }
 
+// Helper: write size pseudo-random bytes from seed, so chunk boundaries vary
+static void create_random_file(const char* path, uint32_t seed, size_t size)
+{
+    FILE* f = fopen(path, "wb");
+    ASSUME_NOT_CNULL(f);
+    for (size_t i = 0; i < size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        fputc((int)(seed & 0xff), f);
+    }
+    fclose(f);
+}
+
+// Helper: run dedupe with stdout redirected, return what it printed
+static char* capture_dedupe(const char* dir_path, bool use_hash, bool reflink, bool chunks,
+                            const char* fmt, const char* out_path, int* result)
+{
+    fflush(stdout);
+    int saved = dup(fileno(stdout));
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, fileno(stdout));
+    close(fd);
+
+    *result = fossil_shark_dedupe(dir_path, use_hash, false, false, false, reflink, chunks, fmt);
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+
+    static char text[4096];
+    FILE* f = fopen(out_path, "r");
+    ASSUME_NOT_CNULL(f);
+    size_t n = fread(text, 1, sizeof(text) - 1, f);
+    text[n] = '\0';
+    fclose(f);
+    remove(out_path);
+    return text;
+}
+
+// Helper: run the chunk report with stdout redirected, return what it printed
+static char* capture_chunk_report(const char* dir_path, const char* out_path)
+{
+    int result = -1;
+    char* text = capture_dedupe(dir_path, true, false, true, "json", out_path, &result);
+    ASSUME_ITS_EQUAL_I32(0, result);
+    return text;
+}
+
+// Helper: whether every line of text is a JSON record
+static bool all_json_records(const char* text)
+{
+    for (const char* line = text; *line; ) {
+        if (strncmp(line, "{\"", 2) != 0)
+            return false;
+        const char* end = strchr(line, '\n');
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    return true;
+}
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Test Cases
 // * * * * * * * * * * * * * * * * * * * * * * * *
 
 FOSSIL_TEST(c_test_dedupe_null_parameters)
 {
-    int result = fossil_shark_dedupe(cnull, true, false, false, false, "text");
+    int result = fossil_shark_dedupe(cnull, true, false, false, false, false, false, "text");
     ASSUME_NOT_EQUAL_I32(0, result);
 
-    result = fossil_shark_dedupe("testdir", true, false, false, false, cnull);
+    result = fossil_shark_dedupe("testdir", true, false, false, false, false, false, cnull);
     ASSUME_NOT_EQUAL_I32(0, result);
 }
 
@@ -68,7 +132,7 @@ FOSSIL_TEST(c_test_dedupe_empty_directory)
 {
     mkdir("empty_dedupe_dir", 0700);
 
-    int result = fossil_shark_dedupe("empty_dedupe_dir", true, false, false, false, "text");
+    int result = fossil_shark_dedupe("empty_dedupe_dir", true, false, false, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     rmdir("empty_dedupe_dir");
@@ -82,7 +146,7 @@ FOSSIL_TEST(c_test_dedupe_no_duplicates)
     create_file("nodupe_dir/file2.txt", "beta");
     create_file("nodupe_dir/file3.txt", "gamma");
 
-    int result = fossil_shark_dedupe("nodupe_dir", true, false, false, false, "text");
+    int result = fossil_shark_dedupe("nodupe_dir", true, false, false, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     remove("nodupe_dir/file1.txt");
@@ -99,7 +163,7 @@ FOSSIL_TEST(c_test_dedupe_detect_duplicates_by_hash)
     create_file("hash_dupe_dir/b.txt", "SAME_CONTENT"); // duplicate
     create_file("hash_dupe_dir/c.txt", "DIFFERENT");
 
-    int result = fossil_shark_dedupe("hash_dupe_dir", true, false, false, false, "text");
+    int result = fossil_shark_dedupe("hash_dupe_dir", true, false, false, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     remove("hash_dupe_dir/a.txt");
@@ -116,7 +180,7 @@ FOSSIL_TEST(c_test_dedupe_detect_duplicates_by_size)
     create_file("size_dupe_dir/y.txt", "12345"); // same size
     create_file("size_dupe_dir/z.txt", "999");
 
-    int result = fossil_shark_dedupe("size_dupe_dir", false, false, false, false, "text");
+    int result = fossil_shark_dedupe("size_dupe_dir", false, false, false, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     remove("size_dupe_dir/x.txt");
@@ -132,7 +196,7 @@ FOSSIL_TEST(c_test_dedupe_delete_duplicates)
     create_file("delete_dupe_dir/a.txt", "DUPLICATE");
     create_file("delete_dupe_dir/b.txt", "DUPLICATE");
 
-    int result = fossil_shark_dedupe("delete_dupe_dir", true, false, true, false, "text");
+    int result = fossil_shark_dedupe("delete_dupe_dir", true, false, true, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // One file should remain
@@ -151,7 +215,7 @@ FOSSIL_TEST(c_test_dedupe_link_duplicates)
     create_file("link_dupe_dir/a.txt", "LINKME");
     create_file("link_dupe_dir/b.txt", "LINKME");
 
-    int result = fossil_shark_dedupe("link_dupe_dir", true, false, false, true, "text");
+    int result = fossil_shark_dedupe("link_dupe_dir", true, false, false, true, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     // Expect link behavior (implementation dependent check)
@@ -160,6 +224,153 @@ FOSSIL_TEST(c_test_dedupe_link_duplicates)
     rmdir("link_dupe_dir");
 }
 
+FOSSIL_TEST(c_test_dedupe_reflink_duplicates)
+{
+    mkdir("reflink_dupe_dir", 0700);
+
+    create_file("reflink_dupe_dir/a.txt", "REFLINKME");
+    create_file("reflink_dupe_dir/b.txt", "REFLINKME");
+
+    // Shared where the filesystem supports it, a failed record where it does not
+    int result = -1;
+    char* out = capture_dedupe("reflink_dupe_dir", true, true, false, "json", "reflink_dupe.json", &result);
+    ASSUME_ITS_TRUE(all_json_records(out));
+    bool shared = strstr(out, "\"status\":\"shared\",\"shared\":9,\"size\":9}") != cnull;
+    ASSUME_ITS_TRUE(shared || strstr(out, "\"status\":\"failed\",\"shared\":0,\"size\":9,\"error\":") != cnull);
+    ASSUME_ITS_EQUAL_I32(shared ? 0 : 1, result);
+    ASSUME_NOT_CNULL(strstr(out, "{\"reclaimed\":"));
+
+    // Reflink never removes files, even when the filesystem cannot share extents
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("reflink_dupe_dir/a.txt"));
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("reflink_dupe_dir/b.txt"));
+
+    remove("reflink_dupe_dir/a.txt");
+    remove("reflink_dupe_dir/b.txt");
+    rmdir("reflink_dupe_dir");
+}
+
+FOSSIL_TEST(c_test_dedupe_reflink_contents_differ)
+{
+    mkdir("reflink_diff_dir", 0700);
+
+    // Same size and mtime, so the size+timestamp mode takes them as duplicates
+    create_file("reflink_diff_dir/a.txt", "REFLINK-A");
+    create_file("reflink_diff_dir/b.txt", "REFLINK-B");
+    struct utimbuf times = {1000000000, 1000000000};
+    utime("reflink_diff_dir/a.txt", &times);
+    utime("reflink_diff_dir/b.txt", &times);
+
+    // The kernel compares the bytes and refuses; that is reported, never shared
+    int result = -1;
+    char* out = capture_dedupe("reflink_diff_dir", false, true, false, "json", "reflink_diff.json", &result);
+    ASSUME_ITS_EQUAL_I32(1, result);
+    ASSUME_ITS_TRUE(all_json_records(out));
+    ASSUME_ITS_TRUE(strstr(out, "\"status\":\"differ\",\"shared\":0,\"size\":9}") != cnull ||
+                    strstr(out, "\"status\":\"failed\",\"shared\":0,\"size\":9,\"error\":") != cnull);
+    ASSUME_NOT_CNULL(strstr(out, "{\"reclaimed\":0}"));
+
+    remove("reflink_diff_dir/a.txt");
+    remove("reflink_diff_dir/b.txt");
+    rmdir("reflink_diff_dir");
+}
+
+FOSSIL_TEST(c_test_dedupe_chunk_report)
+{
+    mkdir("chunk_dupe_dir", 0700);
+
+    // 256 KiB each, tens of chunks per file: b repeats a, c shares nothing
+    create_random_file("chunk_dupe_dir/a.bin", 12345, 256 * 1024);
+    create_random_file("chunk_dupe_dir/b.bin", 12345, 256 * 1024);
+    create_random_file("chunk_dupe_dir/c.bin", 67890, 256 * 1024);
+
+    char* report = capture_chunk_report("chunk_dupe_dir", "chunk_dupe_report.json");
+    char* total = strstr(report, "{\"total_chunks\":");
+    ASSUME_NOT_CNULL(total);
+
+    unsigned long long chunks = 0, bytes = 0, shared = 0;
+    double ratio = 0.0;
+    int fields = sscanf(total, "{\"total_chunks\":%llu,\"bytes\":%llu,\"shared\":%llu,\"ratio\":%lf",
+                        &chunks, &bytes, &shared, &ratio);
+    ASSUME_ITS_EQUAL_I32(4, fields);
+    ASSUME_ITS_TRUE(chunks > 3 * 8);
+    ASSUME_ITS_EQUAL_I32(3 * 256 * 1024, (int32_t)bytes);
+    ASSUME_ITS_EQUAL_I32(256 * 1024, (int32_t)shared);
+    ASSUME_ITS_TRUE(ratio > 1.499 && ratio < 1.501);
+
+    // Analysis only, nothing is removed
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("chunk_dupe_dir/a.bin"));
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("chunk_dupe_dir/b.bin"));
+
+    remove("chunk_dupe_dir/a.bin");
+    remove("chunk_dupe_dir/b.bin");
+    remove("chunk_dupe_dir/c.bin");
+    rmdir("chunk_dupe_dir");
+}
+
+FOSSIL_TEST(c_test_dedupe_json_escapes_paths)
+{
+#ifndef _WIN32 // quotes cannot appear in Windows file names
+    mkdir("json_esc_dir", 0700);
+    mkdir("json_esc_dir/say \"{red}\"", 0700);
+
+    create_random_file("json_esc_dir/say \"{red}\"/a.bin", 4242, 16 * 1024);
+
+    // Quotes are escaped and the markup-like braces come through untouched
+    char* report = capture_chunk_report("json_esc_dir", "json_esc_report.json");
+    ASSUME_NOT_CNULL(strstr(report, "{\"dir\":\"json_esc_dir/say \\\"{red}\\\"\",\"files\":1,"));
+
+    remove("json_esc_dir/say \"{red}\"/a.bin");
+    rmdir("json_esc_dir/say \"{red}\"");
+    rmdir("json_esc_dir");
+#endif
+}
+
+FOSSIL_TEST(c_test_dedupe_fson_keeps_markup_in_paths)
+{
+#ifndef _WIN32
+    mkdir("fson_raw_dir", 0700);
+    mkdir("fson_raw_dir/{red}x", 0700);
+
+    create_random_file("fson_raw_dir/{red}x/a.bin", 4243, 16 * 1024);
+
+    // Paths are data, not markup: the braces must reach the output unchanged
+    int result = -1;
+    char* report = capture_dedupe("fson_raw_dir", true, false, true, "fson", "fson_raw_report.txt", &result);
+    ASSUME_ITS_EQUAL_I32(0, result);
+    ASSUME_NOT_CNULL(strstr(report, "dir:cstr=fson_raw_dir/{red}x files:u64=1 "));
+    ASSUME_NOT_CNULL(strstr(report, " failed:u64=0\n"));
+
+    remove("fson_raw_dir/{red}x/a.bin");
+    rmdir("fson_raw_dir/{red}x");
+    rmdir("fson_raw_dir");
+#endif
+}
+
+FOSSIL_TEST(c_test_dedupe_chunk_report_unreadable_file)
+{
+#ifndef _WIN32
+    if (geteuid() == 0)
+        return; // root reads the file regardless of its mode
+
+    mkdir("chunk_fail_dir", 0700);
+    create_random_file("chunk_fail_dir/a.bin", 111, 16 * 1024);
+    create_random_file("chunk_fail_dir/b.bin", 222, 16 * 1024);
+    chmod("chunk_fail_dir/b.bin", 0);
+
+    // The readable file is still reported; the failure is counted, not hidden
+    int result = -1;
+    char* report = capture_dedupe("chunk_fail_dir", true, false, true, "json", "chunk_fail_report.json", &result);
+    ASSUME_ITS_EQUAL_I32(1, result);
+    ASSUME_NOT_CNULL(strstr(report, "{\"dir\":\"chunk_fail_dir\",\"files\":1,"));
+    ASSUME_NOT_CNULL(strstr(report, ",\"failed\":1}"));
+
+    chmod("chunk_fail_dir/b.bin", 0600);
+    remove("chunk_fail_dir/a.bin");
+    remove("chunk_fail_dir/b.bin");
+    rmdir("chunk_fail_dir");
+#endif
+}
+
 FOSSIL_TEST(c_test_dedupe_json_output)
 {
     mkdir("json_dupe_dir", 0700);
@@ -167,7 +378,7 @@ FOSSIL_TEST(c_test_dedupe_json_output)
     create_file("json_dupe_dir/a.txt", "JSONDATA");
     create_file("json_dupe_dir/b.txt", "JSONDATA");
 
-    int result = fossil_shark_dedupe("json_dupe_dir", true, false, false, false, "json");
+    int result = fossil_shark_dedupe("json_dupe_dir", true, false, false, false, false, false, "json");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     remove("json_dupe_dir/a.txt");
@@ -182,7 +393,7 @@ FOSSIL_TEST(c_test_dedupe_fson_output)
     create_file("fson_dupe_dir/a.txt", "FSONDATA");
     create_file("fson_dupe_dir/b.txt", "FSONDATA");
 
-    int result = fossil_shark_dedupe("fson_dupe_dir", true, false, false, false, "fson");
+    int result = fossil_shark_dedupe("fson_dupe_dir", true, false, false, false, false, false, "fson");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     remove("fson_dupe_dir/a.txt");
@@ -192,7 +403,7 @@ FOSSIL_TEST(c_test_dedupe_fson_output)
 
 FOSSIL_TEST(c_test_dedupe_invalid_directory)
 {
-    int result = fossil_shark_dedupe("nonexistent_dir", true, false, false, false, "text");
+    int result = fossil_shark_dedupe("nonexistent_dir", true, false, false, false, false, false, "text");
     ASSUME_NOT_EQUAL_I32(0, result);
 }
 
@@ -204,7 +415,7 @@ FOSSIL_TEST(c_test_dedupe_mixed_files_and_duplicates)
     create_file("mixed_dupe_dir/b.txt", "DUP");
     create_file("mixed_dupe_dir/c.txt", "UNIQUE");
 
-    int result = fossil_shark_dedupe("mixed_dupe_dir", true, false, true, false, "text");
+    int result = fossil_shark_dedupe("mixed_dupe_dir", true, false, true, false, false, false, "text");
     ASSUME_ITS_EQUAL_I32(0, result);
 
     rmdir("mixed_dupe_dir");
@@ -223,6 +434,12 @@ FOSSIL_TEST_GROUP(c_dedupe_command_tests)
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_detect_duplicates_by_size);
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_delete_duplicates);
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_link_duplicates);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_reflink_duplicates);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_reflink_contents_differ);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_chunk_report);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_json_escapes_paths);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_fson_keeps_markup_in_paths);
+    FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_chunk_report_unreadable_file);
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_json_output);
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_fson_output);
     FOSSIL_ADD_TEST(c_dedupe_command_suite, c_test_dedupe_invalid_directory);
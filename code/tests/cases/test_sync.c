@@ -48,6 +48,33 @@ FOSSIL_TEARDOWN(c_sync_command_suite)
     // Teardown code here
 }
 
+// Helper: monotonic seconds, so a wall-clock step cannot skew an elapsed check
+static double sync_test_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+#ifndef _WIN32
+// Helper: write size bytes of a repeating pattern, with one region flipped when mark is set
+static void sync_test_pattern(const char *path, size_t size, bool mark)
+{
+    FILE *file = fopen(path, "wb");
+    ASSUME_NOT_CNULL(file);
+    for (size_t i = 0; i < size; i++)
+        fputc((mark && i >= 40000 && i < 40016) ? 0xAA : (int)(i % 251), file);
+    fclose(file);
+}
+#endif
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Test Cases
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -58,28 +85,28 @@ FOSSIL_TEARDOWN(c_sync_command_suite)
 
 FOSSIL_TEST(c_test_sync_null_source)
 {
-    int result = fossil_shark_sync(cnull, "dest", false, false, false);
+    int result = fossil_shark_sync(cnull, "dest", cnull);
     ASSUME_NOT_EQUAL_I32(result, 0);
 }
 
 FOSSIL_TEST(c_test_sync_null_destination)
 {
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_src.txt");
-    int result = fossil_shark_sync("test_sync_src.txt", cnull, false, false, false);
+    int result = fossil_shark_sync("test_sync_src.txt", cnull, cnull);
     ASSUME_NOT_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_src.txt");
 }
 
 FOSSIL_TEST(c_test_sync_nonexistent_source)
 {
-    int result = fossil_shark_sync("nonexistent_sync_src.txt", "sync_dest.txt", false, false, false);
+    int result = fossil_shark_sync("nonexistent_sync_src.txt", "sync_dest.txt", cnull);
     ASSUME_NOT_EQUAL_I32(result, 0);
 }
 
 FOSSIL_TEST(c_test_sync_single_file)
 {
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_file_src.txt");
-    int result = fossil_shark_sync("test_sync_file_src.txt", "test_sync_file_dest.txt", false, false, false);
+    int result = fossil_shark_sync("test_sync_file_src.txt", "test_sync_file_dest.txt", cnull);
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_file_src.txt");
     if (FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_file_dest.txt"))
@@ -92,7 +119,7 @@ FOSSIL_TEST(c_test_sync_directory_non_recursive)
 {
     FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_src_dir");
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_src_dir/file1.txt");
-    int result = fossil_shark_sync("test_sync_src_dir", "test_sync_dest_dir", false, false, false);
+    int result = fossil_shark_sync("test_sync_src_dir", "test_sync_dest_dir", cnull);
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_src_dir/file1.txt");
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_src_dir");
@@ -106,7 +133,7 @@ FOSSIL_TEST(c_test_sync_directory_recursive)
 {
     FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_rec_src");
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_rec_src/file1.txt");
-    int result = fossil_shark_sync("test_sync_rec_src", "test_sync_rec_dest", true, false, false);
+    int result = fossil_shark_sync("test_sync_rec_src", "test_sync_rec_dest", &(fossil_shark_sync_options_t){ .recursive = true });
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_rec_src/file1.txt");
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_rec_src");
@@ -119,7 +146,7 @@ FOSSIL_TEST(c_test_sync_directory_recursive)
 FOSSIL_TEST(c_test_sync_update_flag)
 {
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_update_src.txt");
-    int result = fossil_shark_sync("test_sync_update_src.txt", "test_sync_update_dest.txt", false, true, false);
+    int result = fossil_shark_sync("test_sync_update_src.txt", "test_sync_update_dest.txt", &(fossil_shark_sync_options_t){ .update = true });
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_update_src.txt");
     if (FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_update_dest.txt"))
@@ -132,7 +159,7 @@ FOSSIL_TEST(c_test_sync_delete_flag)
 {
     FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_del_src");
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_del_src/file1.txt");
-    int result = fossil_shark_sync("test_sync_del_src", "test_sync_del_dest", true, false, true);
+    int result = fossil_shark_sync("test_sync_del_src", "test_sync_del_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true });
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_del_src/file1.txt");
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_del_src");
@@ -146,12 +173,440 @@ FOSSIL_TEST(c_test_sync_identical_files)
 {
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_identical_src.txt");
     FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_identical_dest.txt");
-    int result = fossil_shark_sync("test_sync_identical_src.txt", "test_sync_identical_dest.txt", false, false, false);
+    int result = fossil_shark_sync("test_sync_identical_src.txt", "test_sync_identical_dest.txt", cnull);
     ASSUME_ITS_EQUAL_I32(result, 0);
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_identical_src.txt");
     FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_identical_dest.txt");
 }
 
+FOSSIL_TEST(c_test_sync_delta_patch)
+{
+    // Destination holds an older copy with one region changed
+    FILE *src = fopen("test_sync_delta_src.bin", "wb");
+    FILE *dest = fopen("test_sync_delta_dest.bin", "wb");
+    ASSUME_NOT_CNULL(src);
+    ASSUME_NOT_CNULL(dest);
+    for (int i = 0; i < 64 * 1024; i++)
+    {
+        fputc(i % 251, src);
+        fputc((i >= 20000 && i < 20010) ? 0 : i % 251, dest);
+    }
+    fclose(src);
+    fclose(dest);
+
+    // Both files can land on the same timestamp tick; age the destination so
+    // the size and mtime quick check does not take them as equal
+    struct utimbuf old_times = {1000000000, 1000000000};
+    utime("test_sync_delta_dest.bin", &old_times);
+
+    int result = fossil_shark_sync("test_sync_delta_src.bin", "test_sync_delta_dest.bin", &(fossil_shark_sync_options_t){ .delta = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_delta_src.bin", "test_sync_delta_dest.bin", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_delta_src.bin");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_delta_dest.bin");
+}
+
+#ifndef _WIN32
+FOSSIL_TEST(c_test_sync_delta_keeps_mode)
+{
+    // One pair is patched in place, the other shifted so it is rebuilt
+    sync_test_pattern("test_sync_dmode_src.bin", 64 * 1024, true);
+    sync_test_pattern("test_sync_dmode_dest.bin", 64 * 1024, false);
+
+    FILE *shifted = fopen("test_sync_dmode_shift_src.bin", "wb");
+    ASSUME_NOT_CNULL(shifted);
+    for (int i = 0; i < 100; i++)
+        fputc('X', shifted);
+    for (int i = 0; i < 64 * 1024; i++)
+        fputc(i % 251, shifted);
+    fclose(shifted);
+    sync_test_pattern("test_sync_dmode_shift_dest.bin", 64 * 1024, false);
+
+    chmod("test_sync_dmode_src.bin", 0750);
+    chmod("test_sync_dmode_shift_src.bin", 0750);
+    chmod("test_sync_dmode_dest.bin", 0600);
+    chmod("test_sync_dmode_shift_dest.bin", 0600);
+    struct utimbuf old_times = {1000000000, 1000000000};
+    utime("test_sync_dmode_dest.bin", &old_times);
+    utime("test_sync_dmode_shift_dest.bin", &old_times);
+
+    int result = fossil_shark_sync("test_sync_dmode_src.bin", "test_sync_dmode_dest.bin", &(fossil_shark_sync_options_t){ .delta = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_sync("test_sync_dmode_shift_src.bin", "test_sync_dmode_shift_dest.bin", &(fossil_shark_sync_options_t){ .delta = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    struct stat st;
+    ASSUME_ITS_EQUAL_I32(stat("test_sync_dmode_dest.bin", &st), 0);
+    ASSUME_ITS_EQUAL_I32((int)(st.st_mode & 07777), 0750);
+    ASSUME_ITS_EQUAL_I32(stat("test_sync_dmode_shift_dest.bin", &st), 0);
+    ASSUME_ITS_EQUAL_I32((int)(st.st_mode & 07777), 0750);
+    result = fossil_shark_compare("test_sync_dmode_shift_src.bin", "test_sync_dmode_shift_dest.bin", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_dmode_src.bin");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_dmode_dest.bin");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_dmode_shift_src.bin");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_dmode_shift_dest.bin");
+}
+#endif
+
+FOSSIL_TEST(c_test_sync_checksum_detects_same_size_change)
+{
+    // Same size and same mtime: the quick check keeps it, --checksum does not
+    FILE *src = fopen("test_sync_sum_src.txt", "w");
+    FILE *dest = fopen("test_sync_sum_dest.txt", "w");
+    ASSUME_NOT_CNULL(src);
+    ASSUME_NOT_CNULL(dest);
+    fprintf(src, "abcdef\n");
+    fprintf(dest, "abcxyz\n");
+    fclose(src);
+    fclose(dest);
+
+    struct utimbuf times = {1000000000, 1000000000};
+    utime("test_sync_sum_src.txt", &times);
+    utime("test_sync_sum_dest.txt", &times);
+
+    int result = fossil_shark_sync("test_sync_sum_src.txt", "test_sync_sum_dest.txt", cnull);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_sum_src.txt", "test_sync_sum_dest.txt", false, true, 0, false, false, false);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+
+    result = fossil_shark_sync("test_sync_sum_src.txt", "test_sync_sum_dest.txt", &(fossil_shark_sync_options_t){ .checksum = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_sum_src.txt", "test_sync_sum_dest.txt", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_sum_src.txt");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_sum_dest.txt");
+}
+
+FOSSIL_TEST(c_test_sync_manifest_incremental)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_man_src");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_man_src/keep.txt");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_man_src/drop.txt");
+
+    // First run writes the manifest, second run deletes from it
+    int result = fossil_shark_sync("test_sync_man_src", "test_sync_man_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_man_dest/.shark-manifest"));
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_man_src/drop.txt");
+    result = fossil_shark_sync("test_sync_man_src", "test_sync_man_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_man_dest/keep.txt"));
+    ASSUME_ITS_FALSE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_man_dest/drop.txt"));
+
+    fossil_io_filesys_remove("test_sync_man_src", true);
+    fossil_io_filesys_remove("test_sync_man_dest", true);
+}
+
+FOSSIL_TEST(c_test_sync_manifest_delete_unrecorded)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_mdel_src");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_mdel_src/keep.txt");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_mdel_src/.shark-manifest.bak");
+
+    int result = fossil_shark_sync("test_sync_mdel_src", "test_sync_mdel_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    // Only the manifest itself is skipped, not names that merely start like it
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_mdel_dest/.shark-manifest.bak"));
+
+    // Never recorded in the manifest, yet --delete still removes it
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_mdel_dest/stray.txt");
+    result = fossil_shark_sync("test_sync_mdel_src", "test_sync_mdel_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_mdel_dest/stray.txt"));
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_mdel_dest/keep.txt"));
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_mdel_dest/.shark-manifest"));
+
+    fossil_io_filesys_remove("test_sync_mdel_src", true);
+    fossil_io_filesys_remove("test_sync_mdel_dest", true);
+}
+
+FOSSIL_TEST(c_test_sync_detects_rename)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_mv_src");
+    FILE *file = fopen("test_sync_mv_src/old_name.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "content that moves\n");
+    fclose(file);
+
+    int result = fossil_shark_sync("test_sync_mv_src", "test_sync_mv_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // Renamed in the source: the destination copy is moved, not re-copied
+    fossil_io_filesys_move("test_sync_mv_src/old_name.txt", "test_sync_mv_src/new_name.txt", false);
+    result = fossil_shark_sync("test_sync_mv_src", "test_sync_mv_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_mv_dest/new_name.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_sync_mv_dest/old_name.txt") == 1);
+
+    fossil_io_filesys_remove("test_sync_mv_src", true);
+    fossil_io_filesys_remove("test_sync_mv_dest", true);
+}
+
+FOSSIL_TEST(c_test_sync_plan_round_trip)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_plan_src");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_plan_src/file.txt");
+
+    // Dry run and plan-out only describe the work
+    int result = fossil_shark_sync("test_sync_plan_src", "test_sync_plan_dest", &(fossil_shark_sync_options_t){ .recursive = true, .dry_run = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_sync("test_sync_plan_src", "test_sync_plan_dest", &(fossil_shark_sync_options_t){ .recursive = true, .plan_out = "test_sync.plan" });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_sync_plan_dest") == 1);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync.plan") == 1);
+
+    result = fossil_shark_sync(cnull, "test_sync_plan_dest", &(fossil_shark_sync_options_t){ .plan_in = "test_sync.plan" });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_plan_dest/file.txt") == 1);
+
+    fossil_io_filesys_remove("test_sync.plan", false);
+    fossil_io_filesys_remove("test_sync_plan_src", true);
+    fossil_io_filesys_remove("test_sync_plan_dest", true);
+}
+
+#ifndef _WIN32
+FOSSIL_TEST(c_test_sync_dry_run_keeps_links)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_link_src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_link_src/sub");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_link_src/sub/a.txt", "alpha\n");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_link_dest");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_link_dest/sub");
+    ASSUME_ITS_EQUAL_I32(symlink("missing-target", "test_sync_link_dest/dangling"), 0);
+    ASSUME_ITS_EQUAL_I32(symlink("missing-target", "test_sync_link_dest/sub/dangling"), 0);
+
+    // Extraneous links are only planned for deletion on a dry run
+    struct stat st;
+    int result = fossil_shark_sync("test_sync_link_src", "test_sync_link_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .dry_run = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_EQUAL_I32(lstat("test_sync_link_dest/dangling", &st), 0);
+    ASSUME_ITS_EQUAL_I32(lstat("test_sync_link_dest/sub/dangling", &st), 0);
+
+    // The real run removes them
+    result = fossil_shark_sync("test_sync_link_src", "test_sync_link_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_NOT_EQUAL_I32(lstat("test_sync_link_dest/dangling", &st), 0);
+    ASSUME_NOT_EQUAL_I32(lstat("test_sync_link_dest/sub/dangling", &st), 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_link_dest/sub/a.txt") == 1);
+
+    fossil_io_filesys_remove("test_sync_link_src", true);
+    fossil_io_filesys_remove("test_sync_link_dest", true);
+}
+#endif
+
+FOSSIL_TEST(c_test_sync_parallel_subtrees)
+{
+    // Several top-level directories, so each subtree is planned on its own worker
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_par_src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_par_src/a");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_par_src/a/deep");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_par_src/b");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_par_src/c");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_par_src/top.txt", "top\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_par_src/a/deep/one.txt", "one\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_par_src/b/two.txt", "two\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_par_src/c/three.txt", "three\n");
+
+    int result = fossil_shark_sync("test_sync_par_src", "test_sync_par_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/top.txt"));
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/a/deep/one.txt"));
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/b/two.txt"));
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/c/three.txt"));
+
+    // The merged manifest still finds each subtree's records on the next run
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_par_src/b/two.txt", "two, changed\n");
+    FOSSIL_SANITY_SYS_CREATE_FILE("test_sync_par_dest/c/stray.txt");
+    result = fossil_shark_sync("test_sync_par_src", "test_sync_par_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .manifest = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/c/stray.txt"));
+    result = fossil_shark_compare("test_sync_par_src/b/two.txt", "test_sync_par_dest/b/two.txt", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(FOSSIL_SANITY_SYS_FILE_EXISTS("test_sync_par_dest/a/deep/one.txt"));
+
+    fossil_io_filesys_remove("test_sync_par_src", true);
+    fossil_io_filesys_remove("test_sync_par_dest", true);
+}
+
+FOSSIL_TEST(c_test_sync_bandwidth_limit)
+{
+    FILE *src = fopen("test_sync_bw_src.bin", "wb");
+    ASSUME_NOT_CNULL(src);
+    for (int i = 0; i < 256 * 1024; i++)
+        fputc(i % 253, src);
+    fclose(src);
+
+    // 256 KiB read plus 256 KiB written at 1 MiB/s: about 0.4s after the burst credit
+    fossil_shark_throttle_set(1024 * 1024, 0, false);
+    double start = sync_test_now();
+    int result = fossil_shark_sync("test_sync_bw_src.bin", "test_sync_bw_dest.bin", cnull);
+    double elapsed = sync_test_now() - start;
+    fossil_shark_throttle_set(0, 0, false);
+
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(elapsed >= 0.3);
+    ASSUME_ITS_TRUE(elapsed < 5.0);
+    result = fossil_shark_compare("test_sync_bw_src.bin", "test_sync_bw_dest.bin", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_EQUAL_U64(fossil_shark_throttle_parse_rate("20M"), 20ULL * 1024 * 1024);
+    ASSUME_ITS_EQUAL_U64(fossil_shark_throttle_parse_rate("fast"), 0);
+
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_bw_src.bin");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_bw_dest.bin");
+}
+
+FOSSIL_TEST(c_test_sync_two_way)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_tw_a");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_tw_b");
+    FILE *file = fopen("test_sync_tw_a/shared.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "first\n");
+    fclose(file);
+
+    int result = fossil_shark_sync("test_sync_tw_a", "test_sync_tw_b", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_tw_b/shared.txt") == 1);
+
+    // A change made on the destination side flows back
+    file = fopen("test_sync_tw_b/back.txt", "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "from b\n");
+    fclose(file);
+    result = fossil_shark_sync("test_sync_tw_a", "test_sync_tw_b", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_tw_a/back.txt") == 1);
+
+    // Edited differently on both sides: reported, neither copy overwritten
+    file = fopen("test_sync_tw_a/shared.txt", "w");
+    fprintf(file, "edited on a\n");
+    fclose(file);
+    file = fopen("test_sync_tw_b/shared.txt", "w");
+    fprintf(file, "edited on b, longer\n");
+    fclose(file);
+    result = fossil_shark_sync("test_sync_tw_a", "test_sync_tw_b", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_tw_a/shared.txt", "test_sync_tw_b/shared.txt", false, true, 0, false, false, false);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+
+    fossil_io_filesys_remove("test_sync_tw_a", true);
+    fossil_io_filesys_remove("test_sync_tw_b", true);
+}
+
+FOSSIL_TEST(c_test_sync_two_way_deep_delete_conflict)
+{
+    // Deeper than any fixed stack of enclosing deleted directories
+    char dir[FOSSIL_FILESYS_MAX_PATH], leaf_a[FOSSIL_FILESYS_MAX_PATH], leaf_b[FOSSIL_FILESYS_MAX_PATH];
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_twd_a");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_twd_b");
+    size_t len = (size_t)snprintf(dir, sizeof(dir), "test_sync_twd_a");
+    for (int depth = 0; depth < 80; depth++)
+    {
+        len += (size_t)snprintf(dir + len, sizeof(dir) - len, "/d");
+        FOSSIL_SANITY_SYS_CREATE_DIR(dir);
+    }
+    snprintf(leaf_a, sizeof(leaf_a), "%s/leaf.txt", dir);
+    snprintf(leaf_b, sizeof(leaf_b), "test_sync_twd_b%s/leaf.txt", dir + strlen("test_sync_twd_a"));
+    FILE *file = fopen(leaf_a, "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "first\n");
+    fclose(file);
+
+    int result = fossil_shark_sync("test_sync_twd_a", "test_sync_twd_b", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists(leaf_b) == 1);
+
+    // Deleted on a, edited on b: the edit survives and a gets its directories back
+    fossil_io_filesys_remove("test_sync_twd_a/d", true);
+    file = fopen(leaf_b, "w");
+    ASSUME_NOT_CNULL(file);
+    fprintf(file, "edited on b, longer\n");
+    fclose(file);
+    result = fossil_shark_sync("test_sync_twd_a", "test_sync_twd_b", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists(leaf_b) == 1);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists(dir) == 1);
+
+    fossil_io_filesys_remove("test_sync_twd_a", true);
+    fossil_io_filesys_remove("test_sync_twd_b", true);
+}
+
+FOSSIL_TEST(c_test_sync_remote_cmd_failure)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_rm_src");
+
+    // A transport that never starts a server fails cleanly instead of hanging
+    int result = fossil_shark_sync("test_sync_rm_src", "test_sync_rm_dest", &(fossil_shark_sync_options_t){ .recursive = true, .remote_cmd = "nonexistent-shark-remote" });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+    result = fossil_shark_sync("test_sync_rm_src", "test_sync_rm_dest", &(fossil_shark_sync_options_t){ .recursive = true, .two_way = true, .remote_cmd = "nonexistent-shark-remote" });
+    ASSUME_NOT_EQUAL_I32(result, 0);
+
+    fossil_io_filesys_remove("test_sync_rm_src", true);
+}
+
+#ifndef _WIN32
+FOSSIL_TEST(c_test_sync_remote_round_trip)
+{
+    // The far side is the built shark binary, served over a pipe as ssh would
+    ccstring shark = getenv("SHARK_BIN");
+    if (!cnotnull(shark) || fossil_io_filesys_exists(shark) != 1)
+        return;
+    char remote_cmd[FOSSIL_FILESYS_MAX_PATH + 2];
+    snprintf(remote_cmd, sizeof(remote_cmd), "'%s'", shark);
+
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_rt_src");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_sync_rt_src/sub");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_rt_src/a.txt", "alpha\n");
+    sync_test_pattern("test_sync_rt_src/sub/big.bin", 128 * 1024, false);
+
+    // A dry run leaves a missing destination missing
+    int result = fossil_shark_sync("test_sync_rt_src", "test_sync_rt_dest", &(fossil_shark_sync_options_t){ .recursive = true, .dry_run = true, .remote_cmd = remote_cmd });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_sync_rt_dest") == 1);
+
+    // Plain copy into a destination that does not exist yet
+    result = fossil_shark_sync("test_sync_rt_src", "test_sync_rt_dest", &(fossil_shark_sync_options_t){ .recursive = true, .remote_cmd = remote_cmd });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_rt_src", "test_sync_rt_dest", false, false, 0, false, false, true);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // Same-size edit in the middle goes over as a delta; a future mtime keeps
+    // the quick check from calling it unchanged
+    sync_test_pattern("test_sync_rt_src/sub/big.bin", 128 * 1024, true);
+    struct utimbuf later = {time(cnull) + 60, time(cnull) + 60};
+    utime("test_sync_rt_src/sub/big.bin", &later);
+    result = fossil_shark_sync("test_sync_rt_src", "test_sync_rt_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delta = true, .remote_cmd = remote_cmd });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    result = fossil_shark_compare("test_sync_rt_src/sub/big.bin", "test_sync_rt_dest/sub/big.bin", false, true, 0, false, false, false);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    // A dry run with --delete leaves the far side alone
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_sync_rt_dest/extra.txt", "stale\n");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_sync_rt_src/a.txt");
+    result = fossil_shark_sync("test_sync_rt_src", "test_sync_rt_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .dry_run = true, .remote_cmd = remote_cmd });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_rt_dest/extra.txt") == 1);
+    ASSUME_ITS_TRUE(fossil_io_filesys_exists("test_sync_rt_dest/a.txt") == 1);
+
+    // The real run removes both, and the trees match again
+    result = fossil_shark_sync("test_sync_rt_src", "test_sync_rt_dest", &(fossil_shark_sync_options_t){ .recursive = true, .delete_flag = true, .remote_cmd = remote_cmd });
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_sync_rt_dest/extra.txt") == 1);
+    ASSUME_ITS_FALSE(fossil_io_filesys_exists("test_sync_rt_dest/a.txt") == 1);
+    result = fossil_shark_compare("test_sync_rt_src", "test_sync_rt_dest", false, false, 0, false, false, true);
+    ASSUME_ITS_EQUAL_I32(result, 0);
+
+    fossil_io_filesys_remove("test_sync_rt_src", true);
+    fossil_io_filesys_remove("test_sync_rt_dest", true);
+}
+#endif
+
 // * * * * * * * * * * * * * * * * * * * * * * * *
 // * Fossil Logic Test Pool
 // * * * * * * * * * * * * * * * * * * * * * * * *
@@ -167,6 +622,26 @@ FOSSIL_TEST_GROUP(c_sync_command_tests)
     FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_update_flag);
     FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_delete_flag);
     FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_identical_files);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_delta_patch);
+#ifndef _WIN32
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_delta_keeps_mode);
+#endif
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_checksum_detects_same_size_change);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_manifest_incremental);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_manifest_delete_unrecorded);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_detects_rename);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_plan_round_trip);
+#ifndef _WIN32
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_dry_run_keeps_links);
+#endif
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_parallel_subtrees);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_bandwidth_limit);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_two_way);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_two_way_deep_delete_conflict);
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_remote_cmd_failure);
+#ifndef _WIN32
+    FOSSIL_ADD_TEST(c_sync_command_suite, c_test_sync_remote_round_trip);
+#endif
 
     FOSSIL_ADD_SUITE(c_sync_command_suite);
 }
@@ -0,0 +1,370 @@
+/**
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop
+ * high-performance, cross-platform applications and libraries. The code
+ * contained herein is licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain
+ * a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 04/05/2013
+ *
+ * Copyright (C) 2013-Current Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include <fossil/maip/framework.h>
+
+#include "fossil/code/app.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <pthread.h>
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Utilites
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// Setup steps for things like test fixtures and
+// mock objects are set here.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+// Define the test suite and add test cases
+FOSSIL_SUITE(c_watch_command_suite);
+
+// Setup function for the test suite
+FOSSIL_SETUP(c_watch_command_suite)
+{
+    // Setup code here
+}
+
+// Teardown function for the test suite
+FOSSIL_TEARDOWN(c_watch_command_suite)
+{
+    // Teardown code here
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+typedef struct
+{
+    ccstring root;
+    size_t queue_max;
+    bool poll;
+    int result;
+} watch_test_run_t;
+
+static void *watch_test_thread(void *arg)
+{
+    watch_test_run_t *run = arg;
+    ccstring paths[1] = {run->root};
+    fossil_shark_watch_options_t opts = {0};
+    opts.recursive = true;
+    opts.poll = run->poll;
+    opts.json = true;
+    opts.interval = 1;
+    opts.passes = 1;
+    opts.queue_max = run->queue_max;
+    run->result = fossil_shark_watch(paths, 1, &opts);
+    return cnull;
+}
+
+static void watch_pause_ms(long ms)
+{
+    struct timespec pause = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&pause, cnull);
+}
+
+// Helper: baseline root, apply change while the watch sleeps, capture the JSON of its one pass
+static int watch_captured(ccstring root, size_t queue_max, void (*change)(void), char *out, size_t size)
+{
+    fflush(stdout);
+    int saved = dup(fileno(stdout));
+    int fd = open("watch_captured.out", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, fileno(stdout));
+    close(fd);
+
+    // The baseline is taken as soon as the watch starts; its pass comes a second later
+    watch_test_run_t run = {root, queue_max, true, -1};
+    pthread_t thread;
+    if (pthread_create(&thread, cnull, watch_test_thread, &run) == 0)
+    {
+        watch_pause_ms(300);
+        change();
+        pthread_join(thread, cnull);
+    }
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+
+    FILE *file = fopen("watch_captured.out", "r");
+    size_t n = file ? fread(out, 1, size - 1, file) : 0;
+    out[n] = '\0';
+    if (file)
+        fclose(file);
+    remove("watch_captured.out");
+    return run.result;
+}
+
+#if defined(__linux__)
+/*
+ * Helper: watch root through inotify, apply change, then remove root so the
+ * watch runs out of directories and returns; capture the JSON it printed.
+ * The removal shows up as trailing deletes.
+ */
+static int watch_notified(ccstring root, void (*change)(void), char *out, size_t size)
+{
+    fflush(stdout);
+    int saved = dup(fileno(stdout));
+    int fd = open("watch_notified.out", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, fileno(stdout));
+    close(fd);
+
+    watch_test_run_t run = {root, 0, false, -1};
+    pthread_t thread;
+    if (pthread_create(&thread, cnull, watch_test_thread, &run) == 0)
+    {
+        watch_pause_ms(300);
+        change();
+        watch_pause_ms(300);
+        fossil_io_filesys_remove(root, true);
+        pthread_join(thread, cnull);
+    }
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+
+    FILE *file = fopen("watch_notified.out", "r");
+    size_t n = file ? fread(out, 1, size - 1, file) : 0;
+    out[n] = '\0';
+    if (file)
+        fclose(file);
+    remove("watch_notified.out");
+    return run.result;
+}
+
+static void watch_change_rename(void)
+{
+    rename("test_watch_in_mv/old.txt", "test_watch_in_mv/moved.txt");
+}
+
+static void watch_change_subdir(void)
+{
+    // Filled faster than its watch can be added: the gap is back-filled
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_sub/sub");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_sub/sub/a.txt", "a\n");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_sub/sub/deeper");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_sub/sub/deeper/b.txt", "b\n");
+    // Once watched, later changes arrive through the new watch
+    watch_pause_ms(200);
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_sub/sub/deeper/later.txt", "later\n");
+}
+
+static void watch_change_move_out(void)
+{
+    rename("test_watch_in_out/gone.txt", "test_watch_outside/gone.txt");
+    rename("test_watch_in_out/dir", "test_watch_outside/dir");
+    // No longer in the tree, so not reported
+    watch_pause_ms(200);
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_outside/dir/after.txt", "after\n");
+}
+#endif
+
+static size_t watch_count(const char *text, const char *needle)
+{
+    size_t count = 0;
+    for (const char *at = strstr(text, needle); at; at = strstr(at + 1, needle))
+        count++;
+    return count;
+}
+
+static void watch_change_events(void)
+{
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ev/new.txt", "new\n");
+    FILE *file = fopen("test_watch_ev/mod.txt", "a");
+    if (file)
+    {
+        fputs("more\n", file);
+        fclose(file);
+    }
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_watch_ev/del.txt");
+    rename("test_watch_ev/old.txt", "test_watch_ev/moved.txt");
+}
+
+static void watch_change_coalesce(void)
+{
+    // Created and deleted between passes: never there as far as the watch knows
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_co/temp.txt", "temp\n");
+    FOSSIL_SANITY_SYS_DELETE_FILE("test_watch_co/temp.txt");
+    // Created and then written: one create
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_co/grown.txt", "one\n");
+    FILE *file = fopen("test_watch_co/grown.txt", "a");
+    if (file)
+    {
+        fputs("two\n", file);
+        fclose(file);
+    }
+}
+
+static void watch_change_overflow(void)
+{
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ov/a.txt", "a\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ov/b.txt", "b\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ov/c.txt", "c\n");
+}
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Cases
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// The test cases below are provided as samples, inspired
+// by the Meson build system's approach of using test cases
+// as samples for library usage.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST(c_test_watch_no_paths)
+{
+    int result = fossil_shark_watch(cnull, 0, cnull);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+FOSSIL_TEST(c_test_watch_missing_path)
+{
+    // Fails on the initial stat instead of waiting for events
+    ccstring paths[1] = {"nonexistent_watch_path"};
+    int result = fossil_shark_watch(paths, 1, cnull);
+    ASSUME_NOT_EQUAL_I32(result, 0);
+}
+
+FOSSIL_TEST(c_test_watch_poll_events)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_ev");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ev/mod.txt", "mod\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ev/del.txt", "del\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_ev/old.txt", "old\n");
+
+    char out[8192];
+    int result = watch_captured("test_watch_ev", 0, watch_change_events, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_ev/new.txt\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"modify\",\"path\":\"test_watch_ev/mod.txt\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"delete\",\"path\":\"test_watch_ev/del.txt\""));
+    // Same inode under a new name: one rename, not a delete and a create
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"rename\",\"path\":\"test_watch_ev/moved.txt\",\"from\":\"test_watch_ev/old.txt\""));
+    ASSUME_ITS_EQUAL_I32((int)watch_count(out, "\"event\":"), 4);
+
+    fossil_io_filesys_remove("test_watch_ev", true);
+}
+
+FOSSIL_TEST(c_test_watch_poll_coalesces)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_co");
+
+    char out[8192];
+    int result = watch_captured("test_watch_co", 0, watch_change_coalesce, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_ITS_CNULL(strstr(out, "temp.txt"));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_co/grown.txt\""));
+    ASSUME_ITS_EQUAL_I32((int)watch_count(out, "\"event\":"), 1);
+
+    fossil_io_filesys_remove("test_watch_co", true);
+}
+
+FOSSIL_TEST(c_test_watch_queue_overflow)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_ov");
+
+    // Room for one path: the other two are dropped and reported ahead of the batch
+    char out[8192];
+    int result = watch_captured("test_watch_ov", 1, watch_change_overflow, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    const char *overflow = strstr(out, "\"event\":\"overflow\",\"dropped\":");
+    ASSUME_NOT_CNULL(overflow);
+    if (overflow)
+        ASSUME_ITS_TRUE(strtoul(overflow + strlen("\"event\":\"overflow\",\"dropped\":"), cnull, 10) > 0);
+    ASSUME_ITS_EQUAL_I32((int)watch_count(out, "\"event\":\"create\""), 1);
+
+    fossil_io_filesys_remove("test_watch_ov", true);
+}
+#endif
+
+#if defined(__linux__)
+FOSSIL_TEST(c_test_watch_inotify_rename)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_mv");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_mv/old.txt", "old\n");
+
+    // Both halves share a cookie: one rename, not a delete and a create
+    char out[8192];
+    int result = watch_notified("test_watch_in_mv", watch_change_rename, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"rename\",\"path\":\"test_watch_in_mv/moved.txt\",\"from\":\"test_watch_in_mv/old.txt\""));
+    ASSUME_ITS_CNULL(strstr(out, "\"event\":\"delete\",\"path\":\"test_watch_in_mv/old.txt\""));
+    ASSUME_ITS_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_mv/moved.txt\""));
+}
+
+FOSSIL_TEST(c_test_watch_inotify_new_subdir)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_sub");
+
+    char out[8192];
+    int result = watch_notified("test_watch_in_sub", watch_change_subdir, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_sub/sub\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_sub/sub/a.txt\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_sub/sub/deeper\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_sub/sub/deeper/b.txt\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"create\",\"path\":\"test_watch_in_sub/sub/deeper/later.txt\""));
+}
+
+FOSSIL_TEST(c_test_watch_inotify_move_out)
+{
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_out");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_in_out/dir");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_out/gone.txt", "gone\n");
+    FOSSIL_SANITY_SYS_WRITE_FILE("test_watch_in_out/dir/inner.txt", "inner\n");
+    FOSSIL_SANITY_SYS_CREATE_DIR("test_watch_outside");
+
+    // A first half with no second is a delete, and the moved directory is dropped
+    char out[8192];
+    int result = watch_notified("test_watch_in_out", watch_change_move_out, out, sizeof(out));
+    ASSUME_ITS_EQUAL_I32(result, 0);
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"delete\",\"path\":\"test_watch_in_out/gone.txt\""));
+    ASSUME_NOT_CNULL(strstr(out, "\"event\":\"delete\",\"path\":\"test_watch_in_out/dir\""));
+    ASSUME_ITS_CNULL(strstr(out, "after.txt"));
+    ASSUME_ITS_CNULL(strstr(out, "\"event\":\"rename\""));
+
+    fossil_io_filesys_remove("test_watch_outside", true);
+}
+#endif
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Pool
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST_GROUP(c_watch_command_tests)
+{
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_no_paths);
+#if !defined(_WIN32) && !defined(_WIN64)
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_missing_path);
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_poll_events);
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_poll_coalesces);
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_queue_overflow);
+#endif
+#if defined(__linux__)
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_inotify_rename);
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_inotify_new_subdir);
+    FOSSIL_ADD_TEST(c_watch_command_suite, c_test_watch_inotify_move_out);
+#endif
+
+    FOSSIL_ADD_SUITE(c_watch_command_suite);
+}